@@ -682,7 +682,8 @@ cl_int CLVK_API_CALL clGetDeviceInfo(cl_device_id dev,
         size_ret = sizeof(val_exec_capabilities);
         break;
     case CL_DEVICE_QUEUE_PROPERTIES:
-        val_queue_properties = CL_QUEUE_PROFILING_ENABLE;
+        val_queue_properties =
+            CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
         copy_ptr = &val_queue_properties;
         size_ret = sizeof(val_queue_properties);
         break;
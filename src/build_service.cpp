@@ -0,0 +1,552 @@
+// Copyright 2026 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef CLSPV_ONLINE_COMPILER
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef ENABLE_SPIRV_IL
+#include "LLVMSPIRVLib.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/CommandLine.h" // FIXME(#380) remove
+#include "llvm/Support/raw_ostream.h"
+#endif
+#include "clspv/Compiler.h"
+
+#include "build_service.hpp"
+#include "config.hpp"
+#include "log.hpp"
+#include "tracing.hpp"
+#include "unit.hpp"
+#include "utils.hpp"
+
+// Held while a compilation runs in the application
+static std::mutex gCompileMutex;
+
+static const char* REQUEST_COMPILE = "compile";
+static const char* REQUEST_TRANSLATE_IL = "translate-il";
+
+#ifndef WIN32
+
+static bool send_all(int fd, const void* data, size_t size) {
+    auto ptr = static_cast<const char*>(data);
+    while (size > 0) {
+        int flags = 0;
+#ifdef MSG_NOSIGNAL
+        // A worker that died must not kill the application with SIGPIPE
+        flags |= MSG_NOSIGNAL;
+#endif
+        ssize_t ret = send(fd, ptr, size, flags);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        ptr += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+using deadline = std::chrono::steady_clock::time_point;
+
+// Returns false when no data arrived before the deadline
+static bool wait_for_data(int fd, deadline end, bool* timed_out) {
+    if (end == deadline::max()) {
+        return true;
+    }
+    while (true) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            end - std::chrono::steady_clock::now());
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, std::max<int>(0, remaining.count()));
+        if (ret > 0) {
+            return true;
+        }
+        if (ret == 0) {
+            *timed_out = true;
+            return false;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+static bool recv_all(int fd, void* data, size_t size, deadline end,
+                     bool* timed_out) {
+    auto ptr = static_cast<char*>(data);
+    while (size > 0) {
+        if (!wait_for_data(fd, end, timed_out)) {
+            return false;
+        }
+        ssize_t ret = recv(fd, ptr, size, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (ret == 0) {
+            return false;
+        }
+        ptr += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+// Messages are sent as the number of strings followed by the size and
+// contents of each string
+template <typename Message>
+static bool send_message(int fd, const Message& msg) {
+    uint64_t count = msg.size();
+    if (!send_all(fd, &count, sizeof(count))) {
+        return false;
+    }
+    for (auto& str : msg) {
+        uint64_t size = str.size();
+        if (!send_all(fd, &size, sizeof(size)) ||
+            !send_all(fd, str.data(), str.size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Message>
+static bool recv_message(int fd, Message& msg, deadline end = deadline::max(),
+                         bool* timed_out = nullptr) {
+    uint64_t count;
+    if (!recv_all(fd, &count, sizeof(count), end, timed_out)) {
+        return false;
+    }
+    msg.resize(count);
+    for (auto& str : msg) {
+        uint64_t size;
+        if (!recv_all(fd, &size, sizeof(size), end, timed_out)) {
+            return false;
+        }
+        str.resize(size);
+        if (!recv_all(fd, &str[0], size, end, timed_out)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sends a file descriptor along with a process ID
+static bool send_fd(int fd, pid_t pid, int fd_to_send) {
+    struct iovec iov = {&pid, sizeof(pid)};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd_to_send, sizeof(int));
+    ssize_t ret;
+    do {
+        ret = sendmsg(fd, &msg, 0);
+    } while ((ret < 0) && (errno == EINTR));
+    return ret == sizeof(pid);
+}
+
+static bool recv_fd(int fd, pid_t* pid, int* received_fd) {
+    struct iovec iov = {pid, sizeof(*pid)};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t ret;
+    do {
+        ret = recvmsg(fd, &msg, 0);
+    } while ((ret < 0) && (errno == EINTR));
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if ((ret != sizeof(*pid)) || (cmsg == nullptr) ||
+        (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+        return false;
+    }
+    memcpy(received_fd, CMSG_DATA(cmsg), sizeof(int));
+    return true;
+}
+
+// Doesn't log so that it can be used in the zygote, where a logging lock
+// may have been held by another thread of the application when it was forked
+static bool create_socket_pair(int fds[2]) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        return false;
+    }
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fds[0], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    // Processes started by the application must not keep workers alive
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+}
+
+void cvk_build_service::worker_main(int fd) {
+    message request;
+    while (recv_message(fd, request)) {
+        auto response = process(request);
+        if (!send_message(fd, response)) {
+            break;
+        }
+    }
+    // Don't run the application's exit handlers
+    _exit(0);
+}
+
+// The zygote is forked during clvk's initialisation and forks the workers.
+// Workers are started from a process that runs no clvk thread so that they
+// don't inherit locks held by clvk's threads.
+void cvk_build_service::zygote_main(int fd) {
+    // Workers are reaped automatically
+    signal(SIGCHLD, SIG_IGN);
+
+    char request;
+    while (recv_all(fd, &request, sizeof(request), deadline::max(),
+                    nullptr)) {
+        int fds[2];
+        if (!create_socket_pair(fds)) {
+            pid_t failed = -1;
+            if (!send_all(fd, &failed, sizeof(failed))) {
+                break;
+            }
+            continue;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fd);
+            close(fds[0]);
+            worker_main(fds[1]);
+        }
+        close(fds[1]);
+        bool sent = (pid < 0) ? send_all(fd, &pid, sizeof(pid))
+                              : send_fd(fd, pid, fds[0]);
+        close(fds[0]);
+        if (!sent) {
+            break;
+        }
+    }
+    _exit(0);
+}
+
+void cvk_build_service::start_zygote() {
+    if (m_max_workers == 0) {
+        return;
+    }
+
+    int fds[2];
+    if (!create_socket_pair(fds)) {
+        cvk_warn("Could not create socket for build zygote: %s",
+                 strerror(errno));
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        zygote_main(fds[1]);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        cvk_warn("Could not fork build zygote: %s", strerror(errno));
+        close(fds[0]);
+        return;
+    }
+    m_zygote_pid = pid;
+    m_zygote_fd = fds[0];
+}
+
+cvk_build_service::worker* cvk_build_service::spawn_worker() {
+    if (m_zygote_fd < 0) {
+        return nullptr;
+    }
+
+    char request = 0;
+    pid_t pid;
+    int fd;
+    if (!send_all(m_zygote_fd, &request, sizeof(request)) ||
+        !recv_fd(m_zygote_fd, &pid, &fd)) {
+        cvk_warn("Could not start build worker");
+        return nullptr;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    m_workers.emplace_back(new worker{pid, fd});
+    cvk_info("Started build worker %d, %zu workers", pid, m_workers.size());
+    return m_workers.back().get();
+}
+
+void cvk_build_service::release_worker(worker* w, bool healthy) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (healthy) {
+        m_idle_workers.push_back(w);
+    } else {
+        cvk_warn("Build worker %d failed", w->pid);
+        close(w->fd);
+        for (auto it = m_workers.begin(); it != m_workers.end(); ++it) {
+            if (it->get() == w) {
+                m_workers.erase(it);
+                break;
+            }
+        }
+    }
+    m_cv.notify_all();
+}
+
+cvk_build_service::~cvk_build_service() {
+    // Workers and the zygote exit once their end of the socket is closed
+    for (auto& w : m_workers) {
+        close(w->fd);
+    }
+    if (m_zygote_fd >= 0) {
+        close(m_zygote_fd);
+        waitpid(m_zygote_pid, nullptr, 0);
+    }
+}
+
+#else // WIN32
+
+void cvk_build_service::worker_main(int) {}
+
+void cvk_build_service::zygote_main(int) {}
+
+void cvk_build_service::start_zygote() {}
+
+cvk_build_service::worker* cvk_build_service::spawn_worker() {
+    return nullptr;
+}
+
+void cvk_build_service::release_worker(worker*, bool) {}
+
+cvk_build_service::~cvk_build_service() {}
+
+#endif // WIN32
+
+cvk_build_service::worker*
+cvk_build_service::acquire_worker(cvk_build_priority priority) {
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    auto ticket = std::make_pair(priority, m_next_ticket++);
+    m_waiting.insert(ticket);
+    CLVK_UNIT_COUNT(build_requests);
+
+    worker* w = nullptr;
+    while (true) {
+        // Only the first request in line can go
+        if (!m_paused && (*m_waiting.begin() == ticket)) {
+            if (!m_idle_workers.empty()) {
+                w = m_idle_workers.back();
+                m_idle_workers.pop_back();
+                break;
+            }
+            if ((m_workers.size() < m_max_workers) && !m_spawn_failed) {
+                w = spawn_worker();
+                if (w != nullptr) {
+                    break;
+                }
+                m_spawn_failed = true;
+            }
+            // Requests run in the application when there are no workers
+            if (m_workers.empty() && !m_application_busy) {
+                m_application_busy = true;
+                break;
+            }
+        }
+        TRACE_BEGIN("wait_for_build_turn");
+        m_cv.wait(lock);
+        TRACE_END();
+    }
+
+    m_waiting.erase(ticket);
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    for (auto& waiting : m_waiting) {
+        if (waiting.second < ticket.second) {
+            CLVK_UNIT_COUNT(builds_overtaken);
+            break;
+        }
+    }
+#endif
+    m_cv.notify_all();
+    return w;
+}
+
+void cvk_build_service::release_application() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_application_busy = false;
+    m_cv.notify_all();
+}
+
+void cvk_build_service::execute(const message& request, message& response,
+                                cvk_build_priority priority) {
+    auto w = acquire_worker(priority);
+    if (w == nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(gCompileMutex);
+            response = process(request);
+        }
+        release_application();
+        return;
+    }
+
+#ifndef WIN32
+    auto end = deadline::max();
+    if (config.build_timeout_ms() != 0) {
+        end = std::chrono::steady_clock::now() +
+              std::chrono::milliseconds(config.build_timeout_ms());
+    }
+    bool timed_out = false;
+    bool healthy = send_message(w->fd, request) &&
+                   recv_message(w->fd, response, end, &timed_out) &&
+                   (response.size() == 3);
+    if (timed_out) {
+        // The build runs again in the application, which may be stuck
+        // too but at least reports it
+        cvk_warn("Build worker %d timed out, killing it", w->pid);
+        kill(w->pid, SIGKILL);
+    }
+    release_worker(w, healthy);
+    if (healthy) {
+        return;
+    }
+#endif
+
+    // Requests that failed in a worker don't wait for their turn again
+    std::lock_guard<std::mutex> lock(gCompileMutex);
+    response = process(request);
+}
+
+cvk_build_service::message
+cvk_build_service::process(const message& request) {
+    if (request[0] == REQUEST_COMPILE) {
+        std::vector<std::string> programs(request.begin() + 2, request.end());
+        std::vector<uint32_t> output;
+        std::string log;
+        int status = clspv::CompileFromSourcesString(programs, request[1],
+                                                     &output, &log);
+        std::string binary(reinterpret_cast<const char*>(output.data()),
+                           output.size() * sizeof(uint32_t));
+        return {std::to_string(status), log, binary};
+    }
+
+#ifdef ENABLE_SPIRV_IL
+    if (request[0] == REQUEST_TRANSLATE_IL) {
+        llvm::LLVMContext llvm_context;
+        llvm::Module* llvm_module;
+        std::string err;
+        std::istringstream il_stream(request[1]);
+        SPIRV::TranslatorOpts translator_opts;
+        // We don't need llvm-spirv to validate extensions for us.
+        translator_opts.enableAllExtensions();
+
+        auto& spec_constants = request[2];
+        for (size_t offset = 0; offset < spec_constants.size();
+             offset += sizeof(uint32_t) + sizeof(uint64_t)) {
+            uint32_t id;
+            uint64_t value;
+            memcpy(&id, &spec_constants[offset], sizeof(id));
+            memcpy(&value, &spec_constants[offset + sizeof(id)],
+                   sizeof(value));
+            translator_opts.setSpecConst(id, value);
+        }
+
+        std::vector<const char*> llvmArgv{
+            "llvm-spirv(online)",
+        };
+        llvm::cl::ResetAllOptionOccurrences();
+        llvm::cl::ParseCommandLineOptions(llvmArgv.size(), llvmArgv.data());
+        if (!llvm::readSpirv(llvm_context, translator_opts, il_stream,
+                             llvm_module, err)) {
+            return {"1", err, ""};
+        }
+
+        std::string bitcode;
+        llvm::raw_string_ostream bitcode_stream(bitcode);
+        llvm::WriteBitcodeToFile(*llvm_module, bitcode_stream);
+        bitcode_stream.flush();
+        return {"0", "", bitcode};
+    }
+#endif
+
+    return {"-1", "unknown build request", ""};
+}
+
+int cvk_build_service::compile(const std::vector<std::string>& programs,
+                               const std::string& options,
+                               std::vector<uint32_t>* output,
+                               std::string* log,
+                               cvk_build_priority priority) {
+    message request{REQUEST_COMPILE, options};
+    request.insert(request.end(), programs.begin(), programs.end());
+
+    message response;
+    execute(request, response, priority);
+
+    *log += response[1];
+    auto& binary = response[2];
+    output->resize(binary.size() / sizeof(uint32_t));
+    memcpy(output->data(), binary.data(), output->size() * sizeof(uint32_t));
+    return std::stoi(response[0]);
+}
+
+bool cvk_build_service::translate_il(
+    const std::vector<uint8_t>& il,
+    const std::vector<std::pair<uint32_t, uint64_t>>& spec_constants,
+    std::string* bitcode, std::string* error, cvk_build_priority priority) {
+    std::string encoded_spec_constants;
+    for (auto& spec_const : spec_constants) {
+        encoded_spec_constants.append(
+            reinterpret_cast<const char*>(&spec_const.first),
+            sizeof(spec_const.first));
+        encoded_spec_constants.append(
+            reinterpret_cast<const char*>(&spec_const.second),
+            sizeof(spec_const.second));
+    }
+    message request{
+        REQUEST_TRANSLATE_IL,
+        std::string(reinterpret_cast<const char*>(il.data()), il.size()),
+        encoded_spec_constants};
+
+    message response;
+    execute(request, response, priority);
+
+    *error = response[1];
+    *bitcode = std::move(response[2]);
+    return response[0] == "0";
+}
+
+#endif // CLSPV_ONLINE_COMPILER
@@ -0,0 +1,121 @@
+// Copyright 2026 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Builds waiting for their turn are served in this order
+enum class cvk_build_priority
+{
+    // Builds an application is waiting for
+    interactive = 0,
+    // Builds the application doesn't wait for, started with a callback to be
+    // notified of their completion
+    prewarm = 1,
+};
+
+// Runs the online compiler. clspv and llvm-spirv keep global state in LLVM,
+// command-line options in particular, so only one compilation can run in a
+// process at a time. Compilations run in the application, one at a time, by
+// priority then order of arrival.
+//
+// To build programs in parallel, compilations can be sent to a bounded pool
+// of worker processes instead. Workers are forked by a zygote process that is
+// itself forked when the service is created during clvk's initialisation.
+// Threads the application started before then don't exist in the zygote and
+// any lock they held stays locked, which is why workers are opt-in.
+// Compilations run in the application when no worker can be started or a
+// worker takes longer than CLVK_BUILD_TIMEOUT_MS.
+struct cvk_build_service {
+
+    explicit cvk_build_service(uint32_t max_workers)
+        : m_max_workers(max_workers), m_next_ticket(0), m_spawn_failed(false),
+          m_application_busy(false), m_paused(false), m_zygote_pid(-1),
+          m_zygote_fd(-1) {
+        start_zygote();
+    }
+
+    ~cvk_build_service();
+
+    // Compiles programs with clspv, returns clspv's status
+    int compile(const std::vector<std::string>& programs,
+                const std::string& options, std::vector<uint32_t>* output,
+                std::string* log, cvk_build_priority priority);
+
+    // Translates SPIR-V to LLVM bitcode, returns false on failure
+    bool translate_il(const std::vector<uint8_t>& il,
+                      const std::vector<std::pair<uint32_t, uint64_t>>&
+                          spec_constants,
+                      std::string* bitcode, std::string* error,
+                      cvk_build_priority priority);
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    // Builds wait for their turn until the service is resumed
+    void set_paused(bool paused) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_paused = paused;
+        m_cv.notify_all();
+    }
+#endif
+
+private:
+    // Requests and responses are lists of byte strings
+    using message = std::vector<std::string>;
+
+    struct worker {
+        int pid;
+        int fd;
+    };
+
+    void execute(const message& request, message& response,
+                 cvk_build_priority priority);
+    // Runs a request in the current process, the caller is responsible for
+    // making sure no other compilation runs in the process at the same time
+    static message process(const message& request);
+
+    // Waits for the turn of a request. Returns nullptr when the request has
+    // to run in the application, which must then be released with
+    // release_application.
+    worker* acquire_worker(cvk_build_priority priority);
+    void release_worker(worker* w, bool healthy);
+    void release_application();
+    // Must be called with m_lock held
+    worker* spawn_worker();
+    static void worker_main(int fd);
+    void start_zygote();
+    static void zygote_main(int fd);
+
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    uint32_t m_max_workers;
+    std::vector<std::unique_ptr<worker>> m_workers;
+    std::vector<worker*> m_idle_workers;
+    // Requests waiting for their turn, by priority then order of arrival
+    std::set<std::pair<cvk_build_priority, uint64_t>> m_waiting;
+    uint64_t m_next_ticket;
+    bool m_spawn_failed;
+    // Whether a request is running in the application
+    bool m_application_busy;
+    bool m_paused;
+    int m_zygote_pid;
+    int m_zygote_fd;
+};
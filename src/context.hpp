@@ -14,6 +14,8 @@
 
 #pragma once
 
+#include <algorithm>
+
 #include "device.hpp"
 #include "objects.hpp"
 
@@ -24,6 +26,13 @@ struct cvk_context_callback {
     void* data;
 };
 
+// Implemented by objects that keep Vulkan state referring to the memory
+// objects and samplers of a context, e.g. descriptor sets, and that need to
+// drop it when they are destroyed.
+struct cvk_resource_listener {
+    virtual void resource_destroyed(const refcounted* resource) = 0;
+};
+
 struct cvk_context : public _cl_context,
                      refcounted,
                      object_magic_header<object_magic::context> {
@@ -73,8 +82,30 @@ struct cvk_context : public _cl_context,
         return size <= m_device->max_mem_alloc_size();
     }
 
+    void add_resource_listener(cvk_resource_listener* listener) {
+        std::lock_guard<std::mutex> lock(m_resource_listeners_lock);
+        m_resource_listeners.push_back(listener);
+    }
+
+    void remove_resource_listener(cvk_resource_listener* listener) {
+        std::lock_guard<std::mutex> lock(m_resource_listeners_lock);
+        auto it = std::find(m_resource_listeners.begin(),
+                            m_resource_listeners.end(), listener);
+        CVK_ASSERT(it != m_resource_listeners.end());
+        m_resource_listeners.erase(it);
+    }
+
+    void notify_resource_destroyed(const refcounted* resource) {
+        std::lock_guard<std::mutex> lock(m_resource_listeners_lock);
+        for (auto listener : m_resource_listeners) {
+            listener->resource_destroyed(resource);
+        }
+    }
+
 private:
     cvk_device* m_device;
+    std::mutex m_resource_listeners_lock;
+    std::vector<cvk_resource_listener*> m_resource_listeners;
     std::mutex m_callbacks_lock;
     std::vector<cvk_context_callback> m_destuctor_callbacks;
     std::vector<cl_context_properties> m_properties;
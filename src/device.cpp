@@ -13,7 +13,6 @@
 // limitations under the License.
 
 #include <array>
-#include <fstream>
 #include <functional>
 #include <iterator>
 #include <sstream>
@@ -55,6 +54,8 @@ void cvk_device::init_vulkan_properties(VkInstance instance) {
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_PROPERTIES;
     m_float_controls_properties.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FLOAT_CONTROLS_PROPERTIES;
+    m_push_descriptor_properties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PUSH_DESCRIPTOR_PROPERTIES_KHR;
 
     //--- Get maxMemoryAllocationSize for figuring out the  max single buffer
     // allocation size and default init when the extension is not supported
@@ -83,6 +84,8 @@ void cvk_device::init_vulkan_properties(VkInstance instance) {
                          m_maintenance3_properties),
             VER_EXT_PROP(VK_MAKE_VERSION(1, 2, 0), nullptr,
                          m_float_controls_properties),
+            VER_EXT_PROP(0, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
+                         m_push_descriptor_properties),
         };
 #undef VER_EXT_PROP
 
@@ -276,6 +279,8 @@ bool cvk_device::init_extensions() {
         VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
         VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
         VK_KHR_GLOBAL_PRIORITY_EXTENSION_NAME,
+        VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+        VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
     };
 
     if (m_properties.apiVersion < VK_MAKE_VERSION(1, 2, 0)) {
@@ -286,6 +291,8 @@ bool cvk_device::init_extensions() {
 
     if (m_properties.apiVersion < VK_MAKE_VERSION(1, 1, 0)) {
         desired_extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        desired_extensions.push_back(
+            VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
     }
 
     if (m_properties.apiVersion < VK_MAKE_VERSION(1, 1, 0)) {
@@ -337,6 +344,8 @@ void cvk_device::init_features(VkInstance instance) {
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES;
     m_features_queue_global_priority.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GLOBAL_PRIORITY_QUERY_FEATURES_KHR;
+    m_features_timeline_semaphore.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
 
     std::vector<std::tuple<uint32_t, const char*, VkBaseOutStructure*>>
         coreversion_extension_features = {
@@ -371,6 +380,9 @@ void cvk_device::init_features(VkInstance instance) {
                          m_features_buffer_device_address),
             VER_EXT_FEAT(0, VK_KHR_GLOBAL_PRIORITY_EXTENSION_NAME,
                          m_features_queue_global_priority),
+            VER_EXT_FEAT(VK_MAKE_VERSION(1, 2, 0),
+                         VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+                         m_features_timeline_semaphore),
 
 #undef VER_EXT_FEAT
         };
@@ -418,6 +430,8 @@ void cvk_device::init_features(VkInstance instance) {
     cvk_info(
         "subgroup extended types: %d",
         m_features_shader_subgroup_extended_types.shaderSubgroupExtendedTypes);
+    cvk_info("timeline semaphores: %d",
+             m_features_timeline_semaphore.timelineSemaphore);
 
     // Selectively enable core features.
     if (supported_features.features.shaderInt16) {
@@ -451,6 +465,37 @@ void cvk_device::init_command_pointers(VkInstance instance) {
         m_vkfns.vkGetBufferDeviceAddressKHR =
             GET_INSTANCE_PROC(instance, vkGetBufferDeviceAddressKHR);
     }
+
+    // Descriptor update templates
+    bool has_templates = false;
+    if (m_properties.apiVersion >= VK_MAKE_VERSION(1, 1, 0)) {
+        m_vkfns.vkCreateDescriptorUpdateTemplateKHR =
+            GET_INSTANCE_PROC(instance, vkCreateDescriptorUpdateTemplate);
+        m_vkfns.vkDestroyDescriptorUpdateTemplateKHR =
+            GET_INSTANCE_PROC(instance, vkDestroyDescriptorUpdateTemplate);
+        m_vkfns.vkUpdateDescriptorSetWithTemplateKHR =
+            GET_INSTANCE_PROC(instance, vkUpdateDescriptorSetWithTemplate);
+        has_templates = true;
+    } else if (is_vulkan_extension_enabled(
+                   VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME)) {
+        m_vkfns.vkCreateDescriptorUpdateTemplateKHR =
+            GET_INSTANCE_PROC(instance, vkCreateDescriptorUpdateTemplateKHR);
+        m_vkfns.vkDestroyDescriptorUpdateTemplateKHR =
+            GET_INSTANCE_PROC(instance, vkDestroyDescriptorUpdateTemplateKHR);
+        m_vkfns.vkUpdateDescriptorSetWithTemplateKHR =
+            GET_INSTANCE_PROC(instance, vkUpdateDescriptorSetWithTemplateKHR);
+        has_templates = true;
+    }
+
+    // Push descriptors
+    if (is_vulkan_extension_enabled(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME)) {
+        m_vkfns.vkCmdPushDescriptorSetKHR =
+            GET_INSTANCE_PROC(instance, vkCmdPushDescriptorSetKHR);
+        if (has_templates) {
+            m_vkfns.vkCmdPushDescriptorSetWithTemplateKHR = GET_INSTANCE_PROC(
+                instance, vkCmdPushDescriptorSetWithTemplateKHR);
+        }
+    }
 }
 
 void cvk_device::init_compiler_options() {
@@ -805,6 +850,14 @@ bool cvk_device::create_vulkan_queues_and_device(uint32_t num_queues,
         m_vulkan_queues.emplace_back(queue, queue_family);
     }
 
+    m_memory_allocator = std::make_unique<cvk_memory_allocator>(
+        m_dev, m_mem_properties, m_physical_addressing);
+
+    m_pipeline_cache_store = std::make_unique<cvk_pipeline_cache_store>(
+        m_dev, config.cache_dir,
+        to_hex_string(m_properties.pipelineCacheUUID, VK_UUID_SIZE),
+        static_cast<uint64_t>(config.pipeline_cache_size_mb) * 1024 * 1024);
+
     return true;
 }
 
@@ -866,130 +919,28 @@ bool cvk_device::init_time_management(VkInstance instance) {
     return true;
 }
 
-// Returns the pipeline cache file path for a given SPIR-V SHA-1 hash.
-// If pipeline cache serialization is not enabled, an empty string is returned.
-std::string
-cvk_device::get_pipeline_cache_filename(const cvk_sha1_hash& sha1) const {
+// Returns the path of a cache file for a given SPIR-V SHA-1 hash.
+// If cache serialization is not enabled, an empty string is returned.
+std::string cvk_device::get_cache_filename(const char* prefix,
+                                           const cvk_sha1_hash& sha1,
+                                           const char* suffix) const {
     if (config.cache_dir().empty()) {
         return "";
     }
 
-    // The pipeline cache file path is:
-    // ${CLVK_CACHE_DIR}/clvk-pipeline-cache.<UUID>.<SHA1>.bin
+    // The cache file path is:
+    // ${CLVK_CACHE_DIR}/<prefix><UUID>.<SHA1><suffix>
     std::string cache_path = config.cache_dir;
     cache_path += "/";
-    cache_path += "clvk-pipeline-cache.";
+    cache_path += prefix;
     cache_path += to_hex_string(m_properties.pipelineCacheUUID, VK_UUID_SIZE);
     cache_path += ".";
     cache_path += to_hex_string(reinterpret_cast<const uint8_t*>(sha1.data()),
                                 SHA1_DIGEST_NUM_BYTES);
-    cache_path += ".bin";
+    cache_path += suffix;
     return cache_path;
 }
 
-bool cvk_device::get_pipeline_cache(const std::vector<uint32_t>& spirv,
-                                    VkPipelineCache& pipeline_cache) {
-
-    std::lock_guard<std::mutex> lock(m_pipeline_cache_mutex);
-
-    pipeline_cache = VK_NULL_HANDLE;
-
-    // Compute SHA-1 hash of the SPIR-V binary
-    cvk_sha1_hash sha1 =
-        cvk_sha1(spirv.data(), spirv.size() * sizeof(uint32_t));
-
-    // Check the in-memory cache of pipeline caches
-    if (m_pipeline_caches.count(sha1)) {
-        pipeline_cache = m_pipeline_caches.at(sha1);
-        return true;
-    }
-
-    std::vector<char> cache_data;
-
-    // Load pipeline cache data from file if this is enabled
-    std::string cache_path = get_pipeline_cache_filename(sha1);
-    if (!cache_path.empty()) {
-        cvk_info("Looking for pipeline cache at %s", cache_path.c_str());
-        std::ifstream cache_file(cache_path, std::ios::in | std::ios::binary);
-        if (cache_file.is_open()) {
-            // Get the size of the pipeline cache file
-            cache_file.seekg(0, std::ios::end);
-            uint32_t size = cache_file.tellg();
-            cache_file.seekg(0, std::ios::beg);
-
-            // Load the pipeline cache data into memory
-            cache_data.resize(size);
-            cache_file.read(cache_data.data(), size);
-            if (!cache_file.good()) {
-                cvk_warn("Failed to read pipeline cache data");
-                cache_data.clear();
-            }
-        } else {
-            cvk_warn("Failed to open pipeline cache file");
-        }
-    }
-
-    // Create pipeline cache
-    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {
-        VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
-        nullptr,           // pNext
-        0,                 // flags
-        cache_data.size(), // initialDataSize
-        cache_data.data(), // pInitialData
-    };
-
-    VkResult res = vkCreatePipelineCache(m_dev, &pipelineCacheCreateInfo,
-                                         nullptr, &pipeline_cache);
-    if (res != VK_SUCCESS) {
-        cvk_error("Could not create pipeline cache.");
-        return false;
-    }
-
-    // Add pipeline cache to the in-memory cache
-    m_pipeline_caches[sha1] = pipeline_cache;
-
-    return cache_data.size() != 0;
-}
-
-void cvk_device::save_pipeline_cache(
-    const cvk_sha1_hash& sha1, const VkPipelineCache& pipeline_cache) const {
-    VkResult res;
-
-    std::string cache_path = get_pipeline_cache_filename(sha1);
-    if (cache_path.empty()) {
-        return;
-    }
-
-    // Retrieve the pipeline cache data from the Vulkan implementation
-    size_t size;
-    res = vkGetPipelineCacheData(m_dev, pipeline_cache, &size, nullptr);
-    if (res != VK_SUCCESS) {
-        cvk_error("Failed to retrieve pipeline cache size");
-        return;
-    }
-    std::vector<char> cache_data(size);
-    res =
-        vkGetPipelineCacheData(m_dev, pipeline_cache, &size, cache_data.data());
-    if (res != VK_SUCCESS) {
-        cvk_error("Failed to retrieve pipeline cache data");
-        return;
-    }
-
-    cvk_info("Writing %lu bytes of pipeline cache data to file", size);
-
-    // Write the pipeline cache data to file
-    std::ofstream cache_file(cache_path, std::ios::out | std::ios::binary);
-    if (!cache_file.is_open()) {
-        cvk_error("Failed to open pipeline cache file for writing: %s",
-                  cache_path.c_str());
-        return;
-    }
-    cache_file.write(cache_data.data(), size);
-    if (!cache_file.good()) {
-        cvk_error("Failed to write pipeline cache data");
-    }
-}
-
 void cvk_device::init_spirv_environment() {
     if (m_properties.apiVersion < VK_MAKE_VERSION(1, 1, 0)) {
         m_vulkan_spirv_env = SPV_ENV_VULKAN_1_0;
@@ -15,8 +15,13 @@
 #pragma once
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -27,13 +32,73 @@
 #include "cl_headers.hpp"
 #include "device_properties.hpp"
 #include "icd.hpp"
+#include "memory_allocator.hpp"
 #include "objects.hpp"
+#include "pipeline_cache_store.hpp"
 #include "sha1.hpp"
 #include "vkutils.hpp"
 
 struct cvk_vulkan_extension_functions {
     PFN_vkGetCalibratedTimestampsEXT vkGetCalibratedTimestampsEXT;
     PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR;
+    PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR;
+    PFN_vkCreateDescriptorUpdateTemplateKHR vkCreateDescriptorUpdateTemplateKHR;
+    PFN_vkDestroyDescriptorUpdateTemplateKHR
+        vkDestroyDescriptorUpdateTemplateKHR;
+    PFN_vkUpdateDescriptorSetWithTemplateKHR
+        vkUpdateDescriptorSetWithTemplateKHR;
+    PFN_vkCmdPushDescriptorSetWithTemplateKHR
+        vkCmdPushDescriptorSetWithTemplateKHR;
+};
+
+// Worker threads creating pipelines in the background. Jobs still queued when
+// the compiler is destroyed are run before its threads exit.
+struct cvk_pipeline_compiler {
+
+    explicit cvk_pipeline_compiler(uint32_t num_threads) : m_shutdown(false) {
+        for (uint32_t i = 0; i < num_threads; i++) {
+            m_threads.emplace_back(&cvk_pipeline_compiler::worker, this);
+        }
+    }
+
+    ~cvk_pipeline_compiler() {
+        m_lock.lock();
+        m_shutdown = true;
+        m_cv.notify_all();
+        m_lock.unlock();
+
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    void submit(std::function<void()>&& job) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_jobs.push_back(std::move(job));
+        m_cv.notify_one();
+    }
+
+private:
+    void worker() {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (true) {
+            m_cv.wait(lock, [this] { return m_shutdown || !m_jobs.empty(); });
+            if (m_jobs.empty()) {
+                return;
+            }
+            auto job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    bool m_shutdown;
+    std::deque<std::function<void()>> m_jobs;
+    std::vector<std::thread> m_threads;
 };
 
 #define MAKE_NAME_VERSION(major, minor, patch, name)                           \
@@ -80,10 +145,9 @@ struct cvk_device : public _cl_device_id,
                               VkPhysicalDevice pdev, bool is_default);
 
     virtual ~cvk_device() {
-        for (auto entry : m_pipeline_caches) {
-            save_pipeline_cache(entry.first, entry.second);
-            vkDestroyPipelineCache(m_dev, entry.second, nullptr);
-        }
+        m_pipeline_compiler.reset();
+        m_pipeline_cache_store.reset();
+        m_memory_allocator.reset();
         vkDestroyDevice(m_dev, nullptr);
     }
 
@@ -97,6 +161,14 @@ struct cvk_device : public _cl_device_id,
         vkGetPhysicalDeviceProperties(m_pdev, &m_properties);
     }
 
+    void recreate_pipeline_cache_store(uint64_t max_size) {
+        m_pipeline_cache_store.reset();
+        m_pipeline_cache_store = std::make_unique<cvk_pipeline_cache_store>(
+            m_dev, config.cache_dir,
+            to_hex_string(m_properties.pipelineCacheUUID, VK_UUID_SIZE),
+            max_size);
+    }
+
 #endif
 
     const VkPhysicalDeviceLimits& vulkan_limits() const {
@@ -161,7 +233,7 @@ struct cvk_device : public _cl_device_id,
     }
 
     struct allocation_parameters {
-        VkDeviceSize size;
+        VkMemoryRequirements requirements;
         uint32_t memory_type_index;
     };
 
@@ -190,7 +262,7 @@ struct cvk_device : public _cl_device_id,
         vkGetImageMemoryRequirements(m_dev, image, &memreqs);
 
         allocation_parameters ret;
-        ret.size = memreqs.size;
+        ret.requirements = memreqs;
         ret.memory_type_index =
             memory_type_index_for_image(memreqs.memoryTypeBits);
 
@@ -211,7 +283,7 @@ struct cvk_device : public _cl_device_id,
         vkGetBufferMemoryRequirements(m_dev, buffer, &memreqs);
 
         allocation_parameters ret;
-        ret.size = memreqs.size;
+        ret.requirements = memreqs;
         ret.memory_type_index =
             memory_type_index_for_buffer(memreqs.memoryTypeBits);
 
@@ -413,6 +485,33 @@ struct cvk_device : public _cl_device_id,
         return m_features_ubo_stdlayout.uniformBufferStandardLayout;
     }
 
+    /// Returns true if POD arguments of all types can be passed to kernels as
+    /// push constants.
+    CHECK_RETURN bool supports_pod_pushconstant() const {
+        return (!supports_int8() ||
+                m_features_8bit_storage.storagePushConstant8) &&
+               m_features_16bit_storage.storagePushConstant16;
+    }
+
+    /// Returns true if descriptors can be pushed to command buffers.
+    CHECK_RETURN bool supports_push_descriptors() const {
+        return m_vkfns.vkCmdPushDescriptorSetKHR != nullptr;
+    }
+
+    uint32_t max_push_descriptors() const {
+        return m_push_descriptor_properties.maxPushDescriptors;
+    }
+
+    /// Returns true if descriptors can be updated using templates.
+    CHECK_RETURN bool supports_descriptor_update_templates() const {
+        return m_vkfns.vkCreateDescriptorUpdateTemplateKHR != nullptr;
+    }
+
+    /// Returns true if timeline semaphores are supported.
+    CHECK_RETURN bool supports_timeline_semaphores() const {
+        return m_features_timeline_semaphore.timelineSemaphore;
+    }
+
     cl_version version() const { return config.opencl_version; }
 
     cl_version c_version() const { return gOpenCLCVersion; }
@@ -498,6 +597,10 @@ struct cvk_device : public _cl_device_id,
 
     VkDevice vulkan_device() const { return m_dev; }
 
+    cvk_memory_allocator* memory_allocator() const {
+        return m_memory_allocator.get();
+    }
+
     const VkPhysicalDevice8BitStorageFeaturesKHR&
     device_8bit_storage_features() const {
         return m_features_8bit_storage;
@@ -531,10 +634,66 @@ struct cvk_device : public _cl_device_id,
     }
 
     // Get a previously created Vulkan pipeline cache for a given SPIR-V binary,
-    // or create a new one if necessary. Returns true if an existing pipeline
-    // cache was found and reused.
+    // or create a new one if necessary. New pipeline caches are seeded with
+    // the data saved in the cache directory and |binary_data|, the pipeline
+    // cache data embedded in a program binary built for this device. Returns
+    // true if an existing pipeline cache was found and reused.
     bool get_pipeline_cache(const std::vector<uint32_t>& spirv,
-                            VkPipelineCache& pipeline_cache);
+                            VkPipelineCache& pipeline_cache,
+                            const std::vector<char>& binary_data) {
+        cvk_sha1_hash sha1 =
+            cvk_sha1(spirv.data(), spirv.size() * sizeof(uint32_t));
+        return m_pipeline_cache_store->get(sha1, binary_data, pipeline_cache);
+    }
+
+    // Retrieve the data of a pipeline cache so that it can be saved
+    CHECK_RETURN bool get_pipeline_cache_data(VkPipelineCache pipeline_cache,
+                                              std::vector<char>& data) const {
+        return m_pipeline_cache_store->get_data(pipeline_cache, data);
+    }
+
+    // Called when pipelines have been added to a pipeline cache
+    void pipeline_cache_updated() { m_pipeline_cache_store->schedule_save(); }
+
+    // SPIR-V binaries that passed validation on this device. Only binaries
+    // validated by this process are recorded, the validation results
+    // embedded in program binaries can be forged.
+    bool spirv_validated(const cvk_sha1_hash& sha1) {
+        std::lock_guard<std::mutex> lock(m_validated_spirv_lock);
+        return m_validated_spirv.count(sha1) != 0;
+    }
+    void record_validated_spirv(const cvk_sha1_hash& sha1) {
+        std::lock_guard<std::mutex> lock(m_validated_spirv_lock);
+        m_validated_spirv.insert(sha1);
+    }
+
+    const uint8_t* pipeline_cache_uuid() const {
+        return m_properties.pipelineCacheUUID;
+    }
+
+    static constexpr const char* PIPELINE_PROFILE_PREFIX =
+        "clvk-pipeline-profile.";
+    static constexpr const char* PIPELINE_PROFILE_SUFFIX = ".txt";
+
+    // Returns the path of the file recording the pipelines used by the
+    // kernels of a SPIR-V binary, or an empty string when there is no cache
+    // directory.
+    std::string
+    get_pipeline_profile_filename(const cvk_sha1_hash& sha1) const {
+        return get_cache_filename(PIPELINE_PROFILE_PREFIX, sha1,
+                                  PIPELINE_PROFILE_SUFFIX);
+    }
+
+    // Threads used to create pipelines ahead of their first use, started on
+    // first use
+    cvk_pipeline_compiler* pipeline_compiler() {
+        std::lock_guard<std::mutex> lock(m_pipeline_compiler_lock);
+        if (m_pipeline_compiler == nullptr) {
+            m_pipeline_compiler = std::make_unique<cvk_pipeline_compiler>(
+                std::max(config.pipeline_compiler_threads(), 1u));
+        }
+        return m_pipeline_compiler.get();
+    }
 
     spv_target_env vulkan_spirv_env() const { return m_vulkan_spirv_env; }
 
@@ -683,11 +842,15 @@ private:
     VkPhysicalDeviceBufferDeviceAddressFeaturesKHR
         m_features_buffer_device_address{};
     VkPhysicalDeviceFloatControlsProperties m_float_controls_properties{};
+    VkPhysicalDevicePushDescriptorPropertiesKHR m_push_descriptor_properties{};
     VkPhysicalDeviceGlobalPriorityQueryFeaturesKHR
         m_features_queue_global_priority{};
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR
+        m_features_timeline_semaphore{};
 
     VkDevice m_dev;
     std::vector<const char*> m_vulkan_device_extensions;
+    std::unique_ptr<cvk_memory_allocator> m_memory_allocator;
 
     std::vector<cvk_vulkan_queue_wrapper> m_vulkan_queues;
     uint32_t m_vulkan_queue_alloc_index;
@@ -703,23 +866,15 @@ private:
     uint32_t m_driver_behaviors;
 
     // Pipeline caching
-    std::string get_pipeline_cache_filename(const cvk_sha1_hash& sha1) const;
-    void save_pipeline_cache(const cvk_sha1_hash& sha1,
-                             const VkPipelineCache& pipeline_cache) const;
-    struct sha1_hasher {
-        size_t operator()(const cvk_sha1_hash& sha1) const {
-            size_t result = 0;
-            for (unsigned i = 0; i < SHA1_DIGEST_NUM_WORDS; i++) {
-                // TODO: Better hash?
-                result *= 59;
-                result += sha1[i];
-            }
-            return result;
-        }
-    };
-    std::unordered_map<cvk_sha1_hash, VkPipelineCache, sha1_hasher>
-        m_pipeline_caches;
-    std::mutex m_pipeline_cache_mutex;
+    std::string get_cache_filename(const char* prefix,
+                                   const cvk_sha1_hash& sha1,
+                                   const char* suffix) const;
+    std::unique_ptr<cvk_pipeline_cache_store> m_pipeline_cache_store;
+    std::set<cvk_sha1_hash> m_validated_spirv;
+    std::mutex m_validated_spirv_lock;
+
+    std::unique_ptr<cvk_pipeline_compiler> m_pipeline_compiler;
+    std::mutex m_pipeline_compiler_lock;
 
     bool m_has_timer_support{};
     bool m_has_fp16_support{};
@@ -20,6 +20,7 @@
 #include "objects.hpp"
 #include "tracing.hpp"
 #include "utils.hpp"
+#include "vkutils.hpp"
 
 #include <mutex>
 #include <unordered_map>
@@ -84,6 +85,32 @@ struct cvk_event : public _cl_event, api_object<object_magic::event> {
         return m_status;
     }
 
+    // Record the point on a timeline semaphore that is signalled when the
+    // device work of the command completes. This lets commands from other
+    // queues wait for it on the device.
+    void set_device_completion(std::shared_ptr<cvk_timeline_semaphore> sem,
+                               uint64_t value) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_completion_semaphore = sem;
+        m_completion_value = value;
+    }
+
+    bool device_completion(std::shared_ptr<cvk_timeline_semaphore>* sem,
+                           uint64_t* value) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_completion_semaphore == nullptr) {
+            return false;
+        }
+        *sem = m_completion_semaphore;
+        *value = m_completion_value;
+        return true;
+    }
+
+    bool has_device_completion() {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_completion_semaphore != nullptr;
+    }
+
     void set_profiling_info(cl_profiling_info pinfo, uint64_t val) {
         m_profiling_data[pinfo - CL_PROFILING_COMMAND_QUEUED] = val;
     }
@@ -121,6 +148,8 @@ private:
     cvk_command* m_cmd;
     cvk_command_queue* m_queue;
     std::unordered_map<cl_int, std::vector<cvk_event_callback>> m_callbacks;
+    std::shared_ptr<cvk_timeline_semaphore> m_completion_semaphore;
+    uint64_t m_completion_value{};
 };
 
 using cvk_event_holder = refcounted_holder<cvk_event>;
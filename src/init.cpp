@@ -17,6 +17,7 @@
 
 #include <vulkan/vulkan.h>
 
+#include "build_service.hpp"
 #include "config.hpp"
 #include "device.hpp"
 #include "init.hpp"
@@ -236,6 +237,20 @@ void clvk_global_state::init_executors() {
 
 void clvk_global_state::term_executors() { delete m_thread_pool; }
 
+// Build workers, when enabled, are forked from a process that has to be
+// created before clvk starts any thread
+void clvk_global_state::init_build_service() {
+#ifdef CLSPV_ONLINE_COMPILER
+    m_build_service = new cvk_build_service(config.build_workers());
+#endif
+}
+
+void clvk_global_state::term_build_service() {
+#ifdef CLSPV_ONLINE_COMPILER
+    delete m_build_service;
+#endif
+}
+
 clvk_global_state::clvk_global_state() {
     // Init the configuration using environment variables before logging so
     // we can enable full logging support before parsing configuration files.
@@ -243,6 +258,7 @@ clvk_global_state::clvk_global_state() {
     init_logging();
     init_config();
     cvk_info("Starting initialisation");
+    init_build_service();
     init_tracing();
     init_vulkan();
     init_platform();
@@ -256,6 +272,7 @@ clvk_global_state::~clvk_global_state() {
         term_platform();
         term_vulkan();
         term_tracing();
+        term_build_service();
         term_logging();
     }
 }
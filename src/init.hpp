@@ -21,6 +21,7 @@
 
 struct cvk_platform;
 struct cvk_executor_thread_pool;
+struct cvk_build_service;
 
 class clvk_global_state {
 public:
@@ -37,6 +38,8 @@ public:
 
     cvk_executor_thread_pool* thread_pool() { return m_thread_pool; }
 
+    cvk_build_service* build_service() { return m_build_service; }
+
 private:
     void init_vulkan();
     void term_vulkan();
@@ -44,8 +47,11 @@ private:
     void term_platform();
     void init_executors();
     void term_executors();
+    void init_build_service();
+    void term_build_service();
 
     cvk_executor_thread_pool* m_thread_pool;
+    cvk_build_service* m_build_service{};
     cvk_platform* m_platform;
     VkInstance m_vulkan_instance;
     bool m_debug_report_enabled{};
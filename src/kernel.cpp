@@ -56,12 +56,25 @@ cl_int cvk_kernel::init() {
         return CL_OUT_OF_RESOURCES;
     }
 
+    m_entry_point->precompile_pipelines();
+
     return CL_SUCCESS;
 }
 
 VkPipeline
-cvk_kernel::create_pipeline(const cvk_spec_constant_map& spec_constants) {
-    return m_entry_point->create_pipeline(spec_constants);
+cvk_kernel::get_pipeline(const cvk_spec_constant_key& spec_constants) {
+    // Successive enqueues of a kernel usually use the same constants
+    auto last = m_last_pipeline.load(std::memory_order_acquire);
+    if ((last != nullptr) && (last->key == spec_constants)) {
+        return last->pipeline.load(std::memory_order_relaxed);
+    }
+
+    auto entry = m_entry_point->get_pipeline(spec_constants);
+    if (entry == nullptr) {
+        return VK_NULL_HANDLE;
+    }
+    m_last_pipeline.store(entry, std::memory_order_release);
+    return entry->pipeline.load(std::memory_order_relaxed);
 }
 
 std::unique_ptr<cvk_kernel> cvk_kernel::clone(cl_int* errcode_ret) const {
@@ -179,294 +192,166 @@ cl_int cvk_kernel::set_arg(cl_uint index, size_t size, const void* value) {
 
 bool cvk_kernel::args_valid() const { return m_argument_values->args_valid(); }
 
-bool cvk_kernel_argument_values::setup_descriptor_sets() {
-    std::lock_guard<std::mutex> lock(m_lock);
-
-    auto program = m_entry_point->program();
-    auto dev = program->context()->device()->vulkan_device();
-
-    // Do nothing if these argument values have already been used in an enqueue
-    if (m_is_enqueued) {
+bool cvk_kernel_argument_values::set_arg_descriptor(
+    const kernel_argument& arg) {
+    auto index = m_entry_point->arg_descriptor_index(arg.pos);
+    if (index == cvk_entry_point::NO_DESCRIPTOR) {
         return true;
     }
+    auto& desc = m_descriptor_info.mutate()[index];
 
-    // Allocate descriptor sets
-    if (!m_entry_point->allocate_descriptor_sets(descriptor_sets())) {
-        return false;
-    }
-    VkDescriptorSet* ds = descriptor_sets();
-
-    // Make enough space to store all descriptor write structures
-    size_t max_descriptor_writes =
-        m_args.size() // upper bound that includes POD buffers
-        + program->literal_sampler_descs().size() +
-        1; // module constant data buffer
-    std::vector<VkWriteDescriptorSet> descriptor_writes;
-    std::vector<VkDescriptorBufferInfo> buffer_info;
-    std::vector<VkDescriptorImageInfo> image_info;
-    std::vector<VkBufferView> buffer_views;
-    descriptor_writes.reserve(max_descriptor_writes);
-    buffer_info.reserve(max_descriptor_writes);
-    image_info.reserve(max_descriptor_writes);
-    buffer_views.reserve(max_descriptor_writes);
-
-    // Setup module-scope variables
-    if (program->module_constant_data_buffer() != nullptr &&
-        program->module_constant_data_buffer_info()->type ==
-            module_buffer_type::storage_buffer) {
-        auto buffer = program->module_constant_data_buffer();
-        auto info = program->module_constant_data_buffer_info();
+    switch (arg.kind) {
+    case kernel_argument_kind::buffer:
+    case kernel_argument_kind::buffer_ubo: {
+        auto buffer = static_cast<cvk_buffer*>(get_arg_value(arg));
         cvk_debug_fn(
-            "constant data buffer %p, size = %zu @ set = %u, binding = %u",
-            buffer->vulkan_buffer(), buffer->size(), info->set, info->binding);
-        // Update descriptors
-        VkDescriptorBufferInfo bufferInfo = {buffer->vulkan_buffer(),
-                                             0, // offset
-                                             VK_WHOLE_SIZE};
-        buffer_info.push_back(bufferInfo);
-
-        VkWriteDescriptorSet writeDescriptorSet = {
-            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            nullptr,
-            ds[info->set],
-            info->binding,                     // dstBinding
-            0,                                 // dstArrayElement
-            1,                                 // descriptorCount
-            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, // descriptorType
-            nullptr,                           // pImageInfo
-            &buffer_info.back(),
-            nullptr, // pTexelBufferView
-        };
-        descriptor_writes.push_back(writeDescriptorSet);
+            "buffer %p, offset = %zu, size = %zu @ set = %u, binding = %u",
+            buffer->vulkan_buffer(), buffer->vulkan_buffer_offset(),
+            buffer->size(), arg.descriptorSet, arg.binding);
+        desc.buffer = {buffer->vulkan_buffer(),
+                       buffer->vulkan_buffer_offset(), // offset
+                       buffer->size()};
+        break;
     }
-
-    // Setup descriptors for POD arguments
-    if (m_entry_point->has_pod_buffer_arguments()) {
-        // Create POD buffer
-        if (!create_pod_buffer()) {
+    case kernel_argument_kind::sampler: {
+        auto clsampler = static_cast<cvk_sampler*>(get_arg_value(arg));
+        bool normalized_coord_sampler_required = false;
+        if (auto md = m_entry_point->sampler_metadata()) {
+            normalized_coord_sampler_required = md->find(arg.pos) != md->end();
+        }
+        auto sampler =
+            normalized_coord_sampler_required &&
+                    !clsampler->normalized_coords()
+                ? clsampler
+                      ->get_or_create_vulkan_sampler_with_normalized_coords()
+                : clsampler->vulkan_sampler();
+        if (sampler == VK_NULL_HANDLE) {
+            cvk_error_fn("Could not set descriptor for sampler");
             return false;
         }
 
-        // Update descriptors
-        cvk_debug_fn("pod buffer %p, size = %zu @ set = %u, binding = %u",
-                     m_pod_buffer->vulkan_buffer(), m_pod_buffer->size(),
-                     m_pod_arg->descriptorSet, m_pod_arg->binding);
-        VkDescriptorBufferInfo bufferInfo = {m_pod_buffer->vulkan_buffer(),
-                                             0, // offset
-                                             VK_WHOLE_SIZE};
-        buffer_info.push_back(bufferInfo);
-
-        VkWriteDescriptorSet writeDescriptorSet = {
-            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            nullptr,
-            ds[m_pod_arg->descriptorSet],
-            m_pod_arg->binding,                   // dstBinding
-            0,                                    // dstArrayElement
-            1,                                    // descriptorCount
-            m_entry_point->pod_descriptor_type(), // descriptorType
-            nullptr,                              // pImageInfo
-            &buffer_info.back(),
-            nullptr, // pTexelBufferView
+        cvk_debug_fn("sampler %p @ set = %u, binding = %u", sampler,
+                     arg.descriptorSet, arg.binding);
+        desc.image = {
+            sampler,
+            VK_NULL_HANDLE,           // imageView
+            VK_IMAGE_LAYOUT_UNDEFINED // imageLayout
+        };
+        break;
+    }
+    case kernel_argument_kind::sampled_image:
+    case kernel_argument_kind::storage_image: {
+        auto image = static_cast<cvk_image*>(get_arg_value(arg));
+        bool sampled = arg.kind == kernel_argument_kind::sampled_image;
+        auto view = sampled ? image->vulkan_sampled_view()
+                            : image->vulkan_storage_view();
+
+        cvk_debug_fn("image view %p @ set = %u, binding = %u", view,
+                     arg.descriptorSet, arg.binding);
+        desc.image = {
+            VK_NULL_HANDLE,
+            view,                   // imageView
+            VK_IMAGE_LAYOUT_GENERAL // imageLayout
         };
-        descriptor_writes.push_back(writeDescriptorSet);
+        break;
+    }
+    case kernel_argument_kind::storage_texel_buffer:
+    case kernel_argument_kind::uniform_texel_buffer: {
+        auto image = static_cast<cvk_image*>(get_arg_value(arg));
+        auto view = image->vulkan_buffer_view();
+
+        cvk_debug_fn("buffer view %p @ set = %u, binding = %u", view,
+                     arg.descriptorSet, arg.binding);
+        desc.buffer_view = view;
+        break;
+    }
+    default:
+        cvk_error_fn("unsupported argument type");
+        return false;
     }
 
-    // Setup other kernel argument descriptors
-    for (cl_uint i = 0; i < m_args.size(); i++) {
-        auto const& arg = m_args[i];
+    return true;
+}
 
-        switch (arg.kind) {
+bool cvk_kernel_argument_values::setup_descriptor_sets(
+    cvk_buffer_ring* pod_ring) {
+    std::lock_guard<std::mutex> lock(m_lock);
 
-        case kernel_argument_kind::buffer:
-        case kernel_argument_kind::buffer_ubo: {
-            auto buffer = static_cast<cvk_buffer*>(get_arg_value(arg));
-            if (buffer == nullptr) {
-                cvk_debug_fn("ignoring NULL buffer argument");
-                break;
-            }
-            auto vkbuf = buffer->vulkan_buffer();
-            cvk_debug_fn(
-                "buffer %p, offset = %zu, size = %zu @ set = %u, binding = %u",
-                buffer->vulkan_buffer(), buffer->vulkan_buffer_offset(),
-                buffer->size(), arg.descriptorSet, arg.binding);
-            VkDescriptorBufferInfo bufferInfo = {
-                vkbuf,
-                buffer->vulkan_buffer_offset(), // offset
-                buffer->size()};
-            buffer_info.push_back(bufferInfo);
-
-            auto descriptor_type = arg.kind == kernel_argument_kind::buffer
-                                       ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
-                                       : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            VkWriteDescriptorSet writeDescriptorSet = {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                nullptr,
-                ds[arg.descriptorSet],
-                arg.binding, // dstBinding
-                0,           // dstArrayElement
-                1,           // descriptorCount
-                descriptor_type,
-                nullptr, // pImageInfo
-                &buffer_info.back(),
-                nullptr, // pTexelBufferView
-            };
-            descriptor_writes.push_back(writeDescriptorSet);
-            break;
-        }
-        case kernel_argument_kind::sampler: {
-            auto clsampler = static_cast<cvk_sampler*>(get_arg_value(arg));
-            bool normalized_coord_sampler_required = false;
-            if (auto md = m_entry_point->sampler_metadata()) {
-                normalized_coord_sampler_required = md->find(i) != md->end();
-            }
-            auto sampler =
-                normalized_coord_sampler_required &&
-                        !clsampler->normalized_coords()
-                    ? clsampler
-                          ->get_or_create_vulkan_sampler_with_normalized_coords()
-                    : clsampler->vulkan_sampler();
-            if (sampler == VK_NULL_HANDLE) {
-                cvk_error_fn("Could not set descriptor for sampler");
-                return false;
-            }
+    auto program = m_entry_point->program();
 
-            cvk_debug_fn("sampler %p @ set = %u, binding = %u", sampler,
-                         arg.descriptorSet, arg.binding);
-            VkDescriptorImageInfo imageInfo = {
-                sampler,
-                VK_NULL_HANDLE,           // imageView
-                VK_IMAGE_LAYOUT_UNDEFINED // imageLayout
-            };
-            image_info.push_back(imageInfo);
-
-            VkWriteDescriptorSet writeDescriptorSet = {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                nullptr,
-                ds[arg.descriptorSet],
-                arg.binding, // dstBinding
-                0,           // dstArrayElement
-                1,           // descriptorCount
-                VK_DESCRIPTOR_TYPE_SAMPLER,
-                &image_info.back(), // pImageInfo
-                nullptr,            // pBufferInfo
-                nullptr,            // pTexelBufferView
-            };
-            descriptor_writes.push_back(writeDescriptorSet);
-            break;
-        }
-        case kernel_argument_kind::sampled_image:
-        case kernel_argument_kind::storage_image: {
-            auto image = static_cast<cvk_image*>(get_arg_value(arg));
-            bool sampled = arg.kind == kernel_argument_kind::sampled_image;
-            auto view = sampled ? image->vulkan_sampled_view()
-                                : image->vulkan_storage_view();
-
-            cvk_debug_fn("image view %p @ set = %u, binding = %u", view,
-                         arg.descriptorSet, arg.binding);
-            VkDescriptorImageInfo imageInfo = {
-                VK_NULL_HANDLE,
-                view,                   // imageView
-                VK_IMAGE_LAYOUT_GENERAL // imageLayout
-            };
-            image_info.push_back(imageInfo);
-
-            VkDescriptorType dtype = sampled ? VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
-                                             : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-
-            VkWriteDescriptorSet writeDescriptorSet = {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                nullptr,
-                ds[arg.descriptorSet],
-                arg.binding, // dstBinding
-                0,           // dstArrayElement
-                1,           // descriptorCount
-                dtype,
-                &image_info.back(), // pImageInfo
-                nullptr,            // pBufferInfo
-                nullptr,            // pTexelBufferView
-            };
-            descriptor_writes.push_back(writeDescriptorSet);
-            break;
-        }
-        case kernel_argument_kind::storage_texel_buffer:
-        case kernel_argument_kind::uniform_texel_buffer: {
-            auto image = static_cast<cvk_image*>(get_arg_value(arg));
-            bool uniform =
-                arg.kind == kernel_argument_kind::uniform_texel_buffer;
-            auto view = image->vulkan_buffer_view();
-            buffer_views.push_back(view);
-
-            cvk_debug_fn("buffer view %p @ set = %u, binding = %u", view,
-                         arg.descriptorSet, arg.binding);
-
-            VkDescriptorType dtype =
-                uniform ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER
-                        : VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
-
-            VkWriteDescriptorSet writeDescriptorSet = {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                nullptr,
-                ds[arg.descriptorSet],
-                arg.binding, // dstBinding
-                0,           // dstArrayElement
-                1,           // descriptorCount
-                dtype,
-                nullptr,              // pImageInfo
-                nullptr,              // pBufferInfo
-                &buffer_views.back(), // pTexelBufferView
-            };
-            descriptor_writes.push_back(writeDescriptorSet);
-            break;
-        }
-        case kernel_argument_kind::pod: // skip POD arguments
-        case kernel_argument_kind::pod_ubo:
-        case kernel_argument_kind::pod_pushconstant:
-        case kernel_argument_kind::pointer_ubo:
-        case kernel_argument_kind::pointer_pushconstant:
-            break;
-        case kernel_argument_kind::local: // nothing to do?
-            break;
-        case kernel_argument_kind::unused:
-            break;
-        default:
-            cvk_error_fn("unsupported argument type");
+    // Do nothing if these argument values have already been used in an enqueue
+    if (m_is_enqueued) {
+        return true;
+    }
+
+    // Create POD buffer and set up its descriptor. The offset of the data in
+    // the ring is provided by each enqueue, when the descriptor sets are bound
+    // for dynamic descriptors or when the descriptors are pushed.
+    if (m_entry_point->has_pod_buffer_arguments()) {
+        if (!create_pod_buffer(pod_ring)) {
             return false;
         }
+        cvk_debug_fn("pod buffer %p (ring: %d), size = %u @ set = %u, "
+                     "binding = %u",
+                     m_bound_pod_buffer->vulkan_buffer(), pod_data_in_ring(),
+                     m_entry_point->pod_buffer_size(), m_pod_arg->descriptorSet,
+                     m_pod_arg->binding);
+        VkDescriptorBufferInfo pod_desc = {m_bound_pod_buffer->vulkan_buffer(),
+                                           0, // offset
+                                           m_entry_point->pod_buffer_size()};
+        // The descriptor of the POD ring doesn't change between enqueues and
+        // needn't be copied
+        auto index = m_entry_point->pod_descriptor_index();
+        auto& current = m_descriptor_info.get()[index].buffer;
+        if ((current.buffer != pod_desc.buffer) ||
+            (current.offset != pod_desc.offset) ||
+            (current.range != pod_desc.range)) {
+            m_descriptor_info.mutate()[index].buffer = pod_desc;
+        }
     }
 
-    // Setup literal samplers
-    for (size_t i = 0; i < program->literal_sampler_descs().size(); i++) {
-        auto desc = program->literal_sampler_descs()[i];
-        auto clsampler = icd_downcast(program->literal_samplers()[i]);
-        auto sampler = clsampler->vulkan_sampler();
+    // Descriptors of the push descriptor set are recorded when the kernel is
+    // enqueued, get descriptor sets for everything else.
+    if (m_entry_point->uses_descriptor_pool()) {
+        // Descriptor sets can be shared between argument values binding the
+        // same resources. The printf buffer is bound when the kernel is
+        // enqueued and POD buffers that aren't the ring are freed with the
+        // argument values so they prevent sharing. When the arguments are
+        // pushed, the sets only hold program-scope resources.
+        std::vector<const refcounted*> key;
+        bool cacheable = !program->uses_printf();
+        if (!m_entry_point->uses_push_descriptors()) {
+            key.assign(m_kernel_resources.get().begin(),
+                       m_kernel_resources.get().end());
+            if (m_entry_point->has_pod_buffer_arguments()) {
+                key.push_back(m_bound_pod_buffer);
+                cacheable = cacheable && pod_data_in_ring();
+            }
+        }
 
-        VkDescriptorImageInfo imageInfo = {
-            sampler,
-            VK_NULL_HANDLE,           // imageView
-            VK_IMAGE_LAYOUT_UNDEFINED // imageLayout
-        };
-        image_info.push_back(imageInfo);
-
-        VkWriteDescriptorSet writeDescriptorSet = {
-            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            nullptr,
-            ds[desc.descriptorSet],
-            desc.binding, // dstBinding
-            0,            // dstArrayElement
-            1,            // descriptorCount
-            VK_DESCRIPTOR_TYPE_SAMPLER,
-            &image_info.back(), // pImageInfo
-            nullptr,            // pBufferInfo
-            nullptr,            // pTexelBufferView
-        };
-        descriptor_writes.push_back(writeDescriptorSet);
+        bool needs_update;
+        m_descriptor_sets_entry = m_entry_point->acquire_descriptor_sets(
+            std::move(key), cacheable, &needs_update);
+        if (m_descriptor_sets_entry == nullptr) {
+            return false;
+        }
+        m_descriptor_sets = m_descriptor_sets_entry->sets;
+
+        // Write descriptors to device
+        if (needs_update) {
+            for (uint32_t set = 0; set < m_entry_point->num_set_layouts();
+                 set++) {
+                if (set != m_entry_point->push_descriptor_set()) {
+                    m_entry_point->write_descriptor_set(
+                        m_descriptor_sets[set], set,
+                        m_descriptor_info.get().data());
+                }
+            }
+            m_entry_point->cache_descriptor_sets(m_descriptor_sets_entry);
+        }
     }
 
     m_is_enqueued = true;
 
-    // Write descriptors to device
-    vkUpdateDescriptorSets(dev, static_cast<uint32_t>(descriptor_writes.size()),
-                           descriptor_writes.data(), 0, nullptr);
-
     return true;
 }
@@ -15,7 +15,9 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -24,6 +26,7 @@
 #include "memory.hpp"
 #include "objects.hpp"
 #include "program.hpp"
+#include "unit.hpp"
 
 struct cvk_kernel_argument_values;
 
@@ -32,7 +35,7 @@ struct cvk_kernel : public _cl_kernel, api_object<object_magic::kernel> {
     cvk_kernel(cvk_program* program, const char* name)
         : api_object(program->context()), m_program(program),
           m_entry_point(nullptr), m_name(name), m_sampler_metadata(nullptr),
-          m_image_metadata(nullptr) {}
+          m_image_metadata(nullptr), m_last_pipeline(nullptr) {}
 
     CHECK_RETURN cl_int init();
     std::unique_ptr<cvk_kernel> clone(cl_int* errcode_ret) const;
@@ -56,8 +59,16 @@ struct cvk_kernel : public _cl_kernel, api_object<object_magic::kernel> {
     void set_image_metadata(cl_uint index, const void* image);
 
     CHECK_RETURN cl_int set_arg(cl_uint index, size_t size, const void* value);
+    void fill_spec_constant_key(cvk_spec_constant_key& key,
+                                const std::array<uint32_t, 3>& lws,
+                                uint32_t dims,
+                                const std::array<uint32_t, 3>& offset) const {
+        m_entry_point->fill_spec_constant_key(key, lws, dims, offset);
+    }
+
+    // Returns VK_NULL_HANDLE when the pipeline couldn't be created
     CHECK_RETURN VkPipeline
-    create_pipeline(const cvk_spec_constant_map& spec_constants);
+    get_pipeline(const cvk_spec_constant_key& spec_constants);
 
     bool has_pod_arguments() const {
         return m_entry_point->has_pod_arguments();
@@ -75,6 +86,12 @@ struct cvk_kernel : public _cl_kernel, api_object<object_magic::kernel> {
     uint32_t num_set_layouts() const {
         return m_entry_point->num_set_layouts();
     }
+    bool uses_push_descriptors() const {
+        return m_entry_point->uses_push_descriptors();
+    }
+    uint32_t push_descriptor_set() const {
+        return m_entry_point->push_descriptor_set();
+    }
     VkPipelineLayout pipeline_layout() const {
         return m_entry_point->pipeline_layout();
     }
@@ -167,6 +184,9 @@ private:
     std::shared_ptr<cvk_kernel_argument_values> m_argument_values;
     const kernel_sampler_metadata_map* m_sampler_metadata;
     const kernel_image_metadata_map* m_image_metadata;
+    // Pipeline used by the last enqueue, checked before the entry point's
+    // table
+    std::atomic<const cvk_pipeline_entry*> m_last_pipeline;
 };
 
 static inline cvk_kernel* icd_downcast(cl_kernel kernel) {
@@ -175,30 +195,69 @@ static inline cvk_kernel* icd_downcast(cl_kernel kernel) {
 
 using cvk_kernel_holder = refcounted_holder<cvk_kernel>;
 
+// A value shared by copies of the argument values until one of them modifies
+// it
+template <typename T> struct cvk_copy_on_write {
+
+    cvk_copy_on_write() : m_value(std::make_shared<T>()) {}
+    explicit cvk_copy_on_write(T&& value)
+        : m_value(std::make_shared<T>(std::move(value))) {}
+
+    const T& get() const { return *m_value; }
+
+    // Only called by the thread that owns this copy
+    T& mutate() {
+        if (m_value.use_count() > 1) {
+            m_value = std::make_shared<T>(*m_value);
+            CLVK_UNIT_COUNT(argument_value_copies);
+        } else {
+            // use_count() is a relaxed load, make sure the reads of the copies
+            // that released the value happen before it is modified
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *m_value;
+    }
+
+private:
+    std::shared_ptr<T> m_value;
+};
+
+// The argument values of a kernel. Enqueues keep the values they were given
+// and the kernel continues with a copy when arguments are set again. Copies
+// share the POD data, resources, local argument sizes and descriptors until
+// they are modified, only the parts an argument belongs to are copied when
+// it is set.
 struct cvk_kernel_argument_values {
 
     cvk_kernel_argument_values(cvk_entry_point* entry_point)
         : m_entry_point(entry_point), m_is_enqueued(false),
           m_args(m_entry_point->args()), m_pod_arg(nullptr),
-          m_kernel_resources(m_entry_point->num_resource_slots()),
-          m_local_args_size(m_entry_point->args().size(), 0),
-          m_args_set(m_args.size(), false), m_descriptor_sets{VK_NULL_HANDLE},
-          m_descriptor_sets_refcount(0) {}
+          m_kernel_resources(std::vector<refcounted*>(
+              m_entry_point->num_resource_slots())),
+          m_local_args_size(
+              std::vector<size_t>(m_entry_point->args().size(), 0)),
+          m_args_set(std::vector<bool>(m_args.size(), false)),
+          m_pod_ring(nullptr), m_bound_pod_buffer(nullptr),
+          m_descriptor_sets{VK_NULL_HANDLE}, m_descriptor_sets_entry(nullptr),
+          m_descriptor_sets_refcount(0),
+          m_descriptor_info(std::vector<cvk_descriptor_info>(
+              m_entry_point->descriptor_info())) {}
 
     cvk_kernel_argument_values(const cvk_kernel_argument_values& other)
-        : m_entry_point(other.m_entry_point), m_is_enqueued(false),
-          m_args(m_entry_point->args()), m_pod_arg(nullptr),
+        : m_entry_point(other.m_entry_point), m_pod_data(other.m_pod_data),
+          m_is_enqueued(false), m_args(m_entry_point->args()),
+          m_pod_arg(other.m_pod_arg),
           m_kernel_resources(other.m_kernel_resources),
           m_local_args_size(other.m_local_args_size),
           m_specialization_constants(other.m_specialization_constants),
-          m_args_set(other.m_args_set), m_descriptor_sets{VK_NULL_HANDLE},
-          m_descriptor_sets_refcount(0) {}
+          m_args_set(other.m_args_set), m_pod_ring(nullptr),
+          m_bound_pod_buffer(nullptr), m_descriptor_sets{VK_NULL_HANDLE},
+          m_descriptor_sets_entry(nullptr), m_descriptor_sets_refcount(0),
+          m_descriptor_info(other.m_descriptor_info) {}
 
     ~cvk_kernel_argument_values() {
-        for (auto ds : m_descriptor_sets) {
-            if (ds != VK_NULL_HANDLE) {
-                m_entry_point->free_descriptor_set(ds);
-            }
+        if (m_descriptor_sets_entry != nullptr) {
+            m_entry_point->release_descriptor_sets(m_descriptor_sets_entry);
         }
     }
 
@@ -215,17 +274,7 @@ struct cvk_kernel_argument_values {
 
     static std::shared_ptr<cvk_kernel_argument_values>
     create(const cvk_kernel_argument_values& other) {
-        auto val = std::make_shared<cvk_kernel_argument_values>(other);
-
-        if (!val->init()) {
-            return nullptr;
-        }
-
-        if (!val->init_copy(other)) {
-            return nullptr;
-        }
-
-        return val;
+        return std::make_shared<cvk_kernel_argument_values>(other);
     }
 
     bool init() {
@@ -248,25 +297,14 @@ struct cvk_kernel_argument_values {
             m_entry_point->has_image_metadata() ||
             m_entry_point->has_sampler_metadata()) {
             // TODO(#101): host out-of-memory errors are currently unhandled.
-            auto buffer = std::make_unique<std::vector<uint8_t>>(
-                m_entry_point->pod_buffer_size());
-            m_pod_data = std::move(buffer);
+            m_pod_data.mutate().resize(m_entry_point->pod_buffer_size());
         }
 
         return true;
     }
 
-    bool init_copy(const cvk_kernel_argument_values& other) {
-        if (m_entry_point->has_pod_arguments()) {
-            memcpy(&pod_data()[0], &other.pod_data()[0], pod_data().size());
-            return true;
-        } else {
-            return true;
-        }
-    }
-
     void set_pod_data(uint32_t offset, size_t size, const void* value) {
-        memcpy(&pod_data()[offset], value, size);
+        memcpy(&m_pod_data.mutate()[offset], value, size);
     }
 
     cl_int set_arg(const kernel_argument& arg, size_t size, const void* value) {
@@ -299,9 +337,9 @@ struct cvk_kernel_argument_values {
             set_pod_data(arg.offset, arg.size, value);
         } else if (arg.kind == kernel_argument_kind::local) {
             CVK_ASSERT(value == nullptr);
-            m_local_args_size[arg.pos] = size;
+            m_local_args_size.mutate()[arg.pos] = size;
             CVK_ASSERT(size % arg.local_elem_size == 0);
-            m_specialization_constants[arg.local_spec_id] =
+            m_specialization_constants.mutate()[arg.local_spec_id] =
                 size / arg.local_elem_size;
         } else if (!arg.is_unused()) {
             // We only expect cl_mem or cl_sampler here
@@ -318,7 +356,10 @@ struct cvk_kernel_argument_values {
                     return CL_INVALID_SAMPLER;
                 }
 
-                m_kernel_resources[arg.binding] = sampler;
+                m_kernel_resources.mutate()[arg.binding] = sampler;
+                if (!set_arg_descriptor(arg)) {
+                    return CL_OUT_OF_RESOURCES;
+                }
             } else {
                 auto apimem = *reinterpret_cast<const cl_mem*>(value);
                 if (apimem == nullptr) {
@@ -328,37 +369,93 @@ struct cvk_kernel_argument_values {
                 if (!mem->is_valid()) {
                     return CL_INVALID_MEM_OBJECT;
                 }
-                m_kernel_resources[arg.binding] = mem;
+                m_kernel_resources.mutate()[arg.binding] = mem;
+                if (!set_arg_descriptor(arg)) {
+                    return CL_OUT_OF_RESOURCES;
+                }
             }
         }
 
-        m_args_set[arg.pos] = true;
+        if (!m_args_set.get()[arg.pos]) {
+            m_args_set.mutate()[arg.pos] = true;
+        }
         return CL_SUCCESS;
     }
 
-    refcounted* get_arg_value(const kernel_argument& arg) {
-        return m_kernel_resources[arg.binding];
+    refcounted* get_arg_value(const kernel_argument& arg) const {
+        return m_kernel_resources.get()[arg.binding];
     }
 
     bool is_enqueued() const { return m_is_enqueued; }
 
-    const std::vector<uint8_t>& pod_data() const { return *m_pod_data; }
-    std::vector<uint8_t>& pod_data() { return *m_pod_data; }
+    const std::vector<uint8_t>& pod_data() const { return m_pod_data.get(); }
 
-    size_t local_arg_size(int pos) const { return m_local_args_size[pos]; }
+    size_t local_arg_size(int pos) const {
+        return m_local_args_size.get()[pos];
+    }
 
     const std::unordered_map<uint32_t, uint32_t>&
     specialization_constants() const {
-        return m_specialization_constants;
+        return m_specialization_constants.get();
+    }
+
+    // POD arguments are read from pod_ring when possible, see
+    // write_pod_data_to_ring
+    CHECK_RETURN bool setup_descriptor_sets(cvk_buffer_ring* pod_ring);
+
+    // Whether the POD arguments are read from the ring passed to
+    // setup_descriptor_sets
+    bool pod_data_in_ring() const { return m_pod_ring != nullptr; }
+
+    // Each enqueue writes the POD arguments to the ring and keeps the range
+    // until its work has completed. Returns nullptr when the ring is full.
+    CHECK_RETURN std::unique_ptr<cvk_buffer_ring_allocation>
+    write_pod_data_to_ring() const {
+        CVK_ASSERT(pod_data_in_ring());
+        return m_pod_ring->allocate(m_pod_data.get().data(),
+                                    m_entry_point->pod_buffer_size());
     }
 
-    CHECK_RETURN bool setup_descriptor_sets();
+    // Argument values holding the same arguments in their own POD buffer,
+    // used by the enqueues of these values that don't fit in the ring. They
+    // are only created once while these values are enqueued, the arguments
+    // can't change until they are released.
+    CHECK_RETURN cvk_kernel_argument_values* pod_fallback() {
+        std::lock_guard<std::mutex> lock(m_lock);
+        CVK_ASSERT(m_descriptor_sets_refcount > 0);
+        if (m_pod_fallback == nullptr) {
+            auto fallback = create(*this);
+            fallback->retain_resources();
+            if (!fallback->setup_descriptor_sets(nullptr)) {
+                fallback->release_resources();
+                return nullptr;
+            }
+            CLVK_UNIT_COUNT(pod_fallback_buffers);
+            m_pod_fallback = std::move(fallback);
+        }
+        return m_pod_fallback.get();
+    }
 
     VkDescriptorSet* descriptor_sets() { return m_descriptor_sets.data(); }
 
+    // Records the descriptors of the push descriptor set, if the entry point
+    // uses one. pod_offset is the offset of the POD arguments in the ring.
+    void push_descriptors(VkCommandBuffer command_buffer,
+                          VkDeviceSize pod_offset) {
+        auto& info = m_descriptor_info.get();
+        if (!pod_data_in_ring() || m_entry_point->pod_descriptor_is_dynamic()) {
+            m_entry_point->push_descriptors(command_buffer, info.data(),
+                                            nullptr);
+            return;
+        }
+        auto pod = info[m_entry_point->pod_descriptor_index()].buffer;
+        pod.offset = pod_offset;
+        m_entry_point->push_descriptors(command_buffer, info.data(), &pod);
+    }
+
     // Take ownership of resources and retain them.
     void retain_resources() {
-        for (auto& resource : m_kernel_resources) {
+        for (auto& resource : m_kernel_resources.get()) {
             if (resource)
                 resource->retain();
         }
@@ -368,18 +465,24 @@ struct cvk_kernel_argument_values {
 
     // Release all resources owned resources.
     void release_resources() {
-        for (auto& resource : m_kernel_resources) {
+        for (auto& resource : m_kernel_resources.get()) {
             if (resource)
                 resource->release();
         }
         std::lock_guard<std::mutex> lock(m_lock);
         if (--m_descriptor_sets_refcount == 0) {
             m_is_enqueued = false;
-            for (auto& ds : m_descriptor_sets) {
-                if (ds != VK_NULL_HANDLE) {
-                    m_entry_point->free_descriptor_set(ds);
-                    ds = VK_NULL_HANDLE;
-                }
+            if (m_descriptor_sets_entry != nullptr) {
+                m_entry_point->release_descriptor_sets(m_descriptor_sets_entry);
+                m_descriptor_sets_entry = nullptr;
+                m_descriptor_sets.fill(VK_NULL_HANDLE);
+            }
+            m_pod_ring = nullptr;
+            m_pod_buffer.reset();
+            m_bound_pod_buffer = nullptr;
+            if (m_pod_fallback != nullptr) {
+                m_pod_fallback->release_resources();
+                m_pod_fallback.reset();
             }
         }
     }
@@ -389,8 +492,7 @@ struct cvk_kernel_argument_values {
         mems.reserve(m_args.size());
         for (auto& arg : m_args) {
             if (arg.is_mem_object_backed()) {
-                auto mem =
-                    static_cast<cvk_mem*>(m_kernel_resources[arg.binding]);
+                auto mem = static_cast<cvk_mem*>(get_arg_value(arg));
                 mems.push_back(mem);
             }
         }
@@ -398,36 +500,58 @@ struct cvk_kernel_argument_values {
     }
 
     bool args_valid() const {
-        return std::all_of(m_args_set.cbegin(), m_args_set.cend(),
+        return std::all_of(m_args_set.get().cbegin(), m_args_set.get().cend(),
                            [](bool b) { return b; });
     }
 
 private:
-    bool create_pod_buffer() {
-        CVK_ASSERT(m_pod_data->size() >= m_entry_point->pod_buffer_size());
+    // Fills in the descriptor for a resource argument
+    CHECK_RETURN bool set_arg_descriptor(const kernel_argument& arg);
+
+    bool create_pod_buffer(cvk_buffer_ring* pod_ring) {
+        auto& pod_data = m_pod_data.get();
+        CVK_ASSERT(pod_data.size() >= m_entry_point->pod_buffer_size());
+
+        // The data is written to the ring by each enqueue
+        if (pod_ring != nullptr) {
+            m_pod_ring = pod_ring;
+            m_bound_pod_buffer = pod_ring->buffer();
+            return true;
+        }
 
-        // Create POD buffer and copy data to it
+        // Fall back to creating a POD buffer and copying data to it
         m_pod_buffer = m_entry_point->allocate_pod_buffer();
         if (m_pod_buffer == nullptr) {
             return false;
         }
-        return m_pod_buffer->copy_from(m_pod_data->data(), 0,
+        m_bound_pod_buffer = m_pod_buffer.get();
+        return m_pod_buffer->copy_from(pod_data.data(), 0,
                                        m_entry_point->pod_buffer_size());
     }
 
     std::mutex m_lock;
     cvk_entry_point* m_entry_point;
-    std::unique_ptr<std::vector<uint8_t>> m_pod_data;
+    cvk_copy_on_write<std::vector<uint8_t>> m_pod_data;
     bool m_is_enqueued;
     const std::vector<kernel_argument>& m_args;
     const kernel_argument* m_pod_arg;
-    std::vector<refcounted*> m_kernel_resources;
-    std::vector<size_t> m_local_args_size;
-    std::unordered_map<uint32_t, uint32_t> m_specialization_constants;
-    std::vector<bool> m_args_set;
+    cvk_copy_on_write<std::vector<refcounted*>> m_kernel_resources;
+    cvk_copy_on_write<std::vector<size_t>> m_local_args_size;
+    cvk_copy_on_write<std::unordered_map<uint32_t, uint32_t>>
+        m_specialization_constants;
+    cvk_copy_on_write<std::vector<bool>> m_args_set;
 
+    cvk_buffer_ring* m_pod_ring;
     std::unique_ptr<cvk_buffer> m_pod_buffer;
+    // Buffer the POD arguments are read from, either the ring or m_pod_buffer
+    cvk_buffer* m_bound_pod_buffer;
+    // Copy of these values with their own POD buffer, see pod_fallback
+    std::shared_ptr<cvk_kernel_argument_values> m_pod_fallback;
     std::array<VkDescriptorSet, spir_binary::MAX_DESCRIPTOR_SETS>
         m_descriptor_sets;
+    cvk_descriptor_sets* m_descriptor_sets_entry;
     uint32_t m_descriptor_sets_refcount;
+    // Descriptors for all the bindings, in the layout expected by the
+    // entry point's descriptor update templates
+    cvk_copy_on_write<std::vector<cvk_descriptor_info>> m_descriptor_info;
 };
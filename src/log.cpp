@@ -49,6 +49,7 @@ static uint64_t init_logging_groups() {
         {"event", loggroup::event},
         {"validation", loggroup::validation},
         {"cfg", loggroup::cfg},
+        {"memory", loggroup::memory},
         {"none", loggroup::none},
         {"all", loggroup::all},
     };
@@ -36,6 +36,7 @@ enum loggroup : uint64_t
     event = (1ULL << 2),
     validation = (1ULL << 3),
     cfg = (1ULL << 4),
+    memory = (1ULL << 5),
     none = (1ULL << 63),
     all = ~0ULL
 };
@@ -12,56 +12,31 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cmath>
 
 #include "image_format.hpp"
 #include "memory.hpp"
 #include "queue.hpp"
+#include "unit.hpp"
 
 bool cvk_mem::map() {
-    std::lock_guard<std::mutex> lock(m_map_lock);
-    cvk_debug("%p::map", this);
-
-    if (m_map_count == 0) {
-        if (m_parent != nullptr) {
-            if (!m_parent->map()) {
-                return false;
-            }
-            m_map_ptr = pointer_offset(m_parent->host_va(), m_parent_offset);
-            cvk_debug("%p::map, sub-buffer, map_ptr = %p", this, m_map_ptr);
-        } else {
-            auto res = m_memory->map(&m_map_ptr);
-            if (res != VK_SUCCESS) {
-                return false;
-            }
-            cvk_debug("%p::map, map_ptr = %p", this, m_map_ptr);
-        }
+    if (!is_host_accessible()) {
+        return false;
     }
 
-    m_map_count++;
     retain();
-    cvk_debug("%p::map, new map_count = %u", this, m_map_count);
+    auto count = ++m_map_count;
+    cvk_debug("%p::map, new map_count = %u", this, count);
 
     return true;
 }
 
 void cvk_mem::unmap() {
-    std::lock_guard<std::mutex> lock(m_map_lock);
-    cvk_debug("%p::unmap", this);
-
     CVK_ASSERT(m_map_count > 0);
-    m_map_count--;
+    auto count = --m_map_count;
+    cvk_debug("%p::unmap, new map_count = %u", this, count);
     release();
-    if (m_map_count == 0) {
-        if (m_parent != nullptr) {
-            m_parent->unmap();
-            cvk_debug("%p::unmap, sub-buffer", this);
-        } else {
-            m_memory->unmap();
-            m_map_ptr = nullptr;
-        }
-    }
-    cvk_debug("%p::unmap, new map_count = %u", this, m_map_count);
 }
 
 std::unique_ptr<cvk_buffer>
@@ -110,21 +85,23 @@ bool cvk_buffer::init() {
     }
 
     // Allocate memory
-    m_memory = std::make_shared<cvk_memory_allocation>(
-        vkdev, params.size, params.memory_type_index);
-    res = m_memory->allocate(device->uses_physical_addressing());
+    m_memory = device->memory_allocator()->allocate(
+        params.requirements, params.memory_type_index, false);
 
-    if (res != VK_SUCCESS) {
+    if (m_memory == nullptr) {
         return false;
     }
 
     // Bind the buffer to memory
-    res = vkBindBufferMemory(vkdev, m_buffer, m_memory->vulkan_memory(), 0);
+    res = vkBindBufferMemory(vkdev, m_buffer, m_memory->vulkan_memory(),
+                             m_memory->offset());
 
     if (res != VK_SUCCESS) {
         return false;
     }
 
+    m_map_ptr = m_memory->host_ptr();
+
     if (has_any_flag(CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR)) {
         if (!copy_from(m_host_ptr, 0, m_size)) {
             return false;
@@ -143,6 +120,104 @@ cvk_mem* cvk_buffer::create_subbuffer(cl_mem_flags flags, size_t origin,
     return buffer.release();
 }
 
+std::shared_ptr<cvk_buffer_ring>
+cvk_buffer_ring::create(cvk_context* context, VkDeviceSize size,
+                        VkDeviceSize alignment) {
+    cl_int err;
+    auto buffer = cvk_buffer::create(context, 0, size, nullptr, &err);
+    if (err != CL_SUCCESS) {
+        return nullptr;
+    }
+
+    if (!buffer->is_host_accessible()) {
+        cvk_warn_fn("ring buffer memory is not host-visible");
+        return nullptr;
+    }
+
+    alignment = std::max<VkDeviceSize>(alignment, 4);
+    return std::make_shared<cvk_buffer_ring>(std::move(buffer), size,
+                                             alignment);
+}
+
+cvk_buffer_ring::cvk_buffer_ring(std::unique_ptr<cvk_buffer>&& buffer,
+                                 VkDeviceSize size, VkDeviceSize alignment)
+    : m_buffer(std::move(buffer)), m_size(size), m_alignment(alignment),
+      m_head(0), m_used(0) {
+    TRACE_CNT_VAR_INIT(used_counter, "clvk-ring-" +
+                                         std::to_string((uintptr_t)this) +
+                                         "-used-bytes");
+}
+
+std::unique_ptr<cvk_buffer_ring_allocation>
+cvk_buffer_ring::allocate(const void* data, VkDeviceSize size) {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    VkDeviceSize data_size = size;
+    size = (size + m_alignment - 1) / m_alignment * m_alignment;
+
+    VkDeviceSize begin;
+    VkDeviceSize head = m_ranges.empty() ? m_head : m_ranges.back().end;
+    if (m_ranges.empty()) {
+        if (size > m_size) {
+            return nullptr;
+        }
+        begin = (head + size <= m_size) ? head : 0;
+    } else {
+        VkDeviceSize tail = m_ranges.front().begin;
+        if (head > tail) {
+            // Free space is at the end of the ring and before the tail
+            if (head + size <= m_size) {
+                begin = head;
+            } else if (size < tail) {
+                begin = 0;
+            } else {
+                return nullptr;
+            }
+        } else if (head + size < tail) {
+            // Free space is between the head and the tail
+            begin = head;
+        } else {
+            return nullptr;
+        }
+    }
+
+    if (begin < head) {
+        CLVK_UNIT_COUNT(ring_wraps);
+    }
+
+    memcpy(pointer_offset(m_buffer->host_va(), begin), data, data_size);
+
+    m_ranges.push_back({begin, begin + size, false});
+    m_head = begin + size;
+    m_used += size;
+    TRACE_CNT(used_counter, m_used);
+
+    return std::make_unique<cvk_buffer_ring_allocation>(shared_from_this(),
+                                                        begin);
+}
+
+void cvk_buffer_ring::free(VkDeviceSize offset) {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto it = std::find_if(m_ranges.begin(), m_ranges.end(),
+                           [offset](const range& r) {
+                               return !r.freed && (r.begin == offset);
+                           });
+    CVK_ASSERT(it != m_ranges.end());
+    it->freed = true;
+    m_used -= it->end - it->begin;
+
+    while (!m_ranges.empty() && m_ranges.front().freed) {
+        m_ranges.pop_front();
+    }
+
+    TRACE_CNT(used_counter, m_used);
+}
+
+cvk_buffer_ring_allocation::~cvk_buffer_ring_allocation() {
+    m_ring->free(m_offset);
+}
+
 cvk_sampler*
 cvk_sampler::create(cvk_context* context, bool normalized_coords,
                     cl_addressing_mode addressing_mode,
@@ -424,18 +499,17 @@ bool cvk_image::init_vulkan_image() {
     }
 
     // Allocate memory
-    m_memory = std::make_unique<cvk_memory_allocation>(
-        vkdev, params.size, params.memory_type_index);
+    m_memory = device->memory_allocator()->allocate(
+        params.requirements, params.memory_type_index, true);
 
-    res = m_memory->allocate(device->uses_physical_addressing());
-
-    if (res != VK_SUCCESS) {
+    if (m_memory == nullptr) {
         cvk_error_fn("Could not allocate memory!");
         return false;
     }
 
     // Bind the image to memory
-    res = vkBindImageMemory(vkdev, m_image, m_memory->vulkan_memory(), 0);
+    res = vkBindImageMemory(vkdev, m_image, m_memory->vulkan_memory(),
+                            m_memory->offset());
 
     if (res != VK_SUCCESS) {
         return false;
@@ -15,55 +15,16 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <deque>
 #include <list>
 
 #include "device.hpp"
 #include "event.hpp"
+#include "memory_allocator.hpp"
 #include "objects.hpp"
 #include "utils.hpp"
 
-struct cvk_memory_allocation {
-
-    cvk_memory_allocation(VkDevice dev, VkDeviceSize size, uint32_t type_index)
-        : m_device(dev), m_size(size), m_memory(VK_NULL_HANDLE),
-          m_memory_type_index(type_index) {}
-
-    ~cvk_memory_allocation() {
-        if (m_memory != VK_NULL_HANDLE) {
-            vkFreeMemory(m_device, m_memory, nullptr);
-        }
-    }
-
-    VkResult allocate(bool physical_addressing) {
-        const VkMemoryAllocateFlagsInfo flagsInfo = {
-            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, nullptr,
-            VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
-
-        const VkMemoryAllocateInfo memoryAllocateInfo = {
-            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            physical_addressing ? &flagsInfo : nullptr,
-            m_size,
-            m_memory_type_index,
-        };
-
-        return vkAllocateMemory(m_device, &memoryAllocateInfo, 0, &m_memory);
-    }
-
-    VkResult map(void** map_ptr) {
-        return vkMapMemory(m_device, m_memory, 0, m_size, 0, map_ptr);
-    }
-
-    void unmap() { vkUnmapMemory(m_device, m_memory); }
-
-    VkDeviceMemory vulkan_memory() { return m_memory; }
-
-private:
-    VkDevice m_device;
-    VkDeviceSize m_size;
-    VkDeviceMemory m_memory;
-    uint32_t m_memory_type_index;
-};
-
 using cvk_mem_callback_pointer_type = void(CL_CALLBACK*)(cl_mem mem,
                                                          void* user_data);
 
@@ -111,12 +72,17 @@ struct cvk_mem : public _cl_mem, api_object<object_magic::memory_object> {
             std::vector<cl_mem_properties>&& properties,
             cl_mem_object_type type)
         : api_object(ctx), m_type(type), m_flags(flags), m_map_count(0),
-          m_map_ptr(nullptr), m_properties(std::move(properties)), m_size(size),
-          m_host_ptr(host_ptr), m_parent(parent),
+          m_properties(std::move(properties)), m_size(size),
+          m_host_ptr(host_ptr), m_map_ptr(nullptr), m_parent(parent),
           m_parent_offset(parent_offset) {
 
         if (m_parent != nullptr) {
 
+            if (m_parent->is_host_accessible()) {
+                m_map_ptr =
+                    pointer_offset(m_parent->host_va(), m_parent_offset);
+            }
+
             // Handle flag inheritance
             cl_mem_flags access_flags =
                 CL_MEM_READ_WRITE | CL_MEM_READ_ONLY | CL_MEM_WRITE_ONLY;
@@ -150,6 +116,7 @@ struct cvk_mem : public _cl_mem, api_object<object_magic::memory_object> {
             auto cb = *cbi;
             cb.pointer(this, cb.data);
         }
+        m_context->notify_resource_destroyed(this);
     }
 
     uint32_t map_count() const { return m_map_count; }
@@ -203,55 +170,52 @@ struct cvk_mem : public _cl_mem, api_object<object_magic::memory_object> {
         m_callbacks.push_back(cb);
     }
 
+    // Host-visible memory is mapped for the whole lifetime of the memory
+    // object so its host address can be used without synchronisation.
+    bool is_host_accessible() const { return m_map_ptr != nullptr; }
+
     void* host_va() const {
         CVK_ASSERT(m_map_ptr != nullptr);
         return m_map_ptr;
     }
 
+    // Only counts the mappings made through the API, memory is always
+    // mapped when possible.
     bool CHECK_RETURN map();
     void unmap();
 
     bool CHECK_RETURN copy_to(void* dst, size_t offset, size_t size) {
-        if (map()) {
-            void* src = pointer_offset(m_map_ptr, offset);
-            memcpy(dst, src, size);
-            unmap();
-            return true;
+        if (!is_host_accessible()) {
+            return false;
         }
-        return false;
+        memcpy(dst, pointer_offset(m_map_ptr, offset), size);
+        return true;
     }
 
     bool CHECK_RETURN copy_to(cvk_mem* dst, size_t src_offset,
                               size_t dst_offset, size_t size) {
-        if (map() && dst->map()) {
-            void* src_ptr = pointer_offset(m_map_ptr, src_offset);
-            void* dst_ptr = pointer_offset(dst->host_va(), dst_offset);
-            memcpy(dst_ptr, src_ptr, size);
-            dst->unmap();
-            unmap();
-            return true;
+        if (!is_host_accessible() || !dst->is_host_accessible()) {
+            return false;
         }
-        return false;
+        memcpy(pointer_offset(dst->host_va(), dst_offset),
+               pointer_offset(m_map_ptr, src_offset), size);
+        return true;
     }
 
     bool CHECK_RETURN copy_from(const void* src, size_t offset, size_t size) {
-        if (map()) {
-            void* dst = pointer_offset(m_map_ptr, offset);
-            memcpy(dst, src, size);
-            unmap();
-            return true;
+        if (!is_host_accessible()) {
+            return false;
         }
-        return false;
+        memcpy(pointer_offset(m_map_ptr, offset), src, size);
+        return true;
     }
 
     cvk_mem_init_tracker& init_tracker() { return m_init_tracker; }
 
 private:
     cl_mem_object_type m_type;
-    std::mutex m_map_lock;
     cl_mem_flags m_flags;
-    uint32_t m_map_count;
-    void* m_map_ptr;
+    std::atomic<uint32_t> m_map_count;
     std::mutex m_callbacks_lock;
     std::vector<cvk_mem_callback> m_callbacks;
     std::vector<cl_mem_properties> m_properties;
@@ -259,6 +223,8 @@ private:
 protected:
     size_t m_size;
     void* m_host_ptr;
+    // Set once when the memory object is initialised
+    void* m_map_ptr;
     cvk_mem_holder m_parent;
     size_t m_parent_offset;
     std::shared_ptr<cvk_memory_allocation> m_memory;
@@ -431,6 +397,63 @@ private:
 
 using cvk_buffer_holder = refcounted_holder<cvk_buffer>;
 
+struct cvk_buffer_ring;
+
+// A range of a ring buffer, returned to the ring when destroyed
+struct cvk_buffer_ring_allocation {
+    cvk_buffer_ring_allocation(std::shared_ptr<cvk_buffer_ring> ring,
+                               VkDeviceSize offset)
+        : m_ring(ring), m_offset(offset) {}
+
+    ~cvk_buffer_ring_allocation();
+
+    VkDeviceSize offset() const { return m_offset; }
+
+private:
+    std::shared_ptr<cvk_buffer_ring> m_ring;
+    VkDeviceSize m_offset;
+};
+
+// Persistently mapped buffer that small pieces of data read by the device are
+// written to. Ranges are handed out in order, wrapping around to the start of
+// the buffer, and can be freed in any order. The space they use is reclaimed
+// once all the ranges allocated before them have been freed.
+struct cvk_buffer_ring : public std::enable_shared_from_this<cvk_buffer_ring> {
+
+    cvk_buffer_ring(std::unique_ptr<cvk_buffer>&& buffer, VkDeviceSize size,
+                    VkDeviceSize alignment);
+
+    static std::shared_ptr<cvk_buffer_ring>
+    create(cvk_context* context, VkDeviceSize size, VkDeviceSize alignment);
+
+    cvk_buffer* buffer() const { return m_buffer.get(); }
+
+    // Returns nullptr when there isn't enough free space in the ring
+    CHECK_RETURN std::unique_ptr<cvk_buffer_ring_allocation>
+    allocate(const void* data, VkDeviceSize size);
+
+    void free(VkDeviceSize offset);
+
+private:
+    struct range {
+        VkDeviceSize begin;
+        VkDeviceSize end;
+        bool freed;
+    };
+
+    std::unique_ptr<cvk_buffer> m_buffer;
+    VkDeviceSize m_size;
+    VkDeviceSize m_alignment;
+
+    std::mutex m_lock;
+    // Ranges in use, in allocation order
+    std::deque<range> m_ranges;
+    // End of the last range allocated
+    VkDeviceSize m_head;
+    VkDeviceSize m_used;
+    TRACE_CNT_VAR(used_counter);
+};
+
 struct cvk_sampler;
 using cvk_sampler_holder = refcounted_holder<cvk_sampler>;
 
@@ -445,6 +468,7 @@ struct cvk_sampler : public _cl_sampler, api_object<object_magic::sampler> {
           m_sampler_norm(VK_NULL_HANDLE) {}
 
     ~cvk_sampler() {
+        m_context->notify_resource_destroyed(this);
         auto vkdev = context()->device()->vulkan_device();
         if (m_sampler != VK_NULL_HANDLE) {
             vkDestroySampler(vkdev, m_sampler, nullptr);
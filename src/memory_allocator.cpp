@@ -0,0 +1,285 @@
+// Copyright 2026 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "config.hpp"
+#include "log.hpp"
+#include "memory_allocator.hpp"
+
+VkResult cvk_memory_block::allocate(bool physical_addressing, bool map) {
+    const VkMemoryAllocateFlagsInfo flagsInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, nullptr,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
+
+    const VkMemoryAllocateInfo memoryAllocateInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        physical_addressing ? &flagsInfo : nullptr,
+        m_size,
+        m_memory_type_index,
+    };
+
+    TRACE_BEGIN("vkAllocateMemory");
+    auto res = vkAllocateMemory(m_device, &memoryAllocateInfo, 0, &m_memory);
+    TRACE_END();
+    if ((res != VK_SUCCESS) || !map) {
+        return res;
+    }
+
+    res = vkMapMemory(m_device, m_memory, 0, VK_WHOLE_SIZE, 0, &m_map_ptr);
+    if (res != VK_SUCCESS) {
+        m_map_ptr = nullptr;
+    }
+    return res;
+}
+
+void cvk_memory_block::init_free_lists() {
+    uint32_t num_orders = 1;
+    while ((MIN_SUBALLOCATION_SIZE << (num_orders - 1)) < m_size) {
+        num_orders++;
+    }
+    CVK_ASSERT((MIN_SUBALLOCATION_SIZE << (num_orders - 1)) == m_size);
+    m_free_lists.resize(num_orders);
+    m_free_lists[num_orders - 1].insert(0);
+}
+
+VkDeviceSize cvk_memory_block::suballocate(VkDeviceSize size,
+                                           VkDeviceSize alignment,
+                                           VkDeviceSize* offset) {
+    if (m_free_lists.empty()) {
+        init_free_lists();
+    }
+
+    // Ranges are aligned to their size
+    uint32_t order = 0;
+    VkDeviceSize range_size = MIN_SUBALLOCATION_SIZE;
+    while ((range_size < size) || (range_size < alignment)) {
+        range_size <<= 1;
+        order++;
+    }
+
+    for (uint32_t o = order; o < m_free_lists.size(); o++) {
+        auto& list = m_free_lists[o];
+        if (list.empty()) {
+            continue;
+        }
+        VkDeviceSize range_offset = *list.begin();
+        list.erase(list.begin());
+
+        // Split the range, keeping the lower half each time
+        while (o > order) {
+            o--;
+            m_free_lists[o].insert(range_offset +
+                                   (MIN_SUBALLOCATION_SIZE << o));
+        }
+
+        m_allocated[range_offset] = order;
+        *offset = range_offset;
+        return range_size;
+    }
+
+    return 0;
+}
+
+void cvk_memory_block::free(VkDeviceSize offset) {
+    auto it = m_allocated.find(offset);
+    CVK_ASSERT(it != m_allocated.end());
+    uint32_t order = it->second;
+    m_allocated.erase(it);
+
+    // Merge the range with its buddy for as long as the buddy is free
+    while (order + 1 < m_free_lists.size()) {
+        VkDeviceSize buddy = offset ^ (MIN_SUBALLOCATION_SIZE << order);
+        auto& list = m_free_lists[order];
+        auto bit = list.find(buddy);
+        if (bit == list.end()) {
+            break;
+        }
+        list.erase(bit);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+
+    m_free_lists[order].insert(offset);
+}
+
+cvk_memory_allocation::~cvk_memory_allocation() {
+    if (m_pool != nullptr) {
+        m_pool->free(m_block.get(), m_offset, m_size, m_reserved);
+    }
+}
+
+cvk_memory_pool::cvk_memory_pool(VkDevice dev, uint32_t type_index,
+                                 bool for_images, VkDeviceSize block_size,
+                                 bool physical_addressing, bool map)
+    : m_device(dev), m_memory_type_index(type_index), m_for_images(for_images),
+      m_block_size(cvk_memory_block::MIN_SUBALLOCATION_SIZE),
+      m_physical_addressing(physical_addressing), m_map(map),
+      m_num_allocations(0), m_used(0), m_reserved(0) {
+    // The buddy allocator needs blocks whose size is a power of two
+    while (m_block_size < block_size) {
+        m_block_size <<= 1;
+    }
+
+    std::string prefix = "clvk-memory-type-" + std::to_string(type_index) +
+                         (for_images ? "-images" : "-buffers");
+    TRACE_CNT_VAR_INIT(blocks_counter, prefix + "-blocks");
+    TRACE_CNT_VAR_INIT(used_counter, prefix + "-used-bytes");
+    TRACE_CNT_VAR_INIT(reserved_counter, prefix + "-reserved-bytes");
+}
+
+std::unique_ptr<cvk_memory_allocation>
+cvk_memory_pool::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    std::shared_ptr<cvk_memory_block> block;
+    VkDeviceSize offset = 0;
+    VkDeviceSize reserved = 0;
+    for (auto& b : m_blocks) {
+        reserved = b->suballocate(size, alignment, &offset);
+        if (reserved != 0) {
+            block = b;
+            break;
+        }
+    }
+
+    if (block == nullptr) {
+        if (m_spare_block != nullptr) {
+            block = std::move(m_spare_block);
+        } else {
+            block = std::make_shared<cvk_memory_block>(m_device, m_block_size,
+                                                       m_memory_type_index);
+            if (block->allocate(m_physical_addressing, m_map) != VK_SUCCESS) {
+                return nullptr;
+            }
+        }
+        m_blocks.push_back(block);
+        reserved = block->suballocate(size, alignment, &offset);
+        CVK_ASSERT(reserved != 0);
+        cvk_debug_group(loggroup::memory,
+                        "memory type %u, %s: using %zu blocks of %llu bytes",
+                        m_memory_type_index, m_for_images ? "images" : "buffers",
+                        m_blocks.size(), (unsigned long long)m_block_size);
+    }
+
+    m_num_allocations++;
+    m_used += size;
+    m_reserved += reserved;
+    update_counters();
+
+    return std::make_unique<cvk_memory_allocation>(
+        block, shared_from_this(), offset, size, reserved);
+}
+
+void cvk_memory_pool::free(cvk_memory_block* block, VkDeviceSize offset,
+                           VkDeviceSize size, VkDeviceSize reserved) {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    block->free(offset);
+    m_num_allocations--;
+    m_used -= size;
+    m_reserved -= reserved;
+
+    if (block->empty()) {
+        auto it = std::find_if(
+            m_blocks.begin(), m_blocks.end(),
+            [block](const std::shared_ptr<cvk_memory_block>& b) {
+                return b.get() == block;
+            });
+        CVK_ASSERT(it != m_blocks.end());
+        if (m_spare_block == nullptr) {
+            m_spare_block = *it;
+        }
+        m_blocks.erase(it);
+        cvk_debug_group(loggroup::memory,
+                        "memory type %u, %s: using %zu blocks of %llu bytes",
+                        m_memory_type_index, m_for_images ? "images" : "buffers",
+                        m_blocks.size(), (unsigned long long)m_block_size);
+    }
+
+    update_counters();
+}
+
+void cvk_memory_pool::update_counters() {
+    TRACE_CNT(blocks_counter, m_blocks.size());
+    TRACE_CNT(used_counter, m_used);
+    TRACE_CNT(reserved_counter, m_reserved);
+}
+
+void cvk_memory_pool::log_stats() {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    VkDeviceSize total = m_blocks.size() * m_block_size;
+    // Internal fragmentation is the padding added to round allocations up to
+    // the size of a buddy range, external fragmentation the free space in
+    // the blocks.
+    cvk_info_group(loggroup::memory,
+                   "memory type %u, %s: %llu allocations in %zu blocks, "
+                   "%llu bytes used, %llu bytes reserved, %llu bytes free",
+                   m_memory_type_index, m_for_images ? "images" : "buffers",
+                   (unsigned long long)m_num_allocations, m_blocks.size(),
+                   (unsigned long long)m_used, (unsigned long long)m_reserved,
+                   (unsigned long long)(total - m_reserved));
+}
+
+std::unique_ptr<cvk_memory_allocation>
+cvk_memory_allocator::allocate(const VkMemoryRequirements& reqs,
+                               uint32_t type_index, bool for_image) {
+    VkDeviceSize block_size =
+        static_cast<VkDeviceSize>(config.memory_block_size_mb) * 1024 * 1024;
+
+    if ((block_size != 0) && (reqs.size <= config.max_suballocation_size) &&
+        (reqs.size <= block_size)) {
+        std::shared_ptr<cvk_memory_pool> pool;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            uint32_t key = type_index * 2 + (for_image ? 1 : 0);
+            auto& entry = m_pools[key];
+            if (entry == nullptr) {
+                entry = std::make_shared<cvk_memory_pool>(
+                    m_device, type_index, for_image, block_size,
+                    m_physical_addressing, should_map(type_index, for_image));
+            }
+            pool = entry;
+        }
+
+        auto allocation = pool->allocate(reqs.size, reqs.alignment);
+        if (allocation != nullptr) {
+            return allocation;
+        }
+
+        // Large blocks may not fit in the memory that is left, try a
+        // dedicated allocation instead.
+        cvk_warn_group(loggroup::memory,
+                       "could not allocate a memory block, falling back to a "
+                       "dedicated allocation");
+    }
+
+    auto block =
+        std::make_shared<cvk_memory_block>(m_device, reqs.size, type_index);
+    if (block->allocate(m_physical_addressing,
+                        should_map(type_index, for_image)) != VK_SUCCESS) {
+        return nullptr;
+    }
+
+    return std::make_unique<cvk_memory_allocation>(block, nullptr, 0, reqs.size,
+                                                   reqs.size);
+}
+
+void cvk_memory_allocator::log_stats() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto& entry : m_pools) {
+        entry.second->log_stats();
+    }
+}
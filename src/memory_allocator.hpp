@@ -0,0 +1,194 @@
+// Copyright 2026 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "tracing.hpp"
+#include "utils.hpp"
+
+// A Vulkan memory allocation. Blocks are either dedicated to a single memory
+// object or split between many of them by a buddy allocator.
+struct cvk_memory_block {
+
+    cvk_memory_block(VkDevice dev, VkDeviceSize size, uint32_t type_index)
+        : m_device(dev), m_size(size), m_memory(VK_NULL_HANDLE),
+          m_memory_type_index(type_index), m_map_ptr(nullptr) {}
+
+    ~cvk_memory_block() {
+        if (m_memory != VK_NULL_HANDLE) {
+            if (m_map_ptr != nullptr) {
+                vkUnmapMemory(m_device, m_memory);
+            }
+            vkFreeMemory(m_device, m_memory, nullptr);
+        }
+    }
+
+    // Host-visible blocks are mapped once when they are allocated and stay
+    // mapped until they are freed.
+    CHECK_RETURN VkResult allocate(bool physical_addressing, bool map);
+
+    // Returns nullptr when the block is not mapped
+    void* host_ptr() const { return m_map_ptr; }
+
+    VkDeviceMemory vulkan_memory() const { return m_memory; }
+    VkDeviceSize size() const { return m_size; }
+    uint32_t memory_type_index() const { return m_memory_type_index; }
+
+    // Buddy allocation. The caller is responsible for synchronisation.
+    // Returns the size of the range that was reserved for the allocation or
+    // 0 when there is no free range large enough in the block.
+    CHECK_RETURN VkDeviceSize suballocate(VkDeviceSize size,
+                                          VkDeviceSize alignment,
+                                          VkDeviceSize* offset);
+    void free(VkDeviceSize offset);
+    bool empty() const { return m_allocated.empty(); }
+
+    // Smallest range handed out by the buddy allocator
+    static constexpr VkDeviceSize MIN_SUBALLOCATION_SIZE = 256;
+
+private:
+    void init_free_lists();
+
+    VkDevice m_device;
+    VkDeviceSize m_size;
+    VkDeviceMemory m_memory;
+    uint32_t m_memory_type_index;
+    void* m_map_ptr;
+
+    // Free ranges, indexed by order (size is MIN_SUBALLOCATION_SIZE << order)
+    std::vector<std::set<VkDeviceSize>> m_free_lists;
+    // Order of the ranges in use, indexed by offset
+    std::unordered_map<VkDeviceSize, uint32_t> m_allocated;
+};
+
+struct cvk_memory_pool;
+
+// The range of device memory a memory object is bound to
+struct cvk_memory_allocation {
+
+    cvk_memory_allocation(std::shared_ptr<cvk_memory_block> block,
+                          std::shared_ptr<cvk_memory_pool> pool,
+                          VkDeviceSize offset, VkDeviceSize size,
+                          VkDeviceSize reserved)
+        : m_block(block), m_pool(pool), m_offset(offset), m_size(size),
+          m_reserved(reserved) {}
+
+    ~cvk_memory_allocation();
+
+    // Returns nullptr when the memory is not host-visible
+    void* host_ptr() const {
+        void* block_ptr = m_block->host_ptr();
+        if (block_ptr == nullptr) {
+            return nullptr;
+        }
+        return pointer_offset(block_ptr, m_offset);
+    }
+
+    VkDeviceMemory vulkan_memory() const { return m_block->vulkan_memory(); }
+    VkDeviceSize offset() const { return m_offset; }
+    VkDeviceSize size() const { return m_size; }
+
+private:
+    std::shared_ptr<cvk_memory_block> m_block;
+    // Only set for allocations that share their block
+    std::shared_ptr<cvk_memory_pool> m_pool;
+    VkDeviceSize m_offset;
+    VkDeviceSize m_size;
+    VkDeviceSize m_reserved;
+};
+
+// The blocks used for one kind of resource in one memory type
+struct cvk_memory_pool : public std::enable_shared_from_this<cvk_memory_pool> {
+
+    cvk_memory_pool(VkDevice dev, uint32_t type_index, bool for_images,
+                    VkDeviceSize block_size, bool physical_addressing,
+                    bool map);
+
+    CHECK_RETURN std::unique_ptr<cvk_memory_allocation>
+    allocate(VkDeviceSize size, VkDeviceSize alignment);
+    void free(cvk_memory_block* block, VkDeviceSize offset, VkDeviceSize size,
+              VkDeviceSize reserved);
+
+    void log_stats();
+
+private:
+    void update_counters();
+
+    VkDevice m_device;
+    uint32_t m_memory_type_index;
+    bool m_for_images;
+    VkDeviceSize m_block_size;
+    bool m_physical_addressing;
+    bool m_map;
+
+    std::mutex m_lock;
+    std::vector<std::shared_ptr<cvk_memory_block>> m_blocks;
+    // Empty block kept around to avoid freeing and allocating memory again
+    // when objects are repeatedly created and released
+    std::shared_ptr<cvk_memory_block> m_spare_block;
+    uint64_t m_num_allocations;
+    // Bytes requested by the memory objects in the blocks
+    VkDeviceSize m_used;
+    // Bytes reserved for them by the buddy allocator
+    VkDeviceSize m_reserved;
+
+    TRACE_CNT_VAR(blocks_counter);
+    TRACE_CNT_VAR(used_counter);
+    TRACE_CNT_VAR(reserved_counter);
+};
+
+// Memory allocator for the buffers and images of a device. Small objects are
+// sub-allocated from large blocks, one set of blocks per memory type and
+// kind of resource so that buffers and images never share a block and
+// bufferImageGranularity never has to be considered. Large objects get
+// dedicated allocations.
+struct cvk_memory_allocator {
+
+    cvk_memory_allocator(VkDevice dev,
+                         const VkPhysicalDeviceMemoryProperties& properties,
+                         bool physical_addressing)
+        : m_device(dev), m_memory_properties(properties),
+          m_physical_addressing(physical_addressing) {}
+
+    ~cvk_memory_allocator() { log_stats(); }
+
+    CHECK_RETURN std::unique_ptr<cvk_memory_allocation>
+    allocate(const VkMemoryRequirements& reqs, uint32_t type_index,
+             bool for_image);
+
+    void log_stats();
+
+private:
+    // Only buffer memory is accessed from the host
+    bool should_map(uint32_t type_index, bool for_image) const {
+        auto flags = m_memory_properties.memoryTypes[type_index].propertyFlags;
+        return !for_image &&
+               ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0);
+    }
+
+    VkDevice m_device;
+    VkPhysicalDeviceMemoryProperties m_memory_properties;
+    bool m_physical_addressing;
+    std::mutex m_lock;
+    std::unordered_map<uint32_t, std::shared_ptr<cvk_memory_pool>> m_pools;
+};
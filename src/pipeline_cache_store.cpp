@@ -0,0 +1,689 @@
+// Copyright 2026 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include "log.hpp"
+#include "pipeline_cache_store.hpp"
+#include "program_cache.hpp"
+#include "unit.hpp"
+
+namespace fs = std::filesystem;
+
+static const char* PIPELINE_CACHE_PREFIX = "clvk-pipeline-cache.";
+static const char* PIPELINE_CACHE_SUFFIX = ".bin";
+
+// Bump the version whenever the format of the store changes
+static constexpr uint32_t PIPELINE_CACHE_STORE_MAGIC = 0x53504b43; // "CKPS"
+static constexpr uint32_t PIPELINE_CACHE_STORE_VERSION = 2;
+
+// Pipelines created shortly after each other are saved together
+static constexpr auto PIPELINE_CACHE_SAVE_DELAY = std::chrono::seconds(2);
+
+// The time modules were last used is only updated in the store when it is
+// older than this many seconds
+static constexpr uint64_t PIPELINE_CACHE_LAST_USE_PERIOD = 24 * 60 * 60;
+
+struct pipeline_cache_store_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t reserved;
+};
+
+enum pipeline_cache_store_record_type : uint32_t
+{
+    // Followed by |size| bytes of pipeline cache data that supersede the
+    // data of the previous records of the module
+    PIPELINE_CACHE_STORE_RECORD_DATA = 0,
+    // Only updates the time the module was last used
+    PIPELINE_CACHE_STORE_RECORD_LAST_USE = 1,
+};
+
+// Records are appended to the store after its header
+struct pipeline_cache_store_record {
+    cvk_sha1_hash module;
+    cvk_sha1_hash checksum;
+    uint64_t last_use;
+    uint64_t size;
+    uint32_t type;
+    uint32_t reserved;
+};
+
+// Held while the store is updated so that processes sharing the cache
+// directory don't drop each other's updates. Does nothing when the lock file
+// can't be opened.
+struct pipeline_cache_store_lock {
+    explicit pipeline_cache_store_lock(const std::string& path) : m_fd(-1) {
+#ifndef WIN32
+        m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (m_fd < 0) {
+            cvk_warn("Could not open pipeline cache store lock %s",
+                     path.c_str());
+            return;
+        }
+        while ((flock(m_fd, LOCK_EX) != 0) && (errno == EINTR)) {
+        }
+#else
+        UNUSED(path);
+#endif
+    }
+
+    ~pipeline_cache_store_lock() {
+#ifndef WIN32
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+#endif
+    }
+
+private:
+    int m_fd;
+};
+
+static uint64_t now_in_seconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+cvk_pipeline_cache_store::~cvk_pipeline_cache_store() {
+    if (m_writer != nullptr) {
+        m_writer_lock.lock();
+        m_shutdown = true;
+        m_writer_cv.notify_all();
+        m_writer_lock.unlock();
+        m_writer->join();
+    } else {
+        save();
+    }
+
+    for (auto& entry : m_caches) {
+        vkDestroyPipelineCache(m_device, entry.second.cache, nullptr);
+    }
+}
+
+std::string cvk_pipeline_cache_store::store_path() const {
+    // ${CLVK_CACHE_DIR}/clvk-pipeline-cache.<UUID>.bin
+    return m_dir + "/" + PIPELINE_CACHE_PREFIX + m_uuid + PIPELINE_CACHE_SUFFIX;
+}
+
+std::string cvk_pipeline_cache_store::lock_path() const {
+    return store_path() + ".lock";
+}
+
+std::string
+cvk_pipeline_cache_store::legacy_path(const cvk_sha1_hash& module) const {
+    // ${CLVK_CACHE_DIR}/clvk-pipeline-cache.<UUID>.<SHA1>.bin
+    return m_dir + "/" + PIPELINE_CACHE_PREFIX + m_uuid + "." +
+           to_hex_string(reinterpret_cast<const uint8_t*>(module.data()),
+                         SHA1_DIGEST_NUM_BYTES) +
+           PIPELINE_CACHE_SUFFIX;
+}
+
+bool cvk_pipeline_cache_store::scan_store(
+    std::ifstream& file, std::map<cvk_sha1_hash, record>& records,
+    uint64_t& end) const {
+    file.seekg(0, std::ios::end);
+    uint64_t size = file.tellg();
+    file.seekg(0);
+
+    pipeline_cache_store_header header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file.good() || (header.magic != PIPELINE_CACHE_STORE_MAGIC) ||
+        (header.version != PIPELINE_CACHE_STORE_VERSION)) {
+        cvk_warn("Ignoring invalid pipeline cache store %s",
+                 store_path().c_str());
+        return false;
+    }
+
+    // Only the headers of the records are read
+    end = sizeof(header);
+    while (size - end >= sizeof(pipeline_cache_store_record)) {
+        pipeline_cache_store_record rec;
+        file.read(reinterpret_cast<char*>(&rec), sizeof(rec));
+        if (!file.good()) {
+            break;
+        }
+        uint64_t data_size =
+            (rec.type == PIPELINE_CACHE_STORE_RECORD_DATA) ? rec.size : 0;
+        if (size - end - sizeof(rec) < data_size) {
+            break;
+        }
+
+        auto it = records.find(rec.module);
+        if (rec.type == PIPELINE_CACHE_STORE_RECORD_DATA) {
+            auto& r = records[rec.module];
+            r.last_use = std::max(r.last_use, rec.last_use);
+            r.checksum = rec.checksum;
+            r.offset = end + sizeof(rec);
+            r.size = data_size;
+        } else if (it != records.end()) {
+            it->second.last_use = std::max(it->second.last_use, rec.last_use);
+        }
+
+        end += sizeof(rec) + data_size;
+        file.seekg(end);
+    }
+
+    // Records may be being appended by another process, or a process may have
+    // crashed while appending them. The incomplete record is dropped the next
+    // time records are appended.
+    if (end != size) {
+        cvk_info("Pipeline cache store %s ends with an incomplete record",
+                 store_path().c_str());
+    }
+    return true;
+}
+
+bool cvk_pipeline_cache_store::read_data(std::ifstream& file,
+                                         const record& rec,
+                                         std::vector<char>& data) const {
+    file.clear();
+    file.seekg(rec.offset);
+    data.resize(rec.size);
+    file.read(data.data(), data.size());
+    if (!file.good()) {
+        cvk_warn("Failed to read pipeline cache store %s",
+                 store_path().c_str());
+        return false;
+    }
+    // Corrupted records are dropped the next time the store is compacted
+    if (cvk_sha1(data.data(), data.size()) != rec.checksum) {
+        cvk_warn("Ignoring corrupted record in pipeline cache store %s",
+                 store_path().c_str());
+        return false;
+    }
+    return true;
+}
+
+void cvk_pipeline_cache_store::write_records(
+    std::ostream& file, const std::vector<entry>& entries) {
+    for (auto& e : entries) {
+        pipeline_cache_store_record rec;
+        rec.module = e.module;
+        rec.checksum = e.checksum;
+        rec.last_use = e.last_use;
+        rec.size = e.has_data ? e.data.size() : 0;
+        rec.type = e.has_data ? PIPELINE_CACHE_STORE_RECORD_DATA
+                              : PIPELINE_CACHE_STORE_RECORD_LAST_USE;
+        rec.reserved = 0;
+        file.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+        if (e.has_data) {
+            file.write(e.data.data(), e.data.size());
+        }
+    }
+}
+
+bool cvk_pipeline_cache_store::write_store(
+    const std::vector<entry>& entries) const {
+    std::string path = store_path();
+    std::string tmp_path = cvk_cache_temporary_path(path);
+
+    pipeline_cache_store_header header;
+    header.magic = PIPELINE_CACHE_STORE_MAGIC;
+    header.version = PIPELINE_CACHE_STORE_VERSION;
+    header.reserved = 0;
+
+    std::error_code ec;
+    {
+        std::ofstream file(tmp_path, std::ios::out | std::ios::binary);
+        if (!file.is_open()) {
+            cvk_warn("Failed to open pipeline cache store for writing: %s",
+                     tmp_path.c_str());
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write_records(file, entries);
+        file.close();
+        if (!file.good()) {
+            cvk_warn("Failed to write pipeline cache store");
+            fs::remove(tmp_path, ec);
+            return false;
+        }
+    }
+
+    // Renaming is atomic, readers see either the previous store or this one
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        cvk_warn("Failed to replace pipeline cache store %s", path.c_str());
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool cvk_pipeline_cache_store::append_records(
+    uint64_t end, const std::vector<entry>& entries) const {
+    std::string path = store_path();
+
+    // Drop the incomplete record a process that crashed may have left
+    std::error_code ec;
+    fs::resize_file(path, end, ec);
+    if (ec) {
+        cvk_warn("Failed to truncate pipeline cache store %s", path.c_str());
+        return false;
+    }
+
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::app);
+    if (!file.is_open()) {
+        cvk_warn("Failed to open pipeline cache store for appending: %s",
+                 path.c_str());
+        return false;
+    }
+    write_records(file, entries);
+    file.close();
+    if (!file.good()) {
+        cvk_warn("Failed to append to pipeline cache store %s", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void cvk_pipeline_cache_store::compact_store(
+    const std::map<cvk_sha1_hash, module_cache>& caches) const {
+    std::ifstream file(store_path(), std::ios::in | std::ios::binary);
+    std::map<cvk_sha1_hash, record> records;
+    uint64_t end;
+    if (!file.is_open() || !scan_store(file, records, end)) {
+        return;
+    }
+
+    // Keep the most recently used modules that fit in the size limit,
+    // modules used by this process first
+    std::vector<std::pair<cvk_sha1_hash, record>> sorted(records.begin(),
+                                                         records.end());
+    auto is_live = [&caches](const cvk_sha1_hash& module) {
+        return caches.count(module) != 0;
+    };
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&is_live](const std::pair<cvk_sha1_hash, record>& a,
+                                const std::pair<cvk_sha1_hash, record>& b) {
+                         if (a.second.last_use != b.second.last_use) {
+                             return a.second.last_use > b.second.last_use;
+                         }
+                         return is_live(a.first) && !is_live(b.first);
+                     });
+    uint64_t total_size = sizeof(pipeline_cache_store_header);
+    std::vector<entry> entries;
+    for (auto& r : sorted) {
+        uint64_t size = sizeof(pipeline_cache_store_record) + r.second.size;
+        if (total_size + size > m_max_size) {
+            break;
+        }
+        entry e;
+        e.module = r.first;
+        e.last_use = r.second.last_use;
+        e.checksum = r.second.checksum;
+        e.has_data = true;
+        if (!read_data(file, r.second, e.data)) {
+            continue;
+        }
+        total_size += size;
+        entries.push_back(std::move(e));
+    }
+    file.close();
+    if (entries.size() < records.size()) {
+        cvk_info("Evicting %zu modules from the pipeline cache store",
+                 records.size() - entries.size());
+    }
+
+    if (write_store(entries)) {
+        cvk_info("Compacted the pipeline cache store to %zu modules, %llu "
+                 "bytes",
+                 entries.size(), (unsigned long long)total_size);
+    }
+}
+
+bool cvk_pipeline_cache_store::read_legacy_file(const cvk_sha1_hash& module,
+                                                std::vector<char>& data) const {
+    std::string path = legacy_path(module);
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec) {
+        return false;
+    }
+    data.resize(size);
+    file.read(data.data(), data.size());
+    if (!file.good()) {
+        data.clear();
+        return false;
+    }
+
+    // The file is removed once its data has been written to the store
+    cvk_info("Read pipeline cache data from %s", path.c_str());
+    return true;
+}
+
+VkPipelineCache
+cvk_pipeline_cache_store::create_cache(const std::vector<char>& data) const {
+    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {
+        VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        nullptr,     // pNext
+        0,           // flags
+        data.size(), // initialDataSize
+        data.data(), // pInitialData
+    };
+
+    VkPipelineCache pipeline_cache;
+    VkResult res = vkCreatePipelineCache(m_device, &pipelineCacheCreateInfo,
+                                         nullptr, &pipeline_cache);
+    if (res != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    return pipeline_cache;
+}
+
+void cvk_pipeline_cache_store::merge_data(VkPipelineCache pipeline_cache,
+                                          const std::vector<char>& data) const {
+    VkPipelineCache src_cache = create_cache(data);
+    if (src_cache == VK_NULL_HANDLE) {
+        cvk_warn("Could not create pipeline cache to merge data from");
+        return;
+    }
+
+    VkResult res =
+        vkMergePipelineCaches(m_device, pipeline_cache, 1, &src_cache);
+    if (res != VK_SUCCESS) {
+        cvk_warn("Could not merge pipeline cache data");
+    }
+
+    vkDestroyPipelineCache(m_device, src_cache, nullptr);
+}
+
+bool cvk_pipeline_cache_store::get(const cvk_sha1_hash& module,
+                                   const std::vector<char>& binary_data,
+                                   VkPipelineCache& pipeline_cache) {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    pipeline_cache = VK_NULL_HANDLE;
+
+    // Pipelines may be created from existing pipeline caches concurrently so
+    // data from a binary can't be merged into them.
+    auto it = m_caches.find(module);
+    if (it != m_caches.end()) {
+        pipeline_cache = it->second.cache;
+        return true;
+    }
+
+    module_cache mc = {};
+    std::vector<char> store_data;
+    if (enabled()) {
+        std::ifstream file(store_path(), std::ios::in | std::ios::binary);
+        std::map<cvk_sha1_hash, record> records;
+        uint64_t end;
+        if (file.is_open() && scan_store(file, records, end)) {
+            auto it = records.find(module);
+            if ((it != records.end()) &&
+                read_data(file, it->second, store_data)) {
+                mc.in_store = true;
+                mc.store_checksum = it->second.checksum;
+                mc.store_last_use = it->second.last_use;
+                mc.saved_size = store_data.size();
+            }
+        }
+        if (!mc.in_store) {
+            if (read_legacy_file(module, store_data)) {
+                mc.from_legacy_file = true;
+            } else {
+                store_data.clear();
+            }
+        }
+        if (!store_data.empty()) {
+            CLVK_UNIT_COUNT(pipeline_cache_store_hits);
+        }
+    }
+
+    // Fall back to the data embedded in the binary when the store doesn't
+    // have any
+    const std::vector<char>* initial_data = &store_data;
+    if (store_data.empty()) {
+        initial_data = &binary_data;
+    }
+
+    mc.cache = create_cache(*initial_data);
+    if (mc.cache == VK_NULL_HANDLE) {
+        cvk_error("Could not create pipeline cache.");
+        return false;
+    }
+
+    // The pipeline cache isn't used yet, the data from the binary can be
+    // merged into it
+    if ((initial_data != &binary_data) && !binary_data.empty()) {
+        merge_data(mc.cache, binary_data);
+    }
+
+    m_caches[module] = mc;
+    pipeline_cache = mc.cache;
+
+    return initial_data->size() != 0;
+}
+
+bool cvk_pipeline_cache_store::get_data(VkPipelineCache pipeline_cache,
+                                        std::vector<char>& data) const {
+    size_t size;
+    VkResult res =
+        vkGetPipelineCacheData(m_device, pipeline_cache, &size, nullptr);
+    if (res != VK_SUCCESS) {
+        cvk_error("Failed to retrieve pipeline cache size");
+        return false;
+    }
+    data.resize(size);
+    res = vkGetPipelineCacheData(m_device, pipeline_cache, &size, data.data());
+    if (res != VK_SUCCESS) {
+        cvk_error("Failed to retrieve pipeline cache data");
+        return false;
+    }
+    // The cache may have grown less than what the size query reported
+    data.resize(size);
+    return true;
+}
+
+void cvk_pipeline_cache_store::schedule_save() {
+    if (!enabled()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_writer_lock);
+    if (m_writer == nullptr) {
+        m_writer = std::make_unique<std::thread>(
+            &cvk_pipeline_cache_store::writer, this);
+    }
+    m_save_requested = true;
+    m_writer_cv.notify_one();
+}
+
+void cvk_pipeline_cache_store::writer() {
+    cvk_set_current_thread_name_if_supported("clvk-pcache");
+
+    std::unique_lock<std::mutex> lock(m_writer_lock);
+    while (true) {
+        m_writer_cv.wait(lock,
+                         [this] { return m_shutdown || m_save_requested; });
+        if (!m_shutdown) {
+            m_writer_cv.wait_for(lock, PIPELINE_CACHE_SAVE_DELAY,
+                                 [this] { return m_shutdown; });
+        }
+        bool shutdown = m_shutdown;
+        m_save_requested = false;
+
+        lock.unlock();
+        save();
+        lock.lock();
+
+        if (shutdown) {
+            return;
+        }
+    }
+}
+
+void cvk_pipeline_cache_store::save() {
+    if (!enabled()) {
+        return;
+    }
+
+    // Pipeline caches are never destroyed before the store, they can be used
+    // without holding the lock
+    std::map<cvk_sha1_hash, module_cache> caches;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        caches = m_caches;
+    }
+
+    // Find the pipeline caches that have data the store may not have, and
+    // the modules used by this process whose time of last use is getting
+    // stale so that modules that are always found in the store aren't
+    // evicted first
+    uint64_t now = now_in_seconds();
+    std::vector<entry> updates;
+    std::map<cvk_sha1_hash, size_t> live_sizes;
+    for (auto& mc : caches) {
+        entry e;
+        e.module = mc.first;
+        e.last_use = now;
+        if (!get_data(mc.second.cache, e.data)) {
+            continue;
+        }
+        e.has_data = e.data.size() != mc.second.saved_size;
+        uint64_t last_use = mc.second.store_last_use;
+        if (!e.has_data && (last_use + PIPELINE_CACHE_LAST_USE_PERIOD >= now)) {
+            continue;
+        }
+        live_sizes[mc.first] = e.data.size();
+        updates.push_back(std::move(e));
+    }
+    if (updates.empty()) {
+        return;
+    }
+
+    // Only the records of these modules are read and appended to the store
+    // while holding the lock. The store is only rewritten when it grows
+    // beyond the size limit.
+    {
+        pipeline_cache_store_lock store_lock(lock_path());
+        std::ifstream file(store_path(), std::ios::in | std::ios::binary);
+        std::map<cvk_sha1_hash, record> records;
+        uint64_t end = 0;
+        bool valid = file.is_open() && scan_store(file, records, end);
+
+        std::vector<entry> appended;
+        std::map<cvk_sha1_hash, bool> merged;
+        for (auto& e : updates) {
+            auto& mc = caches.at(e.module);
+            auto it = records.find(e.module);
+            if (it == records.end()) {
+                // The module may have been evicted by another process
+                e.has_data = true;
+            } else if (e.has_data && (!mc.in_store || (it->second.checksum !=
+                                                       mc.store_checksum))) {
+                // Merge the data other processes wrote since this process last
+                // read or wrote the module
+                std::vector<char> data;
+                VkPipelineCache merged_cache = VK_NULL_HANDLE;
+                if (read_data(file, it->second, data)) {
+                    merged_cache = create_cache(data);
+                }
+                if (merged_cache != VK_NULL_HANDLE) {
+                    VkResult res = vkMergePipelineCaches(
+                        m_device, merged_cache, 1, &mc.cache);
+                    if ((res == VK_SUCCESS) && get_data(merged_cache, e.data)) {
+                        merged[e.module] = true;
+                    } else {
+                        cvk_warn("Could not merge pipeline cache data");
+                    }
+                    vkDestroyPipelineCache(m_device, merged_cache, nullptr);
+                }
+            }
+
+            if (e.has_data) {
+                e.checksum = cvk_sha1(e.data.data(), e.data.size());
+                if ((it != records.end()) &&
+                    (it->second.checksum == e.checksum)) {
+                    // The store already has the data
+                    e.has_data = false;
+                }
+            }
+            if (!e.has_data) {
+                e.checksum = it->second.checksum;
+            }
+
+            // The pipeline caches contain all the data of the records that
+            // weren't merged, those don't need to be merged again by later
+            // saves unless other processes update them
+            mc.saved_size = live_sizes.at(e.module);
+            mc.in_store = !merged[e.module];
+            mc.store_checksum = e.checksum;
+            if (!e.has_data &&
+                (it->second.last_use + PIPELINE_CACHE_LAST_USE_PERIOD >= now)) {
+                mc.store_last_use = it->second.last_use;
+                continue;
+            }
+            mc.store_last_use = now;
+            appended.push_back(std::move(e));
+        }
+
+        file.close();
+
+        if (!appended.empty()) {
+            bool written = valid ? append_records(end, appended)
+                                 : write_store(appended);
+            if (!written) {
+                return;
+            }
+            CLVK_UNIT_COUNT(pipeline_cache_store_writes);
+            cvk_info("Appended %zu records to the pipeline cache store",
+                     appended.size());
+
+            std::error_code ec;
+            auto size = fs::file_size(store_path(), ec);
+            if (!ec && (size > m_max_size)) {
+                compact_store(caches);
+            }
+        }
+    }
+
+    // Files written by older versions of clvk are no longer needed once the
+    // store has their data
+    std::error_code ec;
+    for (auto& live : live_sizes) {
+        if (caches.at(live.first).from_legacy_file) {
+            fs::remove(legacy_path(live.first), ec);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto& live : live_sizes) {
+        auto& mc = m_caches.at(live.first);
+        auto& saved = caches.at(live.first);
+        mc.saved_size = saved.saved_size;
+        mc.in_store = saved.in_store;
+        mc.store_checksum = saved.store_checksum;
+        mc.store_last_use = saved.store_last_use;
+        mc.from_legacy_file = false;
+    }
+}
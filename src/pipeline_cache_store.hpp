@@ -0,0 +1,144 @@
+// Copyright 2026 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "sha1.hpp"
+#include "utils.hpp"
+
+// The Vulkan pipeline caches of a device, one per SPIR-V module, and the
+// on-disk store they are saved to.
+//
+// The data of all the pipeline caches of devices that share a pipeline cache
+// UUID is kept in a single file in the cache directory. Records holding the
+// data of a module, or only the time it was last used, are appended to the
+// store in the background shortly after pipelines have been created and when
+// the device is destroyed. The time modules used by a process were last used
+// is refreshed at most once a day. The store can be shared by several
+// processes: updates are serialized with a lock file, the data of each
+// module is merged with the data other processes wrote in the meantime and
+// records are checked against a checksum when they are read. When the store
+// grows beyond the size limit, it is rewritten to a temporary file that is
+// then renamed, without the superseded records and the least recently used
+// modules that don't fit.
+struct cvk_pipeline_cache_store {
+
+    cvk_pipeline_cache_store(VkDevice dev, const std::string& dir,
+                             const std::string& uuid, uint64_t max_size)
+        : m_device(dev), m_dir(dir), m_uuid(uuid), m_max_size(max_size),
+          m_save_requested(false), m_shutdown(false) {}
+
+    ~cvk_pipeline_cache_store();
+
+    // Get the pipeline cache of a SPIR-V module or create it from the data
+    // in the store, falling back to |binary_data|, the data embedded in a
+    // program binary. Returns true if existing data was reused.
+    CHECK_RETURN bool get(const cvk_sha1_hash& module,
+                          const std::vector<char>& binary_data,
+                          VkPipelineCache& pipeline_cache);
+
+    CHECK_RETURN bool get_data(VkPipelineCache pipeline_cache,
+                               std::vector<char>& data) const;
+
+    // Write the store in the background, called when pipelines are created
+    void schedule_save();
+
+private:
+    struct module_cache {
+        VkPipelineCache cache;
+        bool in_store;
+        // Checksum of the data of the module in the store when it was last
+        // read or written by this process
+        cvk_sha1_hash store_checksum;
+        // Time the module was last used according to the store
+        uint64_t store_last_use;
+        size_t saved_size;
+        // The data was read from a file written by older versions of clvk,
+        // removed once the data is in the store
+        bool from_legacy_file;
+    };
+
+    // Last data record of a module in the store
+    struct record {
+        uint64_t last_use;
+        cvk_sha1_hash checksum;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // Record written to the store, that only updates the time the module was
+    // last used when it doesn't have data
+    struct entry {
+        cvk_sha1_hash module;
+        uint64_t last_use;
+        cvk_sha1_hash checksum;
+        bool has_data;
+        std::vector<char> data;
+    };
+
+    bool enabled() const { return !m_dir.empty() && (m_max_size != 0); }
+    std::string store_path() const;
+    std::string lock_path() const;
+    std::string legacy_path(const cvk_sha1_hash& module) const;
+
+    // Read the headers of the records of the store. Returns false when it
+    // isn't a valid store. |end| is set to the end of the last complete
+    // record.
+    bool scan_store(std::ifstream& file,
+                    std::map<cvk_sha1_hash, record>& records,
+                    uint64_t& end) const;
+    bool read_data(std::ifstream& file, const record& rec,
+                   std::vector<char>& data) const;
+    static void write_records(std::ostream& file,
+                              const std::vector<entry>& entries);
+    bool write_store(const std::vector<entry>& entries) const;
+    bool append_records(uint64_t end, const std::vector<entry>& entries) const;
+    void compact_store(
+        const std::map<cvk_sha1_hash, module_cache>& caches) const;
+    bool read_legacy_file(const cvk_sha1_hash& module,
+                          std::vector<char>& data) const;
+
+    VkPipelineCache create_cache(const std::vector<char>& data) const;
+    void merge_data(VkPipelineCache pipeline_cache,
+                    const std::vector<char>& data) const;
+
+    void save();
+    void writer();
+
+    VkDevice m_device;
+    std::string m_dir;
+    std::string m_uuid;
+    uint64_t m_max_size;
+
+    std::mutex m_lock;
+    std::map<cvk_sha1_hash, module_cache> m_caches;
+
+    std::mutex m_writer_lock;
+    std::condition_variable m_writer_cv;
+    bool m_save_requested;
+    bool m_shutdown;
+    std::unique_ptr<std::thread> m_writer;
+};
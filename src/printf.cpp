@@ -245,8 +245,8 @@ void process_printf(char*& data, const printf_descriptor_map_t& descs,
 cl_int cvk_printf(cvk_mem* printf_buffer,
                   const printf_descriptor_map_t& descriptors) {
     CVK_ASSERT(printf_buffer);
-    if (!printf_buffer->map()) {
-        cvk_error("Could not map printf buffer");
+    if (!printf_buffer->is_host_accessible()) {
+        cvk_error("Could not access printf buffer");
         return CL_OUT_OF_RESOURCES;
     }
     char* data = static_cast<char*>(printf_buffer->host_va());
@@ -268,7 +268,5 @@ cl_int cvk_printf(cvk_mem* printf_buffer,
                         bytes_written);
     }
 
-    printf_buffer->unmap();
-
     return CL_SUCCESS;
 }
@@ -27,26 +27,19 @@
 #include "clspv/Sampler.h"
 #include "utils.hpp"
 
-#ifdef CLSPV_ONLINE_COMPILER
-#ifdef ENABLE_SPIRV_IL
-#include "LLVMSPIRVLib.h"
-#include "llvm/Bitcode/BitcodeWriter.h"
-#include "llvm/Support/CommandLine.h" // FIXME(#380) remove
-#include "llvm/Support/raw_ostream.h"
-#endif
-#include "clspv/Compiler.h"
-#endif
-
 #include "spirv-tools/linker.hpp"
 #include "spirv-tools/optimizer.hpp"
 #include "spirv/unified1/NonSemanticClspvReflection.h"
 #include "spirv/unified1/spirv.hpp"
 
+#include "build_service.hpp"
 #include "config.hpp"
 #include "init.hpp"
 #include "log.hpp"
 #include "program.hpp"
+#include "program_cache.hpp"
 #include "tracing.hpp"
+#include "unit.hpp"
 
 struct membuf : public std::streambuf {
     membuf(const unsigned char* begin, const unsigned char* end) {
@@ -760,8 +753,10 @@ enum class spirv_validation_level
     error,
 };
 
+// |validated| is set when the binary was checked and found to be valid
 bool validate_binary(spir_binary const& binary,
-                     spirv_validation_options const& val_options) {
+                     spirv_validation_options const& val_options,
+                     bool* validated) {
     spirv_validation_level level = spirv_validation_level::error;
     if (config.spirv_validation.set) {
         if (config.spirv_validation == 0) {
@@ -778,6 +773,7 @@ bool validate_binary(spir_binary const& binary,
 
     if (binary.validate(val_options)) {
         cvk_info("SPIR-V binary is valid.");
+        *validated = true;
         return true;
     }
 
@@ -792,12 +788,30 @@ bool validate_binary(spir_binary const& binary,
 
 const uint32_t clvk_binary_magic =
     0x6B766C63; // "clvk" in ASCII in little-endian
-const uint32_t clvk_binary_version = 1;
+const uint32_t clvk_binary_version = 2;
+// Binaries written by older versions of clvk that can still be read
+const uint32_t clvk_binary_min_version = 1;
 struct clvk_binary_header {
     uint32_t magic;
     uint32_t version;
     uint32_t binary_type;
 };
+
+// Since version 2, the binary header of executables is followed by this
+// header, the SPIR-V binary (that carries the reflection information) and the
+// data of the pipeline cache of the device identified by
+// |pipeline_cache_uuid|.
+struct clvk_executable_header {
+    uint32_t spirv_size;
+    uint32_t flags;
+    // Hash of the SPIR-V binary the flags apply to
+    cvk_sha1_hash spirv_checksum;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+    uint32_t pipeline_cache_size;
+};
+// The SPIR-V binary passed validation on the device that wrote it. Only
+// informative, applications can forge it along with |spirv_checksum|.
+const uint32_t clvk_executable_flag_validated = 1 << 0;
 #define COPY_WORD(dst, src)                                                    \
     do {                                                                       \
         ((unsigned char*)dst)[0] = ((unsigned char*)(src))[0];                 \
@@ -827,29 +841,81 @@ void cvk_program::write_binary_header(unsigned char* dst) const {
 }
 
 cl_program_binary_type cvk_program::read_binary_header(const unsigned char* src,
-                                                       size_t size) {
+                                                       size_t size,
+                                                       uint32_t* version) {
     struct clvk_binary_header* header = (struct clvk_binary_header*)src;
-    if (size < sizeof(header)) {
+    if (size < sizeof(*header)) {
         return CL_PROGRAM_BINARY_TYPE_NONE;
     }
-    uint32_t magic, version, binary_type;
+    uint32_t magic, binary_type;
     COPY_WORD(&magic, &header->magic);
-    COPY_WORD(&version, &header->version);
+    COPY_WORD(version, &header->version);
     COPY_WORD(&binary_type, &header->binary_type);
     if (magic != clvk_binary_magic) {
         cvk_info_fn("magic not found");
         return CL_PROGRAM_BINARY_TYPE_NONE;
     }
-    if (version != clvk_binary_version) {
+    if ((*version < clvk_binary_min_version) ||
+        (*version > clvk_binary_version)) {
         cvk_warn_fn("wrong version");
         return CL_PROGRAM_BINARY_TYPE_NONE;
     }
     return binary_type;
 }
 
+bool cvk_program::read_executable(const unsigned char* src, size_t size) {
+    clvk_executable_header header;
+    if (size < sizeof(header)) {
+        cvk_error_fn("executable header is truncated");
+        return false;
+    }
+    memcpy(&header, src, sizeof(header));
+    src += sizeof(header);
+    size -= sizeof(header);
+
+    if (static_cast<size_t>(header.spirv_size) + header.pipeline_cache_size >
+        size) {
+        cvk_error_fn("executable is truncated");
+        return false;
+    }
+
+    if (!m_binary.read(src, header.spirv_size)) {
+        return false;
+    }
+
+    // The validation flag is ignored, applications can modify binaries and
+    // their header. Only validations recorded by the device are trusted.
+    src += header.spirv_size;
+
+    std::lock_guard<std::mutex> lock(m_binary_pipeline_cache_lock);
+    memcpy(m_binary_pipeline_cache_uuid.data(), header.pipeline_cache_uuid,
+           VK_UUID_SIZE);
+    m_binary_pipeline_cache_data.assign(src, src + header.pipeline_cache_size);
+    m_binary_pipeline_cache_valid = true;
+
+    return true;
+}
+
+void cvk_program::snapshot_binary_pipeline_cache() const {
+    std::lock_guard<std::mutex> lock(m_binary_pipeline_cache_lock);
+    if (m_binary_pipeline_cache_valid || (m_pipeline_cache == VK_NULL_HANDLE)) {
+        return;
+    }
+
+    auto device = m_context->device();
+    memcpy(m_binary_pipeline_cache_uuid.data(), device->pipeline_cache_uuid(),
+           VK_UUID_SIZE);
+    if (!device->get_pipeline_cache_data(m_pipeline_cache,
+                                         m_binary_pipeline_cache_data)) {
+        m_binary_pipeline_cache_data.clear();
+    }
+    m_binary_pipeline_cache_valid = true;
+}
+
 bool cvk_program::read(const unsigned char* src, size_t size) {
     bool success = false;
-    auto binary_type = read_binary_header(src, size);
+    uint32_t version;
+    auto binary_type = read_binary_header(src, size, &version);
     // if the binary does not have a clvk binary header, let's try to read
     // it first as a llvm ir buffer, then as a vulkan spirv buffer.
     if (binary_type == CL_PROGRAM_BINARY_TYPE_NONE) {
@@ -879,7 +945,11 @@ bool cvk_program::read(const unsigned char* src, size_t size) {
         success = read_llvm_bitcode(src, size);
         break;
     case CL_PROGRAM_BINARY_TYPE_EXECUTABLE:
-        success = m_binary.read(src, size);
+        if (version < 2) {
+            success = m_binary.read(src, size);
+        } else {
+            success = read_executable(src, size);
+        }
         break;
     }
     if (success) {
@@ -897,8 +967,30 @@ bool cvk_program::write(unsigned char* dst) const {
     case CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT:
         memcpy(dst, m_ir.data(), m_ir.size());
         return true;
-    case CL_PROGRAM_BINARY_TYPE_EXECUTABLE:
-        return m_binary.write(dst);
+    case CL_PROGRAM_BINARY_TYPE_EXECUTABLE: {
+        snapshot_binary_pipeline_cache();
+        std::lock_guard<std::mutex> lock(m_binary_pipeline_cache_lock);
+        clvk_executable_header header;
+        header.spirv_size = m_binary.size();
+        header.spirv_checksum = cvk_sha1(
+            m_binary.code().data(), static_cast<uint32_t>(m_binary.size()));
+        header.flags =
+            m_context->device()->spirv_validated(header.spirv_checksum)
+                ? clvk_executable_flag_validated
+                : 0;
+        memcpy(header.pipeline_cache_uuid, m_binary_pipeline_cache_uuid.data(),
+               VK_UUID_SIZE);
+        header.pipeline_cache_size = m_binary_pipeline_cache_data.size();
+        memcpy(dst, &header, sizeof(header));
+        dst += sizeof(header);
+        if (!m_binary.write(dst)) {
+            return false;
+        }
+        dst += m_binary.size();
+        memcpy(dst, m_binary_pipeline_cache_data.data(),
+               m_binary_pipeline_cache_data.size());
+        return true;
+    }
     }
     return false;
 }
@@ -909,8 +1001,12 @@ size_t cvk_program::binary_size() const {
     case CL_PROGRAM_BINARY_TYPE_LIBRARY:
     case CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT:
         return header_size + m_ir.size();
-    case CL_PROGRAM_BINARY_TYPE_EXECUTABLE:
-        return header_size + m_binary.size();
+    case CL_PROGRAM_BINARY_TYPE_EXECUTABLE: {
+        snapshot_binary_pipeline_cache();
+        std::lock_guard<std::mutex> lock(m_binary_pipeline_cache_lock);
+        return header_size + sizeof(clvk_executable_header) + m_binary.size() +
+               m_binary_pipeline_cache_data.size();
+    }
     }
     return 0;
 }
@@ -975,6 +1071,7 @@ std::string cvk_program::prepare_build_options(const cvk_device* device) const {
 #if COMPILER_AVAILABLE
     options += " " + config.clspv_options() + " ";
 #endif
+
     // split options into a vector
     std::istringstream iss(options);
     std::vector<std::string> vector_options;
@@ -1094,6 +1191,121 @@ cl_int cvk_program::parse_user_spec_constants() {
 }
 
 #if COMPILER_AVAILABLE
+
+#ifndef CLSPV_REVISION
+#define CLSPV_REVISION "unknown"
+#endif
+
+#ifndef CLSPV_ONLINE_COMPILER
+// Identifies a compiler binary by its path, size and modification time
+static void append_compiler_binary_identity(std::string& identity,
+                                            const std::string& path) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    auto time = std::filesystem::last_write_time(path, ec);
+    identity += path;
+    identity += ":" + std::to_string(size);
+    identity += ":" + std::to_string(time.time_since_epoch().count()) + ";";
+}
+#endif
+
+// Returns true if the source includes headers, which are not part of the keys
+// of the program cache
+static bool source_uses_headers(const std::string& source,
+                                const std::string& build_options) {
+    std::istringstream options(build_options);
+    std::string option;
+    while (options >> option) {
+        // -I and the -include, -isystem, -iquote... family
+        if ((option.rfind("-I", 0) == 0) || (option.rfind("-i", 0) == 0)) {
+            return true;
+        }
+    }
+
+    // Look for "#include", allowing whitespace after the '#'. Occurrences in
+    // comments or strings are counted too.
+    for (size_t pos = source.find('#'); pos != std::string::npos;
+         pos = source.find('#', pos + 1)) {
+        size_t directive = source.find_first_not_of(" \t", pos + 1);
+        if ((directive != std::string::npos) &&
+            (source.compare(directive, 7, "include") == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cvk_program::can_use_program_cache(const std::string& build_options,
+                                        bool build_from_il) const {
+#ifdef CLSPV_ONLINE_COMPILER
+    // The revision of clspv is the only thing that identifies the compiler
+    if (strcmp(CLSPV_REVISION, "unknown") == 0) {
+        cvk_info("Not using the program cache, the revision of clspv is "
+                 "unknown");
+        return false;
+    }
+#endif
+    if (!build_from_il && source_uses_headers(m_source, build_options)) {
+        cvk_info("Not using the program cache for a program with headers");
+        return false;
+    }
+    return true;
+}
+
+cvk_sha1_hash cvk_program::program_cache_key(const std::string& build_options,
+                                              bool build_from_il) const {
+    std::string data;
+    auto append = [&data](const void* ptr, size_t size) {
+        data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        data.append(reinterpret_cast<const char*>(ptr), size);
+    };
+    auto append_string = [&append](const std::string& str) {
+        append(str.data(), str.size());
+    };
+
+    // Compiler
+    std::string compiler = "clspv " CLSPV_REVISION ";";
+#ifndef CLSPV_ONLINE_COMPILER
+    append_compiler_binary_identity(compiler, config.clspv_path());
+#if ENABLE_SPIRV_IL
+    if (build_from_il) {
+        append_compiler_binary_identity(compiler, config.llvmspirv_bin());
+    }
+#endif
+#endif
+    append_string(compiler);
+
+    // The build options include the options the device adds
+    append_string(build_options);
+
+    // Input
+    if (build_from_il) {
+        append(m_il.data(), m_il.size());
+        std::vector<uint32_t> ids;
+        for (auto& spec_const : m_user_spec_constants) {
+            ids.push_back(spec_const.first);
+        }
+        std::sort(ids.begin(), ids.end());
+        for (auto id : ids) {
+            auto& spec_const = m_user_spec_constants.at(id);
+            append(&id, sizeof(id));
+            append_string(spec_const.type);
+            append(&spec_const.set, sizeof(spec_const.set));
+            if (spec_const.set) {
+                append(&spec_const.data,
+                       std::min<size_t>(spec_const.size,
+                                        sizeof(spec_const.data)));
+            }
+        }
+    } else if (m_source.empty()) {
+        append(m_ir.data(), m_ir.size());
+    } else {
+        append_string(m_source);
+    }
+
+    return cvk_sha1(data.data(), static_cast<uint32_t>(data.size()));
+}
+
 #ifndef CLSPV_ONLINE_COMPILER
 cl_build_status cvk_program::do_build_inner_offline(bool build_to_ir,
                                                     bool build_from_il,
@@ -1274,22 +1486,19 @@ cl_build_status cvk_program::do_build_inner_online(bool build_to_ir,
                    "build_options", TRACE_STRING(build_options.c_str()));
     cvk_info_fn("build_from_il %u - build_to_ir %u", build_from_il,
                 build_to_ir);
+    // clspv and llvm-spirv keep global state in LLVM, the build service
+    // makes sure compilations don't run concurrently in the same process
+    auto build_service = get_or_init_global_state()->build_service();
+    auto priority = (m_operation_callback != nullptr)
+                        ? cvk_build_priority::prewarm
+                        : cvk_build_priority::interactive;
     if (build_from_il) {
 #ifndef ENABLE_SPIRV_IL
         cvk_error_fn("Could not build from il because clvk has been built with "
                      "CLVK_ENABLE_SPIRV_IL=OFF");
         return CL_BUILD_ERROR;
 #else  // ENABLE_SPIRV_IL
-        llvm::LLVMContext llvm_context;
-        llvm::Module* llvm_module;
-        std::string err;
-        auto m_il_start = reinterpret_cast<const unsigned char*>(m_il.data());
-        membuf m_il_buf(m_il_start, m_il_start + m_il.size());
-        std::istream m_il_stream(&m_il_buf);
-        SPIRV::TranslatorOpts translator_opts;
-        // We don't need llvm-spirv to validate extensions for us.
-        translator_opts.enableAllExtensions();
-
+        std::vector<std::pair<uint32_t, uint64_t>> spec_constants;
         for (const auto& spec_const : m_user_spec_constants) {
             if (!spec_const.second.set) {
                 continue;
@@ -1308,75 +1517,53 @@ cl_build_status cvk_program::do_build_inner_online(bool build_to_ir,
                        spec_const.second.type == "f64") {
                 spec_const_value = spec_const.second.data.i64;
             }
-            translator_opts.setSpecConst(spec_const.first, spec_const_value);
+            spec_constants.emplace_back(spec_const.first, spec_const_value);
         }
 
-        // llvm-spirv is based on LLVM. LLVM options parsing is done using
-        // global variable that are not thread safe. Thus, we need to lock call
-        // to llvm-spirv in order to ensure a thread safe execution.
-        {
-            static std::mutex llvmspirv_compile_mutex;
-            std::lock_guard<std::mutex> llvmspirv_compile_lock(
-                llvmspirv_compile_mutex);
-            std::vector<const char*> llvmArgv{
-                "llvm-spirv(online)",
-            };
-            llvm::cl::ResetAllOptionOccurrences();
-            llvm::cl::ParseCommandLineOptions(llvmArgv.size(), llvmArgv.data());
-            if (!llvm::readSpirv(llvm_context, translator_opts, m_il_stream,
-                                 llvm_module, err)) {
-                cvk_error_fn("Fails to load SPIR-V as LLVM Module: %s",
-                             err.c_str());
-                return CL_BUILD_ERROR;
-            }
+        std::string err;
+        if (!build_service->translate_il(m_il, spec_constants, &m_source,
+                                         &err, priority)) {
+            cvk_error_fn("Fails to load SPIR-V as LLVM Module: %s",
+                         err.c_str());
+            return CL_BUILD_ERROR;
         }
-
-        m_source.clear();
-        llvm::raw_string_ostream spirv_stream(m_source);
-        llvm::WriteBitcodeToFile(*llvm_module, spirv_stream);
 #endif // ENABLE_SPIRV_IL
     }
     cvk_info("About to compile \"%s\"", build_options.c_str());
-    int status;
-    // clspv is based on LLVM. LLVM options parsing is done using global
-    // variable that are not thread safe. Thus, we need to lock call to clspv in
-    // order to ensure a thread safe execution.
-    {
-        static std::mutex clspv_compile_mutex;
-        std::lock_guard<std::mutex> clspv_compile_lock(clspv_compile_mutex);
-        std::vector<std::string> programs;
-        if (m_operation == build_operation::link) {
-            for (auto input_program : m_input_programs) {
-                if (input_program->m_binary_type !=
-                        CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT &&
-                    input_program->m_binary_type !=
-                        CL_PROGRAM_BINARY_TYPE_LIBRARY) {
-                    return CL_BUILD_ERROR;
-                }
-                programs.emplace_back(std::string{input_program->m_ir.begin(),
-                                                  input_program->m_ir.end()});
-            }
-        } else {
-            if (m_source.empty() && !m_ir.empty()) {
-                programs.emplace_back(std::string{m_ir.begin(), m_ir.end()});
-            } else {
-                programs.emplace_back(m_source);
+    std::vector<std::string> programs;
+    if (m_operation == build_operation::link) {
+        for (auto input_program : m_input_programs) {
+            if (input_program->m_binary_type !=
+                    CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT &&
+                input_program->m_binary_type !=
+                    CL_PROGRAM_BINARY_TYPE_LIBRARY) {
+                return CL_BUILD_ERROR;
             }
+            programs.emplace_back(std::string{input_program->m_ir.begin(),
+                                              input_program->m_ir.end()});
         }
-        m_build_log.clear();
-        if (build_to_ir) {
-            std::vector<uint32_t> ir;
-            status = clspv::CompileFromSourcesString(programs, build_options,
-                                                     &ir, &m_build_log);
-            m_ir.clear();
-            auto size = ir.size() * sizeof(uint32_t);
-            m_ir.resize(size);
-            memcpy(m_ir.data(), ir.data(), size);
+    } else {
+        if (m_source.empty() && !m_ir.empty()) {
+            programs.emplace_back(std::string{m_ir.begin(), m_ir.end()});
         } else {
-            status = clspv::CompileFromSourcesString(
-                programs, build_options, m_binary.raw_binary(), &m_build_log);
+            programs.emplace_back(m_source);
         }
     }
+    m_build_log.clear();
+    int status;
+    if (build_to_ir) {
+        std::vector<uint32_t> ir;
+        status = build_service->compile(programs, build_options, &ir,
+                                        &m_build_log, priority);
+        m_ir.clear();
+        auto size = ir.size() * sizeof(uint32_t);
+        m_ir.resize(size);
+        memcpy(m_ir.data(), ir.data(), size);
+    } else {
+        status = build_service->compile(programs, build_options,
+                                        m_binary.raw_binary(), &m_build_log,
+                                        priority);
+    }
     if (status != 0) {
         cvk_error_fn("failed to compile the program");
         cvk_debug_fn("%s", m_build_log.c_str());
@@ -1388,6 +1575,58 @@ cl_build_status cvk_program::do_build_inner_online(bool build_to_ir,
 #endif // #ifndef CLSPV_ONLINE_COMPILER
 #endif // #if COMPILER_AVAILABLE
 
+#if COMPILER_AVAILABLE
+// Returns true if the push constants used by each kernel of |code| fit within
+// the limit of |device|
+static bool push_constants_fit(const std::vector<uint32_t>& code,
+                               const cvk_device* device) {
+    spir_binary binary(device->vulkan_spirv_env());
+    binary.use(std::vector<uint32_t>(code));
+    if (!binary.load_descriptor_map()) {
+        return false;
+    }
+
+    uint32_t program_end = 0;
+    for (auto& pc : binary.push_constants()) {
+        program_end = std::max(program_end, pc.second.offset + pc.second.size);
+    }
+
+    auto& image_metadata = binary.image_metadata();
+    auto& sampler_metadata = binary.sampler_metadata();
+    for (auto& kernel : binary.kernels_arguments()) {
+        uint32_t end = program_end;
+        for (auto& arg : kernel.second) {
+            if (arg.is_pod() && !arg.is_pod_buffer()) {
+                end = std::max(end, arg.offset + arg.size);
+            }
+        }
+        auto images = image_metadata.find(kernel.first);
+        if (images != image_metadata.end()) {
+            for (auto& md : images->second) {
+                if (md.second.has_valid_order()) {
+                    end = std::max(end, md.second.order_offset + 4);
+                }
+                if (md.second.has_valid_data_type()) {
+                    end = std::max(end, md.second.data_type_offset + 4);
+                }
+            }
+        }
+        auto samplers = sampler_metadata.find(kernel.first);
+        if (samplers != sampler_metadata.end()) {
+            for (auto& md : samplers->second) {
+                end = std::max(end, md.second + 4);
+            }
+        }
+        if (round_up(end, 4) > device->vulkan_max_push_constants_size()) {
+            cvk_info_fn("push constants of kernel %s need %u bytes",
+                        kernel.first.c_str(), end);
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
 cl_build_status cvk_program::do_build_inner(const cvk_device* device) {
 #if !COMPILER_AVAILABLE
     UNUSED(device);
@@ -1448,14 +1687,59 @@ cl_build_status cvk_program::do_build_inner(const cvk_device* device) {
         }
     }
 
+    // Pass the POD arguments of the kernels as push constants when they all
+    // fit within the device's limit, the program is built again otherwise and
+    // clspv picks the interface of each kernel.
+    bool try_pod_pushconstant =
+        !build_to_ir && config.pod_pushconstant &&
+        device->supports_pod_pushconstant() &&
+        (build_options.find("-pod-ubo") == std::string::npos) &&
+        (build_options.find("-pod-pushconstant") == std::string::npos);
+    auto fallback_build_options = build_options;
+    if (try_pod_pushconstant) {
+        build_options += " -pod-pushconstant ";
+    }
+
+    // Reuse the SPIR-V built for the same inputs by a previous run. The build
+    // options in the key say whether push constants were tried and include
+    // the device's limit, the binary stored is the one that was kept.
+    cvk_program_cache program_cache(
+        config.cache_dir(),
+        static_cast<uint64_t>(config.program_cache_size_mb()) * 1024 * 1024);
+    bool use_program_cache =
+        program_cache.enabled() && (m_operation == build_operation::build) &&
+        !build_to_ir && can_use_program_cache(build_options, build_from_il);
+    cvk_sha1_hash cache_key{};
+    std::vector<uint32_t> cached_spirv;
+    if (use_program_cache) {
+        cache_key = program_cache_key(build_options, build_from_il);
+    }
+
     cl_build_status build_status;
+    if (use_program_cache && program_cache.load(cache_key, cached_spirv)) {
+        m_binary.use(std::move(cached_spirv));
+        build_status = CL_BUILD_SUCCESS;
+    } else {
+        auto build = [&](std::string& options) {
 #ifdef CLSPV_ONLINE_COMPILER
-    build_status =
-        do_build_inner_online(build_to_ir, build_from_il, build_options);
+            return do_build_inner_online(build_to_ir, build_from_il, options);
 #else
-    build_status = do_build_inner_offline(build_to_ir, build_from_il,
-                                          build_options, tmp_folder);
+            return do_build_inner_offline(build_to_ir, build_from_il, options,
+                                          tmp_folder);
 #endif // CLSPV_ONLINE_COMPILER
+        };
+        build_status = build(build_options);
+        if (try_pod_pushconstant &&
+            ((build_status != CL_BUILD_SUCCESS) ||
+             !push_constants_fit(m_binary.code(), device))) {
+            cvk_info("POD arguments not passed as push constants, building "
+                     "again");
+            build_status = build(fallback_build_options);
+        }
+        if ((build_status == CL_BUILD_SUCCESS) && use_program_cache) {
+            program_cache.store(cache_key, m_binary.code());
+        }
+    }
     if (build_status != CL_BUILD_SUCCESS) {
         return build_status;
     }
@@ -1519,6 +1803,7 @@ void cvk_program::do_build() {
 
     // Destroy entry points from previous build
     m_entry_points.clear();
+    save_pipeline_profile();
 
     auto device = m_context->device();
 
@@ -1546,24 +1831,57 @@ void cvk_program::do_build() {
 
     prepare_push_constant_range();
 
-    bool cache_hit =
-        device->get_pipeline_cache(m_binary.code(), m_pipeline_cache);
+    // Executables read from a binary built for this device come with the
+    // data of its pipeline cache and the result of their validation. Both are
+    // ignored when the binary was built for another device.
+    std::vector<char> binary_pipeline_cache_data;
+    bool binary_from_device = false;
+    {
+        std::lock_guard<std::mutex> lock(m_binary_pipeline_cache_lock);
+        if ((m_operation == build_operation::build_binary) &&
+            m_binary_pipeline_cache_valid) {
+            binary_from_device =
+                memcmp(m_binary_pipeline_cache_uuid.data(),
+                       device->pipeline_cache_uuid(), VK_UUID_SIZE) == 0;
+            if (binary_from_device) {
+                binary_pipeline_cache_data =
+                    std::move(m_binary_pipeline_cache_data);
+            } else {
+                cvk_info("binary was built for another device, ignoring its "
+                         "pipeline cache data");
+            }
+        }
+        // Taken again from the pipeline cache when the binary is queried
+        m_binary_pipeline_cache_valid = false;
+        m_binary_pipeline_cache_data.clear();
+    }
+
+    bool cache_hit = device->get_pipeline_cache(
+        m_binary.code(), m_pipeline_cache, binary_pipeline_cache_data);
     if (m_pipeline_cache == VK_NULL_HANDLE) {
         complete_operation(device, CL_BUILD_ERROR);
         return;
     }
 
-    if (!cache_hit) {
-        // Validate
-        // TODO validate with different rules depending on the binary type
-        if (m_binary_type == CL_PROGRAM_BINARY_TYPE_EXECUTABLE) {
+    load_pipeline_profile(device);
+
+    // Validate
+    // TODO validate with different rules depending on the binary type
+    if (!cache_hit && (m_binary_type == CL_PROGRAM_BINARY_TYPE_EXECUTABLE)) {
+        auto sha1 = cvk_sha1(m_binary.code().data(),
+                             static_cast<uint32_t>(m_binary.size()));
+        if (!device->spirv_validated(sha1)) {
             spirv_validation_options validation_options{};
             validation_options.uniform_buffer_std_layout =
                 m_context->device()->supports_ubo_stdlayout();
-            if (!validate_binary(m_binary, validation_options)) {
+            bool validated = false;
+            if (!validate_binary(m_binary, validation_options, &validated)) {
                 complete_operation(device, CL_BUILD_ERROR);
                 return;
             }
+            if (validated) {
+                device->record_validated_spirv(sha1);
+            }
         }
     }
 
@@ -1713,12 +2031,186 @@ cvk_entry_point::cvk_entry_point(cvk_device* dev, cvk_program* program,
       m_name(name), m_pod_descriptor_type(VK_DESCRIPTOR_TYPE_MAX_ENUM),
       m_pod_buffer_size(0u), m_has_pod_arguments(false),
       m_has_pod_buffer_arguments(false), m_sampler_metadata(nullptr),
-      m_image_metadata(nullptr), m_descriptor_pool(VK_NULL_HANDLE),
-      m_pipeline_layout(VK_NULL_HANDLE), m_nb_descriptor_set_allocated(0),
+      m_image_metadata(nullptr), m_current_descriptor_pool(0),
+      m_push_descriptor_set(NO_PUSH_DESCRIPTOR_SET),
+      m_pod_descriptor_index(NO_DESCRIPTOR),
+      m_pipeline_layout(VK_NULL_HANDLE), m_precompile_started(false),
+      m_precompile_cancelled(false), m_num_precompile_jobs(0),
+      m_descriptor_set_cache_hits(0),
+      m_descriptor_set_cache_misses(0), m_nb_descriptor_set_allocated(0),
       m_first_allocation_failure(true) {
     TRACE_CNT_VAR_INIT(descriptor_set_allocated_counter,
                        "clvk-entry_point_" + std::to_string((uintptr_t)this));
+    TRACE_CNT_VAR_INIT(descriptor_set_cache_hits_counter,
+                       "clvk-entry_point_" + std::to_string((uintptr_t)this) +
+                           "-descriptor-set-cache-hits");
+    TRACE_CNT_VAR_INIT(descriptor_set_cache_misses_counter,
+                       "clvk-entry_point_" + std::to_string((uintptr_t)this) +
+                           "-descriptor-set-cache-misses");
+    TRACE_CNT_VAR_INIT(descriptor_pools_counter,
+                       "clvk-entry_point_" + std::to_string((uintptr_t)this) +
+                           "-descriptor-pools");
     TRACE_CNT(descriptor_set_allocated_counter, 0);
+    TRACE_CNT(descriptor_pools_counter, 0);
+    TRACE_CNT(descriptor_set_cache_hits_counter, 0);
+    TRACE_CNT(descriptor_set_cache_misses_counter, 0);
+    m_pipeline_tables.emplace_back(
+        std::make_unique<cvk_pipeline_table>(INITIAL_PIPELINE_TABLE_CAPACITY));
+    m_pipeline_table.store(m_pipeline_tables.back().get());
+    m_context->add_resource_listener(this);
+}
+
+// The profile has a line per pipeline: the name of the kernel followed by
+// the ID and value of each specialization constant.
+void cvk_program::load_pipeline_profile(cvk_device* device) {
+    std::lock_guard<std::mutex> lock(m_pipeline_profile_lock);
+
+    m_pipeline_profile.clear();
+    m_pipeline_profile_dirty = false;
+
+    auto& code = m_binary.code();
+    m_pipeline_profile_path = device->get_pipeline_profile_filename(
+        cvk_sha1(code.data(), code.size() * sizeof(uint32_t)));
+    if (m_pipeline_profile_path.empty()) {
+        return;
+    }
+
+    std::ifstream file(m_pipeline_profile_path);
+    if (!file.is_open()) {
+        return;
+    }
+
+    // Mark the profile as recently used. Failing to do so only makes it more
+    // likely to be evicted.
+    std::error_code ec;
+    std::filesystem::last_write_time(
+        m_pipeline_profile_path, std::filesystem::file_time_type::clock::now(),
+        ec);
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string kernel;
+        if (!(fields >> kernel)) {
+            continue;
+        }
+        cvk_spec_constant_key key;
+        uint32_t id, value;
+        while (fields >> id >> value) {
+            key.set(id, value);
+        }
+        auto& pipelines = m_pipeline_profile[kernel];
+        if (pipelines.size() < MAX_PROFILED_PIPELINES_PER_KERNEL) {
+            pipelines.push_back(key);
+        }
+    }
+    cvk_info("loaded pipeline profile for %zu kernels from %s",
+             m_pipeline_profile.size(), m_pipeline_profile_path.c_str());
+}
+
+// The profile is written to a temporary file that is then renamed so that
+// other processes never read a partial profile. When they save the profile of
+// the same program concurrently, the last one to save it wins.
+static bool
+write_pipeline_profile(const std::string& path,
+                       const cvk_program::pipeline_profile& profile) {
+    std::string tmp_path = cvk_cache_temporary_path(path);
+    std::error_code ec;
+    {
+        std::ofstream file(tmp_path, std::ios::out | std::ios::trunc);
+        if (!file.is_open()) {
+            cvk_warn("Failed to open pipeline profile file for writing: %s",
+                     tmp_path.c_str());
+            return false;
+        }
+        for (auto& kernel : profile) {
+            for (auto& key : kernel.second) {
+                file << kernel.first;
+                for (auto& constant : key) {
+                    file << " " << constant.id << " " << constant.value;
+                }
+                file << "\n";
+            }
+        }
+        file.close();
+        if (!file.good()) {
+            cvk_warn("Failed to write pipeline profile");
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+
+    cvk_evict_cache_files(
+        config.cache_dir, cvk_device::PIPELINE_PROFILE_PREFIX,
+        cvk_device::PIPELINE_PROFILE_SUFFIX,
+        static_cast<uint64_t>(config.pipeline_profiles_size_mb) * 1024 * 1024);
+    return true;
+}
+
+void cvk_program::save_pipeline_profile() {
+    std::unique_lock<std::mutex> lock(m_pipeline_profile_lock);
+    m_pipeline_profile_cv.wait(
+        lock, [this] { return !m_pipeline_profile_save_pending; });
+
+    if (!m_pipeline_profile_dirty || m_pipeline_profile_path.empty()) {
+        return;
+    }
+    if (write_pipeline_profile(m_pipeline_profile_path, m_pipeline_profile)) {
+        m_pipeline_profile_dirty = false;
+    }
+}
+
+// Writes a copy of the profile so that pipelines can be recorded while it is
+// saved
+void cvk_program::save_pipeline_profile_in_background() {
+    std::unique_lock<std::mutex> lock(m_pipeline_profile_lock);
+    auto path = m_pipeline_profile_path;
+    auto profile = m_pipeline_profile;
+    m_pipeline_profile_dirty = false;
+    lock.unlock();
+
+    TRACE_BEGIN("save_pipeline_profile");
+    bool saved = write_pipeline_profile(path, profile);
+    TRACE_END();
+
+    lock.lock();
+    if (!saved) {
+        m_pipeline_profile_dirty = true;
+    }
+    m_pipeline_profile_save_pending = false;
+    m_pipeline_profile_cv.notify_all();
+}
+
+void cvk_program::record_pipeline(const std::string& kernel,
+                                  const cvk_spec_constant_key& key) {
+    std::lock_guard<std::mutex> lock(m_pipeline_profile_lock);
+
+    if (m_pipeline_profile_path.empty()) {
+        return;
+    }
+    auto& pipelines = m_pipeline_profile[kernel];
+    if ((pipelines.size() >= MAX_PROFILED_PIPELINES_PER_KERNEL) ||
+        (std::find(pipelines.begin(), pipelines.end(), key) !=
+         pipelines.end())) {
+        return;
+    }
+    pipelines.push_back(key);
+    m_pipeline_profile_dirty = true;
+
+    // Programs may never be released, save the profile without holding up
+    // the enqueue that created the pipeline. Pipelines recorded before the
+    // save starts are part of it.
+    if (!m_pipeline_profile_save_pending) {
+        m_pipeline_profile_save_pending = true;
+        m_context->device()->pipeline_compiler()->submit(
+            [this] { save_pipeline_profile_in_background(); });
+    }
 }
 
 cvk_entry_point* cvk_program::get_entry_point(std::string& name,
@@ -1748,10 +2240,11 @@ cvk_entry_point* cvk_program::get_entry_point(std::string& name,
 }
 
 bool cvk_entry_point::build_descriptor_set_layout(
-    const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+    const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+    VkDescriptorSetLayoutCreateFlags flags) {
     VkDescriptorSetLayoutCreateInfo createInfo = {
         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO, nullptr,
-        0,                                      // flags
+        flags,                                  // flags
         static_cast<uint32_t>(bindings.size()), // bindingCount
         bindings.data()                         // pBindings
     };
@@ -1771,6 +2264,27 @@ bool cvk_entry_point::build_descriptor_set_layout(
     return true;
 }
 
+uint32_t cvk_entry_point::add_descriptor(uint32_t set, uint32_t binding,
+                                         VkDescriptorType type) {
+    uint32_t index = m_descriptor_info.size();
+    m_descriptor_info.push_back({});
+
+    if (m_descriptor_update_entries.size() <= set) {
+        m_descriptor_update_entries.resize(set + 1);
+    }
+    VkDescriptorUpdateTemplateEntry entry = {
+        binding,                             // dstBinding
+        0,                                   // dstArrayElement
+        1,                                   // descriptorCount
+        type,                                // descriptorType
+        index * sizeof(cvk_descriptor_info), // offset
+        sizeof(cvk_descriptor_info)          // stride
+    };
+    m_descriptor_update_entries[set].push_back(entry);
+
+    return index;
+}
+
 bool cvk_entry_point::build_descriptor_sets_layout_bindings_for_arguments(
     binding_stat_map& smap, uint32_t& num_resource_slots) {
     bool pod_found = false;
@@ -1778,6 +2292,7 @@ bool cvk_entry_point::build_descriptor_sets_layout_bindings_for_arguments(
     uint32_t highest_binding = 0;
 
     std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+    std::vector<const kernel_argument*> layoutArgs;
     for (auto& arg : m_args) {
         VkDescriptorType dt = VK_DESCRIPTOR_TYPE_MAX_ENUM;
 
@@ -1809,11 +2324,13 @@ bool cvk_entry_point::build_descriptor_sets_layout_bindings_for_arguments(
         case kernel_argument_kind::pod_ubo:
         case kernel_argument_kind::pointer_ubo:
             if (!pod_found) {
+                // POD arguments are written to a ring buffer, their offset
+                // is only known when the descriptor sets are bound.
                 if (arg.kind == kernel_argument_kind::pod) {
-                    dt = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    dt = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
                 } else if (arg.kind == kernel_argument_kind::pod_ubo ||
                            arg.kind == kernel_argument_kind::pointer_ubo) {
-                    dt = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                    dt = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
                 }
 
                 m_pod_descriptor_type = dt;
@@ -1840,12 +2357,56 @@ bool cvk_entry_point::build_descriptor_sets_layout_bindings_for_arguments(
         highest_binding = std::max(arg.binding, highest_binding);
 
         layoutBindings.push_back(binding);
-        smap[binding.descriptorType]++;
+        layoutArgs.push_back(&arg);
     }
 
     num_resource_slots = highest_binding + 1;
 
-    if (!build_descriptor_set_layout(layoutBindings)) {
+    // Push the descriptors for the arguments to command buffers when
+    // possible so that they don't need to be allocated from the pool.
+    // Push descriptors can't be dynamic, the offset of the POD arguments is
+    // then written in the descriptor instead.
+    VkDescriptorSetLayoutCreateFlags flags = 0;
+    if (config.push_descriptors && m_device->supports_push_descriptors() &&
+        (layoutBindings.size() > 0) &&
+        (layoutBindings.size() <= m_device->max_push_descriptors())) {
+        for (auto& binding : layoutBindings) {
+            if (binding.descriptorType ==
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC) {
+                binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            } else if (binding.descriptorType ==
+                       VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC) {
+                binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            }
+        }
+        if (m_pod_descriptor_type ==
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC) {
+            m_pod_descriptor_type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        } else if (m_pod_descriptor_type ==
+                   VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC) {
+            m_pod_descriptor_type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        }
+        m_push_descriptor_set = m_descriptor_set_layouts.size();
+        flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+    } else {
+        for (auto& binding : layoutBindings) {
+            smap[binding.descriptorType]++;
+        }
+    }
+
+    uint32_t set = m_descriptor_set_layouts.size();
+    m_arg_descriptor_indices.assign(m_args.size(), NO_DESCRIPTOR);
+    for (size_t i = 0; i < layoutBindings.size(); i++) {
+        auto index = add_descriptor(set, layoutBindings[i].binding,
+                                    layoutBindings[i].descriptorType);
+        if (layoutArgs[i]->is_pod()) {
+            m_pod_descriptor_index = index;
+        } else {
+            m_arg_descriptor_indices[layoutArgs[i]->pos] = index;
+        }
+    }
+
+    if (!build_descriptor_set_layout(layoutBindings, flags)) {
         return false;
     }
 
@@ -1857,7 +2418,10 @@ bool cvk_entry_point::
         binding_stat_map& smap) {
 
     std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
-    for (auto& desc : m_program->literal_sampler_descs()) {
+    uint32_t set = m_descriptor_set_layouts.size();
+    auto& descs = m_program->literal_sampler_descs();
+    for (size_t i = 0; i < descs.size(); i++) {
+        auto& desc = descs[i];
         VkDescriptorSetLayoutBinding binding = {
             desc.binding,                // binding
             VK_DESCRIPTOR_TYPE_SAMPLER,  // descriptorType
@@ -1867,6 +2431,15 @@ bool cvk_entry_point::
         };
         layoutBindings.push_back(binding);
         smap[binding.descriptorType]++;
+
+        auto clsampler = icd_downcast(m_program->literal_samplers()[i]);
+        auto index =
+            add_descriptor(set, desc.binding, VK_DESCRIPTOR_TYPE_SAMPLER);
+        m_descriptor_info[index].image = {
+            clsampler->vulkan_sampler(),
+            VK_NULL_HANDLE,           // imageView
+            VK_IMAGE_LAYOUT_UNDEFINED // imageLayout
+        };
     }
 
     if (!build_descriptor_set_layout(layoutBindings)) {
@@ -1897,6 +2470,14 @@ bool cvk_entry_point::
         };
         layoutBindings.push_back(binding);
         smap[binding.descriptorType]++;
+
+        auto buffer = m_program->module_constant_data_buffer();
+        auto index = add_descriptor(m_descriptor_set_layouts.size(),
+                                    info->binding,
+                                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        m_descriptor_info[index].buffer = {buffer->vulkan_buffer(),
+                                           0, // offset
+                                           VK_WHOLE_SIZE};
     }
 
     if (!build_descriptor_set_layout(layoutBindings)) {
@@ -2117,33 +2698,24 @@ cl_int cvk_entry_point::init() {
         return CL_INVALID_VALUE;
     }
 
+    if (!create_descriptor_update_templates()) {
+        return CL_INVALID_VALUE;
+    }
+
     // Determine number and types of bindings
-    std::vector<VkDescriptorPoolSize> poolSizes(bindingTypes.size());
+    m_descriptor_pool_sizes.resize(bindingTypes.size());
 
     int bidx = 0;
     for (auto& bt : bindingTypes) {
-        poolSizes[bidx].type = bt.first;
-        poolSizes[bidx].descriptorCount = bt.second * MAX_INSTANCES;
+        m_descriptor_pool_sizes[bidx].type = bt.first;
+        m_descriptor_pool_sizes[bidx].descriptorCount =
+            bt.second * MAX_INSTANCES;
         bidx++;
     }
 
-    // Create descriptor pool
-    if (poolSizes.size() > 0) {
-        VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
-            VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-            nullptr,
-            VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT, // flags
-            MAX_INSTANCES * spir_binary::MAX_DESCRIPTOR_SETS,  // maxSets
-            static_cast<uint32_t>(poolSizes.size()),           // poolSizeCount
-            poolSizes.data(),                                  // pPoolSizes
-        };
-
-        res = vkCreateDescriptorPool(m_device->vulkan_device(),
-                                     &descriptorPoolCreateInfo, 0,
-                                     &m_descriptor_pool);
-
-        if (res != VK_SUCCESS) {
-            cvk_error("Could not create descriptor pool.");
+    // Create the first descriptor pool, more are created when needed
+    if (m_descriptor_pool_sizes.size() > 0) {
+        if (create_descriptor_pool() == nullptr) {
             return CL_INVALID_VALUE;
         }
     }
@@ -2151,25 +2723,280 @@ cl_int cvk_entry_point::init() {
     return CL_SUCCESS;
 }
 
-VkPipeline
-cvk_entry_point::create_pipeline(const cvk_spec_constant_map& spec_constants) {
-    std::lock_guard<std::mutex> lock(m_pipeline_cache_lock);
+cvk_descriptor_pool* cvk_entry_point::create_descriptor_pool() {
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        nullptr,
+        VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT, // flags
+        MAX_INSTANCES * spir_binary::MAX_DESCRIPTOR_SETS,  // maxSets
+        static_cast<uint32_t>(
+            m_descriptor_pool_sizes.size()), // poolSizeCount
+        m_descriptor_pool_sizes.data(),      // pPoolSizes
+    };
+
+    VkDescriptorPool pool;
+    auto res = vkCreateDescriptorPool(m_device->vulkan_device(),
+                                      &descriptorPoolCreateInfo, 0, &pool);
+    if (res != VK_SUCCESS) {
+        cvk_error("Could not create descriptor pool: %s",
+                  vulkan_error_string(res));
+        return nullptr;
+    }
+
+    m_descriptor_pools.emplace_back(new cvk_descriptor_pool{pool, 0});
+    CLVK_UNIT_COUNT(descriptor_pools_created);
+    TRACE_CNT(descriptor_pools_counter, m_descriptor_pools.size());
+    cvk_debug_fn("kernel %s now has %zu descriptor pools", m_name.c_str(),
+                 m_descriptor_pools.size());
+
+    return m_descriptor_pools.back().get();
+}
+
+const cvk_pipeline_entry*
+cvk_entry_point::get_pipeline(const cvk_spec_constant_key& spec_constants) {
+    uint64_t hash = spec_constants.hash();
 
     // Check for a cached pipeline using the same specialization constants
-    if (m_pipelines.count(spec_constants)) {
-        VkPipeline pipeline = m_pipelines.at(spec_constants);
-        cvk_info("reusing pipeline %p for kernel %s", pipeline, m_name.c_str());
-        return pipeline;
+    if (auto entry = m_pipeline_table.load(std::memory_order_acquire)
+                         ->find(spec_constants, hash)) {
+        return entry;
+    }
+
+    std::unique_lock<std::mutex> lock(m_pipeline_cache_lock);
+
+    // Another thread may have created the pipeline in the meantime or be
+    // creating it, in the background or for another enqueue
+    while (true) {
+        auto table = m_pipeline_table.load(std::memory_order_relaxed);
+        if (auto entry = table->find(spec_constants, hash)) {
+            cvk_info("reusing pipeline %p for kernel %s",
+                     entry->pipeline.load(), m_name.c_str());
+            return entry;
+        }
+        if (std::find(m_pending_pipelines.begin(), m_pending_pipelines.end(),
+                      spec_constants) == m_pending_pipelines.end()) {
+            break;
+        }
+        TRACE_BEGIN("wait_for_pipeline");
+        m_pipeline_cv.wait(lock);
+        TRACE_END();
+    }
+
+    // Create the pipeline without holding the lock so that pipelines with
+    // other constants can be looked up and created in the meantime
+    m_pending_pipelines.push_back(spec_constants);
+    lock.unlock();
+    VkPipeline pipeline = create_pipeline(spec_constants);
+    lock.lock();
+
+    auto entry = publish_pipeline(spec_constants, hash, pipeline);
+    lock.unlock();
+    if (entry != nullptr) {
+        m_program->record_pipeline(m_name, spec_constants);
+    }
+    return entry;
+}
+
+const cvk_pipeline_entry*
+cvk_entry_point::publish_pipeline(const cvk_spec_constant_key& key,
+                                  uint64_t hash, VkPipeline pipeline) {
+    auto pending = std::find(m_pending_pipelines.begin(),
+                             m_pending_pipelines.end(), key);
+    CVK_ASSERT(pending != m_pending_pipelines.end());
+    m_pending_pipelines.erase(pending);
+    m_pipeline_cv.notify_all();
+
+    if (pipeline == VK_NULL_HANDLE) {
+        return nullptr;
+    }
+
+    auto table = m_pipeline_table.load(std::memory_order_relaxed);
+    auto entry = table->insert(key, hash, pipeline);
+    if (entry == nullptr) {
+        // Readers may still be searching the current table, copy its entries
+        // to a larger one and publish that instead
+        auto grown =
+            std::make_unique<cvk_pipeline_table>(table->capacity() * 2);
+        for (uint32_t i = 0; i < table->capacity(); i++) {
+            auto& old = table->entry(i);
+            auto p = old.pipeline.load(std::memory_order_relaxed);
+            if (p != VK_NULL_HANDLE) {
+                auto copied = grown->insert(old.key, old.hash, p);
+                CVK_ASSERT(copied != nullptr);
+                UNUSED(copied);
+            }
+        }
+        entry = grown->insert(key, hash, pipeline);
+        CVK_ASSERT(entry != nullptr);
+        m_pipeline_table.store(grown.get(), std::memory_order_release);
+        m_pipeline_tables.emplace_back(std::move(grown));
+        cvk_debug_fn("grew pipeline table of kernel %s to %u entries",
+                     m_name.c_str(), m_pipeline_table.load()->capacity());
+    }
+
+    return entry;
+}
+
+void cvk_entry_point::fill_spec_constant_key(
+    cvk_spec_constant_key& key, const std::array<uint32_t, 3>& lws,
+    uint32_t dims, const std::array<uint32_t, 3>& offset) const {
+    auto& constants = m_program->spec_constants();
+    // TODO: if all kernels in the module use the same reqd_workgroup_size ,
+    // clspv will not generate specialization constants for workgroup size, but
+    // these values should be error checked.
+    uint32_t wgsize_x_id = 0;
+    auto where = constants.find(spec_constant::workgroup_size_x);
+    if (where != constants.end()) {
+        wgsize_x_id = where->second;
+    }
+    uint32_t wgsize_y_id = 1;
+    where = constants.find(spec_constant::workgroup_size_y);
+    if (where != constants.end()) {
+        wgsize_y_id = where->second;
+    }
+    uint32_t wgsize_z_id = 2;
+    where = constants.find(spec_constant::workgroup_size_z);
+    if (where != constants.end()) {
+        wgsize_z_id = where->second;
+    }
+
+    key.set(wgsize_x_id, lws[0]);
+    key.set(wgsize_y_id, lws[1]);
+    key.set(wgsize_z_id, lws[2]);
+
+    // Clspv allocates a spec constant for work dimensions if get_work_dim() is
+    // used.
+    where = constants.find(spec_constant::work_dim);
+    if (where != constants.end()) {
+        key.set(where->second, dims);
+    }
+
+    where = constants.find(spec_constant::subgroup_max_size);
+    if (where != constants.end()) {
+        key.set(where->second, m_device->sub_group_size());
+    }
+
+    // Clspv can allocate spec constants for global offset.
+    where = constants.find(spec_constant::global_offset_x);
+    if (where != constants.end()) {
+        key.set(where->second, offset[0]);
+    }
+    where = constants.find(spec_constant::global_offset_y);
+    if (where != constants.end()) {
+        key.set(where->second, offset[1]);
+    }
+    where = constants.find(spec_constant::global_offset_z);
+    if (where != constants.end()) {
+        key.set(where->second, offset[2]);
+    }
+}
+
+void cvk_entry_point::precompile_pipelines() {
+    if (!config.precompile_pipelines()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_pipeline_cache_lock);
+        if (m_precompile_started) {
+            return;
+        }
+        m_precompile_started = true;
+    }
+
+    // Pipelines used in previous runs come first
+    auto keys = m_program->profiled_pipelines(m_name);
+
+    // The size of local arguments is part of the constants and can't be
+    // guessed
+    bool has_local_args = std::any_of(
+        m_args.begin(), m_args.end(), [](const kernel_argument& arg) {
+            return arg.kind == kernel_argument_kind::local;
+        });
+    if (!has_local_args) {
+        std::array<uint32_t, 3> offset = {0, 0, 0};
+        auto& reqd = m_program->required_work_group_size(m_name);
+        if (reqd[0] != 0) {
+            uint32_t dims = (reqd[2] > 1) ? 3 : (reqd[1] > 1) ? 2 : 1;
+            cvk_spec_constant_key key;
+            fill_spec_constant_key(key, reqd, dims, offset);
+            keys.push_back(key);
+        } else {
+            // Work-group sizes picked for large power-of-two NDRanges when the
+            // application lets the implementation choose
+            static const std::array<uint32_t, 3> global_sizes[] = {
+                {1024 * 1024, 1, 1},
+                {1024, 1024, 1},
+                {256, 256, 16},
+            };
+            for (uint32_t i = 0; i < 3; i++) {
+                std::array<uint32_t, 3> lws;
+                m_device->select_work_group_size(global_sizes[i], lws);
+                cvk_spec_constant_key key;
+                fill_spec_constant_key(key, lws, i + 1, offset);
+                keys.push_back(key);
+            }
+        }
+    }
+
+    auto compiler = m_device->pipeline_compiler();
+    std::vector<cvk_spec_constant_key> submitted;
+    for (auto& key : keys) {
+        if (std::find(submitted.begin(), submitted.end(), key) !=
+            submitted.end()) {
+            continue;
+        }
+        submitted.push_back(key);
+        {
+            std::lock_guard<std::mutex> lock(m_pipeline_cache_lock);
+            m_num_precompile_jobs++;
+        }
+        CLVK_UNIT_COUNT(precompile_jobs_submitted);
+        compiler->submit([this, key] { precompile_pipeline(key); });
     }
+    cvk_info("precompiling %zu pipelines for kernel %s", submitted.size(),
+             m_name.c_str());
+}
+
+void cvk_entry_point::precompile_pipeline(const cvk_spec_constant_key& key) {
+    uint64_t hash = key.hash();
+    std::unique_lock<std::mutex> lock(m_pipeline_cache_lock);
+
+    if (!m_precompile_cancelled &&
+        (m_pipeline_table.load(std::memory_order_relaxed)->find(key, hash) ==
+         nullptr) &&
+        (std::find(m_pending_pipelines.begin(), m_pending_pipelines.end(),
+                   key) == m_pending_pipelines.end())) {
+        m_pending_pipelines.push_back(key);
+        lock.unlock();
+        TRACE_BEGIN("precompile_pipeline");
+        VkPipeline pipeline = create_pipeline(key);
+        TRACE_END();
+        lock.lock();
+        publish_pipeline(key, hash, pipeline);
+    }
+
+    CLVK_UNIT_COUNT(precompile_jobs_finished);
+    m_num_precompile_jobs--;
+    m_pipeline_cv.notify_all();
+}
 
+void cvk_entry_point::cancel_precompiled_pipelines() {
+    std::unique_lock<std::mutex> lock(m_pipeline_cache_lock);
+    m_precompile_cancelled = true;
+    m_pipeline_cv.wait(lock, [this] { return m_num_precompile_jobs == 0; });
+}
+
+VkPipeline
+cvk_entry_point::create_pipeline(const cvk_spec_constant_key& spec_constants) {
     std::vector<VkSpecializationMapEntry> mapEntries;
     std::vector<uint32_t> specConstantData;
     uint32_t constantDataOffset = 0;
     for (auto& spec_const : spec_constants) {
-        VkSpecializationMapEntry entry = {spec_const.first, constantDataOffset,
+        VkSpecializationMapEntry entry = {spec_const.id, constantDataOffset,
                                           sizeof(uint32_t)};
         mapEntries.push_back(entry);
-        specConstantData.push_back(spec_const.second);
+        specConstantData.push_back(spec_const.value);
         constantDataOffset += sizeof(uint32_t);
     }
 
@@ -2233,42 +3060,380 @@ cvk_entry_point::create_pipeline(const cvk_spec_constant_map& spec_constants) {
         return VK_NULL_HANDLE;
     }
 
-    // Add to pipeline cache
-    m_pipelines[spec_constants] = pipeline;
-
     cvk_info("created pipeline %p for kernel %s", pipeline, m_name.c_str());
+    CLVK_UNIT_COUNT(pipelines_created);
+    m_device->pipeline_cache_updated();
 
     return pipeline;
 }
 
-bool cvk_entry_point::allocate_descriptor_sets(VkDescriptorSet* ds) {
-    TRACE_FUNCTION();
+bool cvk_entry_point::create_descriptor_update_templates() {
+    m_descriptor_update_entries.resize(m_descriptor_set_layouts.size());
+    m_descriptor_update_templates.assign(m_descriptor_set_layouts.size(),
+                                         VK_NULL_HANDLE);
 
-    if (m_descriptor_set_layouts.size() == 0) {
+    // Descriptors are written one by one without templates
+    if (!m_device->supports_descriptor_update_templates()) {
         return true;
     }
 
-    std::lock_guard<std::mutex> lock(m_descriptor_pool_lock);
+    auto& vkfns = m_device->vkfns();
+    for (uint32_t set = 0; set < m_descriptor_set_layouts.size(); set++) {
+        auto& entries = m_descriptor_update_entries[set];
+        if (entries.empty()) {
+            continue;
+        }
+
+        bool push = set == m_push_descriptor_set;
+        if (push && (vkfns.vkCmdPushDescriptorSetWithTemplateKHR == nullptr)) {
+            continue;
+        }
+
+        VkDescriptorUpdateTemplateCreateInfo createInfo = {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+            nullptr,
+            0,                                     // flags
+            static_cast<uint32_t>(entries.size()), // descriptorUpdateEntryCount
+            entries.data(),                        // pDescriptorUpdateEntries
+            push ? VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR
+                 : VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+            m_descriptor_set_layouts[set],  // descriptorSetLayout
+            VK_PIPELINE_BIND_POINT_COMPUTE, // pipelineBindPoint
+            m_pipeline_layout,              // pipelineLayout
+            set,                            // set
+        };
+
+        auto res = vkfns.vkCreateDescriptorUpdateTemplateKHR(
+            m_device->vulkan_device(), &createInfo, nullptr,
+            &m_descriptor_update_templates[set]);
+        if (res != VK_SUCCESS) {
+            cvk_error("Could not create descriptor update template: %s",
+                      vulkan_error_string(res));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void cvk_entry_point::build_descriptor_writes(
+    uint32_t set, VkDescriptorSet ds, const cvk_descriptor_info* info,
+    std::vector<VkWriteDescriptorSet>& writes) {
+    for (auto& entry : m_descriptor_update_entries[set]) {
+        auto& desc = info[entry.offset / sizeof(cvk_descriptor_info)];
+        VkWriteDescriptorSet write = {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            nullptr,
+            ds,
+            entry.dstBinding,
+            entry.dstArrayElement,
+            entry.descriptorCount,
+            entry.descriptorType,
+            nullptr, // pImageInfo
+            nullptr, // pBufferInfo
+            nullptr, // pTexelBufferView
+        };
+        switch (entry.descriptorType) {
+        case VK_DESCRIPTOR_TYPE_SAMPLER:
+        case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+        case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+            write.pImageInfo = &desc.image;
+            break;
+        case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+        case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+            write.pTexelBufferView = &desc.buffer_view;
+            break;
+        default:
+            write.pBufferInfo = &desc.buffer;
+            break;
+        }
+        writes.push_back(write);
+    }
+}
+
+void cvk_entry_point::write_descriptor_set(VkDescriptorSet ds, uint32_t set,
+                                           const cvk_descriptor_info* info) {
+    TRACE_FUNCTION();
+
+    if (m_descriptor_update_entries[set].empty()) {
+        return;
+    }
+
+    auto update_template = m_descriptor_update_templates[set];
+    if (update_template != VK_NULL_HANDLE) {
+        m_device->vkfns().vkUpdateDescriptorSetWithTemplateKHR(
+            m_device->vulkan_device(), ds, update_template, info);
+        return;
+    }
+
+    std::vector<VkWriteDescriptorSet> writes;
+    build_descriptor_writes(set, ds, info, writes);
+    vkUpdateDescriptorSets(m_device->vulkan_device(),
+                           static_cast<uint32_t>(writes.size()), writes.data(),
+                           0, nullptr);
+}
+
+void cvk_entry_point::push_descriptors(
+    VkCommandBuffer command_buffer, const cvk_descriptor_info* info,
+    const VkDescriptorBufferInfo* pod_descriptor) {
+    uint32_t set = m_push_descriptor_set;
+    auto& vkfns = m_device->vkfns();
+
+    // Index of the POD descriptor in the writes of the set
+    uint32_t pod_write = NO_DESCRIPTOR;
+    auto& entries = m_descriptor_update_entries[set];
+    if (pod_descriptor != nullptr) {
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            if (entries[i].offset / sizeof(cvk_descriptor_info) ==
+                m_pod_descriptor_index) {
+                pod_write = i;
+                break;
+            }
+        }
+        CVK_ASSERT(pod_write != NO_DESCRIPTOR);
+    }
+
+    auto update_template = m_descriptor_update_templates[set];
+    if (update_template != VK_NULL_HANDLE) {
+        vkfns.vkCmdPushDescriptorSetWithTemplateKHR(
+            command_buffer, update_template, m_pipeline_layout, set, info);
+        if (pod_write == NO_DESCRIPTOR) {
+            return;
+        }
+        // Push descriptor updates only replace the bindings they write
+        auto& entry = entries[pod_write];
+        VkWriteDescriptorSet write = {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            nullptr,
+            VK_NULL_HANDLE,
+            entry.dstBinding,
+            entry.dstArrayElement,
+            entry.descriptorCount,
+            entry.descriptorType,
+            nullptr,        // pImageInfo
+            pod_descriptor, // pBufferInfo
+            nullptr,        // pTexelBufferView
+        };
+        vkfns.vkCmdPushDescriptorSetKHR(command_buffer,
+                                        VK_PIPELINE_BIND_POINT_COMPUTE,
+                                        m_pipeline_layout, set, 1, &write);
+        return;
+    }
+
+    std::vector<VkWriteDescriptorSet> writes;
+    build_descriptor_writes(set, VK_NULL_HANDLE, info, writes);
+    if (pod_write != NO_DESCRIPTOR) {
+        writes[pod_write].pBufferInfo = pod_descriptor;
+    }
+    vkfns.vkCmdPushDescriptorSetKHR(command_buffer,
+                                    VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    m_pipeline_layout, set,
+                                    static_cast<uint32_t>(writes.size()),
+                                    writes.data());
+}
 
+VkResult cvk_entry_point::allocate_descriptor_sets(
+    cvk_descriptor_pool* pool, const std::vector<VkDescriptorSetLayout>& layouts,
+    VkDescriptorSet* ds) {
 #if CLVK_UNIT_TESTING_ENABLED
     if (config.force_descriptor_set_allocation_failure() &&
-        m_nb_descriptor_set_allocated + m_descriptor_set_layouts.size() >
-            config.max_entry_points_instances()) {
-        return false;
+        pool->num_sets + layouts.size() > config.max_entry_points_instances()) {
+        return VK_ERROR_OUT_OF_POOL_MEMORY;
     }
 #endif
 
     VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO, nullptr,
-        m_descriptor_pool,
-        static_cast<uint32_t>(
-            m_descriptor_set_layouts.size()), // descriptorSetCount
-        m_descriptor_set_layouts.data()};
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO, nullptr, pool->pool,
+        static_cast<uint32_t>(layouts.size()), // descriptorSetCount
+        layouts.data()};
 
     VkResult res = vkAllocateDescriptorSets(m_device->vulkan_device(),
                                             &descriptorSetAllocateInfo, ds);
+    if (res == VK_SUCCESS) {
+        pool->num_sets += layouts.size();
+    }
 
-    if (res != VK_SUCCESS) {
+    return res;
+}
+
+VkResult cvk_entry_point::allocate_descriptor_sets(cvk_descriptor_sets& sets) {
+    TRACE_FUNCTION();
+
+    if (!uses_descriptor_pool()) {
+        return VK_SUCCESS;
+    }
+
+    // The push descriptor set is never allocated
+    std::vector<VkDescriptorSetLayout> layouts;
+    for (uint32_t i = 0; i < m_descriptor_set_layouts.size(); i++) {
+        if (i != m_push_descriptor_set) {
+            layouts.push_back(m_descriptor_set_layouts[i]);
+        }
+    }
+
+    // Try all the pools, starting with the one used last, before growing
+    // the chain
+    std::array<VkDescriptorSet, spir_binary::MAX_DESCRIPTOR_SETS> allocated;
+    cvk_descriptor_pool* pool = nullptr;
+    VkResult res = VK_ERROR_OUT_OF_POOL_MEMORY;
+    size_t num_pools = m_descriptor_pools.size();
+    for (size_t i = 0; i < num_pools; i++) {
+        size_t idx = (m_current_descriptor_pool + i) % num_pools;
+        res = allocate_descriptor_sets(m_descriptor_pools[idx].get(), layouts,
+                                       allocated.data());
+        if (res == VK_SUCCESS) {
+            pool = m_descriptor_pools[idx].get();
+            m_current_descriptor_pool = idx;
+            break;
+        }
+        if ((res != VK_ERROR_OUT_OF_POOL_MEMORY) &&
+            (res != VK_ERROR_FRAGMENTED_POOL)) {
+            return res;
+        }
+    }
+
+    if ((pool == nullptr) && ((config.max_descriptor_pools == 0) ||
+                              (num_pools < config.max_descriptor_pools))) {
+        pool = create_descriptor_pool();
+        if (pool == nullptr) {
+            return VK_ERROR_OUT_OF_POOL_MEMORY;
+        }
+        m_current_descriptor_pool = m_descriptor_pools.size() - 1;
+        res = allocate_descriptor_sets(pool, layouts, allocated.data());
+        if (res != VK_SUCCESS) {
+            return res;
+        }
+    }
+
+    if (pool == nullptr) {
+        return res;
+    }
+
+    uint32_t idx = 0;
+    for (uint32_t i = 0; i < m_descriptor_set_layouts.size(); i++) {
+        sets.sets[i] =
+            (i == m_push_descriptor_set) ? VK_NULL_HANDLE : allocated[idx++];
+    }
+    sets.pool = pool;
+    m_nb_descriptor_set_allocated += layouts.size();
+    TRACE_CNT(descriptor_set_allocated_counter, m_nb_descriptor_set_allocated);
+
+    return VK_SUCCESS;
+}
+
+void cvk_entry_point::free_descriptor_sets(cvk_descriptor_sets& sets) {
+    TRACE_FUNCTION();
+
+    if (!uses_descriptor_pool()) {
+        return;
+    }
+
+    std::vector<VkDescriptorSet> allocated;
+    for (uint32_t i = 0; i < m_descriptor_set_layouts.size(); i++) {
+        if (i != m_push_descriptor_set) {
+            allocated.push_back(sets.sets[i]);
+        }
+    }
+
+    auto pool = sets.pool;
+    pool->num_sets -= allocated.size();
+    m_nb_descriptor_set_allocated -= allocated.size();
+    TRACE_CNT(descriptor_set_allocated_counter, m_nb_descriptor_set_allocated);
+
+    if (pool->num_sets != 0) {
+        vkFreeDescriptorSets(m_device->vulkan_device(), pool->pool,
+                             static_cast<uint32_t>(allocated.size()),
+                             allocated.data());
+        return;
+    }
+
+    // Recycle pools once all their sets have been released. Resetting a pool
+    // also gets rid of its fragmentation. Only one empty pool is kept around
+    // besides the current one.
+    vkResetDescriptorPool(m_device->vulkan_device(), pool->pool, 0);
+    CLVK_UNIT_COUNT(descriptor_pools_reset);
+
+    auto num_empty = std::count_if(
+        m_descriptor_pools.begin(), m_descriptor_pools.end(),
+        [](const std::unique_ptr<cvk_descriptor_pool>& p) {
+            return p->num_sets == 0;
+        });
+    auto it = std::find_if(
+        m_descriptor_pools.begin(), m_descriptor_pools.end(),
+        [pool](const std::unique_ptr<cvk_descriptor_pool>& p) {
+            return p.get() == pool;
+        });
+    size_t pos = it - m_descriptor_pools.begin();
+    if ((num_empty <= 1) || (pos == m_current_descriptor_pool)) {
+        return;
+    }
+
+    vkDestroyDescriptorPool(m_device->vulkan_device(), pool->pool, nullptr);
+    m_descriptor_pools.erase(it);
+    if (m_current_descriptor_pool > pos) {
+        m_current_descriptor_pool--;
+    }
+    TRACE_CNT(descriptor_pools_counter, m_descriptor_pools.size());
+}
+
+bool cvk_entry_point::evict_descriptor_sets() {
+    // Evict the least recently used descriptor sets that are not in use
+    for (auto it = m_cached_descriptor_sets.rbegin();
+         it != m_cached_descriptor_sets.rend(); ++it) {
+        if (it->users != 0) {
+            continue;
+        }
+        for (auto resource : it->key) {
+            auto rit = m_cached_resources.find(resource);
+            if (--rit->second == 0) {
+                m_cached_resources.erase(rit);
+            }
+        }
+        m_descriptor_sets_cache.erase(it->key);
+        free_descriptor_sets(*it);
+        m_cached_descriptor_sets.erase(std::next(it).base());
+        return true;
+    }
+    return false;
+}
+
+cvk_descriptor_sets*
+cvk_entry_point::acquire_descriptor_sets(std::vector<const refcounted*>&& key,
+                                         bool cacheable, bool* needs_update) {
+    std::lock_guard<std::mutex> lock(m_descriptor_pool_lock);
+
+    cacheable = cacheable && (config.descriptor_set_cache_size > 0);
+
+    if (cacheable) {
+        auto it = m_descriptor_sets_cache.find(key);
+        if (it != m_descriptor_sets_cache.end()) {
+            auto entry = it->second;
+            m_cached_descriptor_sets.splice(m_cached_descriptor_sets.begin(),
+                                            m_cached_descriptor_sets, entry);
+            entry->users++;
+            m_descriptor_set_cache_hits++;
+            CLVK_UNIT_COUNT(descriptor_set_cache_hits);
+            TRACE_CNT(descriptor_set_cache_hits_counter,
+                      m_descriptor_set_cache_hits);
+            *needs_update = false;
+            return &*entry;
+        }
+        m_descriptor_set_cache_misses++;
+        CLVK_UNIT_COUNT(descriptor_set_cache_misses);
+        TRACE_CNT(descriptor_set_cache_misses_counter,
+                  m_descriptor_set_cache_misses);
+    }
+
+    cvk_descriptor_sets sets;
+    sets.sets.fill(VK_NULL_HANDLE);
+    sets.pool = nullptr;
+    VkResult res;
+    while ((res = allocate_descriptor_sets(sets)) != VK_SUCCESS) {
+        // Make space in the pools by evicting cached descriptor sets once
+        // the chain can't grow anymore
+        if (evict_descriptor_sets()) {
+            continue;
+        }
         if (config.enqueue_command_retry_sleep_us == UINT32_MAX) {
             cvk_error_fn("could not allocate descriptor sets: %s",
                          vulkan_error_string(res));
@@ -2282,13 +3447,102 @@ bool cvk_entry_point::allocate_descriptor_sets(VkDescriptorSet* ds) {
                         vulkan_error_string(res));
         }
         m_first_allocation_failure = false;
-        return false;
+        return nullptr;
     }
+    CLVK_UNIT_COUNT(descriptor_sets_allocated);
+    sets.key = std::move(key);
+    sets.cacheable = cacheable;
+    sets.cached = false;
+    sets.users = 1;
 
-    m_nb_descriptor_set_allocated += m_descriptor_set_layouts.size();
-    TRACE_CNT(descriptor_set_allocated_counter, m_nb_descriptor_set_allocated);
+    m_uncached_descriptor_sets.push_front(std::move(sets));
+    *needs_update = true;
+    return &m_uncached_descriptor_sets.front();
+}
 
-    return true;
+void cvk_entry_point::cache_descriptor_sets(cvk_descriptor_sets* sets) {
+    std::lock_guard<std::mutex> lock(m_descriptor_pool_lock);
+
+    // Another thread may have cached sets for the same resources in the
+    // meantime.
+    if (!sets->cacheable || m_descriptor_sets_cache.count(sets->key)) {
+        return;
+    }
+
+    auto it = std::find_if(
+        m_uncached_descriptor_sets.begin(), m_uncached_descriptor_sets.end(),
+        [sets](const cvk_descriptor_sets& s) { return &s == sets; });
+    CVK_ASSERT(it != m_uncached_descriptor_sets.end());
+    m_cached_descriptor_sets.splice(m_cached_descriptor_sets.begin(),
+                                    m_uncached_descriptor_sets, it);
+    sets->cached = true;
+    m_descriptor_sets_cache[sets->key] = m_cached_descriptor_sets.begin();
+    for (auto resource : sets->key) {
+        m_cached_resources[resource]++;
+    }
+
+    while (m_cached_descriptor_sets.size() > config.descriptor_set_cache_size) {
+        if (!evict_descriptor_sets()) {
+            break;
+        }
+    }
+}
+
+void cvk_entry_point::release_descriptor_sets(cvk_descriptor_sets* sets) {
+    std::lock_guard<std::mutex> lock(m_descriptor_pool_lock);
+
+    CVK_ASSERT(sets->users > 0);
+    if (--sets->users != 0) {
+        return;
+    }
+
+    if (sets->cached) {
+        // Keep the sets unless the cache has grown too large while they were
+        // in use
+        while (m_cached_descriptor_sets.size() >
+               config.descriptor_set_cache_size) {
+            if (!evict_descriptor_sets()) {
+                break;
+            }
+        }
+        return;
+    }
+
+    auto it = std::find_if(
+        m_uncached_descriptor_sets.begin(), m_uncached_descriptor_sets.end(),
+        [sets](const cvk_descriptor_sets& s) { return &s == sets; });
+    CVK_ASSERT(it != m_uncached_descriptor_sets.end());
+    free_descriptor_sets(*it);
+    m_uncached_descriptor_sets.erase(it);
+}
+
+void cvk_entry_point::resource_destroyed(const refcounted* resource) {
+    std::lock_guard<std::mutex> lock(m_descriptor_pool_lock);
+
+    if (m_cached_resources.count(resource) == 0) {
+        return;
+    }
+
+    // A resource can't be destroyed while the sets it is bound to are in
+    // use so they can all be freed.
+    for (auto it = m_cached_descriptor_sets.begin();
+         it != m_cached_descriptor_sets.end();) {
+        auto& key = it->key;
+        if (std::find(key.begin(), key.end(), resource) == key.end()) {
+            ++it;
+            continue;
+        }
+        CVK_ASSERT(it->users == 0);
+        for (auto res : key) {
+            auto rit = m_cached_resources.find(res);
+            if (--rit->second == 0) {
+                m_cached_resources.erase(rit);
+            }
+        }
+        m_descriptor_sets_cache.erase(key);
+        free_descriptor_sets(*it);
+        it = m_cached_descriptor_sets.erase(it);
+    }
 }
 
 std::unique_ptr<cvk_buffer> cvk_entry_point::allocate_pod_buffer() {
@@ -18,8 +18,11 @@
 #include <atomic>
 #include <climits>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <list>
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -413,24 +416,219 @@ enum class build_operation
 
 using cvk_program_callback = void(CL_CALLBACK*)(cl_program, void*);
 
-using cvk_spec_constant_map = std::map<uint32_t, uint32_t>;
+// Values of the specialization constants of a pipeline, sorted by ID. Keys
+// with up to INLINE_SPEC_CONSTANTS constants don't allocate memory, larger
+// ones keep all their entries on the heap.
+struct cvk_spec_constant_key {
+    static constexpr uint32_t INLINE_SPEC_CONSTANTS = 32;
+
+    struct entry {
+        uint32_t id;
+        uint32_t value;
+    };
+
+    cvk_spec_constant_key() : m_size(0) {}
+
+    // Sets the value of a constant, replacing any previous value
+    void set(uint32_t id, uint32_t value) {
+        entry* entries = data();
+        uint32_t pos = 0;
+        while ((pos < m_size) && (entries[pos].id < id)) {
+            pos++;
+        }
+        if ((pos < m_size) && (entries[pos].id == id)) {
+            entries[pos].value = value;
+            return;
+        }
+        if (m_size >= INLINE_SPEC_CONSTANTS) {
+            if (m_size == INLINE_SPEC_CONSTANTS) {
+                m_heap_entries.assign(m_inline_entries.begin(),
+                                      m_inline_entries.end());
+            }
+            m_heap_entries.insert(m_heap_entries.begin() + pos,
+                                  entry{id, value});
+            m_size++;
+            return;
+        }
+        for (uint32_t i = m_size; i > pos; i--) {
+            entries[i] = entries[i - 1];
+        }
+        entries[pos] = {id, value};
+        m_size++;
+    }
+
+    uint32_t size() const { return m_size; }
+    const entry* begin() const { return data(); }
+    const entry* end() const { return data() + m_size; }
+
+    bool operator==(const cvk_spec_constant_key& other) const {
+        return (m_size == other.m_size) &&
+               (memcmp(data(), other.data(), m_size * sizeof(entry)) == 0);
+    }
+
+    // 64-bit FNV-1a over the entries followed by a final mix so that keys
+    // differing in a single value spread over the whole table
+    uint64_t hash() const {
+        const entry* entries = data();
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (uint32_t i = 0; i < m_size; i++) {
+            h = (h ^ entries[i].id) * 0x100000001b3ULL;
+            h = (h ^ entries[i].value) * 0x100000001b3ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    entry* data() {
+        return (m_size > INLINE_SPEC_CONSTANTS) ? m_heap_entries.data()
+                                                : m_inline_entries.data();
+    }
+    const entry* data() const {
+        return (m_size > INLINE_SPEC_CONSTANTS) ? m_heap_entries.data()
+                                                : m_inline_entries.data();
+    }
+
+    uint32_t m_size;
+    std::array<entry, INLINE_SPEC_CONSTANTS> m_inline_entries;
+    std::vector<entry> m_heap_entries;
+};
+
+// A pipeline of an entry point. Entries are immutable once published.
+struct cvk_pipeline_entry {
+    cvk_spec_constant_key key;
+    uint64_t hash;
+    std::atomic<VkPipeline> pipeline;
+};
+
+// Open-addressing table of pipelines that can be searched without taking a
+// lock. Entries are only ever added, by one writer at a time, and are
+// published by storing their pipeline last.
+struct cvk_pipeline_table {
+    explicit cvk_pipeline_table(uint32_t capacity)
+        : m_capacity(capacity), m_size(0),
+          m_entries(new cvk_pipeline_entry[capacity]) {
+        CVK_ASSERT((capacity & (capacity - 1)) == 0);
+        for (uint32_t i = 0; i < capacity; i++) {
+            m_entries[i].pipeline.store(VK_NULL_HANDLE,
+                                        std::memory_order_relaxed);
+        }
+    }
+
+    const cvk_pipeline_entry* find(const cvk_spec_constant_key& key,
+                                   uint64_t hash) const {
+        for (uint32_t i = hash & (m_capacity - 1);;
+             i = (i + 1) & (m_capacity - 1)) {
+            auto& entry = m_entries[i];
+            if (entry.pipeline.load(std::memory_order_acquire) ==
+                VK_NULL_HANDLE) {
+                return nullptr;
+            }
+            if ((entry.hash == hash) && (entry.key == key)) {
+                return &entry;
+            }
+        }
+    }
+
+    // Returns nullptr when the table is too full to take the pipeline
+    const cvk_pipeline_entry* insert(const cvk_spec_constant_key& key,
+                                     uint64_t hash, VkPipeline pipeline) {
+        // Keep the table at most half full so that searches stay short and
+        // always reach an empty entry
+        if ((m_size + 1) * 2 > m_capacity) {
+            return nullptr;
+        }
+        for (uint32_t i = hash & (m_capacity - 1);;
+             i = (i + 1) & (m_capacity - 1)) {
+            auto& entry = m_entries[i];
+            if (entry.pipeline.load(std::memory_order_relaxed) ==
+                VK_NULL_HANDLE) {
+                entry.key = key;
+                entry.hash = hash;
+                entry.pipeline.store(pipeline, std::memory_order_release);
+                m_size++;
+                return &entry;
+            }
+        }
+    }
+
+    uint32_t capacity() const { return m_capacity; }
+    const cvk_pipeline_entry& entry(uint32_t i) const { return m_entries[i]; }
+
+private:
+    uint32_t m_capacity;
+    uint32_t m_size;
+    std::unique_ptr<cvk_pipeline_entry[]> m_entries;
+};
 
 struct cvk_program;
 
-class cvk_entry_point {
+// One of the descriptor pools of an entry point
+struct cvk_descriptor_pool {
+    VkDescriptorPool pool;
+    // Number of descriptor sets allocated from the pool
+    uint32_t num_sets;
+};
+
+// Descriptor sets of an entry point. Sets are written once and shared by all
+// the enqueues that bind the same resources.
+struct cvk_descriptor_sets {
+    std::array<VkDescriptorSet, spir_binary::MAX_DESCRIPTOR_SETS> sets;
+    cvk_descriptor_pool* pool;
+    // Resources bound to the sets, used to look them up
+    std::vector<const refcounted*> key;
+    // Whether the sets can be shared once they have been written
+    bool cacheable;
+    // Whether the sets are in the cache
+    bool cached;
+    uint32_t users;
+};
+
+// The information for one descriptor, laid out as expected by the descriptor
+// update templates of entry points
+union cvk_descriptor_info {
+    VkDescriptorBufferInfo buffer;
+    VkDescriptorImageInfo image;
+    VkBufferView buffer_view;
+};
+
+class cvk_entry_point : public cvk_resource_listener {
 public:
     cvk_entry_point(cvk_device* dev, cvk_program* program,
                     const std::string& name);
 
     ~cvk_entry_point() {
+        cancel_precompiled_pipelines();
+        m_context->remove_resource_listener(this);
+        cvk_info("descriptor set cache for kernel %s: %llu hits, %llu misses",
+                 m_name.c_str(),
+                 (unsigned long long)m_descriptor_set_cache_hits,
+                 (unsigned long long)m_descriptor_set_cache_misses);
+        for (auto& entry : m_cached_descriptor_sets) {
+            CVK_ASSERT(entry.users == 0);
+            free_descriptor_sets(entry);
+        }
         VkDevice vkdev = m_device->vulkan_device();
-        for (auto pipeline : m_pipelines) {
-            cvk_info("destroying pipeline %p for kernel %s", pipeline.second,
-                     m_name.c_str());
-            vkDestroyPipeline(vkdev, pipeline.second, nullptr);
+        // The current table holds all the pipelines
+        auto table = m_pipeline_table.load();
+        for (uint32_t i = 0; i < table->capacity(); i++) {
+            auto pipeline = table->entry(i).pipeline.load();
+            if (pipeline != VK_NULL_HANDLE) {
+                cvk_info("destroying pipeline %p for kernel %s", pipeline,
+                         m_name.c_str());
+                vkDestroyPipeline(vkdev, pipeline, nullptr);
+            }
         }
-        if (m_descriptor_pool != VK_NULL_HANDLE) {
-            vkDestroyDescriptorPool(vkdev, m_descriptor_pool, nullptr);
+        for (auto& pool : m_descriptor_pools) {
+            vkDestroyDescriptorPool(vkdev, pool->pool, nullptr);
+        }
+        for (auto update_template : m_descriptor_update_templates) {
+            if (update_template != VK_NULL_HANDLE) {
+                m_device->vkfns().vkDestroyDescriptorUpdateTemplateKHR(
+                    vkdev, update_template, nullptr);
+            }
         }
         if (m_pipeline_layout != VK_NULL_HANDLE) {
             vkDestroyPipelineLayout(vkdev, m_pipeline_layout, nullptr);
@@ -442,23 +640,82 @@ public:
 
     CHECK_RETURN cl_int init();
 
-    CHECK_RETURN VkPipeline
-    create_pipeline(const cvk_spec_constant_map& spec_constants);
+    // Returns the pipeline for the given specialization constants, creating
+    // it if needed, or nullptr on failure. Looking up existing pipelines
+    // doesn't take any lock.
+    CHECK_RETURN const cvk_pipeline_entry*
+    get_pipeline(const cvk_spec_constant_key& spec_constants);
+
+    // Sets the specialization constants that only depend on the shape of an
+    // NDRange
+    void fill_spec_constant_key(cvk_spec_constant_key& key,
+                                const std::array<uint32_t, 3>& lws,
+                                uint32_t dims,
+                                const std::array<uint32_t, 3>& offset) const;
+
+    // Starts creating the pipelines the kernel is most likely to use in the
+    // background. Only the first call has any effect.
+    void precompile_pipelines();
 
-    CHECK_RETURN bool allocate_descriptor_sets(VkDescriptorSet* ds);
+    // Returns descriptor sets for the resources in key, nullptr on failure.
+    // needs_update is set when the sets are new and have to be written, they
+    // then need to be passed to cache_descriptor_sets once written.
+    CHECK_RETURN cvk_descriptor_sets*
+    acquire_descriptor_sets(std::vector<const refcounted*>&& key,
+                            bool cacheable, bool* needs_update);
+    void cache_descriptor_sets(cvk_descriptor_sets* sets);
+    void release_descriptor_sets(cvk_descriptor_sets* sets);
 
-    void free_descriptor_set(VkDescriptorSet ds) {
-        TRACE_FUNCTION();
-        std::lock_guard<std::mutex> lock(m_descriptor_pool_lock);
-        vkFreeDescriptorSets(m_device->vulkan_device(), m_descriptor_pool, 1,
-                             &ds);
-        m_nb_descriptor_set_allocated--;
-        TRACE_CNT(descriptor_set_allocated_counter,
-                  m_nb_descriptor_set_allocated);
+    void resource_destroyed(const refcounted* resource) override;
+
+    uint64_t descriptor_set_cache_hits() const {
+        return m_descriptor_set_cache_hits;
+    }
+    uint64_t descriptor_set_cache_misses() const {
+        return m_descriptor_set_cache_misses;
     }
 
     uint32_t num_set_layouts() const { return m_descriptor_set_layouts.size(); }
 
+    // Descriptor information for all the descriptors written by the entry
+    // point, program-scope descriptors are already set up. Kernel argument
+    // values fill in the rest.
+    const std::vector<cvk_descriptor_info>& descriptor_info() const {
+        return m_descriptor_info;
+    }
+
+    // Index in the descriptor information of the descriptor for the argument
+    // at position pos, NO_DESCRIPTOR if it doesn't have one.
+    uint32_t arg_descriptor_index(uint32_t pos) const {
+        return m_arg_descriptor_indices[pos];
+    }
+    uint32_t pod_descriptor_index() const { return m_pod_descriptor_index; }
+
+    static constexpr uint32_t NO_DESCRIPTOR = UINT32_MAX;
+
+    // Writes all the descriptors of the given set, except the printf buffer
+    void write_descriptor_set(VkDescriptorSet ds, uint32_t set,
+                              const cvk_descriptor_info* info);
+
+    // Records the descriptors of the push descriptor set to command_buffer.
+    // The POD descriptor found in info is replaced with pod_descriptor when
+    // it isn't null.
+    void push_descriptors(VkCommandBuffer command_buffer,
+                          const cvk_descriptor_info* info,
+                          const VkDescriptorBufferInfo* pod_descriptor);
+
+    // The descriptor set holding the kernel arguments is pushed to command
+    // buffers instead of being allocated when the device supports it.
+    bool uses_push_descriptors() const {
+        return m_push_descriptor_set != NO_PUSH_DESCRIPTOR_SET;
+    }
+    uint32_t push_descriptor_set() const { return m_push_descriptor_set; }
+
+    // Whether any descriptor set needs to be allocated from the pool
+    bool uses_descriptor_pool() const {
+        return num_set_layouts() > (uses_push_descriptors() ? 1u : 0u);
+    }
+
     std::unique_ptr<cvk_buffer> allocate_pod_buffer();
 
     const std::vector<kernel_argument>& args() const { return m_args; }
@@ -489,12 +746,22 @@ public:
         return m_pod_descriptor_type;
     }
 
+    // Dynamic POD descriptors get the offset of the POD arguments when the
+    // descriptor sets are bound
+    bool pod_descriptor_is_dynamic() const {
+        return (m_pod_descriptor_type ==
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC) ||
+               (m_pod_descriptor_type ==
+                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+    }
+
     cvk_program* program() const { return m_program; }
 
     bool uses_printf() const;
 
 private:
     const uint32_t MAX_INSTANCES = config.max_entry_points_instances;
+    static constexpr uint32_t NO_PUSH_DESCRIPTOR_SET = UINT32_MAX;
 
     cvk_device* m_device;
     cvk_context* m_context;
@@ -508,8 +775,21 @@ private:
     const kernel_sampler_metadata_map* m_sampler_metadata;
     const kernel_image_metadata_map* m_image_metadata;
     uint32_t m_num_resource_slots;
-    VkDescriptorPool m_descriptor_pool;
+    // Descriptor sets are allocated from a chain of pools that grows when
+    // they are all full. Pools that become empty are reset and reused.
+    std::vector<std::unique_ptr<cvk_descriptor_pool>> m_descriptor_pools;
+    std::vector<VkDescriptorPoolSize> m_descriptor_pool_sizes;
+    // Pool the last descriptor sets were allocated from
+    size_t m_current_descriptor_pool;
     std::vector<VkDescriptorSetLayout> m_descriptor_set_layouts;
+    uint32_t m_push_descriptor_set;
+    // Descriptor update template entries and templates for each set
+    std::vector<std::vector<VkDescriptorUpdateTemplateEntry>>
+        m_descriptor_update_entries;
+    std::vector<VkDescriptorUpdateTemplate> m_descriptor_update_templates;
+    std::vector<cvk_descriptor_info> m_descriptor_info;
+    std::vector<uint32_t> m_arg_descriptor_indices;
+    uint32_t m_pod_descriptor_index;
     VkPipelineLayout m_pipeline_layout;
 
     std::mutex m_pipeline_cache_lock;
@@ -517,7 +797,14 @@ private:
 
     using binding_stat_map = std::unordered_map<VkDescriptorType, uint32_t>;
     bool build_descriptor_set_layout(
-        const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+        const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+        VkDescriptorSetLayoutCreateFlags flags = 0);
+    uint32_t add_descriptor(uint32_t set, uint32_t binding,
+                            VkDescriptorType type);
+    CHECK_RETURN bool create_descriptor_update_templates();
+    void build_descriptor_writes(uint32_t set, VkDescriptorSet ds,
+                                 const cvk_descriptor_info* info,
+                                 std::vector<VkWriteDescriptorSet>& writes);
     bool build_descriptor_sets_layout_bindings_for_arguments(
         binding_stat_map& smap, uint32_t& num_resource_slots);
     bool build_descriptor_sets_layout_bindings_for_literal_samplers(
@@ -527,38 +814,67 @@ private:
     bool build_descriptor_sets_layout_bindings_for_printf_buffer(
         binding_stat_map& smap);
 
-    // Structures for caching pipelines based on specialization constants
-    struct SpecConstantMapHash {
-        size_t operator()(const cvk_spec_constant_map& spec_constants) const {
-            // TODO: better hash?
+    CHECK_RETURN VkPipeline
+    create_pipeline(const cvk_spec_constant_key& spec_constants);
+    // Adds a pipeline created outside of the lock to the table and wakes up
+    // the threads waiting for it, lock must be held
+    const cvk_pipeline_entry* publish_pipeline(const cvk_spec_constant_key& key,
+                                               uint64_t hash,
+                                               VkPipeline pipeline);
+    void precompile_pipeline(const cvk_spec_constant_key& key);
+    void cancel_precompiled_pipelines();
+
+    // Pipelines for the specialization constants used so far. The table is
+    // replaced by a larger copy when it fills up, previous tables are kept
+    // until the entry point is destroyed since readers may still use them.
+    static constexpr uint32_t INITIAL_PIPELINE_TABLE_CAPACITY = 8;
+    std::atomic<cvk_pipeline_table*> m_pipeline_table;
+    std::vector<std::unique_ptr<cvk_pipeline_table>> m_pipeline_tables;
+    // Pipelines being created outside of the lock, by an enqueue or in the
+    // background. Other threads needing them wait for m_pipeline_cv.
+    std::vector<cvk_spec_constant_key> m_pending_pipelines;
+    std::condition_variable m_pipeline_cv;
+    bool m_precompile_started;
+    bool m_precompile_cancelled;
+    uint32_t m_num_precompile_jobs;
+
+    CHECK_RETURN cvk_descriptor_pool* create_descriptor_pool();
+    CHECK_RETURN VkResult
+    allocate_descriptor_sets(cvk_descriptor_pool* pool,
+                             const std::vector<VkDescriptorSetLayout>& layouts,
+                             VkDescriptorSet* ds);
+    CHECK_RETURN VkResult allocate_descriptor_sets(cvk_descriptor_sets& sets);
+    void free_descriptor_sets(cvk_descriptor_sets& sets);
+    bool evict_descriptor_sets();
+
+    struct descriptor_sets_key_hash {
+        size_t operator()(const std::vector<const refcounted*>& key) const {
             size_t result = 0;
-            for (auto& entry : spec_constants) {
-                result ^= std::hash<uint32_t>{}(entry.first) * 31;
-                result ^= std::hash<uint32_t>{}(entry.second) * 59;
+            for (auto resource : key) {
+                result = result * 31 + std::hash<const refcounted*>{}(resource);
             }
             return result;
         }
     };
-    struct SpecConstantMapEqual {
-        bool operator()(const cvk_spec_constant_map& lhs,
-                        const cvk_spec_constant_map& rhs) const {
-            if (lhs.size() != rhs.size())
-                return false;
-            for (auto& lhs_entry : lhs) {
-                if (!rhs.count(lhs_entry.first))
-                    return false;
-                if (lhs_entry.second != rhs.at(lhs_entry.first))
-                    return false;
-            }
-            return true;
-        }
-    };
-    std::unordered_map<cvk_spec_constant_map, VkPipeline, SpecConstantMapHash,
-                       SpecConstantMapEqual>
-        m_pipelines;
+
+    // Cached descriptor sets, most recently used first
+    std::list<cvk_descriptor_sets> m_cached_descriptor_sets;
+    std::unordered_map<std::vector<const refcounted*>,
+                       std::list<cvk_descriptor_sets>::iterator,
+                       descriptor_sets_key_hash>
+        m_descriptor_sets_cache;
+    // Number of cached descriptor sets each resource is bound to
+    std::unordered_map<const refcounted*, uint32_t> m_cached_resources;
+    // Descriptor sets that are not in the cache
+    std::list<cvk_descriptor_sets> m_uncached_descriptor_sets;
+    uint64_t m_descriptor_set_cache_hits;
+    uint64_t m_descriptor_set_cache_misses;
 
     uint32_t m_nb_descriptor_set_allocated;
     TRACE_CNT_VAR(descriptor_set_allocated_counter);
+    TRACE_CNT_VAR(descriptor_pools_counter);
+    TRACE_CNT_VAR(descriptor_set_cache_hits_counter);
+    TRACE_CNT_VAR(descriptor_set_cache_misses_counter);
 
     bool m_first_allocation_failure;
 };
@@ -569,7 +885,11 @@ struct cvk_program : public _cl_program, api_object<object_magic::program> {
         : api_object(ctx), m_num_devices(1U),
           m_binary_type(CL_PROGRAM_BINARY_TYPE_NONE),
           m_shader_module(VK_NULL_HANDLE),
-          m_binary(m_context->device()->vulkan_spirv_env()) {
+          m_binary(m_context->device()->vulkan_spirv_env()),
+          m_pipeline_cache(VK_NULL_HANDLE),
+          m_binary_pipeline_cache_valid(false),
+          m_binary_pipeline_cache_uuid{}, m_pipeline_profile_dirty(false),
+          m_pipeline_profile_save_pending(false) {
         m_dev_status[m_context->device()] = CL_BUILD_NONE;
     }
 
@@ -580,6 +900,9 @@ struct cvk_program : public _cl_program, api_object<object_magic::program> {
     }
 
     virtual ~cvk_program() {
+        // Entry points may still be creating pipelines from the shader module
+        m_entry_points.clear();
+        save_pipeline_profile();
         if (m_shader_module != VK_NULL_HANDLE) {
             auto vkdev = m_context->device()->vulkan_device();
             vkDestroyShaderModule(vkdev, m_shader_module, nullptr);
@@ -716,7 +1039,10 @@ private:
     void write_binary_header(unsigned char* dst) const;
     CHECK_RETURN cl_program_binary_type
 
-    read_binary_header(const unsigned char* src, size_t size);
+    read_binary_header(const unsigned char* src, size_t size,
+                       uint32_t* version);
+    CHECK_RETURN bool read_executable(const unsigned char* src, size_t size);
+    void snapshot_binary_pipeline_cache() const;
 
 public:
     CHECK_RETURN bool read(const unsigned char* src, size_t size);
@@ -798,6 +1124,25 @@ public:
 
     const VkPipelineCache& pipeline_cache() const { return m_pipeline_cache; }
 
+    // Specialization constants of the pipelines used by each kernel
+    using pipeline_profile =
+        std::unordered_map<std::string, std::vector<cvk_spec_constant_key>>;
+
+    // Specialization constants of the pipelines a kernel used in previous
+    // runs of the application
+    std::vector<cvk_spec_constant_key>
+    profiled_pipelines(const std::string& kernel) {
+        std::lock_guard<std::mutex> lock(m_pipeline_profile_lock);
+        auto it = m_pipeline_profile.find(kernel);
+        if (it == m_pipeline_profile.end()) {
+            return {};
+        }
+        return it->second;
+    }
+
+    void record_pipeline(const std::string& kernel,
+                         const cvk_spec_constant_key& key);
+
     CHECK_RETURN cvk_entry_point* get_entry_point(std::string& name,
                                                   cl_int* errcode_ret);
 
@@ -859,6 +1204,13 @@ private:
     CHECK_RETURN cl_build_status do_build_inner(const cvk_device* device);
 
 #if COMPILER_AVAILABLE
+    // Whether the SPIR-V built for the program only depends on what
+    // program_cache_key hashes
+    bool can_use_program_cache(const std::string& build_options,
+                               bool build_from_il) const;
+    // Hash of everything that affects the SPIR-V built for the program
+    cvk_sha1_hash program_cache_key(const std::string& build_options,
+                                    bool build_from_il) const;
 #ifndef CLSPV_ONLINE_COMPILER
     CHECK_RETURN cl_build_status
     do_build_inner_offline(bool build_to_ir, bool build_from_il,
@@ -900,8 +1252,31 @@ private:
         m_entry_points;
     std::vector<uint32_t> m_stripped_binary;
     VkPipelineCache m_pipeline_cache;
+
+    // Embedded in executable binaries. The pipeline cache data of a built
+    // program is only retrieved when its binary is first queried so that the
+    // size of the binary doesn't change between queries.
+    mutable std::mutex m_binary_pipeline_cache_lock;
+    mutable bool m_binary_pipeline_cache_valid;
+    mutable std::array<uint8_t, VK_UUID_SIZE> m_binary_pipeline_cache_uuid;
+    mutable std::vector<char> m_binary_pipeline_cache_data;
     std::unique_ptr<cvk_buffer> m_module_constant_data_buffer;
     std::unordered_map<uint32_t, user_spec_constant_data> m_user_spec_constants;
+
+    // Pipelines used by each kernel. Recording a new one schedules a save of
+    // the profile to the cache directory on the device's pipeline compiler.
+    static constexpr size_t MAX_PROFILED_PIPELINES_PER_KERNEL = 16;
+    void load_pipeline_profile(cvk_device* device);
+    // Waits for the save in progress, if any, and saves the profile if it
+    // still has changes
+    void save_pipeline_profile();
+    void save_pipeline_profile_in_background();
+    std::mutex m_pipeline_profile_lock;
+    std::condition_variable m_pipeline_profile_cv;
+    pipeline_profile m_pipeline_profile;
+    std::string m_pipeline_profile_path;
+    bool m_pipeline_profile_dirty;
+    bool m_pipeline_profile_save_pending;
 };
 
 static inline cvk_program* icd_downcast(cl_program program) {
@@ -0,0 +1,191 @@
+// Copyright 2026 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <system_error>
+#include <thread>
+
+#include "log.hpp"
+#include "program_cache.hpp"
+#include "unit.hpp"
+
+namespace fs = std::filesystem;
+
+static const char* PROGRAM_CACHE_PREFIX = "clvk-program.";
+static const char* PROGRAM_CACHE_SUFFIX = ".spv";
+
+// Bump the version whenever the format of the entries changes
+static constexpr uint32_t PROGRAM_CACHE_MAGIC = 0x4b564c43; // "CLVK"
+static constexpr uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct program_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_words;
+    cvk_sha1_hash checksum;
+};
+
+std::string cvk_cache_temporary_path(const std::string& path) {
+    std::random_device rd;
+    auto thread_id = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    return path + ".tmp." + std::to_string(rd()) + "." +
+           std::to_string(thread_id);
+}
+
+void cvk_evict_cache_files(const std::string& dir, const char* prefix,
+                           const char* suffix, uint64_t max_size) {
+    struct entry {
+        fs::path path;
+        uint64_t size;
+        fs::file_time_type last_use;
+    };
+    std::vector<entry> entries;
+    uint64_t total_size = 0;
+
+    // Other processes may be adding or removing entries, ignore the files
+    // that disappear while the directory is being scanned
+    std::error_code ec;
+    for (auto it = fs::directory_iterator(dir, ec);
+         !ec && (it != fs::directory_iterator()); it.increment(ec)) {
+        auto name = it->path().filename().string();
+        if ((name.rfind(prefix, 0) != 0) || (name.size() <= strlen(suffix)) ||
+            (name.compare(name.size() - strlen(suffix), std::string::npos,
+                          suffix) != 0)) {
+            continue;
+        }
+        std::error_code entry_ec;
+        auto size = it->file_size(entry_ec);
+        auto last_use = it->last_write_time(entry_ec);
+        if (entry_ec) {
+            continue;
+        }
+        entries.push_back({it->path(), size, last_use});
+        total_size += size;
+    }
+
+    if (total_size <= max_size) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const entry& a, const entry& b) {
+                  return a.last_use < b.last_use;
+              });
+    for (auto& e : entries) {
+        if (total_size <= max_size) {
+            break;
+        }
+        cvk_info("Evicting cache file %s", e.path.string().c_str());
+        fs::remove(e.path, ec);
+        total_size -= e.size;
+    }
+}
+
+std::string cvk_program_cache::entry_path(const cvk_sha1_hash& key) const {
+    std::string path = m_dir;
+    path += "/";
+    path += PROGRAM_CACHE_PREFIX;
+    path += to_hex_string(reinterpret_cast<const uint8_t*>(key.data()),
+                          SHA1_DIGEST_NUM_BYTES);
+    path += PROGRAM_CACHE_SUFFIX;
+    return path;
+}
+
+bool cvk_program_cache::load(const cvk_sha1_hash& key,
+                             std::vector<uint32_t>& spirv) const {
+    std::string path = entry_path(key);
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::error_code ec;
+    auto file_size = fs::file_size(path, ec);
+    program_cache_header header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (ec || !file.good() || (header.magic != PROGRAM_CACHE_MAGIC) ||
+        (header.version != PROGRAM_CACHE_VERSION) ||
+        (file_size != sizeof(header) + header.num_words * sizeof(uint32_t))) {
+        cvk_warn("Ignoring invalid program cache entry %s", path.c_str());
+        return false;
+    }
+
+    spirv.resize(header.num_words);
+    file.read(reinterpret_cast<char*>(spirv.data()),
+              spirv.size() * sizeof(uint32_t));
+    if (!file.good() ||
+        (cvk_sha1(spirv.data(), spirv.size() * sizeof(uint32_t)) !=
+         header.checksum)) {
+        cvk_warn("Removing corrupted program cache entry %s", path.c_str());
+        file.close();
+        fs::remove(path, ec);
+        spirv.clear();
+        return false;
+    }
+
+    // Mark the entry as recently used. Failing to do so only makes it more
+    // likely to be evicted.
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+    cvk_info("Loaded program from cache entry %s", path.c_str());
+    CLVK_UNIT_COUNT(program_cache_hits);
+    return true;
+}
+
+void cvk_program_cache::store(const cvk_sha1_hash& key,
+                              const std::vector<uint32_t>& spirv) const {
+    std::string path = entry_path(key);
+    std::string tmp_path = cvk_cache_temporary_path(path);
+
+    program_cache_header header;
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.num_words = static_cast<uint32_t>(spirv.size());
+    header.checksum = cvk_sha1(spirv.data(), spirv.size() * sizeof(uint32_t));
+
+    std::error_code ec;
+    {
+        std::ofstream file(tmp_path, std::ios::out | std::ios::binary);
+        if (!file.is_open()) {
+            cvk_warn("Failed to open program cache file for writing: %s",
+                     tmp_path.c_str());
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(spirv.data()),
+                   spirv.size() * sizeof(uint32_t));
+        file.close();
+        if (!file.good()) {
+            cvk_warn("Failed to write program cache entry");
+            fs::remove(tmp_path, ec);
+            return;
+        }
+    }
+
+    // Renaming is atomic, the entry is either absent or complete. Another
+    // process may have stored the same entry in the meantime, which is fine.
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+        return;
+    }
+    cvk_info("Stored program in cache entry %s", path.c_str());
+
+    cvk_evict_cache_files(m_dir, PROGRAM_CACHE_PREFIX, PROGRAM_CACHE_SUFFIX,
+                          m_max_size);
+}
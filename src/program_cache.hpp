@@ -0,0 +1,59 @@
+// Copyright 2026 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sha1.hpp"
+#include "utils.hpp"
+
+// Returns the path of a temporary file next to path that no other thread or
+// process will use. Files are written there and then renamed to path so that
+// readers never see a partial file.
+std::string cvk_cache_temporary_path(const std::string& path);
+
+// Removes the least recently written files of dir whose name starts with
+// prefix and ends with suffix until they use at most max_size bytes
+void cvk_evict_cache_files(const std::string& dir, const char* prefix,
+                           const char* suffix, uint64_t max_size);
+
+// On-disk cache of the SPIR-V binaries produced by the compiler, keyed by a
+// hash of everything that affects the compilation.
+//
+// The cache can be shared by several processes. Entries are written to a
+// temporary file that is then renamed so that readers never see a partial
+// entry, and are checked against a checksum when they are read. Reading an
+// entry marks it as recently used. When the entries grow beyond the size
+// limit, the least recently used ones are removed.
+struct cvk_program_cache {
+
+    cvk_program_cache(const std::string& dir, uint64_t max_size)
+        : m_dir(dir), m_max_size(max_size) {}
+
+    bool enabled() const { return !m_dir.empty() && (m_max_size != 0); }
+
+    CHECK_RETURN bool load(const cvk_sha1_hash& key,
+                           std::vector<uint32_t>& spirv) const;
+    void store(const cvk_sha1_hash& key,
+               const std::vector<uint32_t>& spirv) const;
+
+private:
+    std::string entry_path(const cvk_sha1_hash& key) const;
+
+    std::string m_dir;
+    uint64_t m_max_size;
+};
@@ -22,6 +22,7 @@
 #include "queue.hpp"
 #include "queue_controller.hpp"
 #include "tracing.hpp"
+#include "unit.hpp"
 #include "utils.hpp"
 
 static cvk_executor_thread_pool* get_thread_pool() {
@@ -41,14 +42,11 @@ cvk_command_queue::cvk_command_queue(
       m_max_first_cmd_batch_size(device->get_max_first_cmd_batch_size()),
       m_max_cmd_group_size(device->get_max_cmd_group_size()),
       m_max_first_cmd_group_size(device->get_max_first_cmd_group_size()),
-      m_nb_batch_in_flight(0), m_nb_group_in_flight(0) {
+      m_nb_batch_in_flight(0), m_nb_group_in_flight(0),
+      m_pod_ring_created(false), m_pod_ring_exhausted(false) {
 
     m_groups.push_back(std::make_unique<cvk_command_group>());
 
-    if (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) {
-        cvk_warn_fn("out-of-order execution enabled, will be ignored");
-    }
-
     if (config.dynamic_batches) {
         m_controllers.push_back(
             std::make_unique<cvk_queue_controller_batch_parameters>(this));
@@ -71,6 +69,18 @@ cl_int cvk_command_queue::init() {
         return CL_OUT_OF_RESOURCES;
     }
 
+    if (m_device->supports_timeline_semaphores()) {
+        auto sem = std::make_shared<cvk_timeline_semaphore>(
+            m_device->vulkan_device());
+        VkResult res = sem->init();
+        if (res != VK_SUCCESS) {
+            cvk_error_fn("could not create timeline semaphore: %s",
+                         vulkan_error_string(res));
+            return CL_OUT_OF_RESOURCES;
+        }
+        m_timeline_semaphore = std::move(sem);
+    }
+
     return CL_SUCCESS;
 }
 
@@ -78,6 +88,9 @@ cvk_command_queue::~cvk_command_queue() {
     if (m_executor != nullptr) {
         get_thread_pool()->return_executor(m_executor);
     }
+    for (auto pool : m_free_query_pools) {
+        vkDestroyQueryPool(m_device->vulkan_device(), pool, nullptr);
+    }
 }
 
 cl_int cvk_command_queue::satisfy_data_dependencies(cvk_command* cmd) {
@@ -120,20 +133,121 @@ cl_int cvk_command_queue::satisfy_data_dependencies(cvk_command* cmd) {
     return CL_SUCCESS;
 }
 
+static bool is_synchronisation_point(const cvk_command* cmd) {
+    // Barriers always wait for all the commands enqueued before them, even
+    // when given a wait list, which is allowed as it only adds ordering.
+    // Markers do so only when they do not have a wait list.
+    return cmd->type() == CL_COMMAND_BARRIER ||
+           (cmd->type() == CL_COMMAND_MARKER && cmd->dependencies().empty());
+}
+
+bool cvk_command_queue::has_open_command_batch() const {
+    return m_command_batch != nullptr && m_command_batch->batch_size() > 0;
+}
+
+bool cvk_command_dep::can_be_batched() const {
+    // Synchronisation points in out-of-order queues depend on all the
+    // commands enqueued before them, including the ones in the current batch.
+    if (m_queue->is_out_of_order() && is_synchronisation_point(this)) {
+        return false;
+    }
+
+    return m_queue->has_open_command_batch() &&
+           cvk_command_batchable::can_be_batched();
+}
+
+cl_int cvk_command_dep::build_batchable_inner(cvk_command_buffer& cmdbuf) {
+    if (m_type == CL_COMMAND_BARRIER) {
+        record_memory_barrier(cmdbuf);
+    }
+    return CL_SUCCESS;
+}
+
+void cvk_command_queue::track_out_of_order_event(cvk_event* event) {
+    // Forget about completed commands from time to time to avoid
+    // accumulating events in queues that never see a barrier.
+    if (m_events_since_barrier.size() >= 64) {
+        std::vector<cvk_event_holder> pending;
+        for (auto& ev : m_events_since_barrier) {
+            if (!ev->completed()) {
+                pending.emplace_back(ev);
+            }
+        }
+        m_events_since_barrier.swap(pending);
+    }
+    m_events_since_barrier.emplace_back(event);
+}
+
+void cvk_command_queue::add_out_of_order_dependencies(cvk_command* cmd) {
+    if (is_synchronisation_point(cmd)) {
+        for (auto& ev : m_events_since_barrier) {
+            cmd->add_dependency(ev);
+        }
+    }
+
+    if (m_barrier_event != nullptr) {
+        cmd->add_dependency(m_barrier_event);
+    }
+
+    if (cmd->type() == CL_COMMAND_BARRIER) {
+        // Commands enqueued before a barrier do not need to be tracked
+        // anymore, the barrier depends on them.
+        m_events_since_barrier.clear();
+        m_barrier_event.reset(cmd->event());
+    } else {
+        track_out_of_order_event(cmd->event());
+    }
+}
+
 void cvk_command_queue::enqueue_command(cvk_command* cmd) {
     TRACE_FUNCTION("queue", (uintptr_t)this, "cmd", (uintptr_t)cmd);
-    // clvk only supports inorder queues at the moment.
-    // But as the commands can be executed by 2 threads (1 executor and the main
-    // thread), we need to explicit the dependency to ensure it will be
-    // respected.
-    if (!m_groups.back()->commands.empty()) {
-        cmd->add_dependency(m_groups.back()->commands.back()->event());
-    } else if (m_finish_event != nullptr) {
-        cmd->add_dependency(m_finish_event);
+    if (is_out_of_order()) {
+        add_out_of_order_dependencies(cmd);
+    } else {
+        // As the commands can be executed by 2 threads (1 executor and the
+        // main thread), we need to explicit the dependency to ensure in-order
+        // execution will be respected.
+        if (!m_groups.back()->commands.empty()) {
+            cmd->add_dependency(m_groups.back()->commands.back()->event());
+        } else if (m_finish_event != nullptr) {
+            cmd->add_dependency(m_finish_event);
+        }
     }
     m_groups.back()->commands.push_back(cmd);
 }
 
+bool cvk_command_queue::must_end_command_batch_before(cvk_command* cmd) {
+    if (!is_out_of_order() || m_command_batch == nullptr) {
+        return true;
+    }
+
+    // Commands that do not depend on the current batch can be executed
+    // before it on out-of-order queues.
+    return is_synchronisation_point(cmd) ||
+           m_command_batch->contains_any_of(cmd->dependencies());
+}
+
+// Batchable commands that depend on user events that have not been signalled
+// yet are gathered in batches that are only submitted once the events are
+// signalled. The commands that are not gated by these events must not be
+// held back by batching.
+bool cvk_command_queue::must_end_command_batch_before_batchable(
+    cvk_command* cmd) {
+    if (m_command_batch == nullptr || m_command_batch->batch_size() == 0) {
+        return false;
+    }
+
+    if (!m_command_batch->has_unresolved_user_event_dependency()) {
+        return cmd->has_unresolved_user_event_dependency();
+    }
+
+    // All commands enqueued after a gated command in an in-order queue are
+    // gated as well. In out-of-order queues, only the commands that depend
+    // on the batch are.
+    return is_out_of_order() &&
+           !m_command_batch->contains_any_of(cmd->dependencies());
+}
+
 cl_int cvk_command_queue::enqueue_command_with_retry(cvk_command* cmd,
                                                      _cl_event** event) {
     cl_int err = enqueue_command(cmd, event);
@@ -186,6 +300,11 @@ cl_int cvk_command_queue::enqueue_command(cvk_command* cmd, _cl_event** event) {
     // Enqueue the command
     std::lock_guard<std::mutex> lock(m_lock);
     if (cmd->can_be_batched()) {
+        if (must_end_command_batch_before_batchable(cmd) &&
+            (err = end_current_command_batch()) != CL_SUCCESS) {
+            return err;
+        }
+
         if (!m_command_batch) {
             // Create a new command batch
             m_command_batch = new cvk_command_batch(this);
@@ -198,17 +317,26 @@ cl_int cvk_command_queue::enqueue_command(cvk_command* cmd, _cl_event** event) {
             return err;
         }
 
-        // End command batch when size limit reached
-        if (m_command_batch->batch_size() >= m_max_cmd_batch_size ||
-            (m_nb_batch_in_flight == 0 &&
-             m_command_batch->batch_size() >= m_max_first_cmd_batch_size)) {
+        // Submit the batch when the POD ring is full, the ranges used by
+        // its commands are only returned to the ring once they complete.
+        // Otherwise end command batch when size limit reached.
+        if (m_pod_ring_exhausted) {
+            m_pod_ring_exhausted = false;
+            if ((err = flush_no_lock()) != CL_SUCCESS) {
+                return err;
+            }
+        } else if (m_command_batch->batch_size() >= m_max_cmd_batch_size ||
+                   (m_nb_batch_in_flight == 0 &&
+                    m_command_batch->batch_size() >=
+                        m_max_first_cmd_batch_size)) {
             if ((err = end_current_command_batch()) != CL_SUCCESS) {
                 return err;
             }
         }
     } else {
         // End the current command batch
-        if ((err = end_current_command_batch(true)) != CL_SUCCESS) {
+        if (must_end_command_batch_before(cmd) &&
+            (err = end_current_command_batch(true)) != CL_SUCCESS) {
             return err;
         }
 
@@ -346,11 +474,212 @@ cl_int cvk_command_queue::wait_for_events(cl_uint num_events,
     return ret;
 }
 
+static void delete_cmd(cvk_command* cmd) {
+    // Deleting batch with many commands can take a while. Trace it to be
+    // able to understand it easily.
+    TRACE_BEGIN("delete_cmd");
+    delete cmd;
+    TRACE_END();
+}
+
+// An asynchronous command can be submitted ahead of the completion of the
+// commands it depends on if all of them have either completed, been
+// submitted to the same Vulkan queue before it or been submitted by another
+// queue with a timeline semaphore it can wait on. Execution ordering on the
+// device is then guaranteed by the barriers recorded at the end of each
+// command and by the semaphore waits.
+static bool can_submit_ahead(cvk_command* cmd,
+                             const std::deque<cvk_command*>& in_flight) {
+    if (!cmd->is_asynchronous() || config.max_batches_in_flight < 2) {
+        return false;
+    }
+
+    for (auto ev : cmd->dependencies()) {
+        if (ev->completed() || cmd->is_device_waitable(ev)) {
+            continue;
+        }
+        bool dep_in_flight = false;
+        for (auto icmd : in_flight) {
+            if (icmd->event() == ev) {
+                dep_in_flight = true;
+                break;
+            }
+        }
+        if (!dep_in_flight) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void cvk_command_group::retire_cmd(std::deque<cvk_command*>& in_flight,
+                                   cl_int& global_status) {
+    cvk_command* cmd = in_flight.front();
+    in_flight.pop_front();
+
+    cl_int status = cmd->complete(CL_SUCCESS);
+    if (status != CL_COMPLETE && global_status == CL_SUCCESS)
+        global_status = status;
+    cvk_debug_fn("command %p retired with %d", cmd, status);
+
+    delete_cmd(cmd);
+}
+
+// Submit the work of asynchronous commands. The work of several commands is
+// submitted at once when possible to reduce the submission overhead.
+void cvk_command_group::submit_cmds(std::deque<cvk_command*>& in_flight,
+                                    std::vector<cvk_command*>& cmds,
+                                    cl_int& global_status) {
+    cl_int status;
+    if (cmds.size() == 1) {
+        cvk_debug_fn("submitting command %p (%s), event %p", cmds.front(),
+                     cl_command_type_to_string(cmds.front()->type()),
+                     cmds.front()->event());
+        status = cmds.front()->submit();
+    } else {
+        TRACE_BEGIN("coalesced_submit", "num_commands", cmds.size());
+        // Each command buffer is submitted in its own batch so that it only
+        // waits for the dependencies of its command.
+        std::vector<const cvk_semaphore_wait_list*> waits;
+        std::vector<cvk_command_buffer*> cmdbufs;
+        waits.reserve(cmds.size());
+        cmdbufs.reserve(cmds.size());
+        for (auto cmd : cmds) {
+            cvk_debug_fn("submitting command %p (%s), event %p", cmd,
+                         cl_command_type_to_string(cmd->type()), cmd->event());
+            TRACE_BEGIN_CMD(cmd->type(), "queue", (uintptr_t)cmd->queue(),
+                            "command", (uintptr_t)cmd);
+            cmd->begin_submit();
+            TRACE_END();
+            waits.push_back(&cmd->device_dependency_waits());
+            cmdbufs.push_back(cmd->coalescable_command_buffer());
+        }
+
+        uint64_t signal_value;
+        status = CL_SUCCESS;
+        if (!cvk_command_buffer::submit(cmdbufs, waits, &signal_value)) {
+            status = CL_OUT_OF_RESOURCES;
+        } else if (signal_value != 0) {
+            for (auto cmd : cmds) {
+                cmd->set_device_completion(signal_value);
+            }
+        }
+        TRACE_END();
+    }
+
+    if (status != CL_SUCCESS) {
+        // Retire everything submitted before reporting the error
+        while (!in_flight.empty()) {
+            retire_cmd(in_flight, global_status);
+        }
+        for (auto cmd : cmds) {
+            cl_int cmd_status = cmd->complete(status);
+            if (global_status == CL_SUCCESS)
+                global_status = cmd_status;
+            delete_cmd(cmd);
+        }
+        return;
+    }
+
+    for (auto cmd : cmds) {
+        in_flight.push_back(cmd);
+    }
+}
+
 cl_int cvk_command_group::execute_cmds() {
     TRACE_FUNCTION();
     cl_int global_status = CL_SUCCESS;
-    while (!commands.empty()) {
-        cvk_command* cmd = commands.front();
+    std::deque<cvk_command*> in_flight;
+    std::deque<cvk_command*> deferred;
+
+    while (!commands.empty() || !deferred.empty()) {
+        cvk_command* cmd = nullptr;
+
+        // Commands from out-of-order queues whose dependencies are not
+        // resolved are deferred so that the commands that do not depend on
+        // them can make progress. Pick the first one that became ready.
+        for (auto it = deferred.begin(); it != deferred.end(); ++it) {
+            if ((*it)->dependencies_resolved()) {
+                cmd = *it;
+                deferred.erase(it);
+                break;
+            }
+        }
+
+        if (cmd == nullptr && !commands.empty()) {
+            cmd = commands.front();
+            commands.pop_front();
+            if (cmd->queue()->is_out_of_order() &&
+                !can_submit_ahead(cmd, in_flight) &&
+                !cmd->dependencies_resolved()) {
+                cvk_debug_fn("deferring command %p (%s)", cmd,
+                             cl_command_type_to_string(cmd->type()));
+                deferred.push_back(cmd);
+                continue;
+            }
+        }
+
+        if (cmd == nullptr) {
+            // Nothing can make progress without waiting. Retire the commands
+            // in flight first as deferred commands may depend on them.
+            if (!in_flight.empty()) {
+                while (!in_flight.empty()) {
+                    retire_cmd(in_flight, global_status);
+                }
+                continue;
+            }
+            // Deferred commands are in enqueue order and can only depend on
+            // commands enqueued before them. The dependencies of the first
+            // one are necessarily outside of this group.
+            deferred.front()->wait_for_unresolved_dependency();
+            continue;
+        }
+
+        if (can_submit_ahead(cmd, in_flight)) {
+            if (in_flight.size() >= config.max_batches_in_flight) {
+                retire_cmd(in_flight, global_status);
+            }
+
+            // Gather the following commands that can be submitted along
+            // with this one. They are considered in flight when checking
+            // the dependencies of the next ones as they are submitted in
+            // order to the same Vulkan queue.
+            std::vector<cvk_command*> submission = {cmd};
+            if (cmd->coalescable_command_buffer() != nullptr) {
+                std::deque<cvk_command*> pending = in_flight;
+                pending.push_back(cmd);
+                while (!commands.empty() &&
+                       pending.size() < config.max_batches_in_flight) {
+                    auto next = commands.front();
+                    if (next->coalescable_command_buffer() == nullptr ||
+                        !can_submit_ahead(next, pending)) {
+                        break;
+                    }
+                    commands.pop_front();
+                    submission.push_back(next);
+                    pending.push_back(next);
+                }
+            }
+
+            submit_cmds(in_flight, submission, global_status);
+
+            // Retire the commands whose work has already completed without
+            // blocking so that their events are signalled as early as
+            // possible.
+            while (!in_flight.empty() &&
+                   in_flight.front()->submitted_work_completed()) {
+                retire_cmd(in_flight, global_status);
+            }
+            continue;
+        }
+
+        // Commands that cannot be submitted ahead may wait on the host for
+        // the completion of the commands in flight.
+        while (!in_flight.empty()) {
+            retire_cmd(in_flight, global_status);
+        }
+
         cvk_debug_fn("executing command %p (%s), event %p", cmd,
                      cl_command_type_to_string(cmd->type()), cmd->event());
 
@@ -359,14 +688,13 @@ cl_int cvk_command_group::execute_cmds() {
             global_status = status;
         cvk_debug_fn("command returned %d", status);
 
-        commands.pop_front();
+        delete_cmd(cmd);
+    }
 
-        // Deleting batch with many commands can take a while. Trace it to be
-        // able to understand it easily.
-        TRACE_BEGIN("delete_cmd");
-        delete cmd;
-        TRACE_END();
+    while (!in_flight.empty()) {
+        retire_cmd(in_flight, global_status);
     }
+
     return global_status;
 }
 
@@ -377,6 +705,13 @@ cl_int cvk_command_queue::execute_cmds_required_by_no_lock(
         return CL_SUCCESS;
     }
 
+    // Commands enqueued before the ones required are not necessarily
+    // dependencies in out-of-order queues and may be blocked. Let the
+    // executor schedule them.
+    if (is_out_of_order()) {
+        return CL_SUCCESS;
+    }
+
     m_lock.unlock();
     auto cmds = exec->extract_cmds_required_by(false, num_events, event_list);
     auto ret = cmds.execute_cmds();
@@ -505,6 +840,20 @@ cl_int cvk_command_queue::flush_no_lock() {
 
     CVK_ASSERT(group->commands.size() > 0);
 
+    // Commands in out-of-order queues can complete in any order. Terminate
+    // the group with a marker that depends on all the commands enqueued so
+    // far so that it can be used as the finish event.
+    if (is_out_of_order()) {
+        auto marker = new cvk_command_dep(this, CL_COMMAND_MARKER);
+        for (auto& ev : m_events_since_barrier) {
+            marker->add_dependency(ev);
+        }
+        if (m_barrier_event != nullptr) {
+            marker->add_dependency(m_barrier_event);
+        }
+        group->commands.push_back(marker);
+    }
+
     // Set event state and profiling info
     for (auto cmd : group->commands) {
         cmd->set_event_status(CL_SUBMITTED);
@@ -548,23 +897,191 @@ cl_int cvk_command_queue::finish() {
     return CL_SUCCESS;
 }
 
-VkResult cvk_command_pool::allocate_command_buffer(VkCommandBuffer* cmdbuf) {
+VkResult cvk_command_pool::create_command_pool(VkCommandPool* pool) {
+    VkCommandPoolCreateFlags flags = 0;
+    if (m_device->is_driver_behavior_enabled(
+            cvk_device::use_reset_command_buffer_bit)) {
+        flags |= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    }
 
-    std::lock_guard<std::mutex> lock(m_lock);
+    VkCommandPoolCreateInfo createInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr, flags,
+        m_queue_family};
+
+    VkResult res = vkCreateCommandPool(m_device->vulkan_device(), &createInfo,
+                                       nullptr, pool);
+    if (res != VK_SUCCESS) {
+        cvk_error_fn("could not create command pool: %s",
+                     vulkan_error_string(res));
+    }
+    return res;
+}
+
+VkResult cvk_command_pool::create_chunk(pool_chunk** chunk) {
+    VkCommandPool pool;
+    VkResult res = create_command_pool(&pool);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+
+    auto new_chunk = std::make_unique<pool_chunk>();
+    new_chunk->pool = pool;
+    new_chunk->next_buffer = 0;
+    new_chunk->buffers_in_use = 0;
+    *chunk = new_chunk.get();
+    m_chunks.push_back(std::move(new_chunk));
+    TRACE_CNT(pools_counter, m_chunks.size());
+
+    return VK_SUCCESS;
+}
+
+// Whether switching pools stays within max_command_pools
+bool cvk_command_pool::can_switch_chunk() const {
+    return !m_idle_chunks.empty() ||
+           (m_chunks.size() < config.max_command_pools) ||
+           ((m_current != nullptr) && (m_current->buffers_in_use == 0));
+}
+
+// Make an idle pool or a new one the current pool once all the command
+// buffers of the current one have been handed out.
+VkResult cvk_command_pool::switch_chunk() {
+    pool_chunk* previous = m_current;
+    m_current = nullptr;
+    if (previous != nullptr && previous->buffers_in_use == 0) {
+        release_chunk(previous);
+    }
+
+    if (!m_idle_chunks.empty()) {
+        m_current = m_idle_chunks.back();
+        m_idle_chunks.pop_back();
+        return VK_SUCCESS;
+    }
+
+    return create_chunk(&m_current);
+}
+
+// Reset a pool whose command buffers have all been released so that it can
+// be reused, or destroy it if enough pools are already idle.
+void cvk_command_pool::release_chunk(pool_chunk* chunk) {
+    auto vkdev = m_device->vulkan_device();
+
+    if (m_idle_chunks.size() >= config.max_idle_command_pools) {
+        for (auto buf : chunk->buffers) {
+            m_chunk_of_buffer.erase(buf);
+        }
+        vkDestroyCommandPool(vkdev, chunk->pool, nullptr);
+        for (auto it = m_chunks.begin(); it != m_chunks.end(); ++it) {
+            if (it->get() == chunk) {
+                m_chunks.erase(it);
+                break;
+            }
+        }
+        TRACE_CNT(pools_counter, m_chunks.size());
+        return;
+    }
+
+    VkResult res = vkResetCommandPool(vkdev, chunk->pool, 0);
+    if (res != VK_SUCCESS) {
+        cvk_error_fn("could not reset command pool: %s",
+                     vulkan_error_string(res));
+    }
+    chunk->next_buffer = 0;
+    m_idle_chunks.push_back(chunk);
+}
+
+VkResult
+cvk_command_pool::allocate_dedicated_command_buffer(VkCommandBuffer* cmdbuf) {
+    if (m_dedicated_pool == VK_NULL_HANDLE) {
+        VkResult res = create_command_pool(&m_dedicated_pool);
+        if (res != VK_SUCCESS) {
+            m_dedicated_pool = VK_NULL_HANDLE;
+            return res;
+        }
+    }
 
     VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, 0, m_command_pool,
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, 0, m_dedicated_pool,
         VK_COMMAND_BUFFER_LEVEL_PRIMARY,
         1 // commandBufferCount
     };
 
-    return vkAllocateCommandBuffers(m_device->vulkan_device(),
-                                    &commandBufferAllocateInfo, cmdbuf);
+    VkResult res = vkAllocateCommandBuffers(
+        m_device->vulkan_device(), &commandBufferAllocateInfo, cmdbuf);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+    m_chunk_of_buffer[*cmdbuf] = nullptr;
+    m_num_buffers_in_use++;
+    TRACE_CNT(buffers_in_use_counter, m_num_buffers_in_use);
+
+    return VK_SUCCESS;
+}
+
+VkResult cvk_command_pool::allocate_command_buffer(VkCommandBuffer* cmdbuf) {
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (m_current == nullptr ||
+        m_current->next_buffer >= config.command_buffers_per_pool) {
+        // All the pools have command buffers in flight
+        if (!can_switch_chunk()) {
+            return allocate_dedicated_command_buffer(cmdbuf);
+        }
+        VkResult res = switch_chunk();
+        if (res != VK_SUCCESS) {
+            return res;
+        }
+    }
+
+    auto chunk = m_current;
+
+    // Command buffers are allocated the first time the pool hands them out
+    // and reused after the pool has been reset.
+    if (chunk->next_buffer == chunk->buffers.size()) {
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, 0, chunk->pool,
+            VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            1 // commandBufferCount
+        };
+
+        VkCommandBuffer buf;
+        VkResult res = vkAllocateCommandBuffers(
+            m_device->vulkan_device(), &commandBufferAllocateInfo, &buf);
+        if (res != VK_SUCCESS) {
+            return res;
+        }
+        chunk->buffers.push_back(buf);
+        m_chunk_of_buffer[buf] = chunk;
+    }
+
+    *cmdbuf = chunk->buffers[chunk->next_buffer++];
+    chunk->buffers_in_use++;
+    m_num_buffers_in_use++;
+    TRACE_CNT(buffers_in_use_counter, m_num_buffers_in_use);
+
+    return VK_SUCCESS;
 }
 
 void cvk_command_pool::free_command_buffer(VkCommandBuffer buf) {
     std::lock_guard<std::mutex> lock(m_lock);
-    vkFreeCommandBuffers(m_device->vulkan_device(), m_command_pool, 1, &buf);
+
+    auto chunk = m_chunk_of_buffer.at(buf);
+    if (chunk == nullptr) {
+        vkFreeCommandBuffers(m_device->vulkan_device(), m_dedicated_pool, 1,
+                             &buf);
+        m_chunk_of_buffer.erase(buf);
+        m_num_buffers_in_use--;
+        TRACE_CNT(buffers_in_use_counter, m_num_buffers_in_use);
+        return;
+    }
+    CVK_ASSERT(chunk->buffers_in_use > 0);
+    chunk->buffers_in_use--;
+    m_num_buffers_in_use--;
+    TRACE_CNT(buffers_in_use_counter, m_num_buffers_in_use);
+
+    if (chunk->buffers_in_use == 0 && chunk != m_current) {
+        release_chunk(chunk);
+    }
 }
 
 bool cvk_command_buffer::begin() {
@@ -589,24 +1106,84 @@ bool cvk_command_buffer::begin() {
     return true;
 }
 
-bool cvk_command_buffer::submit_and_wait() {
-    auto& queue = m_queue->vulkan_queue();
+bool cvk_command_buffer::submit(const cvk_semaphore_wait_list& waits,
+                                uint64_t* signal_value) {
+    return submit({this}, {&waits}, signal_value);
+}
 
-    VkResult res = queue.submit(m_command_buffer);
+bool cvk_command_buffer::submit(
+    const std::vector<cvk_command_buffer*>& cmdbufs,
+    const std::vector<const cvk_semaphore_wait_list*>& waits,
+    uint64_t* signal_value) {
+    CVK_ASSERT(cmdbufs.size() > 0);
+    cvk_command_queue* queue = cmdbufs.front()->m_queue;
 
+    auto fence = std::make_shared<cvk_fence>(queue->device()->vulkan_device());
+    VkResult res = fence->init();
     if (res != VK_SUCCESS) {
+        cvk_error_fn("could not create fence: %s", vulkan_error_string(res));
         return false;
     }
 
-    res = queue.wait_idle();
+    std::vector<VkCommandBuffer> vkcmdbufs;
+    vkcmdbufs.reserve(cmdbufs.size());
+    for (auto cmdbuf : cmdbufs) {
+        CVK_ASSERT(cmdbuf->m_queue == queue);
+        vkcmdbufs.push_back(cmdbuf->m_command_buffer);
+        cmdbuf->m_fence = fence;
+    }
+
+    auto semaphore = queue->timeline_semaphore();
 
+    *signal_value = 0;
+    res = queue->vulkan_queue().submit(vkcmdbufs, waits, fence->vulkan_fence(),
+                                       semaphore.get(), signal_value);
+
+    return res == VK_SUCCESS;
+}
+
+bool cvk_command_buffer::wait() {
+    CVK_ASSERT(m_fence != nullptr);
+
+    VkResult res = m_fence->wait();
     if (res != VK_SUCCESS) {
+        cvk_error_fn("could not wait for fence: %s", vulkan_error_string(res));
         return false;
     }
 
     return true;
 }
 
+bool cvk_command_buffer::completed() {
+    CVK_ASSERT(m_fence != nullptr);
+    return m_fence->signalled();
+}
+
+void record_memory_barrier(VkCommandBuffer cmdbuf) {
+    VkMemoryBarrier memoryBarrier = {
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr,
+        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT};
+
+    // Workaround for a bug on some NVIDIA devices.
+    // This should already be covered by VK_ACCESS_MEMORY_READ_BIT.
+    memoryBarrier.dstAccessMask |= VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(
+        cmdbuf,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+            VK_PIPELINE_STAGE_TRANSFER_BIT, // srcStageMask
+        VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, // dstStageMask
+        0,                                        // dependencyFlags
+        1,                                        // memoryBarrierCount
+        &memoryBarrier,
+        0,        // bufferMemoryBarrierCount
+        nullptr,  // pBufferMemoryBarriers
+        0,        // imageMemoryBarrierCount
+        nullptr); // pImageMemoryBarriers
+}
+
 cl_int cvk_command_kernel::update_global_push_constants(
     cvk_command_buffer& command_buffer) {
     auto program = m_kernel->program();
@@ -716,6 +1293,7 @@ cl_int cvk_command_kernel::update_global_push_constants(
     }
     if (m_kernel->has_pod_arguments() &&
         !m_kernel->has_pod_buffer_arguments()) {
+        CLVK_UNIT_COUNT(pod_pushconstant_enqueues);
         for (auto& arg : m_kernel->arguments()) {
             if (arg.kind == kernel_argument_kind::pod_pushconstant ||
                 arg.kind == kernel_argument_kind::pointer_pushconstant) {
@@ -753,67 +1331,15 @@ cl_int cvk_command_kernel::dispatch_uniform_region_within_vklimits(
     };
 
     auto program = m_kernel->program();
-    auto constants = program->spec_constants();
-    // TODO: if all kernels in the module use the same reqd_workgroup_size ,
-    // clspv will not generate specialization constants for workgroup size, but
-    // these values should be error checked.
-    uint32_t wgsize_x_id = 0;
-    auto where = constants.find(spec_constant::workgroup_size_x);
-    if (where != constants.end()) {
-        wgsize_x_id = where->second;
-    }
-    uint32_t wgsize_y_id = 1;
-    where = constants.find(spec_constant::workgroup_size_y);
-    if (where != constants.end()) {
-        wgsize_y_id = where->second;
-    }
-    uint32_t wgsize_z_id = 2;
-    where = constants.find(spec_constant::workgroup_size_z);
-    if (where != constants.end()) {
-        wgsize_z_id = where->second;
-    }
-
-    cvk_spec_constant_map specConstants = {
-        {wgsize_x_id, region.lws[0]},
-        {wgsize_y_id, region.lws[1]},
-        {wgsize_z_id, region.lws[2]},
-    };
+    cvk_spec_constant_key specConstants;
+    m_kernel->fill_spec_constant_key(specConstants, region.lws, m_dimensions,
+                                     m_ndrange.offset);
     for (auto const& spec_value :
          m_argument_values->specialization_constants()) {
-        specConstants[spec_value.first] = spec_value.second;
-    }
-    // Clspv allocates a spec constant for work dimensions if get_work_dim() is
-    // used.
-    where = constants.find(spec_constant::work_dim);
-    if (where != constants.end()) {
-        uint32_t dim_id = where->second;
-        specConstants[dim_id] = m_dimensions;
-    }
-
-    where = constants.find(spec_constant::subgroup_max_size);
-    if (where != constants.end()) {
-        uint32_t size_id = where->second;
-        specConstants[size_id] = m_queue->device()->sub_group_size();
-    }
-
-    // Clspv can allocate spec constants for global offset.
-    where = constants.find(spec_constant::global_offset_x);
-    if (where != constants.end()) {
-        uint32_t offset_id = where->second;
-        specConstants[offset_id] = m_ndrange.offset[0];
-    }
-    where = constants.find(spec_constant::global_offset_y);
-    if (where != constants.end()) {
-        uint32_t offset_id = where->second;
-        specConstants[offset_id] = m_ndrange.offset[1];
-    }
-    where = constants.find(spec_constant::global_offset_z);
-    if (where != constants.end()) {
-        uint32_t offset_id = where->second;
-        specConstants[offset_id] = m_ndrange.offset[2];
+        specConstants.set(spec_value.first, spec_value.second);
     }
 
-    m_pipeline = m_kernel->create_pipeline(specConstants);
+    m_pipeline = m_kernel->get_pipeline(specConstants);
 
     if (m_pipeline == VK_NULL_HANDLE) {
         return CL_OUT_OF_RESOURCES;
@@ -1029,12 +1555,36 @@ cvk_command_kernel::build_batchable_inner(cvk_command_buffer& command_buffer) {
     m_argument_values->retain_resources();
 
     // Setup descriptors
-    if (!m_argument_values->setup_descriptor_sets()) {
+    if (!m_argument_values->setup_descriptor_sets(m_queue->pod_ring())) {
         m_argument_values->release_resources();
         m_argument_values = nullptr;
         return CL_OUT_OF_RESOURCES;
     }
 
+    // Argument values whose descriptors are bound
+    auto argvals = m_argument_values.get();
+    if (argvals->pod_data_in_ring()) {
+        m_pod_allocation = argvals->write_pod_data_to_ring();
+        if (m_pod_allocation == nullptr) {
+            // The ring is full, use the copy of the argument values that has
+            // its own POD buffer. It is shared by all the enqueues of these
+            // values and kept until they are released. The queue submits the
+            // batch so that its commands return their ranges to the ring.
+            CLVK_UNIT_COUNT(pod_ring_fallbacks);
+            m_queue->pod_ring_exhausted();
+            argvals = m_argument_values->pod_fallback();
+            if (argvals == nullptr) {
+                m_argument_values->release_resources();
+                m_argument_values = nullptr;
+                return CL_OUT_OF_RESOURCES;
+            }
+        }
+    }
+    uint32_t pod_offset = 0;
+    if (m_pod_allocation != nullptr) {
+        pod_offset = static_cast<uint32_t>(m_pod_allocation->offset());
+    }
+
     // Setup printf buffer descriptor if needed
     if (m_kernel->program()->uses_printf()) {
         // Create and initialize the printf buffer
@@ -1051,7 +1601,7 @@ cvk_command_kernel::build_batchable_inner(cvk_command_buffer& command_buffer) {
                                                  0, // offset
                                                  VK_WHOLE_SIZE};
 
-            auto* ds = m_argument_values->descriptor_sets();
+            auto* ds = argvals->descriptor_sets();
             VkWriteDescriptorSet writeDescriptorSet = {
                 VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                 nullptr,
@@ -1071,11 +1621,35 @@ cvk_command_kernel::build_batchable_inner(cvk_command_buffer& command_buffer) {
     }
 
     // Bind descriptors and update push constants
-    if (m_kernel->num_set_layouts() > 0) {
+    if (m_kernel->uses_push_descriptors()) {
+        // The POD buffer descriptor isn't dynamic when it is pushed and the
+        // sets bound around the push descriptor set don't hold it.
+        uint32_t push_set = m_kernel->push_descriptor_set();
+        uint32_t num_sets = m_kernel->num_set_layouts();
+        auto* ds = argvals->descriptor_sets();
+        if (push_set > 0) {
+            vkCmdBindDescriptorSets(command_buffer,
+                                    VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    m_kernel->pipeline_layout(), 0, push_set,
+                                    ds, 0, nullptr);
+        }
+        if (push_set + 1 < num_sets) {
+            vkCmdBindDescriptorSets(
+                command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                m_kernel->pipeline_layout(), push_set + 1,
+                num_sets - push_set - 1, &ds[push_set + 1], 0, nullptr);
+        }
+        argvals->push_descriptors(command_buffer, pod_offset);
+    } else if (m_kernel->num_set_layouts() > 0) {
+        uint32_t num_dynamic_offsets = 0;
+        if (m_kernel->has_pod_buffer_arguments()) {
+            num_dynamic_offsets = 1;
+        }
         vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
                                 m_kernel->pipeline_layout(), 0,
                                 m_kernel->num_set_layouts(),
-                                m_argument_values->descriptor_sets(), 0, 0);
+                                argvals->descriptor_sets(),
+                                num_dynamic_offsets, &pod_offset);
     }
 
     auto err = update_global_push_constants(command_buffer);
@@ -1089,6 +1663,12 @@ cvk_command_kernel::build_batchable_inner(cvk_command_buffer& command_buffer) {
         return err;
     }
 
+    // Commands in out-of-order queues are only synchronised with the
+    // commands they depend on, see cvk_command_batch::add_command.
+    if (m_queue->is_out_of_order()) {
+        return CL_SUCCESS;
+    }
+
     // Synchronise wrt to memory and other commands
     VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER, // sType
                                      nullptr,                          // pNext
@@ -1130,27 +1710,25 @@ cl_int cvk_command_kernel::do_post_action() {
 }
 
 bool cvk_command_batchable::can_be_batched() const {
-    bool unresolved_user_event_dependencies = false;
     bool unresolved_other_queue_dependencies = false;
 
     for (auto ev : dependencies()) {
+        // Batches are not submitted before the user events their commands
+        // depend on have been signalled.
         if (ev->is_user_event()) {
-            if (!ev->completed()) {
-                unresolved_user_event_dependencies = true;
-                break;
-            } else {
-                continue;
-            }
+            continue;
         }
 
-        if ((ev->queue() != queue()) && !ev->completed()) {
+        // Commands from other queues can be waited for on the device when
+        // timeline semaphores are supported.
+        if ((ev->queue() != queue()) && !ev->completed() &&
+            (m_queue->timeline_semaphore() == nullptr)) {
             unresolved_other_queue_dependencies = true;
             break;
         }
     }
 
-    return !unresolved_user_event_dependencies &&
-           !unresolved_other_queue_dependencies;
+    return !unresolved_other_queue_dependencies;
 }
 
 cl_int cvk_command_batchable::build() {
@@ -1164,6 +1742,10 @@ cl_int cvk_command_batchable::build() {
         return err;
     }
 
+    if (m_queue->is_out_of_order()) {
+        record_memory_barrier(*m_command_buffer);
+    }
+
     if (!m_command_buffer->end()) {
         return CL_OUT_OF_RESOURCES;
     }
@@ -1174,78 +1756,197 @@ cl_int cvk_command_batchable::build() {
 cl_int cvk_command_batchable::build(cvk_command_buffer& command_buffer) {
     CVK_ASSERT(m_command_buffer == nullptr ||
                (*m_command_buffer == command_buffer));
-    // Create query pool
-    VkQueryPoolCreateInfo query_pool_create_info = {
-        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-        nullptr,
-        0,                            // flags
-        VK_QUERY_TYPE_TIMESTAMP,      // queryType
-        NUM_POOL_QUERIES_PER_COMMAND, // queryCount
-        0,                            // pipelineStatistics
-    };
 
-    bool profiling = m_queue->has_property(CL_QUEUE_PROFILING_ENABLE);
+    bool profiling = m_queue->has_property(CL_QUEUE_PROFILING_ENABLE) &&
+                     m_queue->profiling_on_device();
 
-    if (profiling && m_queue->profiling_on_device()) {
-        auto vkdev = m_queue->device()->vulkan_device();
-        auto res = vkCreateQueryPool(vkdev, &query_pool_create_info, nullptr,
-                                     &m_query_pool);
-        if (res != VK_SUCCESS) {
+    // Sample timestamp if profiling
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+    uint32_t first_query = 0;
+    if (profiling) {
+        if (m_timestamp_queries == nullptr) {
+            m_timestamp_queries =
+                std::make_shared<cvk_timestamp_query_allocator>(m_queue);
+        }
+        if (!m_timestamp_queries->allocate_pair(&query_pool, &first_query,
+                                                &m_timestamp_query_pair)) {
             return CL_OUT_OF_RESOURCES;
         }
-    }
-
-    // Sample timestamp if profiling
-    if (profiling && m_queue->profiling_on_device()) {
-        vkCmdResetQueryPool(command_buffer, m_query_pool, 0,
-                            NUM_POOL_QUERIES_PER_COMMAND);
+        vkCmdResetQueryPool(command_buffer, query_pool, first_query, 2);
         vkCmdWriteTimestamp(command_buffer,
-                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, m_query_pool,
-                            POOL_QUERY_CMD_START);
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, query_pool,
+                            first_query + POOL_QUERY_CMD_START);
     }
 
     auto err = build_batchable_inner(command_buffer);
-    if (err != CL_SUCCESS) {
-        return err;
-    }
 
-    // Sample timestamp if profiling
-    if (profiling && m_queue->profiling_on_device()) {
+    // Sample timestamp if profiling. This is done even if building the
+    // command failed as the results of all the queries allocated are read
+    // together.
+    if (profiling) {
         vkCmdWriteTimestamp(command_buffer,
-                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, m_query_pool,
-                            POOL_QUERY_CMD_END);
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, query_pool,
+                            first_query + POOL_QUERY_CMD_END);
     }
 
-    return CL_SUCCESS;
+    return err;
 }
 
 cl_int cvk_command_batchable::get_timestamp_query_results(cl_ulong* start,
                                                           cl_ulong* end) {
-    uint64_t timestamps[NUM_POOL_QUERIES_PER_COMMAND];
-    auto dev = m_queue->device();
-    auto res = vkGetQueryPoolResults(
-        dev->vulkan_device(), m_query_pool, 0, NUM_POOL_QUERIES_PER_COMMAND,
-        sizeof(timestamps), timestamps, sizeof(uint64_t),
-        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
-    if (res != VK_SUCCESS) {
-        cvk_error_fn("vkGetQueryPoolResults failed %d %s", res,
-                     vulkan_error_string(res));
-        return CL_OUT_OF_RESOURCES;
+    CVK_ASSERT(m_timestamp_queries != nullptr);
+    cl_int err = m_timestamp_queries->read_results();
+    if (err != CL_COMPLETE) {
+        return err;
     }
 
-    auto ts_start_raw = timestamps[POOL_QUERY_CMD_START];
-    auto ts_end_raw = timestamps[POOL_QUERY_CMD_END];
+    uint64_t ts_start_raw, ts_end_raw;
+    m_timestamp_queries->get_results(m_timestamp_query_pair, &ts_start_raw,
+                                     &ts_end_raw);
 
+    auto dev = m_queue->device();
     *start = dev->timestamp_to_ns(ts_start_raw);
     *end = dev->timestamp_to_ns(ts_end_raw);
 
     return CL_COMPLETE;
 }
 
+bool cvk_timestamp_query_allocator::allocate_pair(VkQueryPool* pool,
+                                                  uint32_t* first_query,
+                                                  uint32_t* pair) {
+    CVK_ASSERT(!m_results_read);
+    const uint32_t queries_per_pool =
+        cvk_command_queue::TIMESTAMP_QUERIES_PER_POOL;
+
+    if (m_pools.empty() || m_num_queries_in_last_pool == queries_per_pool) {
+        VkQueryPool new_pool;
+        if (m_queue->acquire_timestamp_query_pool(&new_pool) != VK_SUCCESS) {
+            return false;
+        }
+        m_pools.push_back(new_pool);
+        m_num_queries_in_last_pool = 0;
+    }
+
+    *pool = m_pools.back();
+    *first_query = m_num_queries_in_last_pool;
+    *pair = ((m_pools.size() - 1) * queries_per_pool + *first_query) / 2;
+    m_num_queries_in_last_pool += 2;
+
+    return true;
+}
+
+cl_int cvk_timestamp_query_allocator::read_results() {
+    if (m_results_read) {
+        return CL_COMPLETE;
+    }
+
+    TRACE_FUNCTION("num_pools", m_pools.size());
+
+    const uint32_t queries_per_pool =
+        cvk_command_queue::TIMESTAMP_QUERIES_PER_POOL;
+    auto vkdev = m_queue->device()->vulkan_device();
+
+    m_results.resize(m_pools.size() * queries_per_pool);
+    for (size_t i = 0; i < m_pools.size(); i++) {
+        uint32_t count = (i == m_pools.size() - 1) ? m_num_queries_in_last_pool
+                                                   : queries_per_pool;
+        auto res = vkGetQueryPoolResults(
+            vkdev, m_pools[i], 0, count, count * sizeof(uint64_t),
+            &m_results[i * queries_per_pool], sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        if (res != VK_SUCCESS) {
+            cvk_error_fn("vkGetQueryPoolResults failed %d %s", res,
+                         vulkan_error_string(res));
+            return CL_OUT_OF_RESOURCES;
+        }
+    }
+
+    m_results_read = true;
+
+    return CL_COMPLETE;
+}
+
+VkResult cvk_command_queue::acquire_timestamp_query_pool(VkQueryPool* pool) {
+    {
+        std::lock_guard<std::mutex> lock(m_query_pools_lock);
+        if (!m_free_query_pools.empty()) {
+            *pool = m_free_query_pools.back();
+            m_free_query_pools.pop_back();
+            return VK_SUCCESS;
+        }
+    }
+
+    VkQueryPoolCreateInfo query_pool_create_info = {
+        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        nullptr,
+        0,                          // flags
+        VK_QUERY_TYPE_TIMESTAMP,    // queryType
+        TIMESTAMP_QUERIES_PER_POOL, // queryCount
+        0,                          // pipelineStatistics
+    };
+
+    auto res = vkCreateQueryPool(m_device->vulkan_device(),
+                                 &query_pool_create_info, nullptr, pool);
+    if (res != VK_SUCCESS) {
+        cvk_error_fn("could not create query pool: %s",
+                     vulkan_error_string(res));
+    }
+
+    return res;
+}
+
+void cvk_command_queue::release_timestamp_query_pool(VkQueryPool pool) {
+    std::lock_guard<std::mutex> lock(m_query_pools_lock);
+    m_free_query_pools.push_back(pool);
+}
+
+cvk_buffer_ring* cvk_command_queue::pod_ring() {
+    std::lock_guard<std::mutex> lock(m_pod_ring_lock);
+
+    if (!m_pod_ring_created) {
+        m_pod_ring_created = true;
+        if (config.pod_ring_size > 0) {
+            auto& limits = m_device->vulkan_limits();
+            VkDeviceSize alignment =
+                std::max(limits.minStorageBufferOffsetAlignment,
+                         limits.minUniformBufferOffsetAlignment);
+            m_pod_ring = cvk_buffer_ring::create(
+                context(), config.pod_ring_size, alignment);
+            if (m_pod_ring == nullptr) {
+                cvk_warn_fn("could not create POD argument ring");
+            }
+        }
+    }
+
+    return m_pod_ring.get();
+}
+
 cl_int cvk_command_batchable::do_action() {
+    cl_int status = do_submit();
+    if (status != CL_SUCCESS) {
+        return status;
+    }
+
+    return do_complete();
+}
+
+cl_int cvk_command_batchable::do_submit() {
     CVK_ASSERT(m_command_buffer);
 
-    if (!m_command_buffer->submit_and_wait()) {
+    uint64_t signal_value;
+    if (!m_command_buffer->submit(device_dependency_waits(), &signal_value)) {
+        return CL_OUT_OF_RESOURCES;
+    }
+
+    if (signal_value != 0) {
+        set_device_completion(signal_value);
+    }
+
+    return CL_SUCCESS;
+}
+
+cl_int cvk_command_batchable::do_complete() {
+    if (!m_command_buffer->wait()) {
         return CL_OUT_OF_RESOURCES;
     }
 
@@ -1253,10 +1954,32 @@ cl_int cvk_command_batchable::do_action() {
 }
 
 cl_int cvk_command_batch::do_action() {
+    cl_int status = do_submit();
+    if (status != CL_SUCCESS) {
+        return status;
+    }
+
+    return do_complete();
+}
+
+cl_int cvk_command_batch::do_submit() {
 
     cvk_info("executing batch of %lu commands", m_commands.size());
 
-    if (!m_command_buffer->submit_and_wait()) {
+    uint64_t signal_value;
+    if (!m_command_buffer->submit(device_dependency_waits(), &signal_value)) {
+        return CL_OUT_OF_RESOURCES;
+    }
+
+    if (signal_value != 0) {
+        set_device_completion(signal_value);
+    }
+
+    return CL_SUCCESS;
+}
+
+cl_int cvk_command_batch::do_complete() {
+    if (!m_command_buffer->wait()) {
         return CL_OUT_OF_RESOURCES;
     }
 
@@ -1307,26 +2030,6 @@ private:
     size_t m_elem_size;
 };
 
-struct memobj_map_holder {
-    memobj_map_holder(cvk_mem* memobj) : m_mem(memobj), m_mapped(false) {
-        CVK_ASSERT(memobj != nullptr);
-    }
-    ~memobj_map_holder() {
-        if (m_mapped) {
-            m_mem->unmap();
-        }
-    }
-
-    bool CHECK_RETURN map() {
-        m_mapped = m_mem->map();
-        return m_mapped;
-    }
-
-private:
-    cvk_mem* m_mem;
-    bool m_mapped;
-};
-
 void cvk_rectangle_copier::do_copy(direction dir, void* src_base,
                                    void* dst_base) {
     rectangle ra, rb;
@@ -1358,9 +2061,7 @@ void cvk_rectangle_copier::do_copy(direction dir, void* src_base,
 }
 
 cl_int cvk_command_copy_host_buffer_rect::do_action() {
-    memobj_map_holder map_holder{m_buffer};
-
-    if (!map_holder.map()) {
+    if (!m_buffer->is_host_accessible()) {
         return CL_OUT_OF_RESOURCES;
     }
 
@@ -1389,15 +2090,107 @@ cl_int cvk_command_copy_host_buffer_rect::do_action() {
     return CL_COMPLETE;
 }
 
-cl_int cvk_command_copy_buffer_rect::do_action() {
-    memobj_map_holder src_map_holder{m_src_buffer};
-    memobj_map_holder dst_map_holder{m_dst_buffer};
+void cvk_rectangle_copier::get_buffer_copy_regions(
+    direction dir, VkDeviceSize src_base, VkDeviceSize dst_base,
+    std::vector<VkBufferCopy>& regions) const {
+    rectangle ra, rb;
 
-    if (!src_map_holder.map()) {
-        return CL_OUT_OF_RESOURCES;
+    ra.set_params(m_a_origin, m_a_slice_pitch, m_a_row_pitch, m_elem_size);
+    rb.set_params(m_b_origin, m_b_slice_pitch, m_b_row_pitch, m_elem_size);
+
+    rectangle *rsrc, *rdst;
+    if (dir == direction::A_TO_B) {
+        rsrc = &ra;
+        rdst = &rb;
+    } else {
+        CVK_ASSERT(dir == direction::B_TO_A);
+        rsrc = &rb;
+        rdst = &ra;
+    }
+
+    VkDeviceSize row_size = m_region[0] * m_elem_size;
+    for (size_t slice = 0; slice < m_region[2]; slice++) {
+        for (size_t row = 0; row < m_region[1]; row++) {
+            VkDeviceSize src = src_base + rsrc->get_row_offset(slice, row);
+            VkDeviceSize dst = dst_base + rdst->get_row_offset(slice, row);
+            if (!regions.empty()) {
+                auto& last = regions.back();
+                if ((last.srcOffset + last.size == src) &&
+                    (last.dstOffset + last.size == dst)) {
+                    last.size += row_size;
+                    continue;
+                }
+            }
+            regions.push_back({src, dst, row_size});
+        }
     }
+}
+
+static void record_buffer_copy(cvk_command_buffer& cmdbuf, cvk_buffer* src,
+                               cvk_buffer* dst,
+                               const std::vector<VkBufferCopy>& regions) {
+    VkBufferMemoryBarrier bufferBarriers[2] = {
+        {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER, nullptr,
+         VK_ACCESS_MEMORY_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+         0, // srcQueueFamilyIndex
+         0, // dstQueueFamilyIndex
+         src->vulkan_buffer(), src->vulkan_buffer_offset(), src->size()},
+        {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER, nullptr,
+         VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+         VK_ACCESS_TRANSFER_WRITE_BIT,
+         0, // srcQueueFamilyIndex
+         0, // dstQueueFamilyIndex
+         dst->vulkan_buffer(), dst->vulkan_buffer_offset(), dst->size()},
+    };
 
-    if (!dst_map_holder.map()) {
+    vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,              // dependencyFlags
+                         0,              // memoryBarrierCount
+                         nullptr,        // pMemoryBarriers
+                         2,              // bufferMemoryBarrierCount
+                         bufferBarriers, // pBufferMemoryBarriers
+                         0,              // imageMemoryBarrierCount
+                         nullptr);       // pImageMemoryBarriers
+
+    vkCmdCopyBuffer(cmdbuf, src->vulkan_buffer(), dst->vulkan_buffer(),
+                    static_cast<uint32_t>(regions.size()), regions.data());
+
+    VkMemoryBarrier memoryBarrier = {
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_ACCESS_MEMORY_WRITE_BIT | VK_ACCESS_MEMORY_READ_BIT};
+
+    vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0, // dependencyFlags
+                         1, // memoryBarrierCount
+                         &memoryBarrier,
+                         0,        // bufferMemoryBarrierCount
+                         nullptr,  // pBufferMemoryBarriers
+                         0,        // imageMemoryBarrierCount
+                         nullptr); // pImageMemoryBarriers
+}
+
+cl_int cvk_command_copy_buffer_rect::build_batchable_inner(
+    cvk_command_buffer& cmdbuf) {
+    std::vector<VkBufferCopy> regions;
+    m_copier.get_buffer_copy_regions(cvk_rectangle_copier::direction::A_TO_B,
+                                     m_src_buffer->vulkan_buffer_offset(),
+                                     m_dst_buffer->vulkan_buffer_offset(),
+                                     regions);
+
+    record_buffer_copy(cmdbuf, m_src_buffer, m_dst_buffer, regions);
+
+    return CL_SUCCESS;
+}
+
+cl_int cvk_command_copy_buffer_rect::do_action() {
+    if (has_own_command_buffer()) {
+        return cvk_command_batchable::do_action();
+    }
+
+    if (!m_src_buffer->is_host_accessible() ||
+        !m_dst_buffer->is_host_accessible()) {
         return CL_OUT_OF_RESOURCES;
     }
 
@@ -1410,7 +2203,24 @@ cl_int cvk_command_copy_buffer_rect::do_action() {
     return CL_COMPLETE;
 }
 
+cl_int
+cvk_command_copy_buffer::build_batchable_inner(cvk_command_buffer& cmdbuf) {
+    std::vector<VkBufferCopy> regions = {{
+        m_src_buffer->vulkan_buffer_offset() + m_src_offset, // srcOffset
+        m_dst_buffer->vulkan_buffer_offset() + m_dst_offset, // dstOffset
+        m_size,                                              // size
+    }};
+
+    record_buffer_copy(cmdbuf, m_src_buffer, m_dst_buffer, regions);
+
+    return CL_SUCCESS;
+}
+
 cl_int cvk_command_copy_buffer::do_action() {
+    if (has_own_command_buffer()) {
+        return cvk_command_batchable::do_action();
+    }
+
     bool success =
         m_src_buffer->copy_to(m_dst_buffer, m_src_offset, m_dst_offset, m_size);
 
@@ -1429,10 +2239,158 @@ void memset_multi(void* dst, void* pattern_ptr, size_t size) {
 }
 } // namespace
 
+cvk_command_fill_buffer::method cvk_command_fill_buffer::select_method() {
+    VkDeviceSize begin = m_buffer->vulkan_buffer_offset() + m_offset;
+    VkDeviceSize end = begin + m_size;
+    VkDeviceSize aligned_begin = ceil_div<VkDeviceSize>(begin, 4) * 4;
+    VkDeviceSize aligned_end = (end / 4) * 4;
+
+    // The pattern repeats every four bytes if both periods agree over
+    // a common multiple of them.
+    bool repeats_every_word = true;
+    for (size_t i = 0; i < 4 * m_pattern_size; i++) {
+        if (pattern_byte(i) != pattern_byte(i % 4)) {
+            repeats_every_word = false;
+            break;
+        }
+    }
+
+    // The unaligned bytes at either end are copied from the four bytes next
+    // to them.
+    if (repeats_every_word && (aligned_end >= aligned_begin + 4)) {
+        return method::fill_word;
+    }
+
+    // vkCmdUpdateBuffer requires an offset and a size that are multiples of
+    // four. The first update has to contain at least one whole pattern.
+    VkDeviceSize update_size =
+        (std::min(static_cast<VkDeviceSize>(m_size), MAX_UPDATE_SIZE) / 4) * 4;
+    if ((begin % 4 == 0) && (update_size >= m_pattern_size)) {
+        return method::replicate;
+    }
+
+    return method::host;
+}
+
+static void record_transfer_barrier(VkCommandBuffer cmdbuf,
+                                    VkPipelineStageFlags src_stages,
+                                    VkAccessFlags src_access,
+                                    VkPipelineStageFlags dst_stages,
+                                    VkAccessFlags dst_access) {
+    VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr,
+                                     src_access, dst_access};
+
+    vkCmdPipelineBarrier(cmdbuf, src_stages, dst_stages,
+                         0, // dependencyFlags
+                         1, // memoryBarrierCount
+                         &memoryBarrier,
+                         0,        // bufferMemoryBarrierCount
+                         nullptr,  // pBufferMemoryBarriers
+                         0,        // imageMemoryBarrierCount
+                         nullptr); // pImageMemoryBarriers
+}
+
+void cvk_command_fill_buffer::record_fill_word(cvk_command_buffer& cmdbuf,
+                                               VkDeviceSize begin,
+                                               VkDeviceSize end) {
+    VkDeviceSize aligned_begin = ceil_div<VkDeviceSize>(begin, 4) * 4;
+    VkDeviceSize aligned_end = (end / 4) * 4;
+
+    // vkCmdFillBuffer writes the word with the host's endianness, the bytes
+    // are laid out as they are meant to appear in memory.
+    uint8_t bytes[4];
+    for (VkDeviceSize i = 0; i < 4; i++) {
+        bytes[i] = pattern_byte(aligned_begin - begin + i);
+    }
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+
+    VkBuffer buffer = m_buffer->vulkan_buffer();
+    vkCmdFillBuffer(cmdbuf, buffer, aligned_begin, aligned_end - aligned_begin,
+                    word);
+
+    if ((aligned_begin == begin) && (aligned_end == end)) {
+        return;
+    }
+
+    record_transfer_barrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                            VK_ACCESS_TRANSFER_WRITE_BIT,
+                            VK_PIPELINE_STAGE_TRANSFER_BIT,
+                            VK_ACCESS_TRANSFER_READ_BIT);
+
+    std::vector<VkBufferCopy> regions;
+    if (aligned_begin != begin) {
+        regions.push_back({begin + 4, begin, aligned_begin - begin});
+    }
+    if (aligned_end != end) {
+        regions.push_back({aligned_end - 4, aligned_end, end - aligned_end});
+    }
+    vkCmdCopyBuffer(cmdbuf, buffer, buffer,
+                    static_cast<uint32_t>(regions.size()), regions.data());
+}
+
+void cvk_command_fill_buffer::record_replicate(cvk_command_buffer& cmdbuf,
+                                               VkDeviceSize begin,
+                                               VkDeviceSize end) {
+    VkDeviceSize size = end - begin;
+    VkDeviceSize update_size = (std::min(size, MAX_UPDATE_SIZE) / 4) * 4;
+
+    std::vector<uint8_t> data(update_size);
+    for (VkDeviceSize i = 0; i < update_size; i++) {
+        data[i] = pattern_byte(i);
+    }
+
+    VkBuffer buffer = m_buffer->vulkan_buffer();
+    vkCmdUpdateBuffer(cmdbuf, buffer, begin, update_size, data.data());
+
+    // Double the filled range until the whole region is covered. Copies only
+    // ever cover whole patterns so that the pattern is kept in phase.
+    VkDeviceSize filled = (update_size / m_pattern_size) * m_pattern_size;
+    while (filled < size) {
+        record_transfer_barrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_ACCESS_TRANSFER_WRITE_BIT,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_ACCESS_TRANSFER_READ_BIT |
+                                    VK_ACCESS_TRANSFER_WRITE_BIT);
+        VkBufferCopy region = {begin, begin + filled,
+                               std::min(filled, size - filled)};
+        vkCmdCopyBuffer(cmdbuf, buffer, buffer, 1, &region);
+        filled += region.size;
+    }
+}
+
+cl_int cvk_command_fill_buffer::build_batchable_inner(
+    cvk_command_buffer& cmdbuf) {
+    CVK_ASSERT(m_method != method::host);
+
+    record_transfer_barrier(
+        cmdbuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    VkDeviceSize begin = m_buffer->vulkan_buffer_offset() + m_offset;
+    VkDeviceSize end = begin + m_size;
+    if (m_method == method::fill_word) {
+        record_fill_word(cmdbuf, begin, end);
+    } else {
+        record_replicate(cmdbuf, begin, end);
+    }
+
+    record_transfer_barrier(
+        cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT);
+
+    return CL_SUCCESS;
+}
+
 cl_int cvk_command_fill_buffer::do_action() {
-    memobj_map_holder map_holder{m_buffer};
+    if (has_own_command_buffer()) {
+        return cvk_command_batchable::do_action();
+    }
 
-    if (!map_holder.map()) {
+    if (!m_buffer->is_host_accessible()) {
         return CL_OUT_OF_RESOURCES;
     }
 
@@ -16,6 +16,7 @@
 
 #include <array>
 #include <memory>
+#include <unordered_map>
 
 #include "config.hpp"
 #include "event.hpp"
@@ -35,6 +36,12 @@ using cvk_command_queue_holder = refcounted_holder<cvk_command_queue>;
 struct cvk_command_group {
     std::deque<cvk_command*> commands;
     cl_int execute_cmds();
+
+private:
+    void retire_cmd(std::deque<cvk_command*>& in_flight,
+                    cl_int& global_status);
+    void submit_cmds(std::deque<cvk_command*>& in_flight,
+                     std::vector<cvk_command*>& cmds, cl_int& global_status);
 };
 
 struct cvk_executor_thread {
@@ -88,33 +95,38 @@ private:
     bool m_running;
 };
 
+// Command buffers are allocated from a ring of Vulkan command pools. Each
+// pool hands out its command buffers in turn and is reset as a whole once
+// all of them have been released, which lets the command buffers be reused
+// without being freed and allocated again.
 struct cvk_command_pool {
 
     cvk_command_pool(cvk_device* device, uint32_t queue_family)
-        : m_device(device), m_queue_family(queue_family),
-          m_command_pool(VK_NULL_HANDLE) {}
+        : m_device(device), m_queue_family(queue_family), m_current(nullptr),
+          m_dedicated_pool(VK_NULL_HANDLE), m_num_buffers_in_use(0) {
+        TRACE_CNT_VAR_INIT(pools_counter,
+                           "clvk-command-pool_" +
+                               std::to_string((uintptr_t)this) + "-pools");
+        TRACE_CNT_VAR_INIT(buffers_in_use_counter,
+                           "clvk-command-pool_" +
+                               std::to_string((uintptr_t)this) +
+                               "-buffers-in-use");
+    }
 
     ~cvk_command_pool() {
-        if (m_command_pool != VK_NULL_HANDLE) {
-            vkDestroyCommandPool(m_device->vulkan_device(), m_command_pool,
+        for (auto& chunk : m_chunks) {
+            vkDestroyCommandPool(m_device->vulkan_device(), chunk->pool,
+                                 nullptr);
+        }
+        if (m_dedicated_pool != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(m_device->vulkan_device(), m_dedicated_pool,
                                  nullptr);
         }
     }
 
     CHECK_RETURN VkResult init() {
-        VkCommandPoolCreateFlags flags = 0;
-        if (m_device->is_driver_behavior_enabled(
-                cvk_device::use_reset_command_buffer_bit)) {
-            flags |= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-        }
-
-        // Create command pool
-        VkCommandPoolCreateInfo createInfo = {
-            VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr, flags,
-            m_queue_family};
-
-        return vkCreateCommandPool(m_device->vulkan_device(), &createInfo,
-                                   nullptr, &m_command_pool);
+        std::lock_guard<std::mutex> lock(m_lock);
+        return create_chunk(&m_current);
     }
 
     VkResult allocate_command_buffer(VkCommandBuffer* buf);
@@ -125,10 +137,37 @@ struct cvk_command_pool {
     void unlock() { m_lock.unlock(); }
 
 private:
+    struct pool_chunk {
+        VkCommandPool pool;
+        std::vector<VkCommandBuffer> buffers;
+        uint32_t next_buffer;
+        uint32_t buffers_in_use;
+    };
+
+    CHECK_RETURN VkResult create_command_pool(VkCommandPool* pool);
+    CHECK_RETURN VkResult create_chunk(pool_chunk** chunk);
+    bool can_switch_chunk() const;
+    CHECK_RETURN VkResult switch_chunk();
+    void release_chunk(pool_chunk* chunk);
+    CHECK_RETURN VkResult
+    allocate_dedicated_command_buffer(VkCommandBuffer* buf);
+
     cvk_device* m_device;
     uint32_t m_queue_family;
-    VkCommandPool m_command_pool;
     std::mutex m_lock;
+
+    std::vector<std::unique_ptr<pool_chunk>> m_chunks;
+    std::vector<pool_chunk*> m_idle_chunks;
+    // Command buffers allocated from m_dedicated_pool map to nullptr
+    std::unordered_map<VkCommandBuffer, pool_chunk*> m_chunk_of_buffer;
+    pool_chunk* m_current;
+    // Command buffers are allocated and freed one by one from this pool once
+    // max_command_pools pools are in use
+    VkCommandPool m_dedicated_pool;
+    uint32_t m_num_buffers_in_use;
+
+    TRACE_CNT_VAR(pools_counter);
+    TRACE_CNT_VAR(buffers_in_use_counter);
 };
 
 struct cvk_command_queue : public _cl_command_queue,
@@ -146,6 +185,10 @@ struct cvk_command_queue : public _cl_command_queue,
         return (m_properties & prop) == prop;
     }
 
+    bool is_out_of_order() const {
+        return has_property(CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+    }
+
     CHECK_RETURN cl_int enqueue_command_with_deps(cvk_command* cmd,
                                                   cl_uint num_dep_events,
                                                   _cl_event* const* dep_events,
@@ -192,21 +235,36 @@ struct cvk_command_queue : public _cl_command_queue,
     }
 
     cl_int reset_printf_buffer() {
-        if (m_printf_buffer && m_printf_buffer->map()) {
+        if (m_printf_buffer && m_printf_buffer->is_host_accessible()) {
             memset(m_printf_buffer->host_va(), 0, 4);
-            m_printf_buffer->unmap();
             return CL_SUCCESS;
         }
         cvk_error_fn("Could not reset printf buffer");
         return CL_OUT_OF_RESOURCES;
     }
 
+    // Ring that the POD arguments of the kernels enqueued to the queue are
+    // written to. Returns nullptr if the ring is disabled or could not be
+    // created.
+    cvk_buffer_ring* pod_ring();
+
+    // Called by the commands built while the queue's lock is held that could
+    // not allocate their POD arguments from the ring. The current batch is
+    // then submitted.
+    void pod_ring_exhausted() { m_pod_ring_exhausted = true; }
+
     void command_pool_lock() { m_command_pool.lock(); }
 
     void command_pool_unlock() { m_command_pool.unlock(); }
 
     cvk_vulkan_queue_wrapper& vulkan_queue() { return m_vulkan_queue; }
 
+    // Timeline semaphore signalled by all the submissions made by the queue.
+    // nullptr when the device does not support timeline semaphores.
+    std::shared_ptr<cvk_timeline_semaphore> timeline_semaphore() const {
+        return m_timeline_semaphore;
+    }
+
     cvk_device* device() const { return m_device; }
     cl_command_queue_properties properties() const { return m_properties; }
     const std::vector<cl_queue_properties>& properties_array() const {
@@ -231,6 +289,15 @@ struct cvk_command_queue : public _cl_command_queue,
         TRACE_CNT(group_in_flight_counter, group - 1);
     }
 
+    // Timestamp query pools are recycled by the queue
+    static const uint32_t TIMESTAMP_QUERIES_PER_POOL = 512;
+    CHECK_RETURN VkResult acquire_timestamp_query_pool(VkQueryPool* pool);
+    void release_timestamp_query_pool(VkQueryPool pool);
+
+    // Whether there is a command batch being recorded. Must be called with
+    // the queue lock held, i.e. while enqueuing a command.
+    bool has_open_command_batch() const;
+
     cl_int execute_cmds_required_by(cl_uint num_events,
                                     _cl_event* const* event_list);
     cl_int execute_cmds_required_by_no_lock(cl_uint num_events,
@@ -239,6 +306,10 @@ struct cvk_command_queue : public _cl_command_queue,
 private:
     CHECK_RETURN cl_int satisfy_data_dependencies(cvk_command* cmd);
     void enqueue_command(cvk_command* cmd);
+    void add_out_of_order_dependencies(cvk_command* cmd);
+    void track_out_of_order_event(cvk_event* event);
+    bool must_end_command_batch_before(cvk_command* cmd);
+    bool must_end_command_batch_before_batchable(cvk_command* cmd);
     CHECK_RETURN cl_int enqueue_command_with_retry(cvk_command*,
                                                    _cl_event** event);
     CHECK_RETURN cl_int enqueue_command(cvk_command* cmd, _cl_event** event);
@@ -252,6 +323,12 @@ private:
     cvk_executor_thread* m_executor;
     cvk_event_holder m_finish_event;
 
+    // Out-of-order queues only order commands using explicit dependencies
+    // and barriers. Keep track of the last barrier and of the commands
+    // enqueued since then.
+    cvk_event_holder m_barrier_event;
+    std::vector<cvk_event_holder> m_events_since_barrier;
+
     std::mutex m_lock;
     std::deque<std::unique_ptr<cvk_command_group>> m_groups;
 
@@ -259,6 +336,10 @@ private:
 
     cvk_vulkan_queue_wrapper& m_vulkan_queue;
     cvk_command_pool m_command_pool;
+    std::shared_ptr<cvk_timeline_semaphore> m_timeline_semaphore;
+
+    std::mutex m_query_pools_lock;
+    std::vector<VkQueryPool> m_free_query_pools;
 
     cl_uint m_max_cmd_batch_size;
     cl_uint m_max_first_cmd_batch_size;
@@ -273,6 +354,11 @@ private:
 
     std::unique_ptr<cvk_buffer> m_printf_buffer;
 
+    std::mutex m_pod_ring_lock;
+    std::shared_ptr<cvk_buffer_ring> m_pod_ring;
+    bool m_pod_ring_created;
+    bool m_pod_ring_exhausted;
+
     std::vector<std::unique_ptr<cvk_queue_controller>> m_controllers;
 
     friend struct cvk_queue_controller;
@@ -370,15 +456,68 @@ struct cvk_command_buffer {
         return res == VK_SUCCESS;
     }
 
-    CHECK_RETURN bool submit_and_wait();
+    // Submit the command buffer to the queue. Completion is tracked using a
+    // fence so that waiting does not prevent other submissions to the same
+    // Vulkan queue. When the queue has a timeline semaphore, the submission
+    // waits for the given semaphore values and signals the value returned
+    // in signal_value.
+    CHECK_RETURN bool submit(const cvk_semaphore_wait_list& waits,
+                             uint64_t* signal_value);
+    // Submit several command buffers from the same queue at once, each
+    // waiting for its own semaphore values. They share a single fence and
+    // signal a single semaphore value.
+    CHECK_RETURN static bool
+    submit(const std::vector<cvk_command_buffer*>& cmdbufs,
+           const std::vector<const cvk_semaphore_wait_list*>& waits,
+           uint64_t* signal_value);
+    CHECK_RETURN bool wait();
+    bool completed();
 
     operator VkCommandBuffer() { return m_command_buffer; }
 
 protected:
     cvk_command_queue_holder m_queue;
     VkCommandBuffer m_command_buffer;
+    std::shared_ptr<cvk_fence> m_fence;
+};
+
+// Timestamp queries of profiled commands are sub-allocated in pairs from
+// query pools recycled by their queue. The results of all the queries of an
+// allocator, e.g. for all the commands of a batch, are read back at once.
+struct cvk_timestamp_query_allocator {
+    cvk_timestamp_query_allocator(cvk_command_queue* queue)
+        : m_queue(queue), m_num_queries_in_last_pool(0),
+          m_results_read(false) {}
+
+    ~cvk_timestamp_query_allocator() {
+        for (auto pool : m_pools) {
+            m_queue->release_timestamp_query_pool(pool);
+        }
+    }
+
+    CHECK_RETURN bool allocate_pair(VkQueryPool* pool, uint32_t* first_query,
+                                    uint32_t* pair);
+
+    CHECK_RETURN cl_int read_results();
+
+    void get_results(uint32_t pair, uint64_t* start, uint64_t* end) const {
+        CVK_ASSERT(m_results_read);
+        *start = m_results[2 * pair];
+        *end = m_results[2 * pair + 1];
+    }
+
+private:
+    cvk_command_queue_holder m_queue;
+    std::vector<VkQueryPool> m_pools;
+    uint32_t m_num_queries_in_last_pool;
+    bool m_results_read;
+    std::vector<uint64_t> m_results;
 };
 
+// Make the results of all previously recorded commands available to
+// subsequent commands and to the host.
+void record_memory_barrier(VkCommandBuffer cmdbuf);
+
 #define CLVK_COMMAND_BATCH 0x5000
 #define CLVK_COMMAND_IMAGE_INIT 0x5001
 
@@ -425,13 +564,8 @@ struct cvk_command {
     CHECK_RETURN cl_int execute() {
 
         // First wait for dependencies
-        cl_int status = CL_COMPLETE;
-        for (auto& ev : m_event_deps) {
-            if (ev->wait() != CL_COMPLETE) {
-                status = CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
-            }
-            ev->release();
-        }
+        collect_device_dependencies();
+        cl_int status = wait_for_dependencies();
 
         // Then execute the action if no dependencies failed
         if (status != CL_COMPLETE) {
@@ -445,6 +579,11 @@ struct cvk_command {
             TRACE_END();
         }
 
+        cl_int device_deps_status = release_device_dependencies();
+        if (status == CL_COMPLETE) {
+            status = device_deps_status;
+        }
+
         // When executing batch with many commands, "set_event_status" can take
         // a while. Trace it to be able to understand it easily.
         TRACE_BEGIN("set_event_status");
@@ -455,6 +594,82 @@ struct cvk_command {
 
     CHECK_RETURN virtual cl_int do_action() = 0;
 
+    // Asynchronous commands can have their execution split in two steps.
+    // Their work is first submitted to the device without waiting for the
+    // device work they depend on to complete and their completion is handled
+    // later on. This allows several of them to be in flight on the same
+    // Vulkan queue.
+    virtual bool is_asynchronous() const { return false; }
+
+    // Prepare an asynchronous command for the submission of its work
+    void begin_submit() {
+        CVK_ASSERT(is_asynchronous());
+        collect_device_dependencies();
+        set_event_status(CL_RUNNING);
+    }
+
+    CHECK_RETURN cl_int submit() {
+        begin_submit();
+        TRACE_BEGIN_CMD(m_type, "queue", (uintptr_t) & (*m_queue), "command",
+                        (uintptr_t)this);
+        cl_int status = do_submit();
+        TRACE_END();
+        return status;
+    }
+
+    CHECK_RETURN cl_int complete(cl_int submit_status) {
+        CVK_ASSERT(is_asynchronous());
+        // Dependencies were either already complete or submitted ahead of
+        // this command and retired before it, this does not block.
+        cl_int status = wait_for_dependencies();
+        cl_int device_deps_status = release_device_dependencies();
+        if (status == CL_COMPLETE) {
+            status = device_deps_status;
+        }
+        if (status != CL_COMPLETE) {
+            cvk_error_fn("one or more dependencies have failed for cmd %p (%s)",
+                         this, cl_command_type_to_string(m_type));
+        } else if (submit_status != CL_SUCCESS) {
+            status = submit_status;
+        } else {
+            status = do_complete();
+        }
+
+        TRACE_BEGIN("set_event_status");
+        set_event_status(status);
+        TRACE_END();
+        return status;
+    }
+
+    CHECK_RETURN virtual cl_int do_submit() {
+        CVK_ASSERT(false && "Should never be called");
+        return CL_INVALID_OPERATION;
+    }
+
+    CHECK_RETURN virtual cl_int do_complete() {
+        CVK_ASSERT(false && "Should never be called");
+        return CL_INVALID_OPERATION;
+    }
+
+    virtual bool submitted_work_completed() { return true; }
+
+    // Asynchronous commands whose device work is entirely contained in a
+    // command buffer can have it submitted together with that of other
+    // commands from the same queue.
+    virtual cvk_command_buffer* coalescable_command_buffer() {
+        return nullptr;
+    }
+
+    // Commands that submit work to the device can make it wait for the
+    // device work of commands from other queues instead of waiting for them
+    // on the host.
+    virtual bool can_wait_on_device() const { return false; }
+
+    bool is_device_waitable(cvk_event* ev) const {
+        return can_wait_on_device() && !ev->is_user_event() &&
+               (ev->queue() != queue()) && ev->has_device_completion();
+    }
+
     cvk_event* event() const { return m_event; }
 
     cl_command_type type() const { return m_type; }
@@ -463,6 +678,46 @@ struct cvk_command {
 
     const std::vector<cvk_event*>& dependencies() const { return m_event_deps; }
 
+    // Whether executing the command would not have to block waiting for
+    // its dependencies.
+    bool dependencies_resolved() const {
+        for (auto ev : m_event_deps) {
+            if (!ev->completed() && !ev->terminated() &&
+                !is_device_waitable(ev)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void wait_for_unresolved_dependency() const {
+        for (auto ev : m_event_deps) {
+            if (!ev->completed() && !ev->terminated() &&
+                !is_device_waitable(ev)) {
+                ev->wait();
+                return;
+            }
+        }
+    }
+
+    bool depends_on(const cvk_event* event) const {
+        for (auto ev : m_event_deps) {
+            if (ev == event) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool has_unresolved_user_event_dependency() const {
+        for (auto ev : m_event_deps) {
+            if (ev->is_user_event() && !ev->completed()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     virtual const std::vector<cvk_mem*> memory_objects() const {
         CVK_ASSERT(false && "Should never be called");
         return {};
@@ -472,6 +727,14 @@ struct cvk_command {
         m_event->set_status(status);
     }
 
+    virtual void set_device_completion(uint64_t value) {
+        m_event->set_device_completion(m_queue->timeline_semaphore(), value);
+    }
+
+    const cvk_semaphore_wait_list& device_dependency_waits() const {
+        return m_device_dependency_waits;
+    }
+
     CHECK_RETURN virtual cl_int set_profiling_info(cl_profiling_info pinfo) {
         m_event->set_profiling_info_from_monotonic_clock(pinfo);
         return CL_SUCCESS;
@@ -483,7 +746,63 @@ protected:
     cvk_event* m_event;
 
 private:
+    // Move the dependencies whose device work has been submitted to another
+    // queue out of the list of events to wait for on the host.
+    void collect_device_dependencies() {
+        if (!can_wait_on_device()) {
+            return;
+        }
+        std::vector<cvk_event*> host_deps;
+        for (auto ev : m_event_deps) {
+            std::shared_ptr<cvk_timeline_semaphore> sem;
+            uint64_t value;
+            if (!ev->completed() && !ev->is_user_event() &&
+                (ev->queue() != queue()) &&
+                ev->device_completion(&sem, &value)) {
+                cvk_debug_fn("cmd %p waits for event %p on the device", this,
+                             ev);
+                m_device_dependency_waits.add(sem->vulkan_semaphore(), value);
+                m_device_dependency_semaphores.push_back(sem);
+                m_device_deps.push_back(ev);
+            } else {
+                host_deps.push_back(ev);
+            }
+        }
+        m_event_deps.swap(host_deps);
+    }
+
+    // The device work of the commands has completed by the time this is
+    // called but their events may not have been updated yet.
+    cl_int release_device_dependencies() {
+        cl_int status = CL_COMPLETE;
+        for (auto ev : m_device_deps) {
+            if (ev->wait() != CL_COMPLETE) {
+                status = CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
+            }
+            ev->release();
+        }
+        m_device_deps.clear();
+        return status;
+    }
+
+    cl_int wait_for_dependencies() {
+        cl_int status = CL_COMPLETE;
+        for (auto& ev : m_event_deps) {
+            if (ev->wait() != CL_COMPLETE) {
+                status = CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
+            }
+            ev->release();
+        }
+        m_event_deps.clear();
+        return status;
+    }
+
     std::vector<cvk_event*> m_event_deps;
+    std::vector<cvk_event*> m_device_deps;
+    cvk_semaphore_wait_list m_device_dependency_waits;
+    // Keep the semaphores alive until the work waiting for them completes.
+    std::vector<std::shared_ptr<cvk_timeline_semaphore>>
+        m_device_dependency_semaphores;
 };
 
 struct cvk_command_buffer_base : public cvk_command {
@@ -562,6 +881,16 @@ struct cvk_rectangle_copier {
 
     void do_copy(direction dir, void* src_base, void* dst_base);
 
+    // Describe the copy as buffer copy regions, merging rows that are
+    // contiguous in both the source and the destination.
+    void get_buffer_copy_regions(direction dir, VkDeviceSize src_base,
+                                 VkDeviceSize dst_base,
+                                 std::vector<VkBufferCopy>& regions) const;
+
+    size_t size() const {
+        return m_region[0] * m_region[1] * m_region[2] * m_elem_size;
+    }
+
 private:
     std::array<size_t, 3> m_a_origin;
     size_t m_a_row_pitch;
@@ -599,87 +928,24 @@ private:
     void* m_hostptr;
 };
 
-struct cvk_command_copy_buffer final : public cvk_command {
-
-    cvk_command_copy_buffer(cvk_command_queue* q, cl_command_type type,
-                            cvk_buffer* src, cvk_buffer* dst, size_t src_offset,
-                            size_t dst_offset, size_t size)
-        : cvk_command(type, q), m_src_buffer(src), m_dst_buffer(dst),
-          m_src_offset(src_offset), m_dst_offset(dst_offset), m_size(size) {}
-
-    CHECK_RETURN cl_int do_action() override final;
-
-    const std::vector<cvk_mem*> memory_objects() const override {
-        return {m_src_buffer, m_dst_buffer};
-    }
-
-private:
-    cvk_buffer_holder m_src_buffer;
-    cvk_buffer_holder m_dst_buffer;
-    size_t m_src_offset;
-    size_t m_dst_offset;
-    size_t m_size;
-};
-
-struct cvk_command_copy_buffer_rect final : public cvk_command {
-    cvk_command_copy_buffer_rect(cvk_command_queue* queue,
-                                 cvk_buffer* src_buffer, cvk_buffer* dst_buffer,
-                                 const size_t* src_origin,
-                                 const size_t* dst_origin, const size_t* region,
-                                 size_t src_row_pitch, size_t src_slice_pitch,
-                                 size_t dst_row_pitch, size_t dst_slice_pitch)
-        : cvk_command(CL_COMMAND_COPY_BUFFER_RECT, queue),
-          m_copier(src_origin, dst_origin, region, src_row_pitch,
-                   src_slice_pitch, dst_row_pitch, dst_slice_pitch, 1),
-          m_src_buffer(src_buffer), m_dst_buffer(dst_buffer) {}
-
-    CHECK_RETURN cl_int do_action() override final;
-
-    const std::vector<cvk_mem*> memory_objects() const override {
-        return {m_src_buffer, m_dst_buffer};
-    }
-
-private:
-    cvk_rectangle_copier m_copier;
-    cvk_buffer_holder m_src_buffer;
-    cvk_buffer_holder m_dst_buffer;
-};
-
-struct cvk_command_fill_buffer final : public cvk_command_buffer_base_region {
-
-    cvk_command_fill_buffer(cvk_command_queue* q, cvk_buffer* buffer,
-                            size_t offset, size_t size, const void* pattern,
-                            size_t pattern_size, cl_command_type type)
-        : cvk_command_buffer_base_region(q, type, buffer, offset, size),
-          m_pattern_size(pattern_size) {
-        memcpy(m_pattern.data(), pattern, pattern_size);
-    }
-
-    CHECK_RETURN cl_int do_action() override final;
-
-    const std::vector<cvk_mem*> memory_objects() const override {
-        return {m_buffer};
-    }
-
-private:
-    static constexpr int MAX_PATTERN_SIZE = 128;
-    std::array<char, MAX_PATTERN_SIZE> m_pattern;
-    size_t m_pattern_size;
-};
-
 struct cvk_command_batchable : public cvk_command {
     cvk_command_batchable(cl_command_type type, cvk_command_queue* queue)
-        : cvk_command(type, queue), m_query_pool(VK_NULL_HANDLE) {}
+        : cvk_command(type, queue), m_timestamp_query_pair(0) {}
 
-    virtual ~cvk_command_batchable() {
-        if (m_query_pool != VK_NULL_HANDLE) {
-            auto vkdev = m_queue->device()->vulkan_device();
-            vkDestroyQueryPool(vkdev, m_query_pool, nullptr);
-        }
+    virtual ~cvk_command_batchable() {}
+
+    void set_timestamp_query_allocator(
+        std::shared_ptr<cvk_timestamp_query_allocator> allocator) {
+        m_timestamp_queries = allocator;
     }
 
     bool can_be_batched() const override;
-    bool is_built_before_enqueue() const override final { return false; }
+    bool is_built_before_enqueue() const override { return false; }
+    // Commands executed without device work have to wait for their
+    // dependencies on the host.
+    bool can_wait_on_device() const override {
+        return has_own_command_buffer();
+    }
 
     CHECK_RETURN cl_int get_timestamp_query_results(cl_ulong* start,
                                                     cl_ulong* end);
@@ -689,6 +955,17 @@ struct cvk_command_batchable : public cvk_command {
     CHECK_RETURN virtual cl_int
     build_batchable_inner(cvk_command_buffer& cmdbuf) = 0;
     CHECK_RETURN cl_int do_action() override;
+
+    // Commands that were built in their own command buffer
+    bool is_asynchronous() const override { return has_own_command_buffer(); }
+    CHECK_RETURN cl_int do_submit() override final;
+    CHECK_RETURN cl_int do_complete() override final;
+    bool submitted_work_completed() override final {
+        return m_command_buffer->completed();
+    }
+    cvk_command_buffer* coalescable_command_buffer() override final {
+        return m_command_buffer.get();
+    }
     CHECK_RETURN virtual cl_int do_post_action() { return CL_SUCCESS; }
 
     CHECK_RETURN cl_int set_profiling_info_end(cl_ulong sync_dev,
@@ -708,7 +985,8 @@ struct cvk_command_batchable : public cvk_command {
 
     CHECK_RETURN cl_int
     set_profiling_info(cl_profiling_info pinfo) override final {
-        if (!m_queue->profiling_on_device()) {
+        // Commands that were not built do not have timestamps to report
+        if (!m_queue->profiling_on_device() || m_timestamp_queries == nullptr) {
             return cvk_command::set_profiling_info(pinfo);
         }
 
@@ -725,11 +1003,14 @@ struct cvk_command_batchable : public cvk_command {
         }
     }
 
+protected:
+    bool has_own_command_buffer() const { return m_command_buffer != nullptr; }
+
 private:
     std::unique_ptr<cvk_command_buffer> m_command_buffer;
-    VkQueryPool m_query_pool;
+    std::shared_ptr<cvk_timestamp_query_allocator> m_timestamp_queries;
+    uint32_t m_timestamp_query_pair;
 
-    static const int NUM_POOL_QUERIES_PER_COMMAND = 2;
     static const int POOL_QUERY_CMD_START = 0;
     static const int POOL_QUERY_CMD_END = 1;
 
@@ -792,6 +1073,13 @@ struct cvk_command_kernel final : public cvk_command_batchable {
                cvk_command_batchable::can_be_batched();
     }
 
+    // The printf buffer is shared by all the kernels of the queue and has to
+    // be processed before the next kernel using printf executes.
+    bool is_asynchronous() const override final {
+        return !m_kernel->uses_printf() &&
+               cvk_command_batchable::is_asynchronous();
+    }
+
     const std::vector<cvk_mem*> memory_objects() const override {
         std::vector<cvk_mem*> ret;
         std::shared_ptr<cvk_kernel_argument_values> argvals = m_argument_values;
@@ -820,6 +1108,9 @@ private:
     cvk_ndrange m_ndrange;
     VkPipeline m_pipeline;
     std::shared_ptr<cvk_kernel_argument_values> m_argument_values;
+    // Range of the queue's POD ring holding the POD arguments, returned to
+    // the ring when the command is destroyed after its work has completed
+    std::unique_ptr<cvk_buffer_ring_allocation> m_pod_allocation;
 };
 
 struct cvk_command_batch : public cvk_command {
@@ -827,6 +1118,16 @@ struct cvk_command_batch : public cvk_command {
         : cvk_command(CLVK_COMMAND_BATCH, queue) {}
 
     cl_int do_action() override final;
+    bool is_asynchronous() const override final { return true; }
+    cl_int do_submit() override final;
+    cl_int do_complete() override final;
+    bool submitted_work_completed() override final {
+        return m_command_buffer->completed();
+    }
+    cvk_command_buffer* coalescable_command_buffer() override final {
+        return m_command_buffer.get();
+    }
+    bool can_wait_on_device() const override final { return true; }
     cl_int add_command(cvk_command_batchable* cmd) {
         if (!m_command_buffer) {
             // Create command buffer and start recording on first call
@@ -837,11 +1138,41 @@ struct cvk_command_batch : public cvk_command {
         }
         cvk_command_pool_lock_holder lock(m_queue);
 
+        // All the commands of a batch share timestamp query pools
+        if (m_queue->has_property(CL_QUEUE_PROFILING_ENABLE) &&
+            m_queue->profiling_on_device()) {
+            if (m_timestamp_queries == nullptr) {
+                m_timestamp_queries =
+                    std::make_shared<cvk_timestamp_query_allocator>(m_queue);
+            }
+            cmd->set_timestamp_query_allocator(m_timestamp_queries);
+        }
+
+        // Commands in batches for out-of-order queues are not synchronised
+        // with each other unless they depend on one another.
+        if (m_queue->is_out_of_order() &&
+            contains_any_of(cmd->dependencies())) {
+            record_memory_barrier(*m_command_buffer);
+        }
+
         cl_int ret = cmd->build(*m_command_buffer);
         if (ret != CL_SUCCESS) {
             return ret;
         }
 
+        // Batches need to wait for the dependencies of their commands that
+        // are outside of the batch. Commands from the same in-order queue
+        // are already implicitly ordered with the batch.
+        for (auto ev : cmd->dependencies()) {
+            if (!m_queue->is_out_of_order() && !ev->is_user_event() &&
+                (ev->queue() == queue())) {
+                continue;
+            }
+            if (!contains(ev) && !depends_on(ev)) {
+                add_dependency(ev);
+            }
+        }
+
         cvk_debug_fn("add command %p (%s) to batch %p", cmd,
                      cl_command_type_to_string(cmd->type()), this);
         m_commands.emplace_back(cmd);
@@ -851,11 +1182,32 @@ struct cvk_command_batch : public cvk_command {
 
     CHECK_RETURN bool end() {
         cvk_command_pool_lock_holder lock(m_queue);
+        if (m_queue->is_out_of_order()) {
+            record_memory_barrier(*m_command_buffer);
+        }
         return m_command_buffer->end();
     }
 
     cl_uint batch_size() { return m_commands.size(); }
 
+    bool contains(const cvk_event* event) const {
+        for (auto& cmd : m_commands) {
+            if (cmd->event() == event) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool contains_any_of(const std::vector<cvk_event*>& events) const {
+        for (auto ev : events) {
+            if (contains(ev)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     CHECK_RETURN cl_int
     set_profiling_info(cl_profiling_info pinfo) override final {
         cl_int status = cvk_command::set_profiling_info(pinfo);
@@ -864,6 +1216,14 @@ struct cvk_command_batch : public cvk_command {
                 return m_queue->device()->get_device_host_timer(&m_sync_dev,
                                                                 &m_sync_host);
             } else {
+                // Read the timestamps of all commands at once
+                if (pinfo == CL_PROFILING_COMMAND_END &&
+                    m_timestamp_queries != nullptr) {
+                    cl_int err = m_timestamp_queries->read_results();
+                    if (err != CL_COMPLETE) {
+                        return err;
+                    }
+                }
                 for (auto& cmd : m_commands) {
                     cl_int err;
                     if (pinfo == CL_PROFILING_COMMAND_END) {
@@ -893,9 +1253,17 @@ struct cvk_command_batch : public cvk_command {
         }
     }
 
+    void set_device_completion(uint64_t value) override final {
+        cvk_command::set_device_completion(value);
+        for (auto& cmd : m_commands) {
+            cmd->set_device_completion(value);
+        }
+    }
+
 private:
     std::vector<std::unique_ptr<cvk_command_batchable>> m_commands;
     std::unique_ptr<cvk_command_buffer> m_command_buffer;
+    std::shared_ptr<cvk_timestamp_query_allocator> m_timestamp_queries;
     cl_ulong m_sync_dev, m_sync_host;
 };
 
@@ -942,15 +1310,165 @@ private:
     void* m_mapped_ptr;
 };
 
-struct cvk_command_dep : public cvk_command {
+// Markers, barriers and memory object migrations. They join the current
+// command batch when there is one so as not to split it and otherwise
+// complete without any device work.
+struct cvk_command_dep : public cvk_command_batchable {
     cvk_command_dep(cvk_command_queue* q, cl_command_type type)
-        : cvk_command(type, q) {}
+        : cvk_command_batchable(type, q) {}
+
+    bool can_be_batched() const override final;
+    bool is_built_before_enqueue() const override final { return true; }
+    bool can_wait_on_device() const override final { return false; }
+
+    CHECK_RETURN cl_int
+    build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
 
     CHECK_RETURN cl_int do_action() override final { return CL_COMPLETE; }
 
     const std::vector<cvk_mem*> memory_objects() const override { return {}; }
 };
 
+// Buffer to buffer copies are recorded on the device. Small copies that
+// cannot join a command batch are done on the host instead as this is
+// cheaper than submitting a command buffer of their own.
+struct cvk_command_copy_buffer final : public cvk_command_batchable {
+
+    cvk_command_copy_buffer(cvk_command_queue* q, cl_command_type type,
+                            cvk_buffer* src, cvk_buffer* dst, size_t src_offset,
+                            size_t dst_offset, size_t size)
+        : cvk_command_batchable(type, q), m_src_buffer(src), m_dst_buffer(dst),
+          m_src_offset(src_offset), m_dst_offset(dst_offset), m_size(size) {}
+
+    bool can_be_batched() const override final {
+        return (m_queue->has_open_command_batch() || !is_host_copy()) &&
+               cvk_command_batchable::can_be_batched();
+    }
+    bool is_built_before_enqueue() const override final {
+        return is_host_copy();
+    }
+
+    CHECK_RETURN cl_int
+    build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
+    CHECK_RETURN cl_int do_action() override final;
+
+    const std::vector<cvk_mem*> memory_objects() const override {
+        return {m_src_buffer, m_dst_buffer};
+    }
+
+private:
+    bool is_host_copy() const { return m_size <= config.max_host_copy_size; }
+
+    cvk_buffer_holder m_src_buffer;
+    cvk_buffer_holder m_dst_buffer;
+    size_t m_src_offset;
+    size_t m_dst_offset;
+    size_t m_size;
+};
+
+struct cvk_command_copy_buffer_rect final : public cvk_command_batchable {
+    cvk_command_copy_buffer_rect(cvk_command_queue* queue,
+                                 cvk_buffer* src_buffer, cvk_buffer* dst_buffer,
+                                 const size_t* src_origin,
+                                 const size_t* dst_origin, const size_t* region,
+                                 size_t src_row_pitch, size_t src_slice_pitch,
+                                 size_t dst_row_pitch, size_t dst_slice_pitch)
+        : cvk_command_batchable(CL_COMMAND_COPY_BUFFER_RECT, queue),
+          m_copier(src_origin, dst_origin, region, src_row_pitch,
+                   src_slice_pitch, dst_row_pitch, dst_slice_pitch, 1),
+          m_src_buffer(src_buffer), m_dst_buffer(dst_buffer) {}
+
+    bool can_be_batched() const override final {
+        return (m_queue->has_open_command_batch() || !is_host_copy()) &&
+               cvk_command_batchable::can_be_batched();
+    }
+    bool is_built_before_enqueue() const override final {
+        return is_host_copy();
+    }
+
+    CHECK_RETURN cl_int
+    build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
+    CHECK_RETURN cl_int do_action() override final;
+
+    const std::vector<cvk_mem*> memory_objects() const override {
+        return {m_src_buffer, m_dst_buffer};
+    }
+
+private:
+    bool is_host_copy() const {
+        return m_copier.size() <= config.max_host_copy_size;
+    }
+
+    cvk_rectangle_copier m_copier;
+    cvk_buffer_holder m_src_buffer;
+    cvk_buffer_holder m_dst_buffer;
+};
+
+// Buffer fills are recorded on the device. Patterns that repeat every four
+// bytes use vkCmdFillBuffer, with the unaligned bytes at either end copied
+// from the filled range. Other patterns are written once with
+// vkCmdUpdateBuffer and replicated with copies of increasing size.
+struct cvk_command_fill_buffer final : public cvk_command_batchable {
+
+    cvk_command_fill_buffer(cvk_command_queue* q, cvk_buffer* buffer,
+                            size_t offset, size_t size, const void* pattern,
+                            size_t pattern_size, cl_command_type type)
+        : cvk_command_batchable(type, q), m_buffer(buffer), m_offset(offset),
+          m_size(size), m_pattern_size(pattern_size) {
+        memcpy(m_pattern.data(), pattern, pattern_size);
+        m_method = select_method();
+    }
+
+    bool can_be_batched() const override final {
+        return (m_method != method::host) &&
+               (m_queue->has_open_command_batch() || !is_host_fill()) &&
+               cvk_command_batchable::can_be_batched();
+    }
+    bool is_built_before_enqueue() const override final {
+        return is_host_fill();
+    }
+
+    CHECK_RETURN cl_int
+    build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
+    CHECK_RETURN cl_int do_action() override final;
+
+    const std::vector<cvk_mem*> memory_objects() const override {
+        return {m_buffer};
+    }
+
+private:
+    enum class method
+    {
+        fill_word,
+        replicate,
+        host,
+    };
+
+    method select_method();
+    bool is_host_fill() const {
+        return (m_method == method::host) ||
+               (m_size <= config.max_host_copy_size);
+    }
+    uint8_t pattern_byte(size_t offset) const {
+        return m_pattern[offset % m_pattern_size];
+    }
+    void record_fill_word(cvk_command_buffer& cmdbuf, VkDeviceSize begin,
+                          VkDeviceSize end);
+    void record_replicate(cvk_command_buffer& cmdbuf, VkDeviceSize begin,
+                          VkDeviceSize end);
+
+    static constexpr int MAX_PATTERN_SIZE = 128;
+    // Size of the initial copy of the pattern written by vkCmdUpdateBuffer
+    static constexpr VkDeviceSize MAX_UPDATE_SIZE = 4096;
+
+    cvk_buffer_holder m_buffer;
+    size_t m_offset;
+    size_t m_size;
+    std::array<uint8_t, MAX_PATTERN_SIZE> m_pattern;
+    size_t m_pattern_size;
+    method m_method;
+};
+
 struct cvk_command_buffer_image_copy final : public cvk_command_batchable {
     cvk_command_buffer_image_copy(cl_command_type type,
                                   cvk_command_queue* queue, cvk_buffer* buffer,
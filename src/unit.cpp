@@ -12,8 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "build_service.hpp"
 #include "device.hpp"
+#include "init.hpp"
 #include "log.hpp"
+#include "unit.hpp"
 
 #include <vulkan/vulkan.h>
 
@@ -40,6 +43,39 @@ void CL_API_CALL clvk_restore_device_properties(cl_device_id device) {
 #endif
 }
 
+void CL_API_CALL clvk_recreate_pipeline_cache_store(cl_device_id device,
+                                                    uint64_t max_size) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    cvk_debug_fn("device: %p, max_size: %llu\n", (void*)device,
+                 (unsigned long long)max_size);
+    assert(device != nullptr && icd_downcast(device)->is_valid());
+
+    icd_downcast(device)->recreate_pipeline_cache_store(max_size);
+#endif
+}
+
+bool CL_API_CALL clvk_pause_build_service(bool paused) {
+#if defined(CLVK_UNIT_TESTING_ENABLED) && defined(CLSPV_ONLINE_COMPILER)
+    cvk_debug_fn("paused: %d\n", paused);
+    get_or_init_global_state()->build_service()->set_paused(paused);
+    return true;
+#else
+    UNUSED(paused);
+    return false;
+#endif
+}
+
+bool CL_API_CALL clvk_device_supports_pod_pushconstant(cl_device_id device) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    assert(device != nullptr && icd_downcast(device)->is_valid());
+
+    return icd_downcast(device)->supports_pod_pushconstant();
+#else
+    UNUSED(device);
+    return false;
+#endif
+}
+
 const config_struct* CL_API_CALL clvk_get_config() {
 #ifdef CLVK_UNIT_TESTING_ENABLED
     return &config;
@@ -47,4 +83,9 @@ const config_struct* CL_API_CALL clvk_get_config() {
     return nullptr;
 #endif
 }
+
+clvk_unit_counters* CL_API_CALL clvk_get_unit_counters() {
+    static clvk_unit_counters counters;
+    return &counters;
+}
 } // extern "C"
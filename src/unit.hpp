@@ -14,12 +14,66 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+
+#include <CL/cl.h>
+
+// Counters of internal events checked by the unit tests. They are only
+// updated when unit testing is enabled.
+struct clvk_unit_counters {
+    // Ring buffer allocations that wrapped around to the start of the ring
+    std::atomic<uint64_t> ring_wraps{0};
+    // Kernel enqueues whose POD arguments did not fit in the queue's ring
+    std::atomic<uint64_t> pod_ring_fallbacks{0};
+    // Copies of kernel argument values given their own POD buffer for the
+    // enqueues that did not fit in the ring
+    std::atomic<uint64_t> pod_fallback_buffers{0};
+    // Kernel enqueues whose POD arguments were passed as push constants
+    std::atomic<uint64_t> pod_pushconstant_enqueues{0};
+    // Descriptor pools created by entry points
+    std::atomic<uint64_t> descriptor_pools_created{0};
+    // Descriptor pools reset once all their sets had been freed
+    std::atomic<uint64_t> descriptor_pools_reset{0};
+    // Descriptor sets allocated by entry points
+    std::atomic<uint64_t> descriptor_sets_allocated{0};
+    // Lookups of cacheable descriptor sets that found sets to reuse
+    std::atomic<uint64_t> descriptor_set_cache_hits{0};
+    // Lookups of cacheable descriptor sets that had to allocate new sets
+    std::atomic<uint64_t> descriptor_set_cache_misses{0};
+    // Compute pipelines created by entry points
+    std::atomic<uint64_t> pipelines_created{0};
+    // Pipelines submitted for creation in the background by entry points
+    std::atomic<uint64_t> precompile_jobs_submitted{0};
+    // Background pipeline creations that completed or were skipped
+    std::atomic<uint64_t> precompile_jobs_finished{0};
+    // Programs whose SPIR-V was loaded from the program cache
+    std::atomic<uint64_t> program_cache_hits{0};
+    // Pipeline caches created from data found in the cache directory
+    std::atomic<uint64_t> pipeline_cache_store_hits{0};
+    // Writes of pipeline cache stores
+    std::atomic<uint64_t> pipeline_cache_store_writes{0};
+    // Program builds that waited for their turn in the build service
+    std::atomic<uint64_t> build_requests{0};
+    // Builds that went ahead of builds of lower priority that were waiting
+    // for longer
+    std::atomic<uint64_t> builds_overtaken{0};
+    // Parts of kernel argument values copied because they were shared
+    std::atomic<uint64_t> argument_value_copies{0};
+};
+
+extern "C" clvk_unit_counters* CL_API_CALL clvk_get_unit_counters();
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+#define CLVK_UNIT_COUNT(name) clvk_get_unit_counters()->name++
+#else
+#define CLVK_UNIT_COUNT(name)
+#endif
+
 #ifdef CLVK_UNIT_TESTING_ENABLED
 
 #include "config.hpp"
 
-#include <CL/cl.h>
-
 extern "C" {
 
 void CL_API_CALL clvk_override_device_max_compute_work_group_count(
@@ -27,6 +81,20 @@ void CL_API_CALL clvk_override_device_max_compute_work_group_count(
 
 void CL_API_CALL clvk_restore_device_properties(cl_device_id device);
 
+// Saves the pipeline caches of a device and starts over with a store in the
+// current cache directory whose size is limited to |max_size| bytes, like a
+// new process would. No program may be alive on the device.
+void CL_API_CALL clvk_recreate_pipeline_cache_store(cl_device_id device,
+                                                    uint64_t max_size);
+
+// Makes program builds wait for their turn until the build service is
+// resumed. Returns false when there is no build service.
+bool CL_API_CALL clvk_pause_build_service(bool paused);
+
+// Returns true if the POD arguments of kernels can be passed as push
+// constants on |device|
+bool CL_API_CALL clvk_device_supports_pod_pushconstant(cl_device_id device);
+
 const config_struct* CL_API_CALL clvk_get_config();
 }
 
@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -22,6 +23,103 @@
 #include "tracing.hpp"
 #include "utils.hpp"
 
+struct cvk_timeline_semaphore {
+    cvk_timeline_semaphore(VkDevice device)
+        : m_device(device), m_semaphore(VK_NULL_HANDLE), m_value(0) {}
+
+    ~cvk_timeline_semaphore() {
+        if (m_semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(m_device, m_semaphore, nullptr);
+        }
+    }
+
+    CHECK_RETURN VkResult init() {
+        VkSemaphoreTypeCreateInfoKHR typeInfo = {
+            VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+            nullptr,
+            VK_SEMAPHORE_TYPE_TIMELINE_KHR, // semaphoreType
+            0,                              // initialValue
+        };
+
+        VkSemaphoreCreateInfo createInfo = {
+            VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            &typeInfo,
+            0, // flags
+        };
+
+        return vkCreateSemaphore(m_device, &createInfo, nullptr, &m_semaphore);
+    }
+
+    VkSemaphore vulkan_semaphore() const { return m_semaphore; }
+
+    // Signal operations need to use strictly increasing values. Callers are
+    // responsible for making sure values are used in the order they are
+    // returned.
+    uint64_t next_value() { return ++m_value; }
+
+private:
+    VkDevice m_device;
+    VkSemaphore m_semaphore;
+    uint64_t m_value;
+};
+
+struct cvk_fence {
+    cvk_fence(VkDevice device) : m_device(device), m_fence(VK_NULL_HANDLE) {}
+
+    ~cvk_fence() {
+        if (m_fence != VK_NULL_HANDLE) {
+            vkDestroyFence(m_device, m_fence, nullptr);
+        }
+    }
+
+    CHECK_RETURN VkResult init() {
+        VkFenceCreateInfo createInfo = {
+            VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            nullptr, // pNext
+            0,       // flags
+        };
+
+        return vkCreateFence(m_device, &createInfo, nullptr, &m_fence);
+    }
+
+    VkFence vulkan_fence() const { return m_fence; }
+
+    CHECK_RETURN VkResult wait() {
+        TRACE_BEGIN("vkWaitForFences");
+        VkResult res =
+            vkWaitForFences(m_device, 1, &m_fence, VK_TRUE, UINT64_MAX);
+        TRACE_END();
+        return res;
+    }
+
+    bool signalled() const {
+        return vkGetFenceStatus(m_device, m_fence) == VK_SUCCESS;
+    }
+
+private:
+    VkDevice m_device;
+    VkFence m_fence;
+};
+
+struct cvk_semaphore_wait_list {
+    void add(VkSemaphore semaphore, uint64_t value) {
+        m_semaphores.push_back(semaphore);
+        m_values.push_back(value);
+        m_stages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    }
+
+    bool empty() const { return m_semaphores.empty(); }
+    uint32_t size() const { return static_cast<uint32_t>(m_semaphores.size()); }
+    const VkSemaphore* semaphores() const { return m_semaphores.data(); }
+    const uint64_t* values() const { return m_values.data(); }
+    const VkPipelineStageFlags* stages() const { return m_stages.data(); }
+
+private:
+    std::vector<VkSemaphore> m_semaphores;
+    std::vector<uint64_t> m_values;
+    std::vector<VkPipelineStageFlags> m_stages;
+};
+
 struct cvk_vulkan_queue_wrapper {
     cvk_vulkan_queue_wrapper(VkQueue queue, uint32_t family)
         : m_queue(queue), m_queue_family(family) {}
@@ -36,57 +134,81 @@ struct cvk_vulkan_queue_wrapper {
                   (unsigned long long)m_num_submissions);
     }
 
-    CHECK_RETURN VkResult submit(VkCommandBuffer command_buffer) {
-        std::lock_guard<std::mutex> lock(m_lock);
-
-        VkSubmitInfo submitInfo = {
-            VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            nullptr,
-            0,       // waitSemaphoreCOunt
-            nullptr, // pWaitSemaphores
-            nullptr, // pWaitDstStageMask
-            1,       // commandBufferCount
-            &command_buffer,
-            0,       // signalSemaphoreCount
-            nullptr, // pSignalSemaphores
-        };
-
-        TRACE_BEGIN("vkQueueSubmit");
-        auto ret = vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE);
-        TRACE_END();
-        if (ret != VK_SUCCESS) {
-            cvk_error_fn("could not submit work to queue: %s",
-                         vulkan_error_string(ret));
-        }
-
-        m_num_submissions++;
-
-        return ret;
+    CHECK_RETURN VkResult submit(VkCommandBuffer command_buffer,
+                                 VkFence fence = VK_NULL_HANDLE) {
+        cvk_semaphore_wait_list no_waits;
+        return submit({command_buffer}, {&no_waits}, fence, nullptr, nullptr);
     }
 
-    CHECK_RETURN VkResult submit(const std::vector<VkCommandBuffer>& cmdbufs) {
+    // Submit command buffers in a single vkQueueSubmit, each in its own
+    // batch that waits for the semaphore values in the matching entry of
+    // waits. The next value of signal_semaphore, if provided, is signalled
+    // once they have all completed and returned in signal_value.
+    CHECK_RETURN VkResult
+    submit(const std::vector<VkCommandBuffer>& command_buffers,
+           const std::vector<const cvk_semaphore_wait_list*>& waits,
+           VkFence fence, cvk_timeline_semaphore* signal_semaphore,
+           uint64_t* signal_value) {
+        CVK_ASSERT(command_buffers.size() == waits.size());
         std::lock_guard<std::mutex> lock(m_lock);
 
-        VkSubmitInfo submitInfo = {
-            VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            nullptr,
-            0,                                     // waitSemaphoreCOunt
-            nullptr,                               // pWaitSemaphores
-            nullptr,                               // pWaitDstStageMask
-            static_cast<uint32_t>(cmdbufs.size()), // commandBufferCount
-            cmdbufs.data(),
-            0,       // signalSemaphoreCount
-            nullptr, // pSignalSemaphores
-        };
+        // Signal values are allocated under the queue lock so that they are
+        // used in submission order.
+        VkSemaphore signal = VK_NULL_HANDLE;
+        uint64_t value = 0;
+        if (signal_semaphore != nullptr) {
+            signal = signal_semaphore->vulkan_semaphore();
+            value = signal_semaphore->next_value();
+        }
+
+        auto num_batches = static_cast<uint32_t>(command_buffers.size());
+        std::vector<VkTimelineSemaphoreSubmitInfoKHR> timelineInfos(
+            num_batches);
+        std::vector<VkSubmitInfo> submitInfos(num_batches);
+        for (uint32_t i = 0; i < num_batches; i++) {
+            // Only the last batch signals, the signal operation covers all
+            // the batches before it in submission order.
+            bool last = (i == num_batches - 1);
+            uint32_t num_signals = (last && signal != VK_NULL_HANDLE) ? 1 : 0;
+            auto batch_waits = waits[i];
+
+            timelineInfos[i] = {
+                VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+                nullptr,
+                batch_waits->size(),   // waitSemaphoreValueCount
+                batch_waits->values(), // pWaitSemaphoreValues
+                num_signals,           // signalSemaphoreValueCount
+                &value,                // pSignalSemaphoreValues
+            };
+
+            bool uses_semaphores = !batch_waits->empty() || (num_signals != 0);
+
+            submitInfos[i] = {
+                VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                uses_semaphores ? &timelineInfos[i] : nullptr,
+                batch_waits->size(),       // waitSemaphoreCount
+                batch_waits->semaphores(), // pWaitSemaphores
+                batch_waits->stages(),     // pWaitDstStageMask
+                1,                         // commandBufferCount
+                &command_buffers[i],       // pCommandBuffers
+                num_signals,               // signalSemaphoreCount
+                &signal,                   // pSignalSemaphores
+            };
+        }
 
         TRACE_BEGIN("vkQueueSubmit");
-        auto ret = vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE);
+        auto ret =
+            vkQueueSubmit(m_queue, num_batches, submitInfos.data(), fence);
         TRACE_END();
         if (ret != VK_SUCCESS) {
             cvk_error_fn("could not submit work to queue: %s",
                          vulkan_error_string(ret));
+        } else if (signal_value != nullptr) {
+            *signal_value = value;
         }
 
+        m_num_submissions++;
+
         return ret;
     }
 
@@ -14,6 +14,20 @@
 
 #include "testcl.hpp"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
 TEST_F(WithContext, DISABLED_NOCOMPILER(BuildLog)) {
     static const char* source_warning =
         "#warning THIS IS A WARNING\nvoid kernel test(){}\n";
@@ -377,6 +391,117 @@ TEST_F(WithCommandQueue, ProgramBinaryExecutable) {
     ASSERT_EQ(result[3], 3);
 }
 
+// Layout of the executable binaries written by clvk: the binary header
+// (magic, version and binary type) followed by this header, the SPIR-V
+// binary and the pipeline cache data
+struct clvk_executable_header {
+    uint32_t spirv_size;
+    uint32_t flags;
+    uint32_t spirv_checksum[5];
+    uint8_t pipeline_cache_uuid[16];
+    uint32_t pipeline_cache_size;
+};
+static const size_t CLVK_BINARY_HEADER_SIZE = 3 * sizeof(uint32_t);
+
+TEST_F(WithCommandQueue, ProgramBinaryExecutableVersion1) {
+    static const char* source = R"(
+      kernel void test(global uint *output) {
+        uint gid = get_global_id(0);
+        output[gid] = gid * 3;
+      }
+    )";
+    const size_t gws = 4;
+    const size_t buffer_size = gws * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size);
+
+    auto program = CreateAndBuildProgram(source);
+    auto built_binary = GetProgramBinary(program);
+    clvk_executable_header header;
+    ASSERT_GE(built_binary.size(), CLVK_BINARY_HEADER_SIZE + sizeof(header));
+    memcpy(&header, built_binary.data() + CLVK_BINARY_HEADER_SIZE,
+           sizeof(header));
+    auto spirv_offset = CLVK_BINARY_HEADER_SIZE + sizeof(header);
+    ASSERT_GE(built_binary.size(), spirv_offset + header.spirv_size);
+
+    // Version 1 executables only have the SPIR-V binary after the header
+    std::vector<uint8_t> binary(built_binary.begin(),
+                                built_binary.begin() + CLVK_BINARY_HEADER_SIZE);
+    uint32_t version = 1;
+    memcpy(binary.data() + sizeof(uint32_t), &version, sizeof(version));
+    binary.insert(binary.end(), built_binary.begin() + spirv_offset,
+                  built_binary.begin() + spirv_offset + header.spirv_size);
+
+    auto binary_program = CreateAndBuildProgramWithBinary(binary);
+    ASSERT_EQ(GetProgramBinaryType(binary_program),
+              CL_PROGRAM_BINARY_TYPE_EXECUTABLE);
+    auto kernel = CreateKernel(binary_program, "test");
+    SetKernelArg(kernel, 0, buffer);
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+    cl_uint result[gws] = {0};
+    EnqueueReadBuffer(buffer, CL_BLOCKING, 0, buffer_size, result);
+
+    for (cl_uint i = 0; i < gws; i++) {
+        ASSERT_EQ(result[i], i * 3);
+    }
+
+    // The binary of the new program uses the current version
+    auto rebuilt_binary = GetProgramBinary(binary_program);
+    ASSERT_GE(rebuilt_binary.size(), CLVK_BINARY_HEADER_SIZE);
+    EXPECT_EQ(memcmp(rebuilt_binary.data(), built_binary.data(),
+                     CLVK_BINARY_HEADER_SIZE),
+              0);
+}
+
+TEST_F(WithCommandQueue, ProgramBinaryExecutableForAnotherDevice) {
+    static const char* source = R"(
+      kernel void test(global uint *output) {
+        uint gid = get_global_id(0);
+        output[gid] = gid * 2;
+      }
+    )";
+    const size_t gws = 4;
+    const size_t buffer_size = gws * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size);
+
+    // Create a pipeline so that the binary embeds pipeline cache data
+    auto program = CreateAndBuildProgram(source);
+    auto kernel = CreateKernel(program, "test");
+    SetKernelArg(kernel, 0, buffer);
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+    Finish();
+    auto built_binary = GetProgramBinary(program);
+
+    // Change the pipeline cache UUID. The binary must still be usable, its
+    // pipeline cache data and validation result are ignored.
+    const size_t uuid_offset =
+        CLVK_BINARY_HEADER_SIZE +
+        offsetof(clvk_executable_header, pipeline_cache_uuid);
+    const size_t uuid_size =
+        sizeof(clvk_executable_header::pipeline_cache_uuid);
+    ASSERT_GT(built_binary.size(), uuid_offset + uuid_size);
+    for (size_t i = 0; i < uuid_size; i++) {
+        built_binary[uuid_offset + i] ^= 0xFF;
+    }
+
+    auto binary_program = CreateAndBuildProgramWithBinary(built_binary);
+    auto binary_kernel = CreateKernel(binary_program, "test");
+    SetKernelArg(binary_kernel, 0, buffer);
+    EnqueueNDRangeKernel(binary_kernel, 1, nullptr, &gws, nullptr);
+    cl_uint result[gws] = {0};
+    EnqueueReadBuffer(buffer, CL_BLOCKING, 0, buffer_size, result);
+
+    for (cl_uint i = 0; i < gws; i++) {
+        ASSERT_EQ(result[i], i * 2);
+    }
+
+    // The binary of the new program embeds the pipeline cache of this device
+    auto rebuilt_binary = GetProgramBinary(binary_program);
+    ASSERT_GT(rebuilt_binary.size(), uuid_offset + uuid_size);
+    ASSERT_NE(memcmp(built_binary.data() + uuid_offset,
+                     rebuilt_binary.data() + uuid_offset, uuid_size),
+              0);
+}
+
 TEST_F(WithCommandQueue, LinkPrograms) {
     static const char* sourceA = R"(
       extern void bar(global uint *dst, global uint *src);
@@ -479,3 +604,507 @@ TEST_F(WithContext, SetUnusedSamplerArgWithInvalidObject) {
     cl_int err = clSetKernelArg(kernel, 0, sizeof(cl_sampler), &kern);
     ASSERT_EQ(err, CL_INVALID_SAMPLER);
 }
+
+TEST_F(WithCommandQueue, DISABLED_NOCOMPILER(BuildProgramsFromManyThreads)) {
+    static const unsigned NUM_THREADS = 8;
+    static const unsigned PROGRAMS_PER_THREAD = 4;
+    static const unsigned NUM_PROGRAMS = NUM_THREADS * PROGRAMS_PER_THREAD;
+
+    // Each program writes a different value
+    std::vector<cl_kernel> kernels(NUM_PROGRAMS, nullptr);
+    auto build = [this, &kernels](unsigned first) {
+        for (unsigned i = first; i < first + PROGRAMS_PER_THREAD; i++) {
+            std::string source = "kernel void test(global uint* out) {\n"
+                                 "  out[0] = " +
+                                 std::to_string(i) + ";\n}\n";
+            const char* src = source.c_str();
+            cl_int err;
+            auto program =
+                clCreateProgramWithSource(m_context, 1, &src, nullptr, &err);
+            if (err != CL_SUCCESS) {
+                continue;
+            }
+            err = clBuildProgram(program, 1, &gDevice, nullptr, nullptr,
+                                 nullptr);
+            if (err == CL_SUCCESS) {
+                kernels[i] = clCreateKernel(program, "test", &err);
+            }
+            clReleaseProgram(program);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < NUM_THREADS; t++) {
+        threads.emplace_back(build, t * PROGRAMS_PER_THREAD);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto buffer = CreateBuffer(CL_MEM_READ_WRITE, sizeof(cl_uint));
+    for (unsigned i = 0; i < NUM_PROGRAMS; i++) {
+        EXPECT_NE(kernels[i], nullptr);
+        if (kernels[i] == nullptr) {
+            continue;
+        }
+        SetKernelArg(kernels[i], 0, buffer);
+        size_t gws = 1;
+        EnqueueNDRangeKernel(kernels[i], 1, nullptr, &gws, nullptr);
+        cl_uint output = ~0u;
+        EnqueueReadBuffer(buffer, CL_TRUE, 0, sizeof(output), &output);
+        EXPECT_EQ(output, i);
+    }
+    for (auto kernel : kernels) {
+        if (kernel != nullptr) {
+            clReleaseKernel(kernel);
+        }
+    }
+}
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+TEST_F(WithContext, DISABLED_NOCOMPILER(InteractiveBuildOvertakesPrewarm)) {
+    if (!clvk_pause_build_service(true)) {
+        GTEST_SKIP();
+    }
+
+    static const char* source = "kernel void test(global uint* out) {\n"
+                                "  out[0] = 0;\n}\n";
+
+    auto counters = clvk_get_unit_counters();
+    uint64_t requests = counters->build_requests.load();
+    uint64_t overtaken = counters->builds_overtaken.load();
+    auto wait_for_requests = [&](uint64_t num) {
+        auto end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while ((counters->build_requests.load() < requests + num) &&
+               (std::chrono::steady_clock::now() < end)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+
+    // Queue a build started with a callback, then a build the application
+    // waits for
+    auto prewarm = CreateProgram(source);
+    std::promise<void> prewarm_done;
+    auto callback = [](cl_program, void* data) {
+        static_cast<std::promise<void>*>(data)->set_value();
+    };
+    cl_int err =
+        clBuildProgram(prewarm, 1, &gDevice, nullptr, callback, &prewarm_done);
+    EXPECT_EQ(err, CL_SUCCESS);
+    wait_for_requests(1);
+
+    auto interactive = CreateProgram(source);
+    std::thread thread([&interactive] {
+        cl_int err =
+            clBuildProgram(interactive, 1, &gDevice, nullptr, nullptr, nullptr);
+        EXPECT_EQ(err, CL_SUCCESS);
+    });
+    wait_for_requests(2);
+
+    // The interactive build goes first once the builds are resumed
+    clvk_pause_build_service(false);
+    thread.join();
+    if (err == CL_SUCCESS) {
+        prewarm_done.get_future().wait();
+    }
+    EXPECT_EQ(counters->builds_overtaken.load(), overtaken + 1);
+}
+
+TEST_F(WithCommandQueue, DISABLED_NOCOMPILER(ProgramCache)) {
+    static const char* source = R"(
+      kernel void test(global uint *output) {
+        output[0] = 0x1234;
+      }
+    )";
+
+    auto cache_dir = std::filesystem::temp_directory_path() /
+                     ("clvk-program-cache-test-" +
+                      std::to_string(std::random_device{}()));
+    ASSERT_TRUE(std::filesystem::create_directories(cache_dir));
+
+    {
+        auto cfg_cache_dir = CLVK_CONFIG_SCOPED_OVERRIDE(
+            cache_dir, std::string, cache_dir.string(), true);
+
+        auto counters = clvk_get_unit_counters();
+        auto buffer = CreateBuffer(CL_MEM_READ_WRITE, sizeof(cl_uint));
+        auto build_and_run = [&](const char* options) {
+            auto kernel = CreateKernel(source, options, "test");
+            SetKernelArg(kernel, 0, buffer);
+            size_t gws = 1;
+            EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+            cl_uint output = 0;
+            EnqueueReadBuffer(buffer, CL_TRUE, 0, sizeof(output), &output);
+            EXPECT_EQ(output, 0x1234u);
+        };
+        auto cache_entries = [&cache_dir]() {
+            std::vector<std::filesystem::path> entries;
+            for (auto& entry :
+                 std::filesystem::directory_iterator(cache_dir)) {
+                auto name = entry.path().filename().string();
+                if ((name.rfind("clvk-program.", 0) == 0) &&
+                    (entry.path().extension() == ".spv")) {
+                    entries.push_back(entry.path());
+                }
+            }
+            return entries;
+        };
+
+        // The second build uses the SPIR-V stored by the first one
+        uint64_t hits = counters->program_cache_hits.load();
+        build_and_run("");
+        EXPECT_EQ(counters->program_cache_hits.load(), hits);
+        build_and_run("");
+        EXPECT_EQ(counters->program_cache_hits.load(), hits + 1);
+        auto entries = cache_entries();
+        ASSERT_EQ(entries.size(), 1u);
+
+        // A corrupted entry is rejected and replaced
+        {
+            std::fstream file(entries[0], std::ios::in | std::ios::out |
+                                              std::ios::binary);
+            file.seekg(-1, std::ios::end);
+            char last = static_cast<char>(file.get());
+            file.seekp(-1, std::ios::end);
+            file.put(static_cast<char>(last ^ 1));
+        }
+        hits = counters->program_cache_hits.load();
+        build_and_run("");
+        EXPECT_EQ(counters->program_cache_hits.load(), hits);
+        build_and_run("");
+        EXPECT_EQ(counters->program_cache_hits.load(), hits + 1);
+
+        // Programs that may include headers are not cached
+        std::string include_options = "-I " + cache_dir.string();
+        hits = counters->program_cache_hits.load();
+        build_and_run(include_options.c_str());
+        build_and_run(include_options.c_str());
+        EXPECT_EQ(counters->program_cache_hits.load(), hits);
+        EXPECT_EQ(cache_entries().size(), 1u);
+    }
+
+    std::filesystem::remove_all(cache_dir);
+}
+
+// Layout of the pipeline cache store: a header followed by records that hold
+// the data of a module or only update the time it was last used
+struct pipeline_cache_store_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t reserved;
+};
+struct pipeline_cache_store_record {
+    uint8_t module[20];
+    uint8_t checksum[20];
+    uint64_t last_use;
+    uint64_t size;
+    uint32_t type;
+    uint32_t reserved;
+};
+static const uint32_t PIPELINE_CACHE_STORE_RECORD_DATA = 0;
+static const char* PIPELINE_CACHE_PREFIX = "clvk-pipeline-cache.";
+
+struct stored_module {
+    std::array<uint8_t, 20> module;
+    uint64_t last_use;
+    std::vector<char> data;
+};
+
+// Returns the path of the pipeline cache store in |dir|, empty if there is
+// none. Legacy files have the module in their name after the UUID.
+static std::filesystem::path
+FindPipelineCacheStore(const std::filesystem::path& dir) {
+    for (auto& entry : std::filesystem::directory_iterator(dir)) {
+        auto name = entry.path().filename().string();
+        if ((name.rfind(PIPELINE_CACHE_PREFIX, 0) == 0) &&
+            (entry.path().extension() == ".bin") &&
+            (std::count(name.begin(), name.end(), '.') == 2)) {
+            return entry.path();
+        }
+    }
+    return {};
+}
+
+// Returns the latest data of each module in the store
+static std::vector<stored_module>
+ReadPipelineCacheStore(const std::filesystem::path& path) {
+    std::vector<stored_module> modules;
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    pipeline_cache_store_header header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    while (file.good()) {
+        pipeline_cache_store_record rec;
+        file.read(reinterpret_cast<char*>(&rec), sizeof(rec));
+        if (!file.good()) {
+            break;
+        }
+        auto it = std::find_if(modules.begin(), modules.end(),
+                               [&rec](const stored_module& m) {
+                                   return memcmp(m.module.data(), rec.module,
+                                                 sizeof(rec.module)) == 0;
+                               });
+        if (it == modules.end()) {
+            if (rec.type != PIPELINE_CACHE_STORE_RECORD_DATA) {
+                continue;
+            }
+            modules.emplace_back();
+            it = modules.end() - 1;
+            memcpy(it->module.data(), rec.module, sizeof(rec.module));
+            it->last_use = 0;
+        }
+        it->last_use = std::max(it->last_use, rec.last_use);
+        if (rec.type == PIPELINE_CACHE_STORE_RECORD_DATA) {
+            it->data.resize(rec.size);
+            file.read(it->data.data(), it->data.size());
+        }
+    }
+    return modules;
+}
+
+// Moves the time the modules of the store were last used |seconds| back
+static void AgePipelineCacheStore(const std::filesystem::path& path,
+                                  uint64_t seconds) {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    std::streamoff offset = sizeof(pipeline_cache_store_header);
+    while (true) {
+        pipeline_cache_store_record rec;
+        file.seekg(offset);
+        file.read(reinterpret_cast<char*>(&rec), sizeof(rec));
+        if (!file.good()) {
+            break;
+        }
+        rec.last_use -= seconds;
+        file.seekp(offset);
+        file.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+        offset += sizeof(rec);
+        if (rec.type == PIPELINE_CACHE_STORE_RECORD_DATA) {
+            offset += rec.size;
+        }
+    }
+}
+
+// Builds and runs, in a new context, a kernel that writes |value| and
+// releases everything before returning
+static void BuildAndRunInNewContext(cl_uint value) {
+    cl_int err;
+    holder<cl_context> context =
+        clCreateContext(nullptr, 1, &gDevice, nullptr, nullptr, &err);
+    ASSERT_CL_SUCCESS(err);
+    holder<cl_command_queue> queue =
+        clCreateCommandQueue(context, gDevice, 0, &err);
+    ASSERT_CL_SUCCESS(err);
+
+    std::string source = "kernel void test(global uint* out) {\n"
+                         "  out[0] = " +
+                         std::to_string(value) + ";\n}\n";
+    const char* src = source.c_str();
+    holder<cl_program> program =
+        clCreateProgramWithSource(context, 1, &src, nullptr, &err);
+    ASSERT_CL_SUCCESS(err);
+    err = clBuildProgram(program, 1, &gDevice, nullptr, nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    holder<cl_kernel> kernel = clCreateKernel(program, "test", &err);
+    ASSERT_CL_SUCCESS(err);
+    holder<cl_mem> buffer = clCreateBuffer(context, CL_MEM_READ_WRITE,
+                                           sizeof(cl_uint), nullptr, &err);
+    ASSERT_CL_SUCCESS(err);
+
+    cl_mem mem = buffer;
+    err = clSetKernelArg(kernel, 0, sizeof(mem), &mem);
+    ASSERT_CL_SUCCESS(err);
+    size_t gws = 1;
+    err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &gws, nullptr, 0,
+                                 nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    cl_uint output = 0;
+    err = clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, sizeof(output),
+                              &output, 0, nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    EXPECT_EQ(output, value);
+}
+
+// Creates a pipeline cache store in a new cache directory and goes back to
+// the configured store when destroyed
+class PipelineCacheStoreTest : public WithContext {
+protected:
+    static const uint64_t MAX_SIZE = 256 * 1024 * 1024;
+
+    void SetUp() override {
+        WithContext::SetUp();
+        m_cache_dir = std::filesystem::temp_directory_path() /
+                      ("clvk-pipeline-cache-test-" +
+                       std::to_string(std::random_device{}()));
+        ASSERT_TRUE(std::filesystem::create_directories(m_cache_dir));
+        m_cfg_cache_dir.reset(new clvk_config_scoped_override<std::string>(
+            CLVK_CONFIG_SCOPED_OVERRIDE(cache_dir, std::string,
+                                        m_cache_dir.string(), true)));
+        clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+    }
+
+    void TearDown() override {
+        m_cfg_cache_dir.reset();
+        clvk_recreate_pipeline_cache_store(
+            gDevice,
+            static_cast<uint64_t>(clvk_get_config()->pipeline_cache_size_mb) *
+                1024 * 1024);
+        std::filesystem::remove_all(m_cache_dir);
+        WithContext::TearDown();
+    }
+
+    std::filesystem::path m_cache_dir;
+    std::unique_ptr<clvk_config_scoped_override<std::string>> m_cfg_cache_dir;
+};
+
+TEST_F(PipelineCacheStoreTest,
+       DISABLED_NOCOMPILER(PipelineCacheStoreSharedByContexts)) {
+    auto counters = clvk_get_unit_counters();
+
+    // Two contexts each build a program
+    BuildAndRunInNewContext(1);
+    BuildAndRunInNewContext(2);
+    clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+    auto store = FindPipelineCacheStore(m_cache_dir);
+    ASSERT_FALSE(store.empty());
+    auto modules = ReadPipelineCacheStore(store);
+    ASSERT_EQ(modules.size(), 2u);
+
+    // Both modules are served from the store, which already has all the
+    // data and isn't written again
+    uint64_t hits = counters->pipeline_cache_store_hits.load();
+    uint64_t writes = counters->pipeline_cache_store_writes.load();
+    BuildAndRunInNewContext(1);
+    BuildAndRunInNewContext(2);
+    EXPECT_EQ(counters->pipeline_cache_store_hits.load(), hits + 2);
+    clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+    EXPECT_EQ(counters->pipeline_cache_store_writes.load(), writes);
+
+    // When the store is full, the modules used least recently are evicted
+    auto store_size = std::filesystem::file_size(store);
+    clvk_recreate_pipeline_cache_store(gDevice, store_size);
+    BuildAndRunInNewContext(3);
+    clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+    auto new_modules = ReadPipelineCacheStore(store);
+    EXPECT_GT(new_modules.size(), 0u);
+    EXPECT_LT(new_modules.size(), 3u);
+    size_t num_added = 0;
+    for (auto& m : new_modules) {
+        if (std::none_of(modules.begin(), modules.end(),
+                         [&m](const stored_module& old) {
+                             return old.module == m.module;
+                         })) {
+            num_added++;
+        }
+    }
+    EXPECT_EQ(num_added, 1u);
+}
+
+TEST_F(PipelineCacheStoreTest,
+       DISABLED_NOCOMPILER(PipelineCacheStoreMigratesLegacyFiles)) {
+    auto counters = clvk_get_unit_counters();
+
+    BuildAndRunInNewContext(4);
+    clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+    auto store = FindPipelineCacheStore(m_cache_dir);
+    ASSERT_FALSE(store.empty());
+    auto modules = ReadPipelineCacheStore(store);
+    ASSERT_EQ(modules.size(), 1u);
+
+    // Replace the store with a file per module as written by older versions
+    // of clvk: clvk-pipeline-cache.<UUID>.<SHA1>.bin
+    auto name = store.filename().string();
+    auto uuid = name.substr(strlen(PIPELINE_CACHE_PREFIX),
+                            name.size() - strlen(PIPELINE_CACHE_PREFIX) -
+                                strlen(".bin"));
+    std::string sha1;
+    static const char hex[] = "0123456789abcdef";
+    for (auto byte : modules[0].module) {
+        sha1 += hex[byte >> 4];
+        sha1 += hex[byte & 0xF];
+    }
+    auto legacy = m_cache_dir / (PIPELINE_CACHE_PREFIX + uuid + "." + sha1 +
+                                 ".bin");
+    {
+        std::ofstream file(legacy, std::ios::out | std::ios::binary);
+        file.write(modules[0].data.data(), modules[0].data.size());
+        ASSERT_TRUE(file.good());
+    }
+    std::filesystem::remove(store);
+    clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+
+    // The legacy file is used and only removed once the store has its data
+    uint64_t hits = counters->pipeline_cache_store_hits.load();
+    BuildAndRunInNewContext(4);
+    EXPECT_EQ(counters->pipeline_cache_store_hits.load(), hits + 1);
+    EXPECT_TRUE(std::filesystem::exists(legacy));
+    clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+    EXPECT_FALSE(std::filesystem::exists(legacy));
+    auto new_modules = ReadPipelineCacheStore(store);
+    ASSERT_EQ(new_modules.size(), 1u);
+    EXPECT_EQ(new_modules[0].module, modules[0].module);
+}
+
+TEST_F(PipelineCacheStoreTest,
+       DISABLED_NOCOMPILER(PipelineCacheStoreWrittenInBackground)) {
+    auto counters = clvk_get_unit_counters();
+    uint64_t writes = counters->pipeline_cache_store_writes.load();
+
+    // The store is written shortly after pipelines are created, without
+    // waiting for the device to be destroyed
+    BuildAndRunInNewContext(5);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while ((counters->pipeline_cache_store_writes.load() == writes) &&
+           (std::chrono::steady_clock::now() < deadline)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_GT(counters->pipeline_cache_store_writes.load(), writes);
+    auto store = FindPipelineCacheStore(m_cache_dir);
+    ASSERT_FALSE(store.empty());
+    EXPECT_EQ(ReadPipelineCacheStore(store).size(), 1u);
+}
+
+TEST_F(PipelineCacheStoreTest,
+       DISABLED_NOCOMPILER(PipelineCacheStoreRefreshesLastUse)) {
+    auto counters = clvk_get_unit_counters();
+
+    BuildAndRunInNewContext(6);
+    BuildAndRunInNewContext(7);
+    clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+    auto store = FindPipelineCacheStore(m_cache_dir);
+    ASSERT_FALSE(store.empty());
+    ASSERT_EQ(ReadPipelineCacheStore(store).size(), 2u);
+    const uint64_t age = 2 * 24 * 60 * 60;
+    AgePipelineCacheStore(store, age);
+    uint64_t aged_last_use = 0;
+    for (auto& m : ReadPipelineCacheStore(store)) {
+        aged_last_use = std::max(aged_last_use, m.last_use);
+    }
+
+    // Only one module is used again. The store has all its data but the
+    // time it was last used is updated.
+    uint64_t writes = counters->pipeline_cache_store_writes.load();
+    BuildAndRunInNewContext(6);
+    clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+    EXPECT_EQ(counters->pipeline_cache_store_writes.load(), writes + 1);
+    auto modules = ReadPipelineCacheStore(store);
+    ASSERT_EQ(modules.size(), 2u);
+    auto used = std::find_if(modules.begin(), modules.end(),
+                             [aged_last_use](const stored_module& m) {
+                                 return m.last_use > aged_last_use;
+                             });
+    ASSERT_NE(used, modules.end());
+    auto used_module = used->module;
+
+    // When the store is full, the module that was only read survives
+    // eviction
+    clvk_recreate_pipeline_cache_store(gDevice,
+                                       std::filesystem::file_size(store));
+    BuildAndRunInNewContext(8);
+    clvk_recreate_pipeline_cache_store(gDevice, MAX_SIZE);
+    auto new_modules = ReadPipelineCacheStore(store);
+    EXPECT_EQ(new_modules.size(), 2u);
+    EXPECT_TRUE(std::any_of(new_modules.begin(), new_modules.end(),
+                            [&used_module](const stored_module& m) {
+                                return m.module == used_module;
+                            }));
+}
+
+#endif
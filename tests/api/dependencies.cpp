@@ -75,3 +75,110 @@ TEST_F(WithCommandQueue, InOrderQueueStopsExecutionAfterFailedCommand) {
     GetEventInfo(mapev, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
     ASSERT_NE(status, CL_COMPLETE);
 }
+
+TEST_F(WithOutOfOrderCommandQueue, IndependentCommandsDoNotWaitForEachOther) {
+    auto buffer1 = CreateBuffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                BUFFER_SIZE, nullptr);
+    auto buffer2 = CreateBuffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                BUFFER_SIZE, nullptr);
+    std::vector<char> data(BUFFER_SIZE, 42);
+
+    // Enqueue a command blocked on a user event
+    auto uevent = CreateUserEvent();
+    cl_event uev = uevent;
+    cl_event blocked;
+    EnqueueWriteBuffer(buffer1, CL_FALSE, 0, BUFFER_SIZE, data.data(), 1,
+                       &uev, &blocked);
+    holder<cl_event> blocked_holder(blocked);
+
+    // Enqueue an independent command and check it can complete
+    cl_event independent;
+    EnqueueWriteBuffer(buffer2, CL_FALSE, 0, BUFFER_SIZE, data.data(), 0,
+                       nullptr, &independent);
+    holder<cl_event> independent_holder(independent);
+    WaitForEvent(independent);
+
+    cl_int status;
+    GetEventInfo(blocked, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    ASSERT_NE(status, CL_COMPLETE);
+
+    // A barrier waits for all the commands enqueued before it
+    cl_event barrier;
+    auto err = clEnqueueBarrierWithWaitList(m_queue, 0, nullptr, &barrier);
+    ASSERT_CL_SUCCESS(err);
+    holder<cl_event> barrier_holder(barrier);
+    Flush();
+
+    GetEventInfo(barrier, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    ASSERT_NE(status, CL_COMPLETE);
+
+    // Unblock the first command and check everything completes
+    SetUserEventStatus(uevent, CL_COMPLETE);
+    Finish();
+
+    GetEventInfo(blocked, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    ASSERT_EQ(status, CL_COMPLETE);
+    GetEventInfo(barrier, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    ASSERT_EQ(status, CL_COMPLETE);
+}
+
+TEST_F(WithCommandQueue, CommandsGatedByUserEventDoNotHoldBackOthers) {
+    static const char* program_source = R"(
+    kernel void test_simple(global uint* out, uint id)
+    {
+        out[id] = id;
+    }
+    )";
+
+    static const cl_uint NUM_GATED = 16;
+
+    auto kernel = CreateKernel(program_source, "test_simple");
+    size_t buffer_size = (NUM_GATED + 1) * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                               buffer_size, nullptr);
+    SetKernelArg(kernel, 0, buffer);
+
+    size_t gws = 1;
+    size_t lws = 1;
+
+    // Enqueue a kernel that is not gated
+    cl_uint id = 0;
+    SetKernelArg(kernel, 1, &id);
+    cl_event ungated;
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws, 0, nullptr,
+                         &ungated);
+    holder<cl_event> ungated_holder(ungated);
+
+    // Enqueue kernels gated by a user event
+    auto uevent = CreateUserEvent();
+    cl_event uev = uevent;
+    cl_event gated;
+    for (id = 1; id <= NUM_GATED; id++) {
+        SetKernelArg(kernel, 1, &id);
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws, 1, &uev,
+                             id == NUM_GATED ? &gated : nullptr);
+    }
+    holder<cl_event> gated_holder(gated);
+
+    // The kernel enqueued before the gated ones can complete
+    WaitForEvent(ungated);
+
+    cl_int status;
+    GetEventInfo(gated, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    ASSERT_NE(status, CL_COMPLETE);
+
+    // Release the gated kernels and check their results
+    SetUserEventStatus(uevent, CL_COMPLETE);
+    Finish();
+
+    GetEventInfo(gated, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    ASSERT_EQ(status, CL_COMPLETE);
+
+    auto data =
+        EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0, buffer_size);
+    for (cl_uint i = 0; i <= NUM_GATED; i++) {
+        EXPECT_EQ(data[i], i);
+    }
+    EnqueueUnmapMemObject(buffer, data);
+    Finish();
+}
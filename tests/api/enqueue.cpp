@@ -440,7 +440,333 @@ TEST_F(WithCommandQueue, FinishAfterFlush) {
     }
 }
 
+TEST_F(WithCommandQueue, CopyBufferRectAfterKernel) {
+    static const char* program_source = R"(
+    kernel void test_fill(global uint* out)
+    {
+        uint gid = get_global_id(0);
+        out[gid] = gid;
+    }
+    )";
+
+    static const size_t WIDTH = 16;
+    static const size_t HEIGHT = 8;
+    static const size_t NUM_ELEMS = WIDTH * HEIGHT;
+    size_t buffer_size = NUM_ELEMS * sizeof(cl_uint);
+
+    auto kernel = CreateKernel(program_source, "test_fill");
+    auto src = CreateBuffer(CL_MEM_READ_WRITE, buffer_size, nullptr);
+    auto dst = CreateBuffer(CL_MEM_READ_WRITE, buffer_size, nullptr);
+
+    std::vector<cl_uint> zeros(NUM_ELEMS, 0);
+    EnqueueWriteBuffer(dst, CL_FALSE, 0, buffer_size, zeros.data());
+
+    SetKernelArg(kernel, 0, src);
+    size_t gws = NUM_ELEMS;
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+
+    // Copy the right half of every other row into the left half of the
+    // first rows of the destination.
+    size_t row_pitch = WIDTH * sizeof(cl_uint);
+    size_t src_origin[3] = {row_pitch / 2, 0, 0};
+    size_t dst_origin[3] = {0, 0, 0};
+    size_t region[3] = {row_pitch / 2, HEIGHT / 2, 1};
+    auto err = clEnqueueCopyBufferRect(m_queue, src, dst, src_origin,
+                                       dst_origin, region, 2 * row_pitch, 0,
+                                       row_pitch, 0, 0, nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+
+    std::vector<cl_uint> data(NUM_ELEMS);
+    EnqueueReadBuffer(dst, CL_TRUE, 0, buffer_size, data.data());
+
+    for (size_t row = 0; row < HEIGHT; row++) {
+        for (size_t col = 0; col < WIDTH; col++) {
+            cl_uint expected = 0;
+            if ((row < HEIGHT / 2) && (col < WIDTH / 2)) {
+                expected = 2 * row * WIDTH + WIDTH / 2 + col;
+            }
+            EXPECT_EQ(data[row * WIDTH + col], expected);
+        }
+    }
+}
+
+TEST_F(WithCommandQueue, ManySmallBuffers) {
+    static const char* program_source = R"(
+    kernel void test_small(global uint* out, uint val)
+    {
+        out[get_global_id(0)] = val;
+    }
+    )";
+
+    static const unsigned NUM_BUFFERS = 256;
+    static const size_t NUM_ELEMS = 5;
+    size_t buffer_size = NUM_ELEMS * sizeof(cl_uint);
+
+    auto kernel = CreateKernel(program_source, "test_small");
+
+    // Small buffers are sub-allocated from shared blocks, check that they do
+    // not overlap.
+    std::vector<cl_mem> buffers;
+    size_t gws = NUM_ELEMS;
+    for (cl_uint i = 0; i < NUM_BUFFERS; i++) {
+        buffers.push_back(
+            CreateBuffer(CL_MEM_READ_WRITE, buffer_size, nullptr).release());
+        SetKernelArg(kernel, 0, buffers.back());
+        SetKernelArg(kernel, 1, &i);
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+    }
+
+    for (cl_uint i = 0; i < NUM_BUFFERS; i++) {
+        std::vector<cl_uint> data(NUM_ELEMS);
+        EnqueueReadBuffer(buffers[i], CL_TRUE, 0, buffer_size, data.data());
+        for (size_t j = 0; j < NUM_ELEMS; j++) {
+            EXPECT_EQ(data[j], i);
+        }
+    }
+
+    for (auto buffer : buffers) {
+        EXPECT_CL_SUCCESS(clReleaseMemObject(buffer));
+    }
+}
+
+TEST_F(WithCommandQueue, FillBufferAfterKernel) {
+    static const char* program_source = "kernel void test(){}";
+
+    static const size_t BUFFER_SIZE = 4096;
+
+    auto kernel = CreateKernel(program_source, "test");
+    auto buffer = CreateBuffer(CL_MEM_READ_WRITE, BUFFER_SIZE, nullptr);
+
+    std::vector<cl_uchar> zeros(BUFFER_SIZE, 0);
+    EnqueueWriteBuffer(buffer, CL_FALSE, 0, BUFFER_SIZE, zeros.data());
+
+    size_t gws = 1;
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+
+    // Unaligned single byte pattern
+    cl_uchar byte_pattern = 0xAB;
+    EnqueueFillBuffer(buffer, &byte_pattern, sizeof(byte_pattern), 3, 1001);
+
+    // Pattern that repeats every four bytes
+    cl_uchar word_pattern[8] = {1, 2, 3, 4, 1, 2, 3, 4};
+    EnqueueFillBuffer(buffer, word_pattern, sizeof(word_pattern), 1024, 1000);
+
+    // Pattern that does not repeat within four bytes
+    cl_uchar long_pattern[16];
+    for (size_t i = 0; i < sizeof(long_pattern); i++) {
+        long_pattern[i] = 16 + i;
+    }
+    EnqueueFillBuffer(buffer, long_pattern, sizeof(long_pattern), 2048, 2048);
+
+    std::vector<cl_uchar> data(BUFFER_SIZE);
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, BUFFER_SIZE, data.data());
+
+    for (size_t i = 0; i < BUFFER_SIZE; i++) {
+        cl_uchar expected = 0;
+        if ((i >= 3) && (i < 1004)) {
+            expected = byte_pattern;
+        } else if ((i >= 1024) && (i < 2024)) {
+            expected = word_pattern[(i - 1024) % sizeof(word_pattern)];
+        } else if (i >= 2048) {
+            expected = long_pattern[(i - 2048) % sizeof(long_pattern)];
+        }
+        EXPECT_EQ(data[i], expected);
+    }
+}
+
+TEST_F(WithCommandQueue, PingPongBuffers) {
+    static const char* program_source = R"(
+    kernel void test_add(global uint* dst, global const uint* src, uint val)
+    {
+        dst[0] = src[0] + val;
+    }
+    )";
+
+    static const cl_uint NUM_ITERATIONS = 64;
+
+    auto kernel = CreateKernel(program_source, "test_add");
+
+    cl_uint zero = 0;
+    auto buffer_a = CreateBuffer(CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                 sizeof(cl_uint), &zero);
+    auto buffer_b = CreateBuffer(CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                 sizeof(cl_uint), &zero);
+
+    size_t gws = 1;
+    size_t lws = 1;
+
+    // Alternate between the same two sets of buffers
+    cl_mem a = buffer_a;
+    cl_mem b = buffer_b;
+    cl_uint expected = 0;
 #ifdef CLVK_UNIT_TESTING_ENABLED
+    auto counters = clvk_get_unit_counters();
+    uint64_t initially_allocated = counters->descriptor_sets_allocated.load();
+    uint64_t allocated = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+#endif
+    for (cl_uint i = 0; i < NUM_ITERATIONS; i++) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+        // Both sets of buffers have been used once
+        if (i == 2) {
+            allocated = counters->descriptor_sets_allocated.load();
+            hits = counters->descriptor_set_cache_hits.load();
+            misses = counters->descriptor_set_cache_misses.load();
+        }
+#endif
+        cl_mem src = (i % 2) ? b : a;
+        cl_mem dst = (i % 2) ? a : b;
+        SetKernelArg(kernel, 0, dst);
+        SetKernelArg(kernel, 1, src);
+        SetKernelArg(kernel, 2, &i);
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws);
+        expected += i;
+    }
+
+    cl_uint result;
+    cl_mem last = (NUM_ITERATIONS % 2) ? b : a;
+    EnqueueReadBuffer(last, CL_TRUE, 0, sizeof(result), &result);
+    EXPECT_EQ(result, expected);
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    // After warm-up, every enqueue finds the descriptor sets of its buffers
+    // in the cache. Kernels whose descriptors are pushed don't use sets.
+    EXPECT_EQ(counters->descriptor_sets_allocated.load(), allocated);
+    EXPECT_EQ(counters->descriptor_set_cache_misses.load(), misses);
+    if (allocated > initially_allocated) {
+        EXPECT_EQ(counters->descriptor_set_cache_hits.load() - hits,
+                  NUM_ITERATIONS - 2);
+    }
+#endif
+
+    // Descriptor sets for released buffers must not be reused for new
+    // buffers, even if they end up at the same address.
+    for (cl_uint i = 0; i < 8; i++) {
+        auto src = CreateBuffer(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                sizeof(cl_uint), &i);
+        auto dst = CreateBuffer(CL_MEM_WRITE_ONLY, sizeof(cl_uint), nullptr);
+        SetKernelArg(kernel, 0, dst);
+        SetKernelArg(kernel, 1, src);
+        SetKernelArg(kernel, 2, &zero);
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws);
+        EnqueueReadBuffer(dst, CL_TRUE, 0, sizeof(result), &result);
+        EXPECT_EQ(result, i);
+        Finish();
+    }
+}
+
+TEST_F(WithCommandQueue, PodArgumentsLargerThanPushConstants) {
+    // Too large to be passed as push constants on any device
+    static const char* program_source = R"(
+    typedef struct {
+        uint a;
+        uint b[1023];
+    } args;
+    kernel void test_pod(global uint* out, args val, uint c)
+    {
+        out[0] = val.a + val.b[1022] + c;
+    }
+    )";
+
+    struct {
+        cl_uint a;
+        cl_uint b[1023];
+    } val = {};
+    val.a = 1;
+    val.b[1022] = 2;
+    cl_uint c = 4;
+
+    auto kernel = CreateKernel(program_source, "test_pod");
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, sizeof(cl_uint), nullptr);
+
+    size_t gws = 1;
+    size_t lws = 1;
+
+    SetKernelArg(kernel, 0, buffer);
+    SetKernelArg(kernel, 1, sizeof(val), &val);
+    SetKernelArg(kernel, 2, &c);
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws);
+
+    cl_uint result;
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, sizeof(result), &result);
+    EXPECT_EQ(result, 7u);
+}
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+TEST_F(WithCommandQueue, PodArgumentsPassedAsPushConstants) {
+    if (!clvk_device_supports_pod_pushconstant(gDevice)) {
+        GTEST_SKIP();
+    }
+    auto cfg_pod_pushconstant =
+        CLVK_CONFIG_SCOPED_OVERRIDE(pod_pushconstant, bool, true, true);
+
+    // Programs whose POD arguments fit are built with them passed as push
+    // constants, the others fall back to a POD buffer
+    static const char* program_source = R"(
+    typedef struct {
+        uint a;
+        uint b[1023];
+    } args;
+    kernel void test_small(global uint* out, uint a, uint4 b)
+    {
+        out[0] = a + b.z;
+    }
+    kernel void test_large(global uint* out, args val, uint c)
+    {
+        out[1] = val.a + val.b[1022] + c;
+    }
+    )";
+    static const char* small_program_source = R"(
+    kernel void test_small(global uint* out, uint a, uint4 b)
+    {
+        out[0] = a + b.z;
+    }
+    )";
+
+    auto counters = clvk_get_unit_counters();
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, 2 * sizeof(cl_uint), nullptr);
+    size_t gws = 1;
+    size_t lws = 1;
+    cl_uint a = 40;
+    cl_uint b[4] = {1, 2, 3, 4};
+
+    // Push constants are used when all the kernels fit
+    auto small = CreateKernel(small_program_source, "test_small");
+    SetKernelArg(small, 0, buffer);
+    SetKernelArg(small, 1, &a);
+    SetKernelArg(small, 2, sizeof(b), b);
+    uint64_t pushed = counters->pod_pushconstant_enqueues.load();
+    EnqueueNDRangeKernel(small, 1, nullptr, &gws, &lws);
+    Finish();
+    EXPECT_EQ(counters->pod_pushconstant_enqueues.load(), pushed + 1);
+
+    cl_uint result;
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, sizeof(result), &result);
+    EXPECT_EQ(result, 43u);
+
+    // The whole program falls back to a buffer otherwise
+    auto kernel = CreateKernel(program_source, "test_large");
+    struct {
+        cl_uint a;
+        cl_uint b[1023];
+    } val = {};
+    val.a = 1;
+    val.b[1022] = 2;
+    cl_uint c = 4;
+    SetKernelArg(kernel, 0, buffer);
+    SetKernelArg(kernel, 1, sizeof(val), &val);
+    SetKernelArg(kernel, 2, &c);
+    pushed = counters->pod_pushconstant_enqueues.load();
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws);
+    Finish();
+    EXPECT_EQ(counters->pod_pushconstant_enqueues.load(), pushed);
+
+    EnqueueReadBuffer(buffer, CL_TRUE, sizeof(cl_uint), sizeof(result),
+                      &result);
+    EXPECT_EQ(result, 7u);
+}
+
 TEST_F(WithCommandQueue, EnqueueTooManyCommands) {
 
     static const unsigned NUM_INSTANCES =
@@ -458,6 +784,14 @@ TEST_F(WithCommandQueue, EnqueueTooManyCommands) {
                                     bool, true, true);
     auto cfg_early_flush_enabled =
         CLVK_CONFIG_SCOPED_OVERRIDE(early_flush_enabled, bool, false, true);
+    // Descriptor sets would otherwise be shared by all the enqueues
+    auto cfg_descriptor_set_cache_size = CLVK_CONFIG_SCOPED_OVERRIDE(
+        descriptor_set_cache_size, uint32_t, 0, true);
+    // Pushed descriptors are never allocated from the pool
+    auto cfg_push_descriptors =
+        CLVK_CONFIG_SCOPED_OVERRIDE(push_descriptors, bool, false, true);
+    auto cfg_max_descriptor_pools =
+        CLVK_CONFIG_SCOPED_OVERRIDE(max_descriptor_pools, uint32_t, 1, true);
     CLVK_CONFIG_ASSERT_EQ(enqueue_command_retry_sleep_us, UINT32_MAX);
 
     // Create kernel
@@ -505,6 +839,14 @@ TEST_F(WithCommandQueue, EnqueueTooManyCommandsWithRetry) {
         enqueue_command_retry_sleep_us, uint32_t, 100, true);
     auto cfg_early_flush_enabled =
         CLVK_CONFIG_SCOPED_OVERRIDE(early_flush_enabled, bool, false, true);
+    // Descriptor sets would otherwise be shared by all the enqueues
+    auto cfg_descriptor_set_cache_size = CLVK_CONFIG_SCOPED_OVERRIDE(
+        descriptor_set_cache_size, uint32_t, 0, true);
+    // Pushed descriptors are never allocated from the pool
+    auto cfg_push_descriptors =
+        CLVK_CONFIG_SCOPED_OVERRIDE(push_descriptors, bool, false, true);
+    auto cfg_max_descriptor_pools =
+        CLVK_CONFIG_SCOPED_OVERRIDE(max_descriptor_pools, uint32_t, 1, true);
 
     // Create kernel
     auto kernel = CreateKernel(program_source, "test_simple");
@@ -543,4 +885,439 @@ TEST_F(WithCommandQueue, EnqueueTooManyCommandsWithRetry) {
     EnqueueUnmapMemObject(buffer, data);
     Finish();
 }
+
+TEST_F(WithCommandQueue, EnqueueManyCommandsWithPushDescriptors) {
+
+    static const unsigned POOL_INSTANCES =
+        CLVK_CONFIG_GET(max_entry_points_instances);
+    static const unsigned NUM_INSTANCES = POOL_INSTANCES + 16;
+
+    static const char* program_source = R"(
+    kernel void test_simple(global uint* out, uint id)
+    {
+        out[id] = id;
+    }
+    )";
+
+    auto cfg_force_descriptor_set_allocation_failure =
+        CLVK_CONFIG_SCOPED_OVERRIDE(force_descriptor_set_allocation_failure,
+                                    bool, true, true);
+    auto cfg_early_flush_enabled =
+        CLVK_CONFIG_SCOPED_OVERRIDE(early_flush_enabled, bool, false, true);
+    auto cfg_descriptor_set_cache_size = CLVK_CONFIG_SCOPED_OVERRIDE(
+        descriptor_set_cache_size, uint32_t, 0, true);
+    auto cfg_push_descriptors =
+        CLVK_CONFIG_SCOPED_OVERRIDE(push_descriptors, bool, true, true);
+    auto cfg_max_descriptor_pools =
+        CLVK_CONFIG_SCOPED_OVERRIDE(max_descriptor_pools, uint32_t, 1, true);
+    CLVK_CONFIG_ASSERT_EQ(enqueue_command_retry_sleep_us, UINT32_MAX);
+
+    auto kernel = CreateKernel(program_source, "test_simple");
+
+    size_t buffer_size = NUM_INSTANCES * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size, nullptr);
+
+    size_t gws = 1;
+    size_t lws = 1;
+
+    // Pushed descriptors don't come from the pool so enqueues never run out
+    // of descriptor sets.
+    SetKernelArg(kernel, 0, buffer);
+    for (cl_uint i = 0; i < NUM_INSTANCES; i++) {
+        SetKernelArg(kernel, 1, &i);
+        cl_int err = clEnqueueNDRangeKernel(m_queue, kernel, 1, nullptr, &gws,
+                                            &lws, 0, nullptr, nullptr);
+        // The pool is exhausted when descriptors can't be pushed
+        if ((i == POOL_INSTANCES) && (err == CL_OUT_OF_RESOURCES)) {
+            GTEST_SKIP() << "VK_KHR_push_descriptor is not supported";
+        }
+        ASSERT_CL_SUCCESS(err);
+    }
+
+    std::vector<cl_uint> data(NUM_INSTANCES);
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, buffer_size, data.data());
+
+    for (cl_uint i = 0; i < NUM_INSTANCES; i++) {
+        EXPECT_EQ(data[i], i);
+    }
+}
+
+TEST_F(WithCommandQueue, EnqueueManyCommandsWithPoolChain) {
+
+    // More than two pools' worth of enqueues
+    static const unsigned NUM_INSTANCES =
+        CLVK_CONFIG_GET(max_entry_points_instances) * 2 + 16;
+
+    static const char* program_source = R"(
+    kernel void test_simple(global uint* out, uint id)
+    {
+        out[id] = id;
+    }
+    )";
+
+    auto cfg_force_descriptor_set_allocation_failure =
+        CLVK_CONFIG_SCOPED_OVERRIDE(force_descriptor_set_allocation_failure,
+                                    bool, true, true);
+    auto cfg_early_flush_enabled =
+        CLVK_CONFIG_SCOPED_OVERRIDE(early_flush_enabled, bool, false, true);
+    auto cfg_descriptor_set_cache_size = CLVK_CONFIG_SCOPED_OVERRIDE(
+        descriptor_set_cache_size, uint32_t, 0, true);
+    auto cfg_push_descriptors =
+        CLVK_CONFIG_SCOPED_OVERRIDE(push_descriptors, bool, false, true);
+    // Enough pools for all the enqueues of a round
+    auto cfg_max_descriptor_pools =
+        CLVK_CONFIG_SCOPED_OVERRIDE(max_descriptor_pools, uint32_t, 4, true);
+    CLVK_CONFIG_ASSERT_EQ(enqueue_command_retry_sleep_us, UINT32_MAX);
+
+    auto kernel = CreateKernel(program_source, "test_simple");
+
+    size_t buffer_size = NUM_INSTANCES * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size, nullptr);
+
+    size_t gws = 1;
+    size_t lws = 1;
+
+    auto counters = clvk_get_unit_counters();
+    uint64_t created[2];
+    uint64_t reset = counters->descriptor_pools_reset;
+
+    // The chain of pools grows instead of failing or retrying
+    SetKernelArg(kernel, 0, buffer);
+    for (int round = 0; round < 2; round++) {
+        uint64_t created_before = counters->descriptor_pools_created;
+        for (cl_uint i = 0; i < NUM_INSTANCES; i++) {
+            SetKernelArg(kernel, 1, &i);
+            EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws);
+        }
+        created[round] = counters->descriptor_pools_created - created_before;
+        // Pools are recycled once all their sets are released
+        Finish();
+    }
+
+    // The first round needs two pools besides the one created with the
+    // kernel. The second one reuses the pools kept after the first round.
+    EXPECT_EQ(created[0], 2u);
+    EXPECT_LT(created[1], created[0]);
+    EXPECT_GT(counters->descriptor_pools_reset.load(), reset);
+
+    std::vector<cl_uint> data(NUM_INSTANCES);
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, buffer_size, data.data());
+
+    for (cl_uint i = 0; i < NUM_INSTANCES; i++) {
+        EXPECT_EQ(data[i], i);
+    }
+}
+
+TEST_F(WithCommandQueue, PodArgumentsRingWrapsAround) {
+
+    // A ring that only holds a few sets of arguments at a time forces
+    // allocations to wrap around. Ranges are returned to the ring as the
+    // enqueues complete so they never have to fall back to dedicated buffers.
+    auto cfg_pod_ring_size =
+        CLVK_CONFIG_SCOPED_OVERRIDE(pod_ring_size, uint32_t, 4096, true);
+    auto cfg_pod_pushconstant =
+        CLVK_CONFIG_SCOPED_OVERRIDE(pod_pushconstant, bool, false, true);
+
+    static const char* program_source = R"(
+    typedef struct {
+        uint a;
+        uint b[15];
+    } args;
+    kernel void test_pod(global uint* out, args val, uint id)
+    {
+        out[id] = val.a + val.b[14];
+    }
+    )";
+
+    static const cl_uint NUM_ENQUEUES = 256;
+
+    struct {
+        cl_uint a;
+        cl_uint b[15];
+    } val = {};
+
+    auto kernel = CreateKernel(program_source, "test_pod");
+
+    size_t buffer_size = NUM_ENQUEUES * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size, nullptr);
+
+    size_t gws = 1;
+    size_t lws = 1;
+
+    auto counters = clvk_get_unit_counters();
+    uint64_t wraps = counters->ring_wraps;
+    uint64_t fallbacks = counters->pod_ring_fallbacks;
+
+    SetKernelArg(kernel, 0, buffer);
+    for (cl_uint i = 0; i < NUM_ENQUEUES; i++) {
+        val.a = i;
+        val.b[14] = 2 * i;
+        SetKernelArg(kernel, 1, sizeof(val), &val);
+        SetKernelArg(kernel, 2, &i);
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws);
+        // Only keep a few enqueues in flight
+        if (i % 4 == 3) {
+            Finish();
+        }
+    }
+    Finish();
+
+    EXPECT_GT(counters->ring_wraps.load(), wraps);
+    EXPECT_EQ(counters->pod_ring_fallbacks.load(), fallbacks);
+
+    std::vector<cl_uint> data(NUM_ENQUEUES);
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, buffer_size, data.data());
+
+    for (cl_uint i = 0; i < NUM_ENQUEUES; i++) {
+        EXPECT_EQ(data[i], 3 * i);
+    }
+}
+
+TEST_F(WithCommandQueue, PodArgumentsRingExhaustedByBatch) {
+
+    // Enqueues batched behind a full ring share a single copy of their
+    // argument values with a dedicated POD buffer and the batch is submitted
+    // so that the ring can be used again once it has completed.
+    auto cfg_pod_ring_size =
+        CLVK_CONFIG_SCOPED_OVERRIDE(pod_ring_size, uint32_t, 4096, true);
+    auto cfg_pod_pushconstant =
+        CLVK_CONFIG_SCOPED_OVERRIDE(pod_pushconstant, bool, false, true);
+
+    static const char* program_source = R"(
+    typedef struct {
+        uint a;
+        uint b[15];
+    } args;
+    kernel void test_pod(global uint* out, args val)
+    {
+        atomic_add(out, val.a + val.b[14]);
+    }
+    )";
+
+    static const cl_uint NUM_ENQUEUES = 1024;
+
+    struct {
+        cl_uint a;
+        cl_uint b[15];
+    } val = {};
+    val.a = 1;
+    val.b[14] = 2;
+
+    auto kernel = CreateKernel(program_source, "test_pod");
+
+    cl_uint zero = 0;
+    auto buffer = CreateBuffer(CL_MEM_COPY_HOST_PTR, sizeof(zero), &zero);
+
+    size_t gws = 1;
+    size_t lws = 1;
+
+    auto counters = clvk_get_unit_counters();
+    uint64_t fallbacks = counters->pod_ring_fallbacks;
+    uint64_t buffers = counters->pod_fallback_buffers;
+
+    SetKernelArg(kernel, 0, buffer);
+    SetKernelArg(kernel, 1, sizeof(val), &val);
+    for (cl_uint i = 0; i < NUM_ENQUEUES; i++) {
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws);
+    }
+    Finish();
+
+    // A copy is only needed again once all the enqueues using the previous
+    // one have completed and the ring has filled up again, which takes at
+    // least 16 enqueues
+    EXPECT_GT(counters->pod_ring_fallbacks.load(), fallbacks);
+    EXPECT_GE(counters->pod_fallback_buffers.load(), buffers + 1);
+    EXPECT_LE(counters->pod_fallback_buffers.load() - buffers,
+              NUM_ENQUEUES / 16);
+
+    cl_uint data;
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, sizeof(data), &data);
+    EXPECT_EQ(data, 3 * NUM_ENQUEUES);
+}
+
+TEST_F(WithCommandQueue, ManyPipelinesPerKernel) {
+    static const std::string program_source = R"(
+kernel void test(global uint* out) {
+  size_t gid = get_global_id(0);
+  out[gid] = gid;
+}
+)";
+
+    // Each global offset needs its own pipeline, enough of them to grow the
+    // kernel's pipeline table several times
+    static const cl_uint NUM_OFFSETS = 64;
+
+    // Only the enqueues create pipelines
+    auto cfg_precompile_pipelines =
+        CLVK_CONFIG_SCOPED_OVERRIDE(precompile_pipelines, bool, false, true);
+
+    auto kernel = CreateKernel(program_source.c_str(), "test");
+
+    size_t buffer_size = NUM_OFFSETS * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size, nullptr);
+    SetKernelArg(kernel, 0, buffer);
+
+    size_t gws = 1;
+    size_t lws = 1;
+    // Enqueue every offset twice so that the second pass finds the pipelines
+    // created by the first one
+    auto counters = clvk_get_unit_counters();
+    uint64_t created[2];
+    for (cl_uint pass = 0; pass < 2; pass++) {
+        uint64_t created_before = counters->pipelines_created;
+        for (cl_uint i = 0; i < NUM_OFFSETS; i++) {
+            size_t offset = i;
+            EnqueueNDRangeKernel(kernel, 1, &offset, &gws, &lws);
+        }
+        Finish();
+        created[pass] = counters->pipelines_created - created_before;
+    }
+
+    EXPECT_EQ(created[0], NUM_OFFSETS);
+    EXPECT_EQ(created[1], 0u);
+
+    std::vector<cl_uint> data(NUM_OFFSETS);
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, buffer_size, data.data());
+
+    for (cl_uint i = 0; i < NUM_OFFSETS; i++) {
+        EXPECT_EQ(data[i], i);
+    }
+}
+
+TEST_F(WithCommandQueue, ReleaseKernelWhilePrecompilingPipelines) {
+    static const char* program_source = R"(
+kernel void test(global uint* out) {
+  out[get_global_id(0)] = get_work_dim();
+}
+)";
+
+    auto cfg = CLVK_CONFIG_SCOPED_OVERRIDE(precompile_pipelines, bool, true,
+                                           true);
+    auto counters = clvk_get_unit_counters();
+    uint64_t submitted = counters->precompile_jobs_submitted.load();
+    uint64_t finished = counters->precompile_jobs_finished.load();
+
+    // Release the kernels and their programs while their pipelines may still
+    // be being created in the background
+    for (int i = 0; i < 16; i++) {
+        auto kernel = CreateKernel(program_source, "test");
+    }
+
+    // Releasing the kernels waited for all their jobs
+    uint64_t num_submitted =
+        counters->precompile_jobs_submitted.load() - submitted;
+    EXPECT_GT(num_submitted, 0u);
+    EXPECT_EQ(counters->precompile_jobs_finished.load() - finished,
+              num_submitted);
+}
+
+TEST_F(WithCommandQueue, EnqueueUsesPrecompiledPipeline) {
+    static const char* program_source = R"(
+kernel void __attribute__((reqd_work_group_size(16, 1, 1)))
+test(global uint* out) {
+  out[get_global_id(0)] = get_work_dim();
+}
+)";
+
+    auto cfg = CLVK_CONFIG_SCOPED_OVERRIDE(precompile_pipelines, bool, true,
+                                           true);
+    auto counters = clvk_get_unit_counters();
+    uint64_t submitted = counters->precompile_jobs_submitted.load();
+    uint64_t finished = counters->precompile_jobs_finished.load();
+
+    auto kernel = CreateKernel(program_source, "test");
+    uint64_t num_submitted =
+        counters->precompile_jobs_submitted.load() - submitted;
+    ASSERT_EQ(num_submitted, 1u);
+
+    // Wait for the pipeline to be created in the background
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while ((counters->precompile_jobs_finished.load() - finished <
+            num_submitted) &&
+           (std::chrono::steady_clock::now() < deadline)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(counters->precompile_jobs_finished.load() - finished,
+              num_submitted);
+
+    static const size_t NUM_WI = 64;
+    auto buffer =
+        CreateBuffer(CL_MEM_WRITE_ONLY, NUM_WI * sizeof(cl_uint), nullptr);
+    SetKernelArg(kernel, 0, buffer);
+
+    // The enqueue uses the precompiled pipeline
+    uint64_t created = counters->pipelines_created.load();
+    size_t gws = NUM_WI;
+    size_t lws = 16;
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws);
+    Finish();
+    EXPECT_EQ(counters->pipelines_created.load(), created);
+}
+#endif
+
+TEST_F(WithCommandQueue, SetOneOfManyArgumentsAfterEnqueue) {
+    static const char* program_source = R"(
+kernel void test(global uint* out, global uint* in0, global uint* in1,
+                 global uint* in2, uint a0, uint a1, uint a2, uint a3,
+                 uint a4, uint a5, uint a6, uint a7, uint id) {
+  out[id] = id + in0[0] + in1[0] + in2[0] +
+            a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7;
+}
+)";
+
+    static const cl_uint NUM_INSTANCES = 1000;
+    static const cl_uint NUM_POD_ARGS = 8;
+
+    auto kernel = CreateKernel(program_source, "test");
+
+    size_t buffer_size = NUM_INSTANCES * sizeof(cl_uint);
+    auto out = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size, nullptr);
+    cl_uint one = 1;
+    std::vector<holder<cl_mem>> inputs;
+    for (int i = 0; i < 3; i++) {
+        inputs.push_back(CreateBuffer(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      sizeof(one), &one));
+    }
+
+    SetKernelArg(kernel, 0, out);
+    for (cl_uint i = 0; i < 3; i++) {
+        SetKernelArg(kernel, 1 + i, inputs[i]);
+    }
+    for (cl_uint i = 0; i < NUM_POD_ARGS; i++) {
+        SetKernelArg(kernel, 4 + i, &one);
+    }
+
+    // Only the loop counter changes between enqueues, setting it must not
+    // copy the other arguments
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    auto counters = clvk_get_unit_counters();
+    uint64_t copies = counters->argument_value_copies.load();
+    uint64_t fallbacks = counters->pod_ring_fallbacks.load();
+#endif
+    size_t gws = 1;
+    uint64_t set_arg_time = 0;
+    for (cl_uint i = 0; i < NUM_INSTANCES; i++) {
+        auto ts_start = sampleTime();
+        SetKernelArg(kernel, 4 + NUM_POD_ARGS, &i);
+        set_arg_time += sampleTime() - ts_start;
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+    }
+    RecordProperty("set-arg-time", set_arg_time);
+    Finish();
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    // Setting the counter copies the POD data, enqueues that don't fit in the
+    // ring of the queue also copy the descriptors to use another buffer. The
+    // resources, local sizes and other descriptors stay shared.
+    EXPECT_LE(counters->argument_value_copies.load() - copies,
+              NUM_INSTANCES +
+                  (counters->pod_ring_fallbacks.load() - fallbacks));
 #endif
+
+    std::vector<cl_uint> data(NUM_INSTANCES);
+    EnqueueReadBuffer(out, CL_TRUE, 0, buffer_size, data.data());
+
+    for (cl_uint i = 0; i < NUM_INSTANCES; i++) {
+        EXPECT_EQ(data[i], i + 3 + NUM_POD_ARGS);
+    }
+}
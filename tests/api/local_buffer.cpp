@@ -63,3 +63,45 @@ TEST_F(WithCommandQueue, LocalBuffer) {
         ASSERT_TRUE(check(dst_buf, nb_wis, limit));
     }
 }
+
+TEST_F(WithCommandQueue, ManyLocalBuffers) {
+    // Each local argument gets its own specialization constant, more than a
+    // pipeline key holds without allocating
+    static const unsigned NUM_LOCAL_ARGS = 40;
+
+    std::string source = "kernel void test(global int *dst";
+    for (unsigned i = 0; i < NUM_LOCAL_ARGS; i++) {
+        source += ", local int *loc" + std::to_string(i);
+    }
+    source += ") {\n  int lid = get_local_id(0);\n";
+    for (unsigned i = 0; i < NUM_LOCAL_ARGS; i++) {
+        source += "  loc" + std::to_string(i) + "[lid] = lid + " +
+                  std::to_string(i) + ";\n";
+    }
+    source += "  barrier(CLK_LOCAL_MEM_FENCE);\n  int sum = 0;\n";
+    for (unsigned i = 0; i < NUM_LOCAL_ARGS; i++) {
+        source += "  sum += loc" + std::to_string(i) + "[lid];\n";
+    }
+    source += "  dst[lid] = sum;\n}\n";
+
+    const size_t nb_wis = 16;
+    const size_t buffer_size = sizeof(cl_int) * nb_wis;
+
+    auto dst = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size);
+    auto kernel = CreateKernel(source.c_str(), "test");
+    SetKernelArg(kernel, 0, dst);
+    for (unsigned i = 0; i < NUM_LOCAL_ARGS; i++) {
+        SetKernelArg(kernel, 1 + i, buffer_size, nullptr);
+    }
+
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &nb_wis, &nb_wis);
+
+    cl_int dst_buf[nb_wis];
+    EnqueueReadBuffer(dst, true, 0, buffer_size, dst_buf);
+
+    for (size_t i = 0; i < nb_wis; i++) {
+        auto expected = static_cast<cl_int>(
+            NUM_LOCAL_ARGS * i + NUM_LOCAL_ARGS * (NUM_LOCAL_ARGS - 1) / 2);
+        EXPECT_EQ(dst_buf[i], expected);
+    }
+}
@@ -110,6 +110,51 @@ TEST_F(WithProfiledCommandQueue, QueueProfilingMultipleBatchedKernels) {
     }
 }
 
+TEST_F(WithProfiledCommandQueue, QueueProfilingMarkerBetweenBatchedKernels) {
+    // Create kernel
+    auto kernel = CreateKernel(program_source, "donothing");
+
+    // Dispatch kernels with a marker in between
+    size_t gws = 1;
+    size_t lws = 1;
+
+    cl_int dummy = 42;
+    SetKernelArg(kernel, 0, &dummy);
+
+    cl_event ev1, marker, ev2;
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws, 0, nullptr, &ev1);
+    auto err = clEnqueueMarkerWithWaitList(m_queue, 0, nullptr, &marker);
+    ASSERT_CL_SUCCESS(err);
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws, 0, nullptr, &ev2);
+
+    // Complete execution
+    Finish();
+
+    cl_int status;
+    GetEventInfo(marker, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    ASSERT_EQ(status, CL_COMPLETE);
+
+    cl_ulong ts_end_1, ts_start_marker, ts_end_marker, ts_start_2;
+    GetEventProfilingInfo(ev1, CL_PROFILING_COMMAND_END, &ts_end_1);
+    GetEventProfilingInfo(marker, CL_PROFILING_COMMAND_START,
+                          &ts_start_marker);
+    GetEventProfilingInfo(marker, CL_PROFILING_COMMAND_END, &ts_end_marker);
+    GetEventProfilingInfo(ev2, CL_PROFILING_COMMAND_START, &ts_start_2);
+
+    // Check that the marker is profiled between the kernels
+    ASSERT_GE(ts_end_marker, ts_start_marker);
+    auto res = GetPlatformInfo<cl_ulong>(platform(),
+                                         CL_PLATFORM_HOST_TIMER_RESOLUTION);
+    if (res != 0) {
+        ASSERT_GE(ts_start_marker, ts_end_1);
+        ASSERT_GE(ts_start_2, ts_end_marker);
+    }
+
+    clReleaseEvent(ev1);
+    clReleaseEvent(marker);
+    clReleaseEvent(ev2);
+}
+
 TEST_F(WithProfiledCommandQueue, QueueProfilingVsDeviceTimer) {
 
     // Check device timer functions are supported
@@ -186,6 +186,11 @@ template <> inline void holder<cl_command_queue>::deleter() {
     ASSERT_CL_SUCCESS(err);
 }
 
+template <> inline void holder<cl_context>::deleter() {
+    auto err = clReleaseContext(m_obj);
+    ASSERT_CL_SUCCESS(err);
+}
+
 template <typename T>
 T GetPlatformInfo(cl_platform_id platform, cl_platform_info info) {
     T val;
@@ -762,3 +767,10 @@ class WithProfiledCommandQueue : public WithCommandQueue {
 protected:
     void SetUp() override { SetUpQueue(CL_QUEUE_PROFILING_ENABLE); }
 };
+
+class WithOutOfOrderCommandQueue : public WithCommandQueue {
+protected:
+    void SetUp() override {
+        SetUpQueue(CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+    }
+};